@@ -292,53 +292,41 @@ ReplayIteratorImpl::SeekTo(WT_LSN *target_lsn) {
 
 // Create a live backup of a live LevelDB instance.
 // The backup is stored in a directory named "backup-<name>" under the top
-// level of the open LevelDB database.  The implementation is permitted, and
-// even encouraged, to improve the performance of this call through
-// hard-links.
+// level of the open LevelDB database.  Readonly segments are hard-linked by
+// DbTable::createCheckpoint, an existing backup with the same name is used
+// as the previous checkpoint, so just new segments are linked or copied.
 Status
 DbImpl::LiveBackup(const Slice& name)
 {
-	OperationContext *context = GetContext();
-	WT_SESSION *session = context->GetSession();
-	WT_CURSOR *cursor;
-	int ret = session->open_cursor(
-            session, "backup:", NULL, NULL, &cursor);
-	int t_ret;
-	const char *filename;
-	const char *home = conn_->get_home(conn_);
-	char backup[MAXPATHLEN], buf[MAXPATHLEN * 2];
- 
-	// If we couldn't open the backup cursor, we're done.
-	if (ret != 0)
-		return (WiredTigerErrorToStatus(ret));
-
-	// Remove any old directory and create the backup directory.
-	// WT single-threads hot backups.  If we get here we already have
-	// the backup cursor open and we do not have to worry about other
-	// threads trying to remove and recreate the same directory out
-	// from under us.
-	snprintf(buf, sizeof(buf), "rm -rf %s/backup-%s", home,
-	    (char *)name.data());
-	if ((ret = system(buf)) != 0)
-		return WiredTigerErrorToStatus(ret);
-	snprintf(backup, sizeof(backup), "%s/backup-%s", home,
-	    (char *)name.data());
-	if ((ret = mkdir(backup, 0777)) != 0)
-		return WiredTigerErrorToStatus(ret);
-	// Copy all files returned by backup cursor.
-	while ((ret = cursor->next(cursor)) == 0 &&
-	    (ret = cursor->get_key(cursor, &filename)) == 0) {
-		snprintf(buf, sizeof(buf), "cp %s/%s %s/%s",
-		    home, filename, backup, filename);
-		if ((ret = system(buf)) != 0)
-			break;
+	fs::path home = m_tab->getDir().parent_path();
+	fs::path backup = home / ("backup-" + name.ToString());
+	fs::path prev;
+	bool created = false;
+	try {
+		if (fs::exists(backup / "checkpoint.json")) {
+			prev = backup;
+			prev += ".prev";
+			fs::remove_all(prev);
+			fs::rename(backup, prev);
+		}
+		else {
+			fs::remove_all(backup);
+		}
+		m_tab->createCheckpoint(backup, prev);
+		created = true;
+		if (!prev.empty())
+			fs::remove_all(prev);
 	}
-	if (ret == WT_NOTFOUND)
-		ret = 0;
-	if ((t_ret = cursor->close(cursor)) != 0 && ret == 0)
-		ret = t_ret;
-
-	return (WiredTigerErrorToStatus(ret));
+	catch (const std::exception& ex) {
+		// keep the last good backup
+		if (!created && !prev.empty() && fs::exists(prev)) {
+			boost::system::error_code ec;
+			fs::remove_all(backup, ec);
+			fs::rename(prev, backup, ec);
+		}
+		return Status::IOError("DbTable::createCheckpoint failed", ex.what());
+	}
+	return Status::OK();
 }
 
 // Return an opaque timestamp that identifies the current point in time of the
@@ -0,0 +1,90 @@
+// Copyright (c) 2013, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+// The subset of rocksdb::MergeOperator which is supported by terark-db,
+// PartialMerge is not needed: pending operands are collapsed by FullMerge.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_MERGE_OPERATOR_H_
+#define STORAGE_LEVELDB_INCLUDE_MERGE_OPERATOR_H_
+
+#include "leveldb_terark_config.h"
+#if defined(HAVE_ROCKSDB) && !defined(leveldb)
+#define leveldb rocksdb
+#endif
+
+#include <deque>
+#include <string>
+#include <terark/db/db_dll_decl.hpp>
+#include "slice.h"
+
+namespace leveldb {
+
+class Logger;
+
+class TERARK_DB_DLL MergeOperator {
+ public:
+  virtual ~MergeOperator() {}
+
+  // Gives the client a way to express the read -> modify -> write semantics
+  // key:            The key associated with the merge operation.
+  // existing_value: NULL if the key does not exist.
+  // operand_list:   The sequence of merge operations to apply, front first.
+  // new_value:      Client is responsible for filling the merge result here.
+  // logger:         Always NULL in terark-db.
+  //
+  // Returns false on failure, the key keeps its operands.
+  virtual bool FullMerge(const Slice& key,
+                         const Slice* existing_value,
+                         const std::deque<std::string>& operand_list,
+                         std::string* new_value,
+                         Logger* logger) const = 0;
+
+  // The name of the MergeOperator. Used to check for MergeOperator
+  // mismatches (i.e., a DB created with one MergeOperator is
+  // accessed using a different MergeOperator)
+  virtual const char* Name() const = 0;
+};
+
+// The simpler, associative merge operator.
+class TERARK_DB_DLL AssociativeMergeOperator : public MergeOperator {
+ public:
+  virtual ~AssociativeMergeOperator() {}
+
+  // Gives the client a way to express the read -> modify -> write semantics
+  // key:            The key associated with the merge operation.
+  // existing_value: NULL if the key does not exist.
+  // value:          The value to update/merge the existing_value with.
+  // new_value:      Client is responsible for filling the merge result here.
+  virtual bool Merge(const Slice& key,
+                     const Slice* existing_value,
+                     const Slice& value,
+                     std::string* new_value,
+                     Logger* logger) const = 0;
+
+  virtual bool FullMerge(const Slice& key,
+                         const Slice* existing_value,
+                         const std::deque<std::string>& operand_list,
+                         std::string* new_value,
+                         Logger* logger) const {
+    std::string temp_existing;
+    const Slice* existing = existing_value;
+    Slice existing_slice;
+    for (const std::string& operand : operand_list) {
+      std::string temp_value;
+      if (!Merge(key, existing, operand, &temp_value, logger)) {
+        return false;
+      }
+      temp_existing.swap(temp_value);
+      existing_slice = temp_existing;
+      existing = &existing_slice;
+    }
+    *new_value = std::move(temp_existing);
+    return true;
+  }
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_MERGE_OPERATOR_H_
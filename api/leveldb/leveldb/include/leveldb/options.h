@@ -22,6 +22,9 @@ class Env;
 class FilterPolicy;
 class Logger;
 class Snapshot;
+#ifdef HAVE_ROCKSDB
+class MergeOperator;
+#endif
 
 // DB contents are stored in a set of blocks, each of which holds a
 // sequence of key,value pairs.  Each block may be compressed before
@@ -82,6 +85,11 @@ struct TERARK_DB_DLL Options {
   // bottlenecked by RocksDB.
   Options* IncreaseParallelism(int = 16) { return this; }
   Options* OptimizeLevelStyleCompaction() { return this; }
+
+  // Required for DB::Merge and WriteBatch::Merge, must be the same on
+  // each open while the DB has pending merge operands.
+  // Default: nullptr
+  std::shared_ptr<MergeOperator> merge_operator;
 #endif
 
 #if HAVE_BASHOLEVELDB
@@ -65,6 +65,12 @@ class TERARK_DB_DLL WriteBatch {
   void Put(ColumnFamilyHandle*, const SliceParts& key, const SliceParts& value);
 
   void Delete(ColumnFamilyHandle* column_family, const Slice& key);
+
+  // Merge "value" with the existing value of "key" in the database.
+  // "key->merge(existing, value)"
+  void Merge(const Slice& key, const Slice& value);
+  void Merge(ColumnFamilyHandle* column_family, const Slice& key,
+             const Slice& value);
 #endif
 
   // Support for iterating over the contents of a batch.
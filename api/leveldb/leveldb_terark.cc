@@ -29,6 +29,7 @@
 #include <errno.h>
 #include <sstream>
 #include <stdint.h>
+#include <string.h>
 #include <terark/stdtypes.hpp>
 #include <terark/num_to_str.hpp>
 
@@ -244,7 +245,9 @@ Cache *NewLRUCache(size_t capacity) {
   return new CacheImpl(capacity);
 }
 
-static const char g_keyValueSchema[] = R"({
+} // namespace leveldb
+
+const char g_keyValueSchema[] = R"({
   "RowSchema" : {
     "columns" : {
       "key": { "type": "carbin" },
@@ -260,6 +263,8 @@ static const char g_keyValueSchema[] = R"({
   "MinMergeSegNum": 3
 }
 )";
+
+namespace leveldb {
 Status
 DB::Open(const Options &options, const std::string &name, leveldb::DB** dbptr) {
 	fs::path dbdir = fs::path(name) / "TerarkDB";
@@ -283,7 +288,18 @@ DB::Open(const Options &options, const std::string &name, leveldb::DB** dbptr) {
 		return Status::InvalidArgument("dbmeta.json is missing", dbdir.string());
 	}
 	try {
-		*dbptr = new DbImpl(dbdir);
+		DbImpl* db = new DbImpl(dbdir);
+		// Options::block_cache is used as the decoded row cache, it must be
+		// created by NewLRUCache, it overrides RowCacheSize in dbmeta.json
+		if (CacheImpl* cache = dynamic_cast<CacheImpl*>(options.block_cache)) {
+			db->m_tab->setRowCacheCapacity(cache->capacity_);
+		}
+#ifdef HAVE_ROCKSDB
+		if (options.merge_operator) {
+			db->m_tab->setMergeOperator(NewKvMergeOperator(options.merge_operator));
+		}
+#endif
+		*dbptr = db;
 		return Status::OK();
 	}
 	catch (const std::exception& ex) {
@@ -303,7 +319,7 @@ DbImpl::~DbImpl() {
   BOOST_STATIC_ASSERT(offsetof(DbImpl, m_tab) < offsetof(DbImpl, m_ctx));
 }
 
-static void
+void
 encodeKeyVal(terark::valvec<unsigned char>& buf,
 			 const Slice& key, const Slice& val) {
 	buf.erase_all();
@@ -311,7 +327,51 @@ encodeKeyVal(terark::valvec<unsigned char>& buf,
 	buf.append((unsigned char*)key.begin(), key.size());
 //	unaligned_save(buf.grow_no_init(4), uint32_t(val.size()));
 	buf.append((unsigned char*)val.begin(), val.size());
-};
+}
+
+void
+batchDeleteKey(terark::db::BatchWriter& bw, const Slice& key) {
+	terark::db::DbContext* ctx = bw.getCtx();
+	ctx->indexSearchExact(0, key, &ctx->exactMatchRecIdvec);
+	if (!ctx->exactMatchRecIdvec.empty()){
+		long long recId = ctx->exactMatchRecIdvec[0];
+		bw.removeRow(recId);
+	}
+	else {
+		bw.discardMergeOperands(key);
+	}
+}
+
+Slice
+kvRowValue(const terark::valvec<unsigned char>& row) {
+	uint32_t keyLen = unaligned_load<uint32_t>(row.data());
+	return Slice((const char*)row.data() + 4 + keyLen, row.size() - 4 - keyLen);
+}
+
+bool
+kvGetValue(terark::db::DbTable* tab, terark::db::DbContext* ctx,
+		   const Slice& key, terark::valvec<unsigned char>* val) {
+	if (tab->hasMergeOperands()) {
+		terark::valvec<unsigned char> row;
+		if (!tab->getMergedRow(key, &row, ctx)) {
+			return false;
+		}
+		Slice v = kvRowValue(row);
+		val->assign((const unsigned char*)v.data(), v.size());
+		return true;
+	}
+	ctx->indexSearchExact(0, key, &ctx->exactMatchRecIdvec);
+	if (ctx->exactMatchRecIdvec.empty()) {
+		return false;
+	}
+	try {
+		ctx->selectOneColgroup(ctx->exactMatchRecIdvec[0], 1, val);
+		return true;
+	}
+	catch (const std::exception&) {
+		return false;
+	}
+}
 
 // Set the database entry for "key" to "value".  Returns OK on success,
 // and a non-OK status on error.
@@ -351,6 +411,9 @@ DbImpl::Delete(const WriteOptions& options, const Slice& key)
 
 	  }
   }
+  else {
+	  m_tab->discardMergeOperands(key);
+  }
   return Status::OK();
 }
 
@@ -361,20 +424,57 @@ WriteBatchHandler::Put(const Slice& key, const Slice& value) {
 	terark::db::DbContext* ctx = opctx->m_batchWriter.getCtx();
 	encodeKeyVal(ctx->userBuf, key, value);
 	opctx->m_batchWriter.upsertRow(ctx->userBuf);
+#ifdef HAVE_ROCKSDB
+	opctx->TouchTable(ctx->m_tab);
+#endif
 }
 
 void WriteBatchHandler::Delete(const Slice& key) {
 //	THROW_STD(invalid_argument, "Not supported");
-	auto opctx = context_;
-	terark::db::DbContext* ctx = opctx->m_batchWriter.getCtx();
-	ctx->indexSearchExact(0, key, &ctx->exactMatchRecIdvec);
-	if (!ctx->exactMatchRecIdvec.empty()){
-		long long recId = ctx->exactMatchRecIdvec[0];
-		opctx->m_batchWriter.removeRow(recId);
-	}
-	else {
-		fprintf(stderr, "ERROR: Delete(key = %s), NotFound\n", escape(key).c_str());
-	}
+	batchDeleteKey(context_->m_batchWriter, key);
+#ifdef HAVE_ROCKSDB
+	context_->TouchTable(context_->m_batchWriter.getCtx()->m_tab);
+#endif
+}
+
+// Each table commits its own transaction, there is no atomic commit across
+// tables, so a WriteBatch which touches more than one column family is
+// rejected before anything is committed.
+Status OperationContext::Commit() {
+#ifdef HAVE_ROCKSDB
+  if (m_tables.size() > 1) {
+    Rollback();
+    return Status::NotSupported(
+        "WriteBatch touching multiple column families can not be committed atomically");
+  }
+  m_tables.clear();
+  for (size_t i = 0; i < m_cfWriters.size(); ++i) {
+    std::unique_ptr<terark::db::BatchWriter> bw(std::move(m_cfWriters[i]));
+    if (bw && !bw->commit()) {
+      // bw has been rollbacked by commit
+      Rollback();
+      return Status::InvalidArgument(
+          "Commit BatchWriter of column family failed", bw->strError());
+    }
+  }
+  m_cfWriters.clear();
+#endif
+  if (!m_batchWriter.commit()) {
+    return Status::InvalidArgument("Commit BatchWriter failed", m_batchWriter.strError());
+  }
+  return Status::OK();
+}
+
+void OperationContext::Rollback() {
+#ifdef HAVE_ROCKSDB
+  for (size_t i = 0; i < m_cfWriters.size(); ++i) {
+    if (m_cfWriters[i])
+      m_cfWriters[i]->rollback();
+  }
+  m_cfWriters.clear();
+  m_tables.clear();
+#endif
+  m_batchWriter.rollback();
 }
 
 // Apply the specified updates to the database.
@@ -391,16 +491,15 @@ DbImpl::Write(const WriteOptions& options, WriteBatch* updates) {
   try {
     status = updates->Iterate(&handler);
   } catch(...) {
-    context->m_batchWriter.rollback();
+    context->Rollback();
     throw;
   }
 #endif
-  if (context->m_batchWriter.commit()) {
-	return status;
-  }
-  else {
-	return Status::InvalidArgument("Commit BatchWriter failed", context->m_batchWriter.strError());
+  if (!status.ok()) {
+    context->Rollback();
+    return status;
   }
+  return context->Commit();
 }
 
 // If the database contains an entry for "key" store the
@@ -414,20 +513,10 @@ Status
 DbImpl::Get(const ReadOptions& options, const Slice& key, std::string* value) {
   terark::db::DbContext* ctx = GetDbContext();
   assert(NULL != ctx);
-  ctx->indexSearchExact(0, key, &ctx->exactMatchRecIdvec);
-  if (!ctx->exactMatchRecIdvec.empty()) {
-	  auto recId = ctx->exactMatchRecIdvec[0];
-	  try {
-		  ctx->selectOneColgroup(recId, 1, &ctx->userBuf);
-	//	  fprintf(stderr
-	//		, "DEBUG: recId=%lld, colgroup[1]={size=%zd, content=%.*s}\n"
-	//		, recId, ctx->userBuf.size(), (int)ctx->userBuf.size(), ctx->userBuf.data());
-		  value->resize(0);
-		  value->append((char*)ctx->userBuf.data(), ctx->userBuf.size());
-		  return Status::OK();
-	  }
-	  catch (const std::exception&) {
-	  }
+  if (kvGetValue(m_tab.get(), ctx, key, &ctx->userBuf)) {
+	  value->resize(0);
+	  value->append((char*)ctx->userBuf.data(), ctx->userBuf.size());
+	  return Status::OK();
   }
   return Status::NotFound(key);
 }
@@ -523,6 +612,11 @@ DbImpl::ReleaseSnapshot(const Snapshot* snapshot)
 bool
 DbImpl::GetProperty(const Slice& property, std::string* value)
 {
+  // "leveldb.stats" is the conventional name, "terarkdb.stats" is an alias
+  if (property == Slice("terarkdb.stats") || property == Slice("leveldb.stats")) {
+    *value = m_tab->getStatsJson();
+    return true;
+  }
   /* Not supported */
   return false;
 }
@@ -612,6 +706,9 @@ IteratorImpl::IteratorImpl(terark::db::DbTable *db) {
 	m_tab = db;
 	m_ctx = db->createDbContext();
 	m_recId = -1;
+	m_idxRecId = -1;
+	m_idxValid = false;
+	m_pendPos = 0;
 	m_valid = false;
 	m_direction = Direction::forward;
 	g_iterLiveCnt++;
@@ -629,17 +726,99 @@ IteratorImpl::~IteratorImpl() {
 	g_iterLiveCnt--;
 }
 
+static int
+compareKey(const terark::valvec<unsigned char>& x, const std::string& y) {
+	size_t n = std::min(x.size(), y.size());
+	int ret = memcmp(x.data(), y.data(), n);
+	if (ret)
+		return ret;
+	return x.size() < y.size() ? -1 : x.size() > y.size() ? 1 : 0;
+}
+
+// keys which just have pending merge operands have no record id, they
+// are read from a snapshot of the operand keys taken by each seek, and
+// are merged with the keys of the index iterator
+void IteratorImpl::loadPendingKeys(const Slice& target, bool seekTarget) {
+	m_tab->getMergeOperandKeys(&m_pend);
+	if (!seekTarget) {
+		m_pendPos = Direction::forward == m_direction ? 0 : m_pend.size();
+		return;
+	}
+	std::string t(target.data(), target.size());
+	if (Direction::forward == m_direction)
+		m_pendPos = std::lower_bound(m_pend.begin(), m_pend.end(), t) - m_pend.begin();
+	else // keys <= target
+		m_pendPos = std::upper_bound(m_pend.begin(), m_pend.end(), t) - m_pend.begin();
+}
+
+void IteratorImpl::loadValue() {
+	m_tab->selectOneColgroup(m_recId, 1, &m_val, m_ctx.get());
+	if (m_tab->hasMergeOperands(m_key)) {
+		terark::valvec<unsigned char> row;
+		if (m_tab->getMergedRow(m_key, &row, m_ctx.get())) {
+			Slice v = kvRowValue(row);
+			m_val.assign((const unsigned char*)v.data(), v.size());
+		}
+	}
+}
+
+void IteratorImpl::idxIncrement() {
+	m_idxValid = m_iter->increment(&m_idxRecId, &m_idxKey);
+}
+
+// take the next key from the index iterator or the pending keys,
+// the index iterator is always read ahead by one key
 void IteratorImpl::iterIncrement() {
-	m_valid = m_iter->increment(&m_recId, &m_key);
-	while (m_valid) {
+	const bool forward = Direction::forward == m_direction;
+	for (;;) {
+		bool hasPend = forward ? m_pendPos < m_pend.size() : m_pendPos > 0;
+		if (!m_idxValid && !hasPend) {
+			m_valid = false;
+			return;
+		}
+		const std::string* pk = NULL;
+		if (hasPend) {
+			pk = &m_pend[forward ? m_pendPos : m_pendPos - 1];
+		}
+		int cmp = 0;
+		if (m_idxValid && hasPend) {
+			cmp = compareKey(m_idxKey, *pk);
+			if (!forward)
+				cmp = -cmp;
+		}
+		if (m_idxValid && (!hasPend || cmp <= 0)) {
+			if (hasPend && 0 == cmp) {
+				m_pendPos += forward ? 1 : -1;
+			}
+			m_key.swap(m_idxKey);
+			m_recId = m_idxRecId;
+			idxIncrement();
+			try {
+				loadValue();
+				m_valid = true;
+				return;
+			}
+			catch (const std::exception& ex) {
+				fprintf(stderr, "ERROR: %s: what=%s\n", BOOST_CURRENT_FUNCTION, ex.what());
+				continue;
+			}
+		}
+		m_pendPos += forward ? 1 : -1;
+		m_key.assign((const unsigned char*)pk->data(), pk->size());
+		m_recId = -1;
+		terark::valvec<unsigned char> row;
 		try {
-			m_tab->selectOneColgroup(m_recId, 1, &m_val, m_ctx.get());
-			break;
+			if (!m_tab->getMergedRow(*pk, &row, m_ctx.get()))
+				continue; // operands are discarded
 		}
 		catch (const std::exception& ex) {
 			fprintf(stderr, "ERROR: %s: what=%s\n", BOOST_CURRENT_FUNCTION, ex.what());
-			m_valid = m_iter->increment(&m_recId, &m_key);
+			continue;
 		}
+		Slice v = kvRowValue(row);
+		m_val.assign((const unsigned char*)v.data(), v.size());
+		m_valid = true;
+		return;
 	}
 }
 
@@ -655,6 +834,8 @@ IteratorImpl::SeekToFirst() {
 		m_iter = m_tab->createIndexIterForward(0);
 	}
 	m_iter->reset();
+	idxIncrement();
+	loadPendingKeys(Slice(), false);
 	iterIncrement();
 	TRACE_KEY_VAL(m_key, m_val);
 }
@@ -671,6 +852,8 @@ IteratorImpl::SeekToLast() {
 		m_iter = m_tab->createIndexIterBackward(0);
 	}
 	m_iter->reset();
+	idxIncrement();
+	loadPendingKeys(Slice(), false);
 	iterIncrement();
 	TRACE_KEY_VAL(m_key, m_val);
 }
@@ -692,15 +875,38 @@ IteratorImpl::Seek(const Slice& target) {
 		}
 	//	fprintf(stderr, "DEBUG: %s: direction=forward\n", BOOST_CURRENT_FUNCTION);
 	}
-	int cmp = m_iter->seekLowerBound(target, &m_recId, &m_key);
-	if (cmp < 0) {
-		m_valid = false;
+	int cmp = m_iter->seekLowerBound(target, &m_idxRecId, &m_idxKey);
+	m_idxValid = cmp >= 0;
+	loadPendingKeys(target, true);
+	iterIncrement();
+	TRACE_KEY_VAL(m_key, m_val);
+}
+
+// seek the index iterator of the new direction to the current key,
+// the current key is skipped
+void IteratorImpl::switchDirection(Direction direction) {
+	m_direction = direction;
+	if (Direction::forward == direction)
+		m_iter = m_tab->createIndexIterForward(0);
+	else
+		m_iter = m_tab->createIndexIterBackward(0);
+	m_posKey.swap(m_key);
+	int cmp = m_iter->seekLowerBound(m_posKey, &m_idxRecId, &m_idxKey);
+	TRACE_CMP_KEY_VAL();
+	m_idxValid = cmp >= 0;
+	if (0 == cmp) {
+		idxIncrement();
+	}
+	Slice pos((const char*)m_posKey.data(), m_posKey.size());
+	loadPendingKeys(pos, true);
+	if (Direction::forward == direction) {
+		if (m_pendPos < m_pend.size() && 0 == compareKey(m_posKey, m_pend[m_pendPos]))
+			m_pendPos++;
 	}
 	else {
-		m_tab->selectOneColgroup(m_recId, 1, &m_val, m_ctx.get());
-		m_valid = true;
+		if (m_pendPos > 0 && 0 == compareKey(m_posKey, m_pend[m_pendPos-1]))
+			m_pendPos--;
 	}
-	TRACE_KEY_VAL(m_key, m_val);
 }
 
 // Moves to the next entry in the source.  After this call, Valid() is
@@ -710,33 +916,11 @@ void
 IteratorImpl::Next() {
 	assert(m_valid);
 	assert(m_iter != nullptr);
-	if (Direction::forward == m_direction) {
-		iterIncrement();
-		TRACE_KEY_VAL(m_key, m_val);
-	}
-	else {
-		m_iter = m_tab->createIndexIterForward(0);
-		m_direction = Direction::forward;
-		m_posKey.swap(m_key);
-		int cmp = m_iter->seekLowerBound(m_posKey, &m_recId, &m_key);
-		TRACE_CMP_KEY_VAL();
-		if (cmp < 0) {
-			m_valid = false;
-		}
-		else if (0 == cmp) {
-			iterIncrement();
-			TRACE_KEY_VAL(m_key, m_val);
-		}
-		else try {
-			m_tab->selectOneColgroup(m_recId, 1, &m_val, m_ctx.get());
-			m_valid = true;
-			TRACE_KEY_VAL(m_key, m_val);
-		}
-		catch (const std::exception& ex) {
-			fprintf(stderr, "ERROR: %s: what=%s\n", BOOST_CURRENT_FUNCTION, ex.what());
-			iterIncrement();
-		}
+	if (Direction::forward != m_direction) {
+		switchDirection(Direction::forward);
 	}
+	iterIncrement();
+	TRACE_KEY_VAL(m_key, m_val);
 }
 
 // Moves to the previous entry in the source.  After this call, Valid() is
@@ -746,32 +930,10 @@ void
 IteratorImpl::Prev() {
 	assert(m_valid);
 	assert(m_iter != nullptr);
-	if (Direction::backward == m_direction) {
-		iterIncrement();
-		TRACE_KEY_VAL(m_key, m_val);
-	}
-	else {
-		m_iter = m_tab->createIndexIterBackward(0);
-		m_direction = Direction::backward;
-		m_posKey.swap(m_key);
-		int cmp = m_iter->seekLowerBound(m_posKey, &m_recId, &m_key);
-		TRACE_CMP_KEY_VAL();
-		if (cmp < 0) {
-			m_valid = false;
-		}
-		else if (0 == cmp) {
-			iterIncrement();
-			TRACE_KEY_VAL(m_key, m_val);
-		}
-		else try {
-			m_tab->selectOneColgroup(m_recId, 1, &m_val, m_ctx.get());
-			m_valid = true;
-			TRACE_KEY_VAL(m_key, m_val);
-		}
-		catch (const std::exception& ex) {
-			fprintf(stderr, "ERROR: %s: what=%s\n", BOOST_CURRENT_FUNCTION, ex.what());
-			iterIncrement();
-		}
+	if (Direction::backward != m_direction) {
+		switchDirection(Direction::backward);
 	}
+	iterIncrement();
+	TRACE_KEY_VAL(m_key, m_val);
 }
 
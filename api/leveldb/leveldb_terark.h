@@ -30,6 +30,10 @@
 
 #include <leveldb/leveldb_terark_config.h>
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include "leveldb/cache.h"
 #include "leveldb/comparator.h"
@@ -43,6 +47,9 @@
 #if HAVE_BASHO_LEVELDB
 #include "basho/perf_count.h"
 #endif
+#ifdef HAVE_ROCKSDB
+#include "leveldb/merge_operator.h"
+#endif
 
 #include <terark/db/db_table.hpp>
 #include <boost/filesystem.hpp>
@@ -98,8 +105,24 @@ using leveldb::ColumnFamilyHandle;
 
 extern Status WiredTigerErrorToStatus(int wiredTigerError, const char *msg = "");
 
+// dbmeta.json of a key-value table, used by the db and each column family
+extern const char g_keyValueSchema[];
+extern void encodeKeyVal(terark::valvec<unsigned char>& buf, const Slice& key, const Slice& val);
+extern void batchDeleteKey(terark::db::BatchWriter& bw, const Slice& key);
+extern Slice kvRowValue(const terark::valvec<unsigned char>& row);
+// pending merge operands of key are applied to the value
+extern bool kvGetValue(terark::db::DbTable* tab, terark::db::DbContext* ctx,
+                       const Slice& key, terark::valvec<unsigned char>* val);
+#ifdef HAVE_ROCKSDB
+extern terark::db::MergeOperator*
+NewKvMergeOperator(const std::shared_ptr<leveldb::MergeOperator>& op);
+#endif
+
 /* WiredTiger implementations. */
 class DbImpl;
+#ifdef HAVE_ROCKSDB
+class ColumnFamilyHandleImpl;
+#endif
 
 /* Context for operations (including snapshots, write batches, transactions) */
 class OperationContext {
@@ -117,29 +140,31 @@ public:
   int Close() {
     return 0;
   }
-/*
-  WT_CURSOR *GetCursor() { return cursor_; }
-  void SetCursor(WT_CURSOR *c) { cursor_ = c; }
+
+  // commit m_batchWriter or the writer of the touched column family,
+  // tables are committed independently, so a batch which touches more
+  // than one column family is rejected and rolled back
+  Status Commit();
+  void Rollback();
+
 #ifdef HAVE_ROCKSDB
-  WT_CURSOR *GetCursor(u_int i) {
-    return (i < cursors_.size()) ? cursors_[i] : NULL;
-  }
-  void SetCursor(u_int i, WT_CURSOR *c) {
-    if (i >= cursors_.size())
-      cursors_.resize(i + 1);
-    cursors_[i] = c;
+  // BatchWriter of a non-default column family, created on first use,
+  // the default column family is m_batchWriter
+  terark::db::BatchWriter* GetBatchWriter(ColumnFamilyHandleImpl* cf);
+
+  void TouchTable(terark::db::DbTable* tab) {
+    if (std::find(m_tables.begin(), m_tables.end(), tab) == m_tables.end())
+      m_tables.push_back(tab);
   }
 #endif
-  WT_SESSION *GetSession() { return session_; }
-*/
+
   terark::db::BatchWriter m_batchWriter;
 //  terark::valvec<unsigned char> m_rowBuf;
 //  terark::valvec<long long> m_exactRecIdvec;
 private:
-//  WT_SESSION *session_;
-//  WT_CURSOR *cursor_;
 #ifdef HAVE_ROCKSDB
-  std::vector<WT_CURSOR *> cursors_;
+  std::vector<std::unique_ptr<terark::db::BatchWriter> > m_cfWriters; // by cf id
+  std::vector<terark::db::DbTable*> m_tables; // touched by the batch
 #endif
 };
 
@@ -163,17 +188,33 @@ public:
 // ColumnFamilyHandleImpl is the class that clients use to access different
 // column families. It has non-trivial destructor, which gets called when client
 // is done using the column family
+//
+// Each column family is a key-value DbTable, the default column family is
+// DbImpl::m_tab, others are in "TerarkDB/cf/<name>", all tables share the
+// background flush/compression threads of terark-db.
 class ColumnFamilyHandleImpl : public ColumnFamilyHandle {
  public:
-  ColumnFamilyHandleImpl(DbImpl* db, std::string const &name, uint32_t id) : db_(db), id_(id), name_(name) {}
-  ColumnFamilyHandleImpl(const ColumnFamilyHandleImpl &copyfrom) : db_(copyfrom.db_), id_(copyfrom.id_), name_(copyfrom.name_) {}
+  ColumnFamilyHandleImpl(DbImpl* db, std::string const &name, uint32_t id, terark::db::DbTable* tab)
+    : db_(db), id_(id), name_(name), m_tab(tab), dropped_(false) {}
+  ColumnFamilyHandleImpl(const ColumnFamilyHandleImpl &copyfrom)
+    : db_(copyfrom.db_), id_(copyfrom.id_), name_(copyfrom.name_), m_tab(copyfrom.m_tab)
+    , dropped_(copyfrom.IsDropped()) {}
   virtual ~ColumnFamilyHandleImpl() {}
   size_t GetID() const { return id_; }
   std::string const &GetName() const { return name_; }
+  terark::db::DbTable* GetTable() const { return m_tab.get(); }
+  terark::db::DbContext* GetDbContext();
+  // set by DropColumnFamily, all operations on a dropped handle fail,
+  // the handle itself is still owned and deleted by the user
+  bool IsDropped() const { return dropped_.load(std::memory_order_acquire); }
+  void MarkDropped() { dropped_.store(true, std::memory_order_release); }
  private:
   DbImpl* db_;
   size_t  id_;
   std::string const name_;
+  terark::db::DbTablePtr m_tab; // must destruct after m_ctx
+  tbb::enumerable_thread_specific<DbContextPtr> m_ctx;
+  std::atomic<bool> dropped_;
 };
 #endif
 
@@ -209,21 +250,32 @@ public:
   }
 
 private:
+  enum class Direction : unsigned char {
+//	  invalid,
+	  forward,
+	  backward,
+  };
   void iterIncrement();
+  void idxIncrement();
+  void loadValue();
+  void loadPendingKeys(const Slice& target, bool seekTarget);
+  void switchDirection(Direction);
   terark::db::DbTable*  m_tab;
   terark::db::DbContextPtr     m_ctx;
   terark::db::IndexIteratorPtr m_iter;
   long long m_recId;
   terark::valvec<unsigned char> m_posKey;
   terark::valvec<unsigned char> m_key, m_val;
+  // the next key of m_iter, which is read ahead
+  long long m_idxRecId;
+  terark::valvec<unsigned char> m_idxKey;
+  bool m_idxValid;
+  // keys which have pending merge operands, see DbTable::mergeRow
+  std::vector<std::string> m_pend;
+  size_t m_pendPos;
   Status m_status;
   bool m_valid;
 //bool m_isPositioned;
-  enum class Direction : unsigned char {
-//	  invalid,
-	  forward,
-	  backward,
-  };
   Direction m_direction;
 
   // No copying allowed
@@ -336,11 +388,15 @@ public:
                        ColumnFamilyHandle* column_family);
 
   ColumnFamilyHandleImpl *GetCF(uint32_t id) {
+    std::lock_guard<std::mutex> lock(columnsMutex_);
     return (id < columns_.size()) ? static_cast<ColumnFamilyHandleImpl *>(columns_[id]) : NULL;
   }
   void SetColumns(std::vector<ColumnFamilyHandle *> &cols) {
     columns_ = cols;
   }
+  // open table of a non-default column family
+  terark::db::DbTablePtr OpenCFTable(std::string const &name, const Options& options, bool createIfMissing);
+  fs::path GetCFDir(std::string const &name) const;
 #endif
 
   Iterator* NewIterator(const ReadOptions& options) override;
@@ -363,6 +419,7 @@ private:
 
 #ifdef HAVE_ROCKSDB
   std::vector<ColumnFamilyHandle*> columns_;
+  std::mutex columnsMutex_; // for CreateColumnFamily/DropColumnFamily
 #endif
 
   OperationContext* GetContext();
@@ -388,8 +445,10 @@ public:
   // Implementations are in rocksdb_terark.cc
   virtual Status PutCF(uint32_t column_family_id, const Slice& key, const Slice& value);
   virtual Status DeleteCF(uint32_t column_family_id, const Slice& key);
+  virtual Status MergeCF(uint32_t column_family_id, const Slice& key, const Slice& value);
 #endif
 
+
 private:
   DbImpl *db_;
   OperationContext *context_;
@@ -32,6 +32,7 @@
   #include <sys/stat.h>
   #include <unistd.h>
 #endif
+#include <algorithm>
 #include <sstream>
 
 using leveldb::Cache;
@@ -48,30 +49,90 @@ using leveldb::Slice;
 using leveldb::Snapshot;
 using leveldb::Status;
 
-static int
-wtrocks_get_cursor(OperationContext *context, ColumnFamilyHandle *cfhp, WT_CURSOR **cursorp, int acquire=0)
-{
-	ColumnFamilyHandleImpl *cf =
-	    static_cast<ColumnFamilyHandleImpl *>(cfhp);
-	if (cf == NULL) {
-		fprintf(stderr, "Missing column!\n");
-		assert(0);
-	}
-	WT_CURSOR *c = context->GetCursor(cf->GetID());
-	if (c == NULL) {
-		WT_SESSION *session = context->GetSession();
-		int ret;
-		if ((ret = session->open_cursor(
-		    session, cf->GetURI().c_str(), NULL, NULL, &c)) != 0) {
-			fprintf(stderr, "Failed to open cursor on %s: %s\n", cf->GetURI().c_str(), wiredtiger_strerror(ret));
-			return (ret);
+namespace leveldb {
+const std::string kDefaultColumnFamilyName("default");
+}
+
+terark::db::DbContext* ColumnFamilyHandleImpl::GetDbContext() {
+	DbContextPtr& refctx = m_ctx.local();
+	if (!refctx) {
+		refctx.reset(m_tab->createDbContext());
+	}
+	return refctx.get();
+}
+
+terark::db::BatchWriter*
+OperationContext::GetBatchWriter(ColumnFamilyHandleImpl* cf) {
+	TouchTable(cf->GetTable());
+	if (cf->GetTable() == m_batchWriter.getCtx()->m_tab) {
+		return &m_batchWriter;
+	}
+	size_t id = cf->GetID();
+	if (id >= m_cfWriters.size())
+		m_cfWriters.resize(id + 1);
+	if (!m_cfWriters[id])
+		m_cfWriters[id].reset(new terark::db::BatchWriter(cf->GetTable(), cf->GetDbContext()));
+	return m_cfWriters[id].get();
+}
+
+namespace {
+// rows of key-value tables are encoded by encodeKeyVal
+class KvMergeOperator : public terark::db::MergeOperator {
+	std::shared_ptr<leveldb::MergeOperator> m_op;
+public:
+	explicit KvMergeOperator(const std::shared_ptr<leveldb::MergeOperator>& op)
+	  : m_op(op) {}
+	void fullMerge(terark::fstring key,
+				   const terark::valvec<terark::byte>* existingRow,
+				   const terark::valvec<terark::fstring>& operands,
+				   terark::valvec<terark::byte>* newRow)
+	const override {
+		Slice userKey(key.data(), key.size());
+		Slice existingVal;
+		if (existingRow) {
+			existingVal = kvRowValue(*existingRow);
+		}
+		std::deque<std::string> operandList;
+		for (size_t i = 0; i < operands.size(); ++i) {
+			operandList.push_back(operands[i].str());
+		}
+		std::string newVal;
+		if (!m_op->FullMerge(userKey, existingRow ? &existingVal : NULL,
+							 operandList, &newVal, NULL)) {
+			THROW_STD(invalid_argument, "%s::FullMerge failed", m_op->Name());
 		}
-		if (!acquire)
-			context->SetCursor(cf->GetID(), c);
-	} else if (acquire)
-		context->SetCursor(cf->GetID(), NULL);
-	*cursorp = c;
-	return (0);
+		encodeKeyVal(*newRow, userKey, newVal);
+	}
+	const char* name() const override { return m_op->Name(); }
+};
+} // namespace
+
+terark::db::MergeOperator*
+NewKvMergeOperator(const std::shared_ptr<leveldb::MergeOperator>& op) {
+	return new KvMergeOperator(op);
+}
+
+fs::path DbImpl::GetCFDir(std::string const &name) const {
+	return m_tab->getDir() / "cf" / name;
+}
+
+terark::db::DbTablePtr
+DbImpl::OpenCFTable(std::string const &name, const Options& options, bool createIfMissing) {
+	fs::path dir = GetCFDir(name);
+	fs::path metaPath = dir / "dbmeta.json";
+	if (!fs::exists(metaPath)) {
+		if (!createIfMissing) {
+			THROW_STD(invalid_argument, "column family does not exist: %s"
+				, dir.string().c_str());
+		}
+		fs::create_directories(dir);
+		leveldb::WriteStringToFile(leveldb::Env::Default(), g_keyValueSchema, metaPath.string());
+	}
+	DbTablePtr tab = terark::db::DbTable::open(dir);
+	if (options.merge_operator) {
+		tab->setMergeOperator(NewKvMergeOperator(options.merge_operator));
+	}
+	return tab;
 }
 
 Status
@@ -79,26 +140,22 @@ DB::ListColumnFamilies(
 	Options const &options, std::string const &name,
 	std::vector<std::string> *column_families)
 {
-	std::vector<std::string> cf;
 	fs::path dbdir = fs::path(name) / "TerarkDB";
 	fs::path metaPath = dbdir / "dbmeta.json";
 	if (!fs::exists(metaPath)) {
 		fprintf(stderr, "ERROR: not exists: %s\n", metaPath.string().c_str());
 		return Status::InvalidArgument("ListColumnFamilies: dbmeta.json is missing", dbdir.string());
 	}
-	try {
-		terark::db::SchemaConfigPtr sconf = new terark::db::SchemaConfig();
-		sconf->loadJsonFile(metaPath.string());
-		column_families->resize(0);
-		size_t cgNum = sconf->getColgroupNum();
-		for (size_t i = 0; i < cgNum; ++i) {
-			const terark::db::Schema& schema = sconf->getColgroupSchema(i);
-			column_families->push_back(schema.m_name);
+	column_families->resize(0);
+	column_families->push_back(leveldb::kDefaultColumnFamilyName);
+	fs::path cfRoot = dbdir / "cf";
+	if (fs::exists(cfRoot)) {
+		for (auto& x : fs::directory_iterator(cfRoot)) {
+			if (fs::exists(x.path() / "dbmeta.json"))
+				column_families->push_back(x.path().filename().string());
 		}
 	}
-	catch (const std::exception& ex) {
-		return Status::InvalidArgument("ListColumnFamilies: load dbmeta.json failed", dbdir.string());
-	}
+	return Status::OK();
 }
 
 Status
@@ -112,10 +169,32 @@ DB::Open(Options const &options,
 	if (!status.ok())
 		return status;
 	DbImpl *db = static_cast<DbImpl*>(*dbptr);
-	std::vector<ColumnFamilyHandle*> cfhandles(column_families.size());
-	for (size_t i = 0; i < column_families.size(); i++) {
-		printf("Open column families: [%d] = %s\n", (int)i, column_families[i].name.c_str());
-		cfhandles[i] = new ColumnFamilyHandleImpl(db, column_families[i].name, i);
+	std::vector<ColumnFamilyHandle*> cfhandles;
+	try {
+		for (size_t i = 0; i < column_families.size(); i++) {
+			const std::string& cfname = column_families[i].name;
+			fprintf(stderr, "INFO: Open column families: [%d] = %s\n", (int)i, cfname.c_str());
+			Options cfopt = options;
+			if (column_families[i].options.merge_operator)
+				cfopt.merge_operator = column_families[i].options.merge_operator;
+			DbTablePtr tab;
+			if (cfname == leveldb::kDefaultColumnFamilyName) {
+				tab = db->m_tab;
+				if (cfopt.merge_operator && !tab->getMergeOperator())
+					tab->setMergeOperator(NewKvMergeOperator(cfopt.merge_operator));
+			}
+			else
+				tab = db->OpenCFTable(cfname, cfopt, options.create_if_missing);
+			cfhandles.push_back(new ColumnFamilyHandleImpl(db, cfname, i, tab.get()));
+		}
+	}
+	catch (const std::exception& ex) {
+		fprintf(stderr, "ERROR: caught exception: %s for dbdir: %s\n", ex.what(), name.c_str());
+		for (auto cf : cfhandles)
+			delete cf;
+		delete db;
+		*dbptr = NULL;
+		return Status::InvalidArgument("Open column families failed", ex.what());
 	}
 	db->SetColumns(*handles = cfhandles);
 	return Status::OK();
@@ -135,90 +214,144 @@ Status
 WriteBatchHandler::PutCF(
     uint32_t column_family_id, const Slice& key, const Slice& value)
 {
-	WT_CURSOR *cursor;
-	int ret = wtrocks_get_cursor(context_, db_->GetCF(column_family_id), &cursor);
-	if (ret != 0)
-		return WiredTigerErrorToStatus(ret);
-	WT_ITEM item;
-	item.data = key.data();
-	item.size = key.size();
-	cursor->set_key(cursor, &item);
-	item.data = value.data();
-	item.size = value.size();
-	cursor->set_value(cursor, &item);
-	ret = cursor->insert(cursor);
-	return WiredTigerErrorToStatus(ret);
+	ColumnFamilyHandleImpl *cf = db_->GetCF(column_family_id);
+	if (cf == NULL)
+		return Status::InvalidArgument("PutCF: invalid column family id");
+	try {
+		terark::db::BatchWriter* bw = context_->GetBatchWriter(cf);
+		terark::db::DbContext* ctx = bw->getCtx();
+		encodeKeyVal(ctx->userBuf, key, value);
+		bw->upsertRow(ctx->userBuf);
+		return Status::OK();
+	}
+	catch (const std::exception& ex) {
+		return Status::Corruption("PutCF: BatchWriter::upsertRow failed", ex.what());
+	}
 }
 
 Status
 WriteBatchHandler::DeleteCF(uint32_t column_family_id, const Slice& key)
 {
-	WT_CURSOR *cursor;
-	int ret = wtrocks_get_cursor(context_, db_->GetCF(column_family_id), &cursor);
-	if (ret != 0)
-		return WiredTigerErrorToStatus(ret);
-	WT_ITEM item;
-	item.data = key.data();
-	item.size = key.size();
-	cursor->set_key(cursor, &item);
-	ret = cursor->remove(cursor);
-	if (ret == 0) {
-		int t_ret = cursor->reset(cursor);
-		assert(t_ret == 0);
-	} else if (ret == WT_NOTFOUND)
-		ret = 0;
-	return WiredTigerErrorToStatus(ret);
+	ColumnFamilyHandleImpl *cf = db_->GetCF(column_family_id);
+	if (cf == NULL)
+		return Status::InvalidArgument("DeleteCF: invalid column family id");
+	try {
+		batchDeleteKey(*context_->GetBatchWriter(cf), key);
+		return Status::OK();
+	}
+	catch (const std::exception& ex) {
+		return Status::Corruption("DeleteCF: BatchWriter::removeRow failed", ex.what());
+	}
+}
+
+Status
+WriteBatchHandler::MergeCF(
+    uint32_t column_family_id, const Slice& key, const Slice& value)
+{
+	ColumnFamilyHandleImpl *cf = db_->GetCF(column_family_id);
+	if (cf == NULL)
+		return Status::InvalidArgument("MergeCF: invalid column family id");
+	if (!cf->GetTable()->getMergeOperator())
+		return Status::NotSupported("MergeCF: merge_operator is not set", cf->GetName());
+	try {
+		context_->GetBatchWriter(cf)->mergeRow(key, value);
+		return Status::OK();
+	}
+	catch (const std::exception& ex) {
+		return Status::Corruption("MergeCF: BatchWriter::mergeRow failed", ex.what());
+	}
 }
 
+// The operand is just appended to the writing segment of the table, it
+// is applied on read and collapsed into the row by segment conversion
 Status
-DbImpl::Merge(WriteOptions const&, ColumnFamilyHandle*, Slice const&, Slice const&)
+DbImpl::Merge(WriteOptions const&, ColumnFamilyHandle* cfhp, Slice const& key, Slice const& value)
 {
-	return WiredTigerErrorToStatus(ENOTSUP);
+	ColumnFamilyHandleImpl *cf =
+	    static_cast<ColumnFamilyHandleImpl *>(cfhp);
+	if (cf->IsDropped())
+		return Status::InvalidArgument("Merge: column family is dropped", cf->GetName());
+	terark::db::DbTable* tab = cf->GetTable();
+	if (!tab->getMergeOperator())
+		return Status::NotSupported("Merge: merge_operator is not set", cf->GetName());
+	try {
+		tab->mergeRow(key, value);
+		return Status::OK();
+	}
+	catch (const std::exception& ex) {
+		return Status::Corruption("DbTable::mergeRow failed", ex.what());
+	}
 }
 
 Status
 DbImpl::CreateColumnFamily(Options const &options, std::string const &name, ColumnFamilyHandle **cfhp)
 {
-	extern int wtleveldb_create(WT_CONNECTION *,
-	    const Options &, std::string const &uri);
-	int ret = wtleveldb_create(conn_, options, "table:" + name);
-	if (ret != 0)
-		return WiredTigerErrorToStatus(ret);
-	int id = (int)columns_.size();
-	*cfhp = new ColumnFamilyHandleImpl(this, name, id);
-	printf("Create column family: [%d] = %s\n", id, name.c_str());
-	columns_.push_back(*cfhp);
-	return Status::OK();
+	std::lock_guard<std::mutex> lock(columnsMutex_);
+	for (auto x : columns_) {
+		if (x && static_cast<ColumnFamilyHandleImpl*>(x)->GetName() == name)
+			return Status::InvalidArgument("Column family already exists", name);
+	}
+	try {
+		DbTablePtr tab = OpenCFTable(name, options, true);
+		int id = (int)columns_.size();
+		*cfhp = new ColumnFamilyHandleImpl(this, name, id, tab.get());
+		fprintf(stderr, "INFO: Create column family: [%d] = %s\n", id, name.c_str());
+		columns_.push_back(*cfhp);
+		return Status::OK();
+	}
+	catch (const std::exception& ex) {
+		return Status::InvalidArgument("CreateColumnFamily failed", ex.what());
+	}
 }
 
+// The table is deleted when the last handle/iterator of it is destroyed,
+// the slot in columns_ is cleared but not reused, so column family ids
+// in WriteBatch'es stay stable and a dropped id is rejected by GetCF
 Status
 DbImpl::DropColumnFamily(ColumnFamilyHandle *cfhp)
 {
 	ColumnFamilyHandleImpl *cf =
 	    static_cast<ColumnFamilyHandleImpl *>(cfhp);
-	WT_SESSION *session = GetContext()->GetSession();
-	int ret = session->drop(session, cf->GetURI().c_str(), NULL);
-	return WiredTigerErrorToStatus(ret);
+	if (cf->GetTable() == m_tab.get())
+		return Status::InvalidArgument("Can not drop default column family");
+	std::lock_guard<std::mutex> lock(columnsMutex_);
+	if (cf->IsDropped())
+		return Status::InvalidArgument("Column family is already dropped", cf->GetName());
+	try {
+		cf->GetTable()->dropTable();
+		size_t id = cf->GetID();
+		if (id < columns_.size() && columns_[id] == cfhp)
+			columns_[id] = NULL;
+		cf->MarkDropped();
+		fprintf(stderr, "INFO: Drop column family: [%zd] = %s\n", id, cf->GetName().c_str());
+		return Status::OK();
+	}
+	catch (const std::exception& ex) {
+		return Status::Corruption("DropColumnFamily failed", ex.what());
+	}
 }
 
 Status
 DbImpl::Delete(WriteOptions const &write_options, ColumnFamilyHandle *cfhp, Slice const &key)
 {
-	WT_CURSOR *cursor;
-	int ret = wtrocks_get_cursor(GetContext(), cfhp, &cursor);
-	if (ret != 0)
-		return WiredTigerErrorToStatus(ret);
-	WT_ITEM item;
-	item.data = key.data();
-	item.size = key.size();
-	cursor->set_key(cursor, &item);
-	ret = cursor->remove(cursor);
-	// Reset the WiredTiger cursor so it doesn't keep any pages pinned.
-	// Track failures in debug builds since we don't expect failure, but
-	// don't pass failures on - it's not necessary for correct operation.
-	int t_ret = cursor->reset(cursor);
-	assert(t_ret == 0);
-	return WiredTigerErrorToStatus(ret);
+	ColumnFamilyHandleImpl *cf =
+	    static_cast<ColumnFamilyHandleImpl *>(cfhp);
+	if (cf->IsDropped())
+		return Status::InvalidArgument("Delete: column family is dropped", cf->GetName());
+	terark::db::DbContext* ctx = cf->GetDbContext();
+	try {
+		ctx->indexSearchExact(0, key, &ctx->exactMatchRecIdvec);
+		if (!ctx->exactMatchRecIdvec.empty()) {
+			ctx->removeRow(ctx->exactMatchRecIdvec[0]);
+		}
+		else {
+			cf->GetTable()->discardMergeOperands(key);
+		}
+		return Status::OK();
+	}
+	catch (const std::exception& ex) {
+		return Status::Corruption("DbTable::removeRow failed", ex.what());
+	}
 }
 
 Status
@@ -226,76 +359,116 @@ DbImpl::Flush(FlushOptions const&, ColumnFamilyHandle* cfhp)
 {
 	ColumnFamilyHandleImpl *cf =
 	    static_cast<ColumnFamilyHandleImpl *>(cfhp);
-	WT_SESSION *session = GetContext()->GetSession();
-	return WiredTigerErrorToStatus(session->checkpoint(session, ("target=(\"" + cf->GetURI() + "\")").c_str()));
+	if (cf->IsDropped())
+		return Status::InvalidArgument("Flush: column family is dropped", cf->GetName());
+	try {
+		cf->GetTable()->flush();
+		return Status::OK();
+	}
+	catch (const std::exception& ex) {
+		return Status::IOError("DbTable::flush failed", ex.what());
+	}
 }
 
 Status
 DbImpl::Get(ReadOptions const &options, ColumnFamilyHandle *cfhp, Slice const &key, std::string *value)
 {
-	const char *errmsg = NULL;
-	OperationContext *context = GetContext(options);
-
-	WT_CURSOR *cursor;
-	int ret = wtrocks_get_cursor(context, cfhp, &cursor);
-	if (ret != 0)
-		return WiredTigerErrorToStatus(ret);
-
-	WT_ITEM item;
-	item.data = key.data();
-	item.size = key.size();
-	cursor->set_key(cursor, &item);
-	if ((ret = cursor->search(cursor)) == 0 &&
-	    (ret = cursor->get_value(cursor, &item)) == 0) {
-		*value = std::string((const char *)item.data, item.size);
-		ret = cursor->reset(cursor);
-	}
-	if (ret == WT_NOTFOUND)
-		errmsg = "DB::Get key not found";
-	return WiredTigerErrorToStatus(ret, errmsg);
+	ColumnFamilyHandleImpl *cf =
+	    static_cast<ColumnFamilyHandleImpl *>(cfhp);
+	if (cf->IsDropped())
+		return Status::InvalidArgument("Get: column family is dropped", cf->GetName());
+	terark::db::DbContext* ctx = cf->GetDbContext();
+	if (kvGetValue(cf->GetTable(), ctx, key, &ctx->userBuf)) {
+		value->assign((char*)ctx->userBuf.data(), ctx->userBuf.size());
+		return Status::OK();
+	}
+	return Status::NotFound(key);
 }
 
 bool
-DbImpl::GetProperty(ColumnFamilyHandle*, Slice const&, std::string*)
+DbImpl::GetProperty(ColumnFamilyHandle* cfhp, Slice const& property, std::string* value)
 {
+	ColumnFamilyHandleImpl *cf =
+	    static_cast<ColumnFamilyHandleImpl *>(cfhp);
+	if (cf->IsDropped())
+		return false;
+	if (property == Slice("terarkdb.stats") || property == Slice("rocksdb.stats")) {
+		*value = cf->GetTable()->getStatsJson();
+		return true;
+	}
 	return false;
 }
 
+// Keys are grouped by column family and sorted in each group, so each
+// table is searched with one DbContext in key order, which makes index
+// and store accesses of adjacent keys hit the same pages.
 std::vector<Status>
-DbImpl::MultiGet(ReadOptions const&, std::vector<ColumnFamilyHandle*> const&, std::vector<Slice> const&, std::vector<std::string, std::allocator<std::string> >*)
+DbImpl::MultiGet(ReadOptions const&,
+				 std::vector<ColumnFamilyHandle*> const& column_family,
+				 std::vector<Slice> const& keys,
+				 std::vector<std::string>* values)
 {
-	std::vector<Status> ret;
-	ret.push_back(WiredTigerErrorToStatus(ENOTSUP));
+	assert(column_family.size() == keys.size());
+	std::vector<Status> ret(keys.size(), Status::NotFound(Slice()));
+	values->resize(keys.size());
+	terark::valvec<std::pair<ColumnFamilyHandleImpl*, size_t> > order(keys.size());
+	for (size_t i = 0; i < keys.size(); ++i) {
+		order[i].first = static_cast<ColumnFamilyHandleImpl*>(column_family[i]);
+		order[i].second = i;
+	}
+	std::sort(order.begin(), order.end(),
+		[&](const std::pair<ColumnFamilyHandleImpl*, size_t>& x,
+			const std::pair<ColumnFamilyHandleImpl*, size_t>& y) {
+			if (x.first != y.first)
+				return x.first->GetID() < y.first->GetID();
+			return keys[x.second].compare(keys[y.second]) < 0;
+		});
+	for (size_t i = 0; i < order.size(); ) {
+		ColumnFamilyHandleImpl* cf = order[i].first;
+		if (cf->IsDropped()) {
+			for (; i < order.size() && order[i].first == cf; ++i)
+				ret[order[i].second] = Status::InvalidArgument(
+					"MultiGet: column family is dropped", cf->GetName());
+			continue;
+		}
+		terark::db::DbContext* ctx = cf->GetDbContext();
+		for (; i < order.size() && order[i].first == cf; ++i) {
+			size_t idx = order[i].second;
+			if (kvGetValue(cf->GetTable(), ctx, keys[idx], &ctx->userBuf)) {
+				(*values)[idx].assign((char*)ctx->userBuf.data(), ctx->userBuf.size());
+				ret[idx] = Status::OK();
+			}
+		}
+	}
 	return ret;
 }
 
 Iterator *
 DbImpl::NewIterator(ReadOptions const &options, ColumnFamilyHandle *cfhp)
 {
-	OperationContext *context = GetContext(options);
-
-	WT_CURSOR *c;
-	int ret = wtrocks_get_cursor(context, cfhp, &c, 1);
-	assert(ret == 0);
-	return new IteratorImpl(this, c,
-	    static_cast<ColumnFamilyHandleImpl *>(cfhp)->GetID());
+	ColumnFamilyHandleImpl *cf =
+	    static_cast<ColumnFamilyHandleImpl *>(cfhp);
+	if (cf->IsDropped())
+		return NewErrorIterator(Status::InvalidArgument(
+			"NewIterator: column family is dropped", cf->GetName()));
+	return new IteratorImpl(cf->GetTable());
 }
 
 Status
 DbImpl::Put(WriteOptions const &options, ColumnFamilyHandle *cfhp, Slice const &key, Slice const &value)
 {
-	WT_CURSOR *cursor;
-	int ret = wtrocks_get_cursor(GetContext(), cfhp, &cursor);
-	if (ret != 0)
-		return WiredTigerErrorToStatus(ret);
-
-	WT_ITEM item;
-	item.data = key.data();
-	item.size = key.size();
-	cursor->set_key(cursor, &item);
-	item.data = value.data();
-	item.size = value.size();
-	cursor->set_value(cursor, &item);
-	ret = cursor->insert(cursor);
-	return WiredTigerErrorToStatus(ret, NULL);
+	ColumnFamilyHandleImpl *cf =
+	    static_cast<ColumnFamilyHandleImpl *>(cfhp);
+	if (cf->IsDropped())
+		return Status::InvalidArgument("Put: column family is dropped", cf->GetName());
+	terark::db::DbContext* ctx = cf->GetDbContext();
+	try {
+		encodeKeyVal(ctx->userBuf, key, value);
+		long long recId = ctx->upsertRow(ctx->userBuf);
+		TERARK_RT_assert(recId >= 0, std::logic_error);
+		return Status::OK();
+	}
+	catch (const std::exception& ex) {
+		return Status::Corruption("DbTable::upsertRow failed", ex.what());
+	}
 }
@@ -697,6 +697,213 @@ void encodeMaxValueField(const ColumnMeta& colmeta, valvec<char>* encoded) {
 	}
 }
 
+static void
+encodeColumn(const ColumnMeta& colmeta, const BSONElement& elem,
+			 bool isLastField, valvec<char>* encoded) {
+	BSONType elemType = elem.type();
+	const char* value = elem.value();
+	switch (elemType) {
+	case EOO:
+		break;
+	case Undefined:
+	case jstNULL:
+		encodeMissingField(colmeta, encoded);
+		break;
+	case MaxKey:
+		encodeMaxValueField(colmeta, encoded);
+		break;
+	case MinKey:
+		encodeMinValueField(colmeta, encoded);
+		break;
+	case mongo::Bool:
+		encoded->push_back(value[0] ? 1 : 0);
+		assert(colmeta.type == terark::db::ColumnType::Uint08);
+		break;
+	case NumberInt:
+		encodeConvertFrom<int32_t>(colmeta.type, value, encoded, isLastField);
+		break;
+	case NumberDouble:
+		encodeConvertFromDouble(colmeta.type, value, encoded, isLastField);
+		break;
+	case NumberLong:
+		encodeConvertFrom<int64_t>(colmeta.type, value, encoded, isLastField);
+		break;
+	case bsonTimestamp: // low 32 bit is always positive
+		invariant(colmeta.type == ColumnType::Sint64 ||
+				  colmeta.type == ColumnType::Uint64);
+		encoded->append(value, 8);
+		break;
+	case mongo::Date:
+		if (colmeta.type == ColumnType::Uint32 ||
+			colmeta.type == ColumnType::Sint32)
+		{
+			int64_t millisec = ConstDataView(value).read<LittleEndian<int64_t>>();
+			int64_t sec = millisec / 1000;
+			DataView(encoded->grow_no_init(4)).write<LittleEndian<int>>(sec);
+		}
+		else if (colmeta.type == ColumnType::Uint64 ||
+				 colmeta.type == ColumnType::Sint64) {
+			encoded->append(value, 8);
+		}
+		else {
+			invariant(!"mongo::Date must map to one of terark sint32, uint32, sint64, uint64");
+		}
+		break;
+	case jstOID:
+	//	log() << "encode: OID=" << toHexLower(value, OID::kOIDSize);
+		encoded->append(value, OID::kOIDSize);
+		assert(colmeta.type == terark::db::ColumnType::Fixed);
+		assert(colmeta.fixedLen == OID::kOIDSize);
+		break;
+	case Symbol:
+	case Code:
+	case mongo::String:
+	//	log() << "encode: strlen+1=" << elem.valuestrsize() << ", str=" << elem.valuestr();
+		if (colmeta.type == terark::db::ColumnType::StrZero) {
+			encoded->append(value + 4, elem.valuestrsize());
+		}
+		else {
+			encodeConvertString(colmeta.type, value + 4, encoded);
+		}
+		break;
+	case DBRef:
+		assert(0); // deprecated, should not in data
+		encoded->append(value + 4, elem.valuestrsize() + OID::kOIDSize);
+		break;
+	case mongo::Array:
+		assert(colmeta.type == terark::db::ColumnType::CarBin);
+		{
+			size_t oldsize = encoded->size();
+			encoded->resize(oldsize + 4); // reserve for uint32 length
+			terarkEncodeBsonArray(elem.embeddedObject(), *encoded);
+			size_t len = encoded->size() - (oldsize + 4);
+			DataView(encoded->data()+oldsize)
+					.write(LittleEndian<uint32_t>(uint32_t(len)));
+		}
+		break;
+	case Object:
+		assert(colmeta.type == terark::db::ColumnType::CarBin);
+		{
+			size_t oldsize = encoded->size();
+			encoded->resize(oldsize + 4); // reserve for uint32 length
+			terarkEncodeBsonObject(elem.embeddedObject(), *encoded);
+			size_t len = encoded->size() - (oldsize + 4);
+			DataView(encoded->data()+oldsize)
+					.write(LittleEndian<uint32_t>(uint32_t(len)));
+		}
+		break;
+	case CodeWScope:
+		assert(colmeta.type == terark::db::ColumnType::CarBin);
+		{
+			assert(colmeta.type == terark::db::ColumnType::CarBin);
+			size_t oldsize = encoded->size();
+			encoded->resize(oldsize + 8); // reserve for uint32 length + uint32 codelen
+			DataView(encoded->data()+oldsize + 4)
+					.write(LittleEndian<uint32_t>(elem.codeWScopeCodeLen()));
+			encoded->append(elem.codeWScopeCode(), elem.codeWScopeCodeLen());
+			terarkEncodeBsonObject(elem.codeWScopeObject(), *encoded);
+			size_t len = encoded->size() - (oldsize + 4);
+			DataView(encoded->data()+oldsize)
+					.write(LittleEndian<uint32_t>(uint32_t(len)));
+		}
+		encoded->append(value, elem.objsize());
+		break;
+	case BinData:
+		if (colmeta.type == terark::db::ColumnType::CarBin) {
+			uint32_t len = elem.valuestrsize() + 1; // 1 is for subtype byte
+			encoded->resize(encoded->size() + 4);
+			DataView(encoded->end() - 4)
+					.write(LittleEndian<uint32_t>(len));
+			encoded->append(value + 4, 1 + elem.valuestrsize());
+		}
+		else if (colmeta.type == terark::db::ColumnType::StrZero) {
+			BsonBinDataToTerarkStrZero(elem, *encoded, isLastField);
+		}
+		else {
+			invariant(!"mongo bindata must be terark carbin or strzero");
+		}
+		break;
+	case RegEx:
+		{
+			const char* p = value;
+			size_t len1 = strlen(p); // regex len
+			p += len1 + 1;
+			size_t len2 = strlen(p);
+			encoded->append(p, len1 + 1 + len2 + 1);
+		}
+		assert(colmeta.type == terark::db::ColumnType::TwoStrZero);
+		break;
+	default:
+		{
+			StringBuilder ss;
+			ss << BOOST_CURRENT_FUNCTION
+			   << ": BSONElement: bad elem.type " << (int)elem.type();
+			std::string msg = ss.str();
+		//	damnbrain(314159266, msg.c_str(), false);
+			throw std::invalid_argument(msg);
+		}
+	}
+}
+
+static void
+encodeSchemaLessField(const Schema* exclude, const BSONElement& elem,
+					  valvec<char>* encoded) {
+	fstring fieldName = elem.fieldName();
+	assert(fieldName.end()[0] == 0);
+	if (exclude) {
+		size_t colid = exclude->m_columnsMeta.find_i(fieldName);
+		if (colid >= exclude->columnNum())
+			return;
+	}
+	encoded->push_back((unsigned char)elem.type());
+	encoded->append(fieldName.data(), fieldName.size()+1);
+	terarkEncodeBsonElemVal(elem, *encoded);
+}
+
+// fast path for the common case: fields of obj are in schema order and
+// no field is missing, field names of schema columns are just compared,
+// just the trailing schema-less fields are hashed for duplicate check,
+// a duplicate fieldname is reported by the slow path
+bool SchemaRecordCoder::encodeInSchemaOrder(const Schema* schema,
+											const Schema* exclude,
+											const BSONObj& obj,
+											size_t schemaColumn,
+											valvec<char>* encoded) {
+	m_orderedElems.resize(0);
+	BSONObjIterator it(obj);
+	for (size_t i = 0; i < schemaColumn; ++i) {
+		if (!it.more())
+			return false;
+		BSONElement elem = it.next();
+		fstring colname = schema->m_columnsMeta.key(i);
+		if (size_t(elem.fieldNameSize()) != colname.size() + 1 ||
+			memcmp(elem.fieldName(), colname.data(), colname.size()) != 0)
+			return false;
+		m_orderedElems.push_back(elem);
+	}
+	if (schemaColumn == schema->columnNum() && it.more()) {
+		return false; // extra fields are reported by the slow path
+	}
+	m_fields.erase_all();
+	while (it.more()) {
+		BSONElement elem = it.next();
+		fstring fieldname = elem.fieldName();
+		if (schema->m_columnsMeta.find_i(fieldname) < schemaColumn ||
+			!m_fields.insert_i(fieldname).second)
+			return false;
+		m_orderedElems.push_back(elem);
+	}
+	const size_t lastColumn = schema->m_columnsMeta.end_i() - 1;
+	for (size_t i = 0; i < schemaColumn; ++i) {
+		const auto& colmeta = schema->m_columnsMeta.val(i);
+		encodeColumn(colmeta, m_orderedElems[i], lastColumn == i, encoded);
+	}
+	for (size_t i = schemaColumn; i < m_orderedElems.size(); ++i) {
+		encodeSchemaLessField(exclude, m_orderedElems[i], encoded);
+	}
+	return true;
+}
+
 // for WritableSegment, param schema is m_rowSchema, param exclude is nullptr
 // for ReadonlySegment, param schema is m_nonIndexSchema,
 //                      param exclude is m_uniqIndexFields
@@ -704,8 +911,7 @@ void SchemaRecordCoder::encode(const Schema* schema, const Schema* exclude,
 							   const BSONObj& obj, valvec<char>* encoded) {
 	assert(nullptr != schema);
 	encoded->resize(0);
-	parseToFields(obj, &m_fields);
-	m_stored.resize_fill(m_fields.end_i(), false);
+	encoded->reserve(obj.objsize());
 
 	// last is $$ field, the schema-less fields
 	size_t schemaColumn
@@ -713,6 +919,12 @@ void SchemaRecordCoder::encode(const Schema* schema, const Schema* exclude,
 		? schema->m_columnsMeta.end_i() - 1
 		: schema->m_columnsMeta.end_i()
 		;
+	if (encodeInSchemaOrder(schema, exclude, obj, schemaColumn, encoded)) {
+		return;
+	}
+	encoded->resize(0);
+	parseToFields(obj, &m_fields);
+	m_stored.resize_fill(m_fields.end_i(), false);
 	for(size_t i = 0; i < schemaColumn; ++i) {
 		fstring     colname = schema->m_columnsMeta.key(i);
 		const auto& colmeta = schema->m_columnsMeta.val(i);
@@ -730,149 +942,7 @@ void SchemaRecordCoder::encode(const Schema* schema, const Schema* exclude,
 		bool isLastField = schema->m_columnsMeta.end_i() - 1 == i;
 		BSONElement elem(m_fields.key(j).data() - 1, colname.size()+1,
 						 BSONElement::FieldNameSizeTag());
-		BSONType elemType = elem.type();
-		const char* value = elem.value();
-		switch (elemType) {
-		case EOO:
-			break;
-		case Undefined:
-		case jstNULL:
-			encodeMissingField(colmeta, encoded);
-			break;
-		case MaxKey:
-			encodeMaxValueField(colmeta, encoded);
-			break;
-		case MinKey:
-			encodeMinValueField(colmeta, encoded);
-			break;
-		case mongo::Bool:
-			encoded->push_back(value[0] ? 1 : 0);
-			assert(colmeta.type == terark::db::ColumnType::Uint08);
-			break;
-		case NumberInt:
-			encodeConvertFrom<int32_t>(colmeta.type, value, encoded, isLastField);
-			break;
-		case NumberDouble:
-			encodeConvertFromDouble(colmeta.type, value, encoded, isLastField);
-			break;
-		case NumberLong:
-			encodeConvertFrom<int64_t>(colmeta.type, value, encoded, isLastField);
-			break;
-		case bsonTimestamp: // low 32 bit is always positive
-			invariant(colmeta.type == ColumnType::Sint64 ||
-					  colmeta.type == ColumnType::Uint64);
-			encoded->append(value, 8);
-			break;
-		case mongo::Date:
-			if (colmeta.type == ColumnType::Uint32 ||
-				colmeta.type == ColumnType::Sint32)
-			{
-				int64_t millisec = ConstDataView(value).read<LittleEndian<int64_t>>();
-				int64_t sec = millisec / 1000;
-				DataView(encoded->grow_no_init(4)).write<LittleEndian<int>>(sec);
-			}
-			else if (colmeta.type == ColumnType::Uint64 ||
-					 colmeta.type == ColumnType::Sint64) {
-				encoded->append(value, 8);
-			}
-			else {
-				invariant(!"mongo::Date must map to one of terark sint32, uint32, sint64, uint64");
-			}
-			break;
-		case jstOID:
-		//	log() << "encode: OID=" << toHexLower(value, OID::kOIDSize);
-			encoded->append(value, OID::kOIDSize);
-			assert(colmeta.type == terark::db::ColumnType::Fixed);
-			assert(colmeta.fixedLen == OID::kOIDSize);
-			break;
-		case Symbol:
-		case Code:
-		case mongo::String:
-		//	log() << "encode: strlen+1=" << elem.valuestrsize() << ", str=" << elem.valuestr();
-			if (colmeta.type == terark::db::ColumnType::StrZero) {
-				encoded->append(value + 4, elem.valuestrsize());
-			}
-			else {
-				encodeConvertString(colmeta.type, value + 4, encoded);
-			}
-			break;
-		case DBRef:
-			assert(0); // deprecated, should not in data
-			encoded->append(value + 4, elem.valuestrsize() + OID::kOIDSize);
-			break;
-		case mongo::Array:
-			assert(colmeta.type == terark::db::ColumnType::CarBin);
-			{
-				size_t oldsize = encoded->size();
-				encoded->resize(oldsize + 4); // reserve for uint32 length
-				terarkEncodeBsonArray(elem.embeddedObject(), *encoded);
-				size_t len = encoded->size() - (oldsize + 4);
-				DataView(encoded->data()+oldsize)
-						.write(LittleEndian<uint32_t>(uint32_t(len)));
-			}
-			break;
-		case Object:
-			assert(colmeta.type == terark::db::ColumnType::CarBin);
-			{
-				size_t oldsize = encoded->size();
-				encoded->resize(oldsize + 4); // reserve for uint32 length
-				terarkEncodeBsonObject(elem.embeddedObject(), *encoded);
-				size_t len = encoded->size() - (oldsize + 4);
-				DataView(encoded->data()+oldsize)
-						.write(LittleEndian<uint32_t>(uint32_t(len)));
-			}
-			break;
-		case CodeWScope:
-			assert(colmeta.type == terark::db::ColumnType::CarBin);
-			{
-				assert(colmeta.type == terark::db::ColumnType::CarBin);
-				size_t oldsize = encoded->size();
-				encoded->resize(oldsize + 8); // reserve for uint32 length + uint32 codelen
-				DataView(encoded->data()+oldsize + 4)
-						.write(LittleEndian<uint32_t>(elem.codeWScopeCodeLen()));
-				encoded->append(elem.codeWScopeCode(), elem.codeWScopeCodeLen());
-				terarkEncodeBsonObject(elem.codeWScopeObject(), *encoded);
-				size_t len = encoded->size() - (oldsize + 4);
-				DataView(encoded->data()+oldsize)
-						.write(LittleEndian<uint32_t>(uint32_t(len)));
-			}
-			encoded->append(value, elem.objsize());
-			break;
-		case BinData:
-			if (colmeta.type == terark::db::ColumnType::CarBin) {
-				uint32_t len = elem.valuestrsize() + 1; // 1 is for subtype byte
-				encoded->resize(encoded->size() + 4);
-				DataView(encoded->end() - 4)
-						.write(LittleEndian<uint32_t>(len));
-				encoded->append(value + 4, 1 + elem.valuestrsize());
-			}
-			else if (colmeta.type == terark::db::ColumnType::StrZero) {
-				BsonBinDataToTerarkStrZero(elem, *encoded, isLastField);
-			}
-			else {
-				invariant(!"mongo bindata must be terark carbin or strzero");
-			}
-			break;
-		case RegEx:
-			{
-				const char* p = value;
-				size_t len1 = strlen(p); // regex len
-				p += len1 + 1;
-				size_t len2 = strlen(p);
-				encoded->append(p, len1 + 1 + len2 + 1);
-			}
-			assert(colmeta.type == terark::db::ColumnType::TwoStrZero);
-			break;
-		default:
-			{
-				StringBuilder ss;
-				ss << BOOST_CURRENT_FUNCTION
-				   << ": BSONElement: bad elem.type " << (int)elem.type();
-				std::string msg = ss.str();
-			//	damnbrain(314159266, msg.c_str(), false);
-				throw std::invalid_argument(msg);
-			}
-		}
+		encodeColumn(colmeta, elem, isLastField, encoded);
 		m_stored.set1(j);
 	}
 
@@ -891,17 +961,7 @@ void SchemaRecordCoder::encode(const Schema* schema, const Schema* exclude,
 	for (auto it = obj.begin(), End = obj.end(); it != End; ++it, ++idx) {
 		if (m_stored.is1(idx))
 			continue;
-		BSONElement elem = *it;
-		fstring fieldName = elem.fieldName();
-		assert(fieldName.end()[0] == 0);
-		if (exclude) {
-			size_t colid = exclude->m_columnsMeta.find_i(fieldName);
-			if (colid >= exclude->columnNum())
-				continue;
-		}
-		encoded->push_back((unsigned char)elem.type());
-		encoded->append(fieldName.data(), fieldName.size()+1);
-		terarkEncodeBsonElemVal(elem, *encoded);
+		encodeSchemaLessField(exclude, *it, encoded);
 	}
 }
 
@@ -1155,6 +1215,188 @@ static void terarkEncodeNull(MyBsonBuilder& bb, ColumnType coltype) {
 }
 */
 
+static void
+decodeColumn(MyBsonBuilder& bb, fstring colname, const ColumnMeta& colmeta,
+			 const char*& pos, const char* end, bool isLast) {
+	bb.writeByte(colmeta.mongoType);
+	bb.ensureWrite(colname.data(), colname.size()+1); // include '\0'
+	switch ((signed char)colmeta.mongoType) {
+	case EOO:
+		invariant(!"terarkDecodeBsonElemVal: encountered EOO");
+		break;
+	case Undefined:
+		LOG(2) << "SchemaRecordCoder::decode: field('" << colname.c_str() << "') = undefined";
+		assert(0);
+		break;
+	case jstNULL:
+		LOG(2) << "SchemaRecordCoder::decode: field('" << colname.c_str() << "') = null";
+		assert(0);
+		break;
+	case MaxKey:
+		LOG(2) << "SchemaRecordCoder::decode: field('" << colname.c_str() << "') = MaxKey";
+		assert(0);
+		break;
+	case MinKey:
+		LOG(2) << "SchemaRecordCoder::decode: field('" << colname.c_str() << "') = MinKey";
+		assert(0);
+		break;
+	case mongo::Bool:
+		assert(colmeta.fixedLen == 1);
+		bb << char(decodeConvertTo<char>(colmeta.type, pos) ? 1 : 0);
+		break;
+	case NumberInt:
+		bb << decodeConvertTo<int>(colmeta.type, pos);
+		break;
+	case bsonTimestamp:
+		invariant(colmeta.type == ColumnType::Sint64 ||
+				  colmeta.type == ColumnType::Uint64);
+		bb.ensureWrite(pos, 8);
+		pos += 8;
+		break;
+	case mongo::Date:
+		switch (colmeta.type) {
+		default:
+			invariant(!"SchemaRecordCoder::decode: mongo::Date must map to one of terark sint32, uint32, sint64, uint64");
+			break;
+		case ColumnType::Sint32:
+		case ColumnType::Uint32:
+			{
+				int64_t ival = ConstDataView(pos).read<LittleEndian<int>>();
+				int64_t millisec = 1000 * ival;
+				bb << millisec;
+				pos += 4;
+			}
+			break;
+		case ColumnType::Sint64:
+		case ColumnType::Uint64:
+			bb.ensureWrite(pos, 8);
+			pos += 8;
+			break;
+		}
+		break;
+	case NumberDouble:
+		bb << decodeConvertTo<double>(colmeta.type, pos);
+		break;
+	case NumberLong:
+		bb << decodeConvertTo<int64_t>(colmeta.type, pos);
+		break;
+	case jstOID:
+		invariant(colmeta.type == ColumnType::Fixed);
+		invariant(colmeta.fixedLen == OID::kOIDSize);
+		bb.ensureWrite(pos, OID::kOIDSize);
+		pos += OID::kOIDSize;
+		break;
+	case Symbol:
+	case Code:
+	case mongo::String:
+		invariant(colmeta.type == ColumnType::StrZero);
+		if (isLast) {
+			size_t len = end - pos;
+			if (terark_unlikely(0 == len)) {
+				bb << int(1);
+				bb.writeByte('\0');
+			}
+			else if ('\0' != end[-1]) {
+				bb << int(len + 1);
+				bb.ensureWrite(pos, len);
+				bb.writeByte('\0');
+			}
+			else {
+				bb << int(len);
+				bb.ensureWrite(pos, len);
+			}
+			pos = end;
+		}
+		else {
+			size_t len = strlen(pos);
+			bb << int(len + 1);
+			bb.ensureWrite(pos, len + 1);
+			pos += len + 1;
+		}
+		break;
+	case DBRef:
+		{
+			size_t len = strlen(pos);
+			bb << int(len + 1);
+			bb.ensureWrite(pos + 4, len + 1 + OID::kOIDSize);
+			pos += len + 1 + OID::kOIDSize;
+		}
+		break;
+	case mongo::Array:
+		{
+			invariant(colmeta.type == ColumnType::CarBin);
+			size_t len = ConstDataView(pos).read<LittleEndian<uint32_t> >();
+			auto   end = pos + len;
+			terarkDecodeBsonArray(bb, pos, end);
+		}
+		break;
+	case Object:
+		{
+			invariant(colmeta.type == ColumnType::CarBin);
+			size_t len = ConstDataView(pos).read<LittleEndian<uint32_t> >();
+			auto   end = pos + len;
+			terarkDecodeBsonObject(bb, pos, end);
+		}
+		break;
+	case CodeWScope:
+		{
+			invariant(colmeta.type == ColumnType::CarBin);
+			int binlen = ConstDataView(pos).read<LittleEndian<int>>();
+			size_t oldpos = bb.tell();
+			bb << uint32_t(0); // reserve for whole len
+			int codelen = ConstDataView(pos+4).read<LittleEndian<int>>();
+			bb << uint32_t(codelen);
+			bb.ensureWrite(pos + 8, codelen);
+			auto end = pos + binlen;
+			pos += 8 + codelen;
+			terarkDecodeBsonObject(bb, pos, end);
+			uint32_t wholeLen = uint32_t(bb.tell() - oldpos);
+			DataView((char*)bb.buf() + oldpos).write<LittleEndian<uint32_t> >(wholeLen);
+		}
+		break;
+	case BinData:
+		if (colmeta.type == ColumnType::CarBin) {
+			int len = ConstDataView(pos).read<LittleEndian<int>>();
+			bb << len - 1; // pos[4] is binary data subtype
+			bb.ensureWrite(pos + 4, len);
+			pos += 4 + len;
+		}
+		else if (colmeta.type == ColumnType::StrZero) {
+			TerarkStrZeroToBsonBinData(bb, pos, end, isLast);
+		}
+		else {
+			invariant(!"mongo bindata must be terark carbin or strzero");
+		}
+		break;
+	case RegEx:
+		invariant(colmeta.type == ColumnType::TwoStrZero);
+		if (isLast && '\0' != end[-1]) {
+			size_t len1 = strlen(pos); // regex len
+			size_t len2 = end - (pos + len1 + 1);
+			bb.ensureWrite(pos, len1 + 1 + len2);
+			bb.writeByte('\0');
+			pos = end;
+		} else {
+			size_t len1 = strlen(pos); // regex len
+			size_t len2 = strlen(pos + len1 + 1);
+			size_t len3 = len1 + len2 + 2;
+			bb.ensureWrite(pos, len3);
+			pos += len3;
+		}
+		break;
+	default:
+		{
+			StringBuilder ss;
+			ss << "SchemaRecordCoder::decode(): field('"
+			   << colname.c_str()
+			   << "') = bad subkey.type " << (int)colmeta.mongoType;
+			std::string msg = ss.str();
+//				damnbrain(314159268, msg.c_str(), false);
+			throw std::invalid_argument(msg);
+		}
+	}
+}
+
 SharedBuffer
 SchemaRecordCoder::decode(const Schema* schema, const char* data, size_t size) {
 	assert(nullptr != schema);
@@ -1181,183 +1423,7 @@ SchemaRecordCoder::decode(const Schema* schema, const char* data, size_t size) {
 	for (size_t i = 0; i < schemaColumn; ++i) {
 		fstring     colname = schema->m_columnsMeta.key(i);
 		const auto& colmeta = schema->m_columnsMeta.val(i);
-		bb.writeByte(colmeta.mongoType);
-		bb.ensureWrite(colname.data(), colname.size()+1); // include '\0'
-		switch ((signed char)colmeta.mongoType) {
-		case EOO:
-			invariant(!"terarkDecodeBsonElemVal: encountered EOO");
-			break;
-		case Undefined:
-			LOG(2) << "SchemaRecordCoder::decode: field('" << colname.c_str() << "') = undefined";
-			assert(0);
-			break;
-		case jstNULL:
-			LOG(2) << "SchemaRecordCoder::decode: field('" << colname.c_str() << "') = null";
-			assert(0);
-			break;
-		case MaxKey:
-			LOG(2) << "SchemaRecordCoder::decode: field('" << colname.c_str() << "') = MaxKey";
-			assert(0);
-			break;
-		case MinKey:
-			LOG(2) << "SchemaRecordCoder::decode: field('" << colname.c_str() << "') = MinKey";
-			assert(0);
-			break;
-		case mongo::Bool:
-			assert(colmeta.fixedLen == 1);
-			bb << char(decodeConvertTo<char>(colmeta.type, pos) ? 1 : 0);
-			break;
-		case NumberInt:
-			bb << decodeConvertTo<int>(colmeta.type, pos);
-			break;
-		case bsonTimestamp:
-			invariant(colmeta.type == ColumnType::Sint64 ||
-					  colmeta.type == ColumnType::Uint64);
-			bb.ensureWrite(pos, 8);
-			pos += 8;
-			break;
-		case mongo::Date:
-			switch (colmeta.type) {
-			default:
-				invariant(!"SchemaRecordCoder::decode: mongo::Date must map to one of terark sint32, uint32, sint64, uint64");
-				break;
-			case ColumnType::Sint32:
-			case ColumnType::Uint32:
-				{
-					int64_t ival = ConstDataView(pos).read<LittleEndian<int>>();
-					int64_t millisec = 1000 * ival;
-					bb << millisec;
-					pos += 4;
-				}
-				break;
-			case ColumnType::Sint64:
-			case ColumnType::Uint64:
-				bb.ensureWrite(pos, 8);
-				pos += 8;
-				break;
-			}
-			break;
-		case NumberDouble:
-			bb << decodeConvertTo<double>(colmeta.type, pos);
-			break;
-		case NumberLong:
-			bb << decodeConvertTo<int64_t>(colmeta.type, pos);
-			break;
-		case jstOID:
-			invariant(colmeta.type == ColumnType::Fixed);
-			invariant(colmeta.fixedLen == OID::kOIDSize);
-			bb.ensureWrite(pos, OID::kOIDSize);
-			pos += OID::kOIDSize;
-			break;
-		case Symbol:
-		case Code:
-		case mongo::String:
-			invariant(colmeta.type == ColumnType::StrZero);
-			if (colnum-1 == i) {
-				size_t len = end - pos;
-				if (terark_unlikely(0 == len)) {
-					bb << int(1);
-					bb.writeByte('\0');
-				}
-				else if ('\0' != end[-1]) {
-					bb << int(len + 1);
-					bb.ensureWrite(pos, len);
-					bb.writeByte('\0');
-				}
-				else {
-					bb << int(len);
-					bb.ensureWrite(pos, len);
-				}
-				pos = end;
-			}
-			else {
-				size_t len = strlen(pos);
-				bb << int(len + 1);
-				bb.ensureWrite(pos, len + 1);
-				pos += len + 1;
-			}
-			break;
-		case DBRef:
-			{
-				size_t len = strlen(pos);
-				bb << int(len + 1);
-				bb.ensureWrite(pos + 4, len + 1 + OID::kOIDSize);
-				pos += len + 1 + OID::kOIDSize;
-			}
-			break;
-		case mongo::Array:
-			{
-				invariant(colmeta.type == ColumnType::CarBin);
-				size_t len = ConstDataView(pos).read<LittleEndian<uint32_t> >();
-				auto   end = pos + len;
-				terarkDecodeBsonArray(bb, pos, end);
-			}
-			break;
-		case Object:
-			{
-				invariant(colmeta.type == ColumnType::CarBin);
-				size_t len = ConstDataView(pos).read<LittleEndian<uint32_t> >();
-				auto   end = pos + len;
-				terarkDecodeBsonObject(bb, pos, end);
-			}
-			break;
-		case CodeWScope:
-			{
-				invariant(colmeta.type == ColumnType::CarBin);
-				int binlen = ConstDataView(pos).read<LittleEndian<int>>();
-				size_t oldpos = bb.tell();
-				bb << uint32_t(0); // reserve for whole len
-				int codelen = ConstDataView(pos+4).read<LittleEndian<int>>();
-				bb << uint32_t(codelen);
-				bb.ensureWrite(pos + 8, codelen);
-				auto end = pos + binlen;
-				pos += 8 + codelen;
-				terarkDecodeBsonObject(bb, pos, end);
-				uint32_t wholeLen = uint32_t(bb.tell() - oldpos);
-				DataView((char*)bb.buf() + oldpos).write<LittleEndian<uint32_t> >(wholeLen);
-			}
-			break;
-		case BinData:
-			if (colmeta.type == ColumnType::CarBin) {
-				int len = ConstDataView(pos).read<LittleEndian<int>>();
-				bb << len - 1; // pos[4] is binary data subtype
-				bb.ensureWrite(pos + 4, len);
-				pos += 4 + len;
-			}
-			else if (colmeta.type == ColumnType::StrZero) {
-				TerarkStrZeroToBsonBinData(bb, pos, end, colnum-1 == i);
-			}
-			else {
-				invariant(!"mongo bindata must be terark carbin or strzero");
-			}
-			break;
-		case RegEx:
-			invariant(colmeta.type == ColumnType::TwoStrZero);
-			if (colnum-1 == i && '\0' != end[-1]) {
-				size_t len1 = strlen(pos); // regex len
-				size_t len2 = end - (pos + len1 + 1);
-				bb.ensureWrite(pos, len1 + 1 + len2);
-				bb.writeByte('\0');
-				pos = end;
-			} else {
-				size_t len1 = strlen(pos); // regex len
-				size_t len2 = strlen(pos + len1 + 1);
-				size_t len3 = len1 + len2 + 2;
-				bb.ensureWrite(pos, len3);
-				pos += len3;
-			}
-			break;
-		default:
-			{
-				StringBuilder ss;
-				ss << "SchemaRecordCoder::decode(): field('"
-				   << colname.c_str()
-				   << "') = bad subkey.type " << (int)colmeta.mongoType;
-				std::string msg = ss.str();
-//				damnbrain(314159268, msg.c_str(), false);
-				throw std::invalid_argument(msg);
-			}
-		}
+		decodeColumn(bb, colname, colmeta, pos, end, colnum-1 == i);
 	}
 	if (pos < end) {
 		while (pos < end) {
@@ -1407,6 +1473,103 @@ SchemaRecordCoder::decode(const Schema* schema, terark::fstring encoded) {
 	return decode(schema, encoded.data(), encoded.size());
 }
 
+RecordProjection::RecordProjection(const Schema& rowSchema, const BSONObj& projection) {
+	m_isValid = false;
+	m_needSchemaLess = false;
+	bool hasId = true;
+	BSONForEach(elem, projection) {
+		if (!elem.isNumber() && !elem.isBoolean()) {
+			return; // $slice, $elemMatch, $meta...
+		}
+		StringData field = elem.fieldNameStringData();
+		if (field == "_id") {
+			hasId = elem.trueValue();
+			continue;
+		}
+		if (!elem.trueValue()) {
+			return; // exclusion projection
+		}
+		size_t dot = field.find('.');
+		if (std::string::npos != dot) {
+			field = field.substr(0, dot);
+		}
+		addField(rowSchema, field);
+	}
+	if (hasId) {
+		addField(rowSchema, "_id");
+	}
+	std::sort(m_colsId.begin(), m_colsId.end());
+	m_colsId.trim(std::unique(m_colsId.begin(), m_colsId.end()));
+	if (m_needSchemaLess) {
+		m_colsId.push_back(rowSchema.m_columnsMeta.end_i() - 1);
+	}
+	m_isValid = true;
+}
+
+void RecordProjection::addField(const Schema& rowSchema, StringData field) {
+	fstring name(field.rawData(), field.size());
+	size_t colnum = rowSchema.m_columnsMeta.end_i();
+	bool hasSchemaLess = colnum > 0
+		&& rowSchema.m_columnsMeta.end_key(1) == G_schemaLessFieldName;
+	size_t f = rowSchema.m_columnsMeta.find_i(name);
+	if (f < colnum && !(hasSchemaLess && colnum-1 == f)) {
+		m_colsId.push_back(f);
+	}
+	else if (hasSchemaLess) {
+		m_schemaLessFields.insert_i(name);
+		m_needSchemaLess = true;
+	}
+	// else no record has this field
+}
+
+SharedBuffer
+SchemaRecordCoder::decodeProjected(const Schema* rowSchema,
+								   const RecordProjection& proj,
+								   fstring colsData) {
+	assert(nullptr != rowSchema);
+	assert(proj.isValid());
+	MyBsonBuilder bb;
+	bb.resize(4 + 2 * colsData.size());
+	bb.skip(4); // object size
+	const char* pos = colsData.data();
+	const char* end = colsData.data() + colsData.size();
+	size_t projnum = proj.m_colsId.size();
+	for (size_t i = 0; i < projnum; ++i) {
+		size_t      colId   = proj.m_colsId[i];
+		fstring     colname = rowSchema->m_columnsMeta.key(colId);
+		const auto& colmeta = rowSchema->m_columnsMeta.val(colId);
+		if (colname == G_schemaLessFieldName) {
+			assert(projnum-1 == i);
+			break;
+		}
+		decodeColumn(bb, colname, colmeta, pos, end, projnum-1 == i);
+	}
+	// fields of "$$" which are not projected are decoded then dropped,
+	// there is no way to skip a value without decoding it
+	while (pos < end) {
+		size_t oldpos = bb.tell();
+		const int type = (unsigned char)(*pos++);
+		bb << char(type);
+		assert(EOO != type);
+		StringData fieldname = pos;
+		bb.ensureWrite(fieldname.begin(), fieldname.size()+1);
+		pos += fieldname.size() + 1;
+		terarkDecodeBsonElemVal(bb, pos, end, type);
+		fstring name(fieldname.rawData(), fieldname.size());
+		if (proj.m_schemaLessFields.find_i(name) == proj.m_schemaLessFields.end_i()) {
+			bb.seek(oldpos);
+		}
+	}
+	invariant(pos == end);
+	bb << char(EOO); // End of object
+
+	int bsonSize = int(bb.tell());
+	DataView((char*)bb.buf()).write<LittleEndian<int>>(bsonSize);
+	SharedBuffer sb = SharedBuffer::allocate(bsonSize);
+	memcpy(sb.get(), bb.begin(), bsonSize);
+	return sb;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////
@@ -9,6 +9,7 @@
 #include <mongo/bson/bsonobj.h>
 #include <terark/valvec.hpp>
 #include <terark/fstring.hpp>
+#include <terark/hash_strmap.hpp>
 #include <terark/db/db_conf.hpp>
 #include <terark/db/db_segment.hpp>
 
@@ -21,12 +22,32 @@ using terark::db::SchemaSetPtr;
 
 extern const char G_schemaLessFieldName[];
 
+// Row schema columns needed by an inclusion projection such as
+// {a:1, "b.c":1}, only the top level field names are used, so the
+// decoded record is a superset of the projection result.
+// Exclusion and operator projections are not supported, isValid()
+// is false for them and the whole record should be decoded.
+class RecordProjection {
+public:
+	RecordProjection(const Schema& rowSchema, const BSONObj& projection);
+	bool isValid() const { return m_isValid; }
+
+	terark::valvec<size_t> m_colsId; // in schema order, "$$" is the last
+	terark::hash_strmap<>  m_schemaLessFields; // needed fields in "$$"
+
+private:
+	void addField(const Schema& rowSchema, StringData field);
+	bool m_isValid;
+	bool m_needSchemaLess;
+};
+
 class SchemaRecordCoder {
 public:
 	terark::febitvec m_stored;
 	typedef terark::gold_hash_set<terark::fstring,
 		terark::fstring_func::hash, terark::fstring_func::equal> FieldsMap;
 	FieldsMap m_fields;
+	std::vector<BSONElement> m_orderedElems; // for encodeInSchemaOrder
 
 	SchemaRecordCoder();
 	~SchemaRecordCoder();
@@ -52,6 +73,16 @@ public:
 	SharedBuffer decode(const Schema* schema, const terark::valvec<char>& encoded);
 	SharedBuffer decode(const Schema* schema, StringData encoded);
 	SharedBuffer decode(const Schema* schema, terark::fstring encoded);
+
+	// colsData is the result of DbTable::selectColumns(proj.m_colsId)
+	SharedBuffer decodeProjected(const Schema* rowSchema,
+								 const RecordProjection& proj,
+								 terark::fstring colsData);
+
+private:
+	bool encodeInSchemaOrder(const Schema* schema, const Schema* exclude,
+							 const BSONObj& obj, size_t schemaColumn,
+							 terark::valvec<char>* encoded);
 };
 
 void encodeIndexKey(const Schema& indexSchema,
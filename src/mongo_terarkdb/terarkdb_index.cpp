@@ -301,6 +301,7 @@ public:
 		EmptyKey:
             // This means scan to end of index.
             cur->m_endPositionKey.erase_all();
+			cur->m_cursor->clearEndBound();
 			_endPositionInclude = false;
         }
 		else {
@@ -311,6 +312,11 @@ public:
 			}
 			encodeIndexKey(*_idx.getIndexSchema(), key, &cur->m_endPositionKey);
 			_endPositionInclude = inclusive;
+			// segments past the end are pruned by the index iter,
+			// atOrPastEndPointAfterSeeking is still needed when the end
+			// position is changed after the iter is positioned
+			cur->m_cursor->setEndBound(cur->m_endPositionKey, inclusive,
+									   *_idx.getIndexSchema());
 	        TRACE_CURSOR << "setEndPosition: _endPositionKey="
 						 << _idx.getIndexSchema()->toJsonStr(cur->m_endPositionKey);
 		}
@@ -556,6 +562,10 @@ public:
 	}
 
     Status addKey(const BSONObj& newKey, const RecordId& id) override {
+        if (_idx->getIndexSchema()->m_keepColumnStored) {
+            // added by DbTable::addIndex, keys have been built
+            return Status::OK();
+        }
         {
             const Status s = checkKeySize(newKey);
             if (!s.isOK())
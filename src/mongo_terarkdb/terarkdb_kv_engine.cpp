@@ -61,9 +61,11 @@
 #include "terarkdb_record_store.h"
 #include "terarkdb_record_store_capped.h"
 #include "terarkdb_recovery_unit.h"
+#include "terarkdb_schema_inference.h"
 #include "terarkdb_size_storer.h"
 #include "mongo/db/storage/storage_options.h"
 #include "mongo/util/log.h"
+#include "mongo/json.h"
 #include "mongo/util/background.h"
 #include "mongo/util/exit.h"
 #include "mongo/util/processinfo.h"
@@ -91,7 +93,26 @@ TableThreadData::TableThreadData(DbTable* tab) {
 }
 
 ThreadSafeTable::ThreadSafeTable(const fs::path& dbPath) {
-	m_tab = DbTable::open(dbPath);
+	terark::db::ConvRowObserverFactory observerFactory;
+	if (!terark::getEnvBool("MongoTerarkDB_DisableSchemaInference") &&
+			SchemaInference::isDynamicCollection(dbPath)) {
+		SchemaInferencePtr inference(new SchemaInference(dbPath));
+		if (terark::getEnvBool("MongoTerarkDB_PromoteInferredSchema")) {
+			try {
+				inference->promote();
+			}
+			catch (const std::exception& ex) {
+				log() << "ThreadSafeTable: promote inferred schema failed: "
+					  << dbPath.string() << ", error: " << ex.what();
+			}
+		}
+		observerFactory = [inference](const Schema& rowSchema) {
+			return inference->createObserver(&rowSchema);
+		};
+	}
+	// set the factory before open, segments left by last run are
+	// converted in background on open
+	m_tab = DbTable::open(dbPath, observerFactory);
 	m_indexForwardIterCache.resize(m_tab->getIndexNum());
 	m_indexBackwardIterCache.resize(m_tab->getIndexNum());
 }
@@ -153,6 +174,8 @@ IndexIterDataPtr ThreadSafeTable::allocIndexIter(size_t indexId, bool forward) {
 void ThreadSafeTable::releaseIndexIter(size_t indexId, bool forward, IndexIterDataPtr iter) {
 	assert(indexId < m_indexForwardIterCache.size());
 	assert(m_indexForwardIterCache.size() == m_indexBackwardIterCache.size());
+	iter->m_endPositionKey.erase_all();
+	iter->m_cursor->clearEndBound();
 	std::unique_lock<std::mutex> lock(m_cursorCacheMutex);
 	if (forward) {
 		m_indexForwardIterCache[indexId].push_back(std::move(iter));
@@ -288,6 +311,17 @@ void TerarkDbKVEngine::cleanShutdown() {
 //	std::this_thread::sleep_for(std::chrono::milliseconds(200));
 }
 
+void TerarkDbKVEngine::appendTableStats(BSONObjBuilder& bob) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (size_t i = 0; i < m_tables.end_i(); ++i) {
+		if (m_tables.is_deleted(i))
+			continue;
+		const fstring    key = m_tables.key(i);
+		ThreadSafeTable* tab = m_tables.val(i).get();
+		bob.append(key.str(), fromjson(tab->m_tab->getStatsJson()));
+	}
+}
+
 void TerarkDbKVEngine::setJournalListener(JournalListener* jl) {
 	m_wtEngine->setJournalListener(jl);
 }
@@ -385,6 +419,22 @@ void TerarkDbKVEngine::setSortedDataInterfaceExtraOptions(const std::string& opt
     _indexOptions = options;
 }
 
+// capped collections created with a TerarkDB schema and without max docs
+// are TerarkDbRecordStore, oldest records are dropped by whole segments,
+// other capped collections are kept in wiredtiger
+static bool isTerarkDbCapped(const CollectionOptions& options) {
+	if (options.cappedMaxDocs > 0) {
+		return false;
+	}
+	BSONElement dbmetaElem = options.storageEngine[kTerarkDbEngineName];
+	return !dbmetaElem.eoo() && !dbmetaElem.Obj().getField("RowSchema").eoo();
+}
+
+static bool isTerarkDbStore(const IndexDescriptor* desc) {
+	const RecordStore* rs = desc->getCollection()->getRecordStore();
+	return dynamic_cast<const TerarkDbRecordStore*>(rs) != NULL;
+}
+
 Status
 TerarkDbKVEngine::createRecordStore(OperationContext* opCtx,
 								  StringData ns,
@@ -396,7 +446,7 @@ TerarkDbKVEngine::createRecordStore(OperationContext* opCtx,
 	if (NamespaceString(ns).isOnInternalDb()) {
 		return m_wtEngine->createRecordStore(opCtx, ns, ident, options);
 	}
-    if (options.capped) {
+    if (options.capped && !isTerarkDbCapped(options)) {
 		// now don't use TerarkDbRecordStoreCapped
 		// use TerarkDbRecordStoreCapped when we need hook some virtual functions
 		return m_wtEngine->createRecordStore(opCtx, ns, ident, options);
@@ -493,7 +543,7 @@ TerarkDbKVEngine::getRecordStore(OperationContext* opCtx,
 	if (NamespaceString(ns).isOnInternalDb()) {
 		return m_wtEngine->getRecordStore(opCtx, ns, ident, options);
 	}
-    if (options.capped) {
+    if (options.capped && !isTerarkDbCapped(options)) {
 		// now don't use TerarkDbRecordStoreCapped
 		// use TerarkDbRecordStoreCapped when we need hook some virtual functions
 		// const bool ephemeral = false;
@@ -504,7 +554,11 @@ TerarkDbKVEngine::getRecordStore(OperationContext* opCtx,
 	if (NULL == tab) {
 		return NULL;
 	}
-    return new TerarkDbRecordStore(opCtx, ns, ident, tab, NULL);
+	int64_t cappedMaxSize = -1;
+	if (options.capped) {
+		cappedMaxSize = options.cappedSize ? options.cappedSize : 4096;
+	}
+    return new TerarkDbRecordStore(opCtx, ns, ident, tab, NULL, cappedMaxSize);
 }
 
 static std::string getIndexKeyPattern(const BSONObj& kp) {
@@ -524,7 +578,7 @@ TerarkDbKVEngine::createSortedDataInterface(OperationContext* opCtx,
 	if (desc->getCollection()->ns().isOnInternalDb()) {
 		return m_wtEngine->createSortedDataInterface(opCtx, ident, desc);
 	}
-    if (desc->getCollection()->isCapped()) {
+    if (desc->getCollection()->isCapped() && !isTerarkDbStore(desc)) {
 		// now don't use TerarkDbRecordStoreCapped
 		// use TerarkDbRecordStoreCapped when we need hook some virtual functions
 		// const bool ephemeral = false;
@@ -565,6 +619,17 @@ TerarkDbKVEngine::createSortedDataInterface(OperationContext* opCtx,
 		if (indexId < tab->getIndexNum()) {
 			return Status::OK();
 		}
+		if (!desc->unique() && terark::getEnvBool("MongoTerarkDB_OnlineCreateIndex")) {
+			// index of existing segments are built from their colgroups,
+			// BulkBuilder will not insert keys of existing records
+			try {
+				tab->addIndex(BSON("fields" << strkp).jsonString());
+			}
+			catch (const std::exception& ex) {
+				return Status(ErrorCodes::InternalError, ex.what());
+			}
+			return Status::OK();
+		}
 		if (terark::getEnvBool("MongoTerarkDB_DynamicCreateIndex")) {
 			// forward dynamic index to wiredtiger
 			return m_wtEngine->createSortedDataInterface(opCtx, ident, desc);
@@ -582,7 +647,7 @@ TerarkDbKVEngine::getSortedDataInterface(OperationContext* opCtx,
 	if (desc->getCollection()->ns().isOnInternalDb()) {
 		return m_wtEngine->getSortedDataInterface(opCtx, ident, desc);
 	}
-    if (desc->getCollection()->isCapped()) {
+    if (desc->getCollection()->isCapped() && !isTerarkDbStore(desc)) {
 		// now don't use TerarkDbRecordStoreCapped
 		// use TerarkDbRecordStoreCapped when we need hook some virtual functions
 		// const bool ephemeral = false;
@@ -49,6 +49,7 @@
 
 namespace mongo {
 	class KVCatalog; // fuckMongoKVCatalog
+	class BSONObjBuilder;
 }
 
 namespace mongo { namespace terarkdb {
@@ -126,6 +127,9 @@ public:
     // held by this class
     int reconfigure(const char* str);
 
+    // append DbTable statistics of all opened tables, for serverStatus
+    void appendTableStats(BSONObjBuilder& bob) const;
+
 	const KVCatalog* m_fuckKVCatalog;
 
 private:
@@ -42,6 +42,7 @@
 #include "mongo/bson/util/builder.h"
 #include "mongo/db/concurrency/locker.h"
 #include "mongo/db/concurrency/write_conflict_exception.h"
+#include "mongo/db/curop.h"
 #include "mongo/db/namespace_string.h"
 #include "mongo/db/operation_context.h"
 #include "mongo/db/service_context.h"
@@ -49,7 +50,7 @@
 #include "terarkdb_customization_hooks.h"
 #include "terarkdb_global_options.h"
 //#include "terarkdb_kv_engine.h"
-//#include "terarkdb_record_store_oplog_stones.h"
+#include "terarkdb_record_store_oplog_stones.h"
 //#include "terarkdb_recovery_unit.h"
 //#include "terarkdb_session_cache.h"
 #include "terarkdb_size_storer.h"
@@ -62,6 +63,7 @@
 #include "mongo/util/scopeguard.h"
 #include "mongo/util/time_support.h"
 #include <boost/none.hpp>
+#include <set>
 
 //#define RS_ITERATOR_TRACE(x) log() << "TerarkDbRS::Iterator " << x
 #define RS_ITERATOR_TRACE(x)
@@ -87,14 +89,27 @@ static_assert(kCurrentRecordStoreVersion <= kMaximumRecordStoreVersion,
 
 class TerarkDbRecordStore::Cursor final : public SeekableRecordCursor {
 public:
-    Cursor(OperationContext* txn, const TerarkDbRecordStore& rs, bool forward)
+    Cursor(OperationContext* txn, const TerarkDbRecordStore& rs, bool forward,
+		   const BSONObj& projection = BSONObj())
         : _rs(rs),
           _txn(txn), _forward(forward) {
 		ThreadSafeTable* tst = rs.m_table.get();
 		DbTable* tab = tst->m_tab.get();
     	m_ttd = tst->allocTableThreadData();
-    	if (forward)
+		if (!projection.isEmpty()) {
+			m_proj.reset(new RecordProjection(tab->rowSchema(), projection));
+			if (!m_proj->isValid()) {
+				LOG(1) << "TerarkDbRecordStore::Cursor: unsupported projection "
+					   << projection << ", decode whole records";
+				m_proj.reset();
+			}
+		}
+    	if (forward) {
+			// collection scans are sequential, let segments read ahead
+			if (0 == m_ttd->m_dbCtx->scanReadAheadRows)
+				m_ttd->m_dbCtx->scanReadAheadRows = 1024;
     		_cursor = tab->createStoreIterForward(m_ttd->m_dbCtx.get());
+		}
     	else
     		_cursor = tab->createStoreIterBackward(m_ttd->m_dbCtx.get());
     }
@@ -107,6 +122,8 @@ public:
     boost::optional<Record> next() final {
         if (_eof)
             return {};
+		if (m_proj)
+			return nextProjected();
 
         llong recIdx = _lastReturnedId.repr() - 1;
         if (!_skipNextAdvance) {
@@ -161,6 +178,16 @@ public:
 			return boost::none;
 		}
 		auto& ttd = *m_ttd;
+		if (m_proj) {
+			SharedBuffer sbuf;
+			if (!tab.exists(recIdx) || !decodeProjected(recIdx, &sbuf)) {
+				return boost::none;
+			}
+			int len = ConstDataView(sbuf.get()).read<LittleEndian<int>>();
+			_lastReturnedId = id;
+			_eof = false;
+			return {{id, {sbuf, len}}};
+		}
 	//	ttd.m_dbCtx->getValue(recIdx, &ttd.m_buf);
 		if (!_cursor->seekExact(recIdx, &ttd.m_buf)) {
 			return boost::none;
@@ -208,6 +235,10 @@ public:
             return true;
 
         llong recIdx = _lastReturnedId.repr() - 1;
+		if (m_proj) {
+			// deleted records are skipped by the next nextProjected()
+			return true;
+		}
         if (!_cursor->seekExact(recIdx, &m_ttd->m_buf)) {
             _eof = true;
             return false;
@@ -230,6 +261,53 @@ public:
     }
 
 private:
+	// records are located by DbTable::exists and only the projected
+	// columns are read, the store iterator would read whole records
+	boost::optional<Record> nextProjected() {
+		DbTable& tab = *_rs.m_table->m_tab;
+		llong rows = tab.numDataRows();
+		llong recIdx = _lastReturnedId.isNull()
+					 ? (_forward ? -1 : rows)
+					 : _lastReturnedId.repr() - 1;
+		SharedBuffer sbuf;
+		do {
+			recIdx += _forward ? 1 : -1;
+			if (recIdx < 0 || recIdx >= rows) {
+				_eof = true;
+				return {};
+			}
+		} while (!tab.exists(recIdx) || !decodeProjected(recIdx, &sbuf));
+		const RecordId id(recIdx + 1);
+		int len = ConstDataView(sbuf.get()).read<LittleEndian<int>>();
+		_lastReturnedId = id;
+		return {{id, {sbuf, len}}};
+	}
+
+	// returns false if the record is deleted after DbTable::exists
+	bool decodeProjected(llong recIdx, SharedBuffer* sbuf) {
+		DbTable& tab = *_rs.m_table->m_tab;
+		auto& ttd = *m_ttd;
+		if (m_proj->m_colsId.empty()) {
+			ttd.m_buf.erase_all();
+		} else {
+			try {
+				ttd.m_dbCtx->selectColumns(recIdx, m_proj->m_colsId, &ttd.m_buf);
+			}
+			catch (const terark::db::ReadRecordException&) {
+				if (tab.exists(recIdx))
+					throw;
+				return false;
+			}
+			catch (const std::out_of_range&) {
+				if (tab.exists(recIdx))
+					throw;
+				return false; // dropped by capped truncation
+			}
+		}
+		*sbuf = ttd.m_coder.decodeProjected(&tab.rowSchema(), *m_proj, ttd.m_buf);
+		return true;
+	}
+
     const TerarkDbRecordStore& _rs;
     OperationContext* _txn;
     bool _skipNextAdvance = false;
@@ -237,6 +315,7 @@ private:
 	const bool _forward;
 	TableThreadDataPtr m_ttd;
     terark::db::StoreIteratorPtr _cursor;
+	std::unique_ptr<RecordProjection> m_proj;
     RecordId _lastReturnedId;  // If null, need to seek to first/last record.
 };
 
@@ -259,20 +338,246 @@ StatusWith<std::string> parseOptionsField(const BSONObj options) {
     return StatusWith<std::string>(ss.str());
 }
 
+// Stones are kept as in WiredTigerRecordStore, stones of existing records
+// are calculated from segments, so they are aligned to segment boundaries
+// and can be dropped by DbTable::dropLeadingSegments without any I/O.
+class TerarkDbRecordStore::OplogStones::InsertChange final : public RecoveryUnit::Change {
+public:
+    InsertChange(OplogStones* oplogStones,
+                 int64_t bytesInserted,
+                 RecordId highestInserted,
+                 int64_t countInserted)
+        : _oplogStones(oplogStones),
+          _bytesInserted(bytesInserted),
+          _highestInserted(highestInserted),
+          _countInserted(countInserted) {}
+
+    void commit() final {
+        invariant(_bytesInserted >= 0);
+        invariant(_highestInserted.isNormal());
+        _oplogStones->_currentRecords.addAndFetch(_countInserted);
+        int64_t newCurrentBytes = _oplogStones->_currentBytes.addAndFetch(_bytesInserted);
+        if (newCurrentBytes >= _oplogStones->_minBytesPerStone) {
+            _oplogStones->createNewStoneIfNeeded(_highestInserted);
+        }
+    }
+
+    void rollback() final {}
+
+private:
+    OplogStones* _oplogStones;
+    int64_t _bytesInserted;
+    RecordId _highestInserted;
+    int64_t _countInserted;
+};
+
+class TerarkDbRecordStore::OplogStones::TruncateChange final : public RecoveryUnit::Change {
+public:
+    TruncateChange(OplogStones* oplogStones) : _oplogStones(oplogStones) {}
+
+    void commit() final {
+        _oplogStones->_currentRecords.store(0);
+        _oplogStones->_currentBytes.store(0);
+        stdx::lock_guard<stdx::mutex> lk(_oplogStones->_mutex);
+        _oplogStones->_stones.clear();
+    }
+
+    void rollback() final {}
+
+private:
+    OplogStones* _oplogStones;
+};
+
+TerarkDbRecordStore::OplogStones::OplogStones(OperationContext* txn, TerarkDbRecordStore* rs)
+    : _rs(rs) {
+    invariant(rs->isCapped());
+    invariant(rs->cappedMaxSize() > 0);
+    unsigned long long maxSize = rs->cappedMaxSize();
+
+    const unsigned long long kMinStonesToKeep = 10ULL;
+    const unsigned long long kMaxStonesToKeep = 100ULL;
+
+    unsigned long long numStones = maxSize / BSONObjMaxInternalSize;
+    _numStonesToKeep = std::min(kMaxStonesToKeep, std::max(kMinStonesToKeep, numStones));
+    _minBytesPerStone = maxSize / _numStonesToKeep;
+    invariant(_minBytesPerStone > 0);
+
+    _calculateStones(txn);
+    _pokeReclaimThreadIfNeeded();  // Reclaim stones if over the limit.
+}
+
+bool TerarkDbRecordStore::OplogStones::isDead() {
+    stdx::lock_guard<stdx::mutex> lk(_oplogReclaimMutex);
+    return _isDead;
+}
+
+void TerarkDbRecordStore::OplogStones::kill() {
+    stdx::lock_guard<stdx::mutex> lk(_oplogReclaimMutex);
+    _isDead = true;
+    _oplogReclaimCv.notify_one();
+}
+
+void TerarkDbRecordStore::OplogStones::awaitHasExcessStonesOrDead() {
+    // Wait until kill() is called or there are too many oplog stones.
+    stdx::unique_lock<stdx::mutex> lock(_oplogReclaimMutex);
+    while (!_isDead) {
+        {
+            stdx::lock_guard<stdx::mutex> lk(_mutex);
+            if (hasExcessStones()) {
+                break;
+            }
+        }
+        _oplogReclaimCv.wait(lock);
+    }
+}
+
+boost::optional<TerarkDbRecordStore::OplogStones::Stone>
+TerarkDbRecordStore::OplogStones::peekOldestStoneIfNeeded() const {
+    stdx::lock_guard<stdx::mutex> lk(_mutex);
+    if (!hasExcessStones()) {
+        return {};
+    }
+    return _stones.front();
+}
+
+void TerarkDbRecordStore::OplogStones::popOldestStone() {
+    stdx::lock_guard<stdx::mutex> lk(_mutex);
+    _stones.pop_front();
+}
+
+void TerarkDbRecordStore::OplogStones::createNewStoneIfNeeded(RecordId lastRecord) {
+    stdx::unique_lock<stdx::mutex> lk(_mutex, stdx::try_to_lock);
+    if (!lk) {
+        // Someone else is either already creating a new stone or popping the oldest one. In the
+        // latter case, we let the next insert trigger the new stone's creation.
+        return;
+    }
+    if (_currentBytes.load() < _minBytesPerStone) {
+        // Must have raced to create a new stone, someone else already triggered it.
+        return;
+    }
+    if (!_stones.empty() && lastRecord < _stones.back().lastRecord) {
+        // Skip creating a new stone when the record's position comes before the most recently
+        // created stone. We likely raced with another batch of inserts that caused us to try and
+        // make multiple stones.
+        return;
+    }
+    OplogStones::Stone stone = {_currentRecords.swap(0), _currentBytes.swap(0), lastRecord};
+    _stones.push_back(stone);
+    _pokeReclaimThreadIfNeeded();
+}
+
+void TerarkDbRecordStore::OplogStones::updateCurrentStoneAfterInsertOnCommit(
+    OperationContext* txn,
+    int64_t bytesInserted,
+    RecordId highestInserted,
+    int64_t countInserted) {
+    txn->recoveryUnit()->registerChange(
+        new InsertChange(this, bytesInserted, highestInserted, countInserted));
+}
+
+void TerarkDbRecordStore::OplogStones::clearStonesOnCommit(OperationContext* txn) {
+    txn->recoveryUnit()->registerChange(new TruncateChange(this));
+}
+
+void TerarkDbRecordStore::OplogStones::updateStonesAfterCappedTruncateAfter(
+    int64_t recordsRemoved, int64_t bytesRemoved, RecordId firstRemovedId) {
+    stdx::lock_guard<stdx::mutex> lk(_mutex);
+    int64_t numStonesToRemove = 0;
+    int64_t recordsInStonesToRemove = 0;
+    int64_t bytesInStonesToRemove = 0;
+    // Compute the number and associated sizes of the records from stones that are either fully or
+    // partially truncated.
+    for (auto it = _stones.rbegin(); it != _stones.rend(); ++it) {
+        if (it->lastRecord < firstRemovedId) {
+            break;
+        }
+        numStonesToRemove++;
+        recordsInStonesToRemove += it->records;
+        bytesInStonesToRemove += it->bytes;
+    }
+    // Remove the stones corresponding to the records that were deleted.
+    int64_t offset = _stones.size() - numStonesToRemove;
+    _stones.erase(_stones.begin() + offset, _stones.end());
+    // Account for any remaining records from a partially truncated stone in the stone currently
+    // being filled.
+    _currentRecords.addAndFetch(recordsInStonesToRemove - recordsRemoved);
+    _currentBytes.addAndFetch(bytesInStonesToRemove - bytesRemoved);
+}
+
+void TerarkDbRecordStore::OplogStones::setMinBytesPerStone(int64_t size) {
+    invariant(size > 0);
+    stdx::lock_guard<stdx::mutex> lk(_mutex);
+    // Only allow changing the minimum bytes per stone if no data has been inserted.
+    invariant(_stones.size() == 0 && _currentRecords.load() == 0);
+    _minBytesPerStone = size;
+}
+
+void TerarkDbRecordStore::OplogStones::setNumStonesToKeep(size_t numStones) {
+    invariant(numStones > 0);
+    stdx::lock_guard<stdx::mutex> lk(_mutex);
+    // Only allow changing the number of stones to keep if no data has been inserted.
+    invariant(_stones.size() == 0 && _currentRecords.load() == 0);
+    _numStonesToKeep = numStones;
+}
+
+// A stone is closed at the end of a segment once it has _minBytesPerStone,
+// rows of the writing segment are put into the stone being filled, so no
+// record is scanned or sampled
+void TerarkDbRecordStore::OplogStones::_calculateStones(OperationContext* txn) {
+    DbTable* tab = _rs->m_table->m_tab.get();
+    terark::db::SegArrayVersionPtr ver = tab->getSegArrayVersion();
+    log() << "Capped collection " << _rs->ns() << " contains " << tab->existingRows()
+          << " records totaling to " << tab->dataInflateSize() << " bytes";
+    _currentRecords.store(0);
+    _currentBytes.store(0);
+    const size_t segNum = ver->m_segments.size();
+    for (size_t i = 0; i < segNum; ++i) {
+        auto seg = ver->m_segments[i].get();
+        int64_t rows = seg->m_isDel.size() - seg->m_delcnt;
+        _currentRecords.addAndFetch(rows);
+        int64_t bytes = _currentBytes.addAndFetch(seg->dataInflateSize());
+        if (bytes >= _minBytesPerStone && i + 1 < segNum) {
+            // RecordId is recIdx + 1, the last record of segment i has
+            // recIdx m_rowNumVec[i+1] - 1
+            RecordId lastRecord(ver->m_rowNumVec[i + 1]);
+            OplogStones::Stone stone = {_currentRecords.swap(0), _currentBytes.swap(0), lastRecord};
+            _stones.push_back(stone);
+        }
+    }
+    LOG(1) << "Calculated " << _stones.size() << " oplog stones from " << segNum << " segments";
+}
+
+void TerarkDbRecordStore::OplogStones::_pokeReclaimThreadIfNeeded() {
+    if (hasExcessStones()) {
+        _oplogReclaimCv.notify_one();
+    }
+}
+
 TerarkDbRecordStore::TerarkDbRecordStore(OperationContext* ctx,
 									 StringData ns,
 									 StringData ident,
 									 ThreadSafeTable* tab,
-									 TerarkDbSizeStorer* sizeStorer)
+									 TerarkDbSizeStorer* sizeStorer,
+									 int64_t cappedMaxSize)
 		: RecordStore(ns),
 		  m_table(tab),
 		  _ident(ident.toString()),
-		  _shuttingDown(false)
+		  _shuttingDown(false),
+		  _isCapped(cappedMaxSize > 0),
+		  _isOplog(NamespaceString::oplog(ns)),
+		  _cappedMaxSize(cappedMaxSize)
 {
+	if (_isCapped) {
+		_oplogStones = std::make_shared<OplogStones>(ctx, this);
+	}
 }
 
 TerarkDbRecordStore::~TerarkDbRecordStore() {
     _shuttingDown = true;
+	if (_oplogStones) {
+		_oplogStones->kill();
+	}
 	DbTable* tab = m_table->m_tab.get();
 	tab->flush();
     LOG(1) << BOOST_CURRENT_FUNCTION << ": namespace: " << ns() << ", dir: " << tab->getDir().string();
@@ -297,7 +602,7 @@ long long TerarkDbRecordStore::numRecords(OperationContext* txn) const {
 }
 
 bool TerarkDbRecordStore::isCapped() const {
-    return false;
+    return _isCapped;
 }
 
 int64_t TerarkDbRecordStore::storageSize(OperationContext* txn,
@@ -340,11 +645,16 @@ Status TerarkDbRecordStore::insertRecords(OperationContext* txn,
 										bool enforceQuota) {
 	DbTable* tab = m_table->m_tab.get();
     auto& td = m_table->getMyThreadData();
+    int64_t totalBytes = 0;
+    RecordId highestId;
     for (Record& rec : *records) {
     	BSONObj bson(rec.data.data());
     	td.m_coder.encode(&tab->rowSchema(), nullptr, bson, &td.m_buf);
     	rec.id = RecordId(1 + tab->insertRow(td.m_buf, &*td.m_dbCtx));
+    	totalBytes += rec.data.size();
+    	highestId = std::max(highestId, rec.id);
     }
+    _oplogStonesAfterInsert(txn, totalBytes, highestId, records->size());
     return Status::OK();
 }
 
@@ -358,6 +668,7 @@ StatusWith<RecordId> TerarkDbRecordStore::insertRecord(OperationContext* txn,
 	invariant(bson.objsize() == len);
     td.m_coder.encode(&tab->rowSchema(), nullptr, bson, &td.m_buf);
     llong recIdx = tab->insertRow(td.m_buf, &*td.m_dbCtx);
+	_oplogStonesAfterInsert(txn, len, RecordId(recIdx + 1), 1);
 	return {RecordId(recIdx + 1)};
 }
 
@@ -400,6 +711,13 @@ TerarkDbRecordStore::insertRecordsWithDocWriter(OperationContext* txn,
 	if (!batch.commit()) {
 		return Status(ErrorCodes::OperationFailed, "TerarkDbRecordStore::insertRecordsWithDocWriter: terark::db::BatchWriter::commit failed");
 	}
+	if (nDocs) {
+		RecordId highestId;
+		for (size_t i = 0; i < nDocs; i++) {
+			highestId = std::max(highestId, records[i].id);
+		}
+		_oplogStonesAfterInsert(txn, totalSize, highestId, nDocs);
+	}
 
     if (idsOut) {
         for (size_t i = 0; i < nDocs; i++) {
@@ -454,9 +772,97 @@ StatusWith<RecordData> TerarkDbRecordStore::updateWithDamages(
     MONGO_UNREACHABLE;
 }
 
+// Top level fields needed by the find command running in txn: fields of
+// its projection, filter and sort, and _id. Returns an empty object if
+// whole records are needed, such as for other commands, legacy queries
+// and filters using $where or $text.
+static bool addTopLevelField(StringData path, BSONObjBuilder* fields,
+							 std::set<std::string>* added) {
+	std::string name = path.toString();
+	name = name.substr(0, name.find('.'));
+	if (name.empty() || '$' == name[0]) {
+		return false;
+	}
+	if (added->insert(name).second) {
+		fields->append(name, 1);
+	}
+	return true;
+}
+static bool addFilterFields(const BSONObj& filter, BSONObjBuilder* fields,
+							std::set<std::string>* added) {
+	for (const BSONElement& elem : filter) {
+		StringData name = elem.fieldNameStringData();
+		if (name == "$and" || name == "$or" || name == "$nor") {
+			if (elem.type() != Array)
+				return false;
+			for (const BSONElement& sub : elem.Obj()) {
+				if (sub.type() != Object || !addFilterFields(sub.Obj(), fields, added))
+					return false;
+			}
+		}
+		else if (name == "$comment") {
+			continue;
+		}
+		else if (!addTopLevelField(name, fields, added)) {
+			return false;
+		}
+	}
+	return true;
+}
+static BSONObj findCommandFields(OperationContext* txn) {
+	CurOp* curOp = txn ? CurOp::get(txn) : nullptr;
+	if (!curOp || !curOp->isCommand()) {
+		return BSONObj();
+	}
+	const BSONObj& cmd = curOp->query();
+	if (cmd.firstElementFieldName() != StringData("find")) {
+		return BSONObj();
+	}
+	BSONElement proj = cmd["projection"];
+	if (proj.type() != Object || proj.Obj().isEmpty()) {
+		return BSONObj();
+	}
+	BSONObjBuilder fields;
+	std::set<std::string> added;
+	addTopLevelField("_id", &fields, &added);
+	for (const BSONElement& elem : proj.Obj()) {
+		if (elem.fieldNameStringData() == "_id") {
+			continue;
+		}
+		// exclusion and operator projections need whole records
+		if (!(elem.isNumber() || elem.isBoolean()) || !elem.trueValue() ||
+			!addTopLevelField(elem.fieldNameStringData(), &fields, &added))
+			return BSONObj();
+	}
+	BSONElement filter = cmd["filter"];
+	if (!filter.eoo() && (filter.type() != Object ||
+			!addFilterFields(filter.Obj(), &fields, &added)))
+		return BSONObj();
+	BSONElement sort = cmd["sort"];
+	if (!sort.eoo()) {
+		if (sort.type() != Object)
+			return BSONObj();
+		for (const BSONElement& elem : sort.Obj()) {
+			if (elem.fieldNameStringData() == "$natural")
+				continue;
+			if (!elem.isNumber() ||
+				!addTopLevelField(elem.fieldNameStringData(), &fields, &added))
+				return BSONObj(); // {$meta: "textScore"}
+		}
+	}
+	return fields.obj();
+}
+
+// cursors of a find command with an inclusion projection are projected
 std::unique_ptr<SeekableRecordCursor> TerarkDbRecordStore::getCursor(OperationContext* txn,
                                                                        bool forward) const {
-    return stdx::make_unique<Cursor>(txn, *this, forward);
+    return stdx::make_unique<Cursor>(txn, *this, forward, findCommandFields(txn));
+}
+
+std::unique_ptr<SeekableRecordCursor>
+TerarkDbRecordStore::getProjectedCursor(OperationContext* txn, bool forward,
+										const BSONObj& projection) const {
+    return stdx::make_unique<Cursor>(txn, *this, forward, projection);
 }
 
 std::unique_ptr<RecordCursor> TerarkDbRecordStore::getRandomCursor(OperationContext* txn) const {
@@ -473,6 +879,9 @@ TerarkDbRecordStore::getManyCursors(OperationContext* txn) const {
 Status TerarkDbRecordStore::truncate(OperationContext* txn) {
 	DbTable* tab = m_table->m_tab.get();
 	tab->clear();
+	if (_oplogStones) {
+		_oplogStones->clearStonesOnCommit(txn);
+	}
     return Status::OK();
 }
 
@@ -511,6 +920,78 @@ void TerarkDbRecordStore::updateStatsAfterRepair(OperationContext* txn,
 	LOG(2) << BOOST_CURRENT_FUNCTION << ": is in TODO list, not implemented now";
 }
 
+void TerarkDbRecordStore::_oplogStonesAfterInsert(OperationContext* txn,
+												 int64_t bytesInserted,
+												 RecordId highestInserted,
+												 int64_t countInserted) {
+	if (!_oplogStones) {
+		return;
+	}
+	_oplogStones->updateCurrentStoneAfterInsertOnCommit(
+		txn, bytesInserted, highestInserted, countInserted);
+	if (!_isOplog) {
+		// the oplog is reclaimed by TerarkDbRecordStoreThread, other capped
+		// collections are reclaimed by their writers
+		reclaimOplog(txn);
+	}
+}
+
+bool TerarkDbRecordStore::yieldAndAwaitOplogDeletionRequest(OperationContext* txn) {
+    // Create another reference to the oplog stones while holding a lock on the collection to
+    // prevent it from being destructed.
+    std::shared_ptr<OplogStones> oplogStones = _oplogStones;
+    invariant(oplogStones);
+
+    Locker* locker = txn->lockState();
+    Locker::LockSnapshot snapshot;
+
+    // Release any locks before waiting on the condition variable. It is illegal to access any
+    // methods or members of this record store after this line because it could be deleted.
+    bool releasedAnyLocks = locker->saveLockStateAndUnlock(&snapshot);
+    invariant(releasedAnyLocks);
+
+    txn->recoveryUnit()->abandonSnapshot();
+
+    // Wait for an oplog deletion request, or for this record store to have been destroyed.
+    oplogStones->awaitHasExcessStonesOrDead();
+
+    // Reacquire the locks that were released.
+    locker->restoreLockState(snapshot);
+
+    return !oplogStones->isDead();
+}
+
+bool TerarkDbRecordStore::reclaimOplog(OperationContext* txn) {
+	DbTable* tab = m_table->m_tab.get();
+	while (auto stone = _oplogStones->peekOldestStoneIfNeeded()) {
+		invariant(stone->lastRecord.isNormal());
+		// RecordId is recIdx + 1, records of the stone are below endRecId
+		const llong endRecId = stone->lastRecord.repr();
+		LOG(1) << "Truncating the oplog " << ns() << " to " << stone->lastRecord
+			   << " to remove approximately " << stone->records
+			   << " records totaling to " << stone->bytes << " bytes";
+		tab->dropLeadingSegments(endRecId);
+		terark::db::SegArrayVersionPtr ver = tab->getSegArrayVersion();
+		if (ver->m_segments.size() > 1 && ver->m_rowNumVec[1] <= endRecId) {
+			// the head segment is below the boundary but could not be
+			// dropped: background tasks are running or it is not converted
+			LOG(1) << "Oplog " << ns() << ": head segment is busy, retry later";
+			return false;
+		}
+		// the head segment crosses the boundary, remove its rows which
+		// belong to the stone, rows before firstRecord were removed
+		llong recIdx = std::max<llong>(ver->m_rowNumVec[0], _oplogStones->firstRecord.repr());
+		ver = nullptr;
+		auto& td = m_table->getMyThreadData();
+		for (; recIdx < endRecId; ++recIdx) {
+			tab->removeRow(recIdx, &*td.m_dbCtx);
+		}
+		_oplogStones->popOldestStone();
+		_oplogStones->firstRecord = stone->lastRecord;
+	}
+	return true;
+}
+
 void TerarkDbRecordStore::temp_cappedTruncateAfter(OperationContext* txn,
 												 RecordId end,
 												 bool inclusive) {
@@ -33,6 +33,7 @@
 #pragma once
 
 #include <boost/thread/mutex.hpp>
+#include <memory>
 #include <set>
 #include <string>
 
@@ -49,11 +50,14 @@ namespace mongo { namespace terarkdb {
 
 class TerarkDbRecordStore : public RecordStore {
 public:
+    // cappedMaxSize > 0 makes a capped collection, oldest records are
+    // dropped in OplogStones, see reclaimOplog
     TerarkDbRecordStore(OperationContext* txn,
 					  StringData ns,
 					  StringData ident,
 					  ThreadSafeTable* tab,
-					  TerarkDbSizeStorer* sizeStorer);
+					  TerarkDbSizeStorer* sizeStorer,
+					  int64_t cappedMaxSize = -1);
 
     virtual ~TerarkDbRecordStore();
 
@@ -111,6 +115,14 @@ public:
                                                     bool forward) const override final;
     std::unique_ptr<RecordCursor> getRandomCursor(OperationContext* txn) const override final;
 
+    // Records returned by this cursor have only the top level fields
+    // needed by projection, see RecordProjection. An unsupported
+    // projection falls back to whole records. getCursor returns it for
+    // find commands, with the fields of filter and sort added.
+    std::unique_ptr<SeekableRecordCursor>
+    getProjectedCursor(OperationContext* txn, bool forward,
+                       const BSONObj& projection) const;
+
     std::vector<std::unique_ptr<RecordCursor>> getManyCursors(OperationContext* txn) const override final;
 
     virtual Status truncate(OperationContext* txn) override;
@@ -156,12 +168,39 @@ public:
 
     bool inShutdown() const;
 
+    class OplogStones;
+
+    int64_t cappedMaxSize() const { return _cappedMaxSize; }
+
+    // Returns NULL if this record store is not capped
+    OplogStones* oplogStones() { return _oplogStones.get(); }
+
+    // Releases locks of txn and waits until there are excess oplog stones
+    // or the record store is destroyed, returns false if it was destroyed
+    bool yieldAndAwaitOplogDeletionRequest(OperationContext* txn);
+
+    // Drops excess oldest stones, whole segments below a stone boundary
+    // are dropped by DbTable::dropLeadingSegments, rows of the segment
+    // which crosses the boundary are removed one by one.
+    // Returns false if segments can not be dropped now because background
+    // tasks of the table are running, the caller should retry later
+    bool reclaimOplog(OperationContext* txn);
+
     ThreadSafeTablePtr m_table;
 
 private:
     class Cursor;
+    void _oplogStonesAfterInsert(OperationContext* txn,
+                                 int64_t bytesInserted,
+                                 RecordId highestInserted,
+                                 int64_t countInserted);
     const std::string _ident;
     bool _shuttingDown;
+    const bool _isCapped;
+    const bool _isOplog;
+    const int64_t _cappedMaxSize;
+    // shared with yieldAndAwaitOplogDeletionRequest, which may outlive this
+    std::shared_ptr<OplogStones> _oplogStones;
 };
 
 // TerarkDb failpoint to throw write conflict exceptions randomly
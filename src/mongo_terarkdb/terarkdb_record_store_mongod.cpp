@@ -104,7 +104,9 @@ public:
             if (!rs->yieldAndAwaitOplogDeletionRequest(&txn)) {
                 return false;  // Oplog went away.
             }
-            rs->reclaimOplog(&txn);
+            if (!rs->reclaimOplog(&txn)) {
+                return false;  // Segments are busy, back off.
+            }
         } catch (const std::exception& e) {
             severe() << "error in TerarkDbRecordStoreThread: " << e.what();
             fassertFailedNoTrace(!"error in TerarkDbRecordStoreThread");
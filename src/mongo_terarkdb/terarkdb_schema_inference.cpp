@@ -0,0 +1,387 @@
+/*
+ *  Created on: 2016-09-20
+ *      Author: leipeng, rockeet@gmail.com
+ */
+#define MONGO_LOG_DEFAULT_COMPONENT ::mongo::logger::LogComponent::kStorage
+#ifdef _MSC_VER
+#pragma warning(disable: 4800) // bool conversion
+#pragma warning(disable: 4244) // 'return': conversion from '__int64' to 'double', possible loss of data
+#pragma warning(disable: 4267) // '=': conversion from 'size_t' to 'int', possible loss of data
+#endif
+
+#include "terarkdb_schema_inference.h"
+
+#include <mongo/json.h>
+#include <mongo/util/log.h>
+#include <terark/db/json.hpp>
+#include <terark/io/FileStream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <fstream>
+#include <sstream>
+
+namespace mongo { namespace terarkdb {
+
+using terark::FileStream;
+
+static const char kSegInferredFile[] = "inferred-schema.json";
+static const char kTabInferredFile[] = "dbmeta.inferred.json";
+
+static std::string readFile(const fs::path& fpath) {
+	std::ifstream ifs(fpath.string());
+	std::stringstream ss;
+	ss << ifs.rdbuf();
+	return ss.str();
+}
+
+void SchemaInference::FieldStat::add(const BSONElement& elem) {
+	rows++;
+	types[elem.type()]++;
+	if (String == elem.type()) {
+		int len = elem.valuestrsize() - 1;
+		minLen = std::min(minLen, len);
+		maxLen = std::max(maxLen, len);
+	}
+}
+
+void SchemaInference::FieldStat::merge(const FieldStat& y) {
+	rows += y.rows;
+	minLen = std::min(minLen, y.minLen);
+	maxLen = std::max(maxLen, y.maxLen);
+	for (const auto& kv : y.types) {
+		types[kv.first] += kv.second;
+	}
+}
+
+void SchemaInference::FieldStat::toBson(BSONObjBuilder& bb) const {
+	bb.append("rows", rows);
+	if (minLen <= maxLen) {
+		bb.append("minLen", minLen);
+		bb.append("maxLen", maxLen);
+	}
+	BSONObjBuilder tb(bb.subobjStart("types"));
+	for (const auto& kv : types) {
+		tb.append(std::to_string(kv.first), kv.second);
+	}
+	tb.done();
+}
+
+void SchemaInference::FieldStat::fromBson(const BSONObj& obj) {
+	rows = obj["rows"].safeNumberLong();
+	if (obj.hasField("minLen")) {
+		minLen = obj["minLen"].numberInt();
+		maxLen = obj["maxLen"].numberInt();
+	}
+	for (const BSONElement& e : obj["types"].Obj()) {
+		types[std::stoi(e.fieldName())] = e.safeNumberLong();
+	}
+}
+
+namespace {
+class InferenceObserver : public terark::db::ConvRowObserver {
+	SchemaInferencePtr m_owner;
+	const Schema*      m_rowSchema;
+	SchemaRecordCoder  m_coder;
+	SchemaInference::FieldStatMap m_fields;
+	llong m_rows;
+public:
+	InferenceObserver(SchemaInference* owner, const Schema* rowSchema)
+	  : m_owner(owner), m_rowSchema(rowSchema), m_rows(0) {}
+
+	void observe(fstring row) override {
+		SharedBuffer buf = m_coder.decode(m_rowSchema, row);
+		BSONObj obj(buf.get());
+		for (const BSONElement& e : obj) {
+			m_fields[e.fieldName()].add(e);
+		}
+		m_rows++;
+	}
+
+	void complete(terark::db::PathRef segDir) override {
+		m_owner->mergeSegment(m_fields, m_rows, segDir);
+	}
+};
+} // namespace
+
+SchemaInference::SchemaInference(const fs::path& tabDir) : m_tabDir(tabDir) {
+	m_rows = 0;
+	m_version = 0;
+	load();
+}
+
+SchemaInference::~SchemaInference() {
+}
+
+terark::db::ConvRowObserver*
+SchemaInference::createObserver(const Schema* rowSchema) {
+	return new InferenceObserver(this, rowSchema);
+}
+
+void SchemaInference::statsToBson(const FieldStatMap& fields, llong rows,
+								  BSONObjBuilder& bb) {
+	bb.append("rows", rows);
+	BSONObjBuilder fb(bb.subobjStart("FieldStats"));
+	for (size_t i = fields.beg_i(); i < fields.end_i(); i = fields.next_i(i)) {
+		BSONObjBuilder sb(fb.subobjStart(fields.key(i).str()));
+		fields.val(i).toBson(sb);
+		sb.done();
+	}
+	fb.done();
+}
+
+// A field is promoted only if it is present in all rows with one type,
+// a missing field of a typed column would be read back as zero.
+static int getPromotedType(const SchemaInference::FieldStat& f, llong rows) {
+	if (f.rows != rows || f.types.size() != 1) {
+		return EOO;
+	}
+	switch (f.types.begin()->first) {
+	default:
+		return EOO; // Object, Array, BinData... are kept in "$$"
+	case jstOID:
+	case NumberInt:
+	case NumberLong:
+	case NumberDouble:
+	case Bool:
+	case Date:
+	case bsonTimestamp:
+	case String:
+		return f.types.begin()->first;
+	}
+}
+
+static bool appendColumn(BSONObjBuilder& cb, StringData name, int type) {
+	BSONObjBuilder col(cb.subobjStart(name));
+	bool isFixed = true;
+	switch (type) {
+	case jstOID:
+		col.append("type", "fixed");
+		col.append("length", 12);
+		col.append("mongoType", "oid");
+		break;
+	case NumberInt:
+		col.append("type", "sint32");
+		break;
+	case NumberLong:
+		col.append("type", "sint64");
+		break;
+	case NumberDouble:
+		col.append("type", "float64");
+		break;
+	case Bool:
+		col.append("type", "uint08");
+		break;
+	case Date:
+		col.append("type", "sint64");
+		col.append("mongoType", "date");
+		break;
+	case bsonTimestamp:
+		col.append("type", "sint64");
+		col.append("mongoType", "timestamp");
+		break;
+	case String:
+		col.append("type", "strzero");
+		isFixed = false;
+		break;
+	}
+	col.done();
+	return isFixed;
+}
+
+void SchemaInference::proposeDbMeta(const FieldStatMap& fields, llong rows,
+									BSONObjBuilder& bb) {
+	bb.append("This is an inferred schema", true);
+	bb.append("CheckMongoType", true);
+	std::vector<std::string> fixedCols;
+	bool hasOid = false;
+	{
+		BSONObjBuilder rb(bb.subobjStart("RowSchema"));
+		BSONObjBuilder cb(rb.subobjStart("columns"));
+		size_t idPos = fields.find_i("_id");
+		if (idPos < fields.end_i()) {
+			int type = getPromotedType(fields.val(idPos), rows);
+			if (EOO != type) {
+				appendColumn(cb, "_id", type);
+				hasOid = jstOID == type;
+			}
+		}
+		for (size_t i = fields.beg_i(); i < fields.end_i(); i = fields.next_i(i)) {
+			fstring name = fields.key(i);
+			if (i == idPos || name[0] == '$') {
+				continue;
+			}
+			int type = getPromotedType(fields.val(i), rows);
+			if (EOO != type && appendColumn(cb, name.str(), type)) {
+				fixedCols.push_back(name.str());
+			}
+		}
+		BSONObjBuilder ab(cb.subobjStart(G_schemaLessFieldName));
+		ab.append("type", "carbin");
+		ab.done();
+		cb.done();
+		rb.done();
+	}
+	if (hasOid) {
+		BSONArrayBuilder ib(bb.subarrayStart("TableIndex"));
+		ib.append(BSON("fields" << "_id" << "unique" << true));
+		ib.done();
+	}
+	if (!fixedCols.empty()) {
+		BSONObjBuilder gb(bb.subobjStart("ColumnGroups"));
+		BSONObjBuilder fb(gb.subobjStart("fixed_fields"));
+		fb.append("fields", fixedCols);
+		fb.done();
+		gb.done();
+	}
+	statsToBson(fields, rows, bb);
+}
+
+void SchemaInference::mergeSegment(const FieldStatMap& fields, llong rows,
+								   const fs::path& segDir) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_version++;
+	m_rows += rows;
+	for (size_t i = fields.beg_i(); i < fields.end_i(); i = fields.next_i(i)) {
+		m_fields[fields.key(i)].merge(fields.val(i));
+	}
+	try {
+		BSONObjBuilder bb;
+		bb.append("InferenceVersion", m_version);
+		statsToBson(fields, rows, bb);
+		FileStream((segDir / kSegInferredFile).string(), "w")
+			.puts(bb.done().jsonString(Strict, true, true));
+		save();
+	}
+	catch (const std::exception& ex) {
+		LOG(0) << "SchemaInference::mergeSegment: segDir=" << segDir.string()
+			   << ", error: " << ex.what();
+	}
+}
+
+void SchemaInference::save() const {
+	BSONObjBuilder bb;
+	bb.append("InferenceVersion", m_version);
+	proposeDbMeta(m_fields, m_rows, bb);
+	fs::path fpath = m_tabDir / kTabInferredFile;
+	fs::path ftemp = m_tabDir / (std::string(kTabInferredFile) + ".tmp");
+	FileStream(ftemp.string(), "w").puts(bb.done().jsonString(Strict, true, true));
+	fs::rename(ftemp, fpath);
+}
+
+void SchemaInference::load() {
+	fs::path fpath = m_tabDir / kTabInferredFile;
+	if (!fs::exists(fpath)) {
+		return;
+	}
+	try {
+		BSONObj obj = fromjson(readFile(fpath));
+		// "SchemaVersion" by old versions
+		m_version = obj.hasField("InferenceVersion")
+				  ? obj["InferenceVersion"].safeNumberLong()
+				  : obj["SchemaVersion"].safeNumberLong();
+		m_rows = obj["rows"].safeNumberLong();
+		for (const BSONElement& e : obj["FieldStats"].Obj()) {
+			m_fields[e.fieldName()].fromBson(e.Obj());
+		}
+	}
+	catch (const std::exception& ex) {
+		LOG(0) << "SchemaInference::load: " << fpath.string()
+			   << ", error: " << ex.what() << ", discarded";
+		m_fields.clear();
+		m_rows = 0;
+		m_version = 0;
+	}
+}
+
+bool SchemaInference::isDynamicCollection(const fs::path& tabDir) {
+	terark::json meta = terark::json::parse(readFile(tabDir / "dbmeta.json"));
+	auto iter = meta.find("This is a dynamically created collection");
+	return meta.end() != iter && static_cast<bool>(iter.value());
+}
+
+bool SchemaInference::promote() {
+	using terark::json;
+	using terark::db::SchemaConfig;
+	using terark::db::SchemaConfigPtr;
+	const llong minRows = terark::getEnvLong("MongoTerarkDB_PromoteMinRows", 100000);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_rows < std::max(minRows, 1LL)) {
+		return false;
+	}
+	const fs::path metaFile = m_tabDir / "dbmeta.json";
+	json meta = json::parse(readFile(metaFile));
+	json& columns = meta["RowSchema"]["columns"];
+	if (columns.end() == columns.find(G_schemaLessFieldName)) {
+		return false;
+	}
+	json newColumns = json::object();
+	for (auto iter = columns.begin(); iter != columns.end(); ++iter) {
+		if (iter.key() != G_schemaLessFieldName)
+			newColumns[iter.key()] = iter.value();
+	}
+	std::vector<std::pair<std::string, int> > promoted;
+	std::vector<std::string> fixedCols;
+	for (size_t i = m_fields.beg_i(); i < m_fields.end_i(); i = m_fields.next_i(i)) {
+		std::string name = m_fields.key(i).str();
+		if (name[0] == '$' || columns.end() != columns.find(name)) {
+			continue;
+		}
+		int type = getPromotedType(m_fields.val(i), m_rows);
+		if (EOO == type) {
+			continue;
+		}
+		BSONObjBuilder cb;
+		if (appendColumn(cb, name, type)) {
+			fixedCols.push_back(name);
+		}
+		newColumns[name] = json::parse(cb.done()[name].Obj().jsonString(Strict));
+		promoted.emplace_back(name, type);
+	}
+	if (promoted.empty()) {
+		return false;
+	}
+	newColumns[G_schemaLessFieldName] = columns[G_schemaLessFieldName];
+	columns = newColumns;
+	llong version = 0;
+	auto verIter = meta.find("SchemaVersion");
+	if (meta.end() != verIter) {
+		version = verIter.value().get<llong>();
+	}
+	meta["SchemaVersion"] = version + 1;
+	if (!fixedCols.empty()) {
+		std::string cgName = "fixed_fields_" + std::to_string(version + 1);
+		meta["ColumnGroups"][cgName]["fields"] = fixedCols;
+	}
+	std::string newMetaJson = meta.dump(4);
+
+	SchemaConfigPtr oldConf = new SchemaConfig();
+	SchemaConfigPtr newConf = new SchemaConfig();
+	oldConf->loadJsonFile(metaFile.string());
+	newConf->loadJsonString(newMetaJson);
+	const Schema* oldSchema = oldConf->m_rowSchema.get();
+	const Schema* newSchema = newConf->m_rowSchema.get();
+	SchemaRecordCoder coder;
+	valvec<char> encoded;
+	// called by one thread, rows are checked against the inferred types,
+	// rows which are not observed may miss a field or have another type
+	auto transcode = [&](fstring oldRow, valvec<unsigned char>* newRow) {
+		SharedBuffer buf = coder.decode(oldSchema, oldRow);
+		BSONObj obj(buf.get());
+		for (const auto& f : promoted) {
+			BSONElement e = obj[f.first];
+			if (int(e.type()) != f.second) {
+				THROW_STD(invalid_argument
+					, "field %s is missing or not of inferred type %d: %s"
+					, f.first.c_str(), f.second, obj.toString().c_str());
+			}
+		}
+		coder.encode(newSchema, nullptr, obj, &encoded);
+		newRow->assign((const unsigned char*)encoded.data(), encoded.size());
+	};
+	LOG(0) << "SchemaInference::promote: " << m_tabDir.string()
+		   << ", promote " << promoted.size() << " fields to SchemaVersion "
+		   << version + 1;
+	DbTable::alterRowSchema(m_tabDir, newMetaJson, transcode);
+	return true;
+}
+
+} } // namespace mongo::terarkdb
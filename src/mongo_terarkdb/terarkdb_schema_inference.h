@@ -0,0 +1,77 @@
+/*
+ *  Created on: 2016-09-20
+ *      Author: leipeng, rockeet@gmail.com
+ */
+
+#ifndef SRC_TERARKDB_SCHEMA_INFERENCE_H_
+#define SRC_TERARKDB_SCHEMA_INFERENCE_H_
+
+#include "mongo_terarkdb_common.hpp"
+#include <mongo/bson/bsonobj.h>
+#include <mongo/bson/bsonobjbuilder.h>
+#include <climits>
+#include <map>
+#include <mutex>
+
+namespace mongo { namespace terarkdb {
+
+// Infers field types of a dynamically created schema-less ("$$": carbin)
+// collection from the rows of each converted segment, saved as:
+//   segDir/inferred-schema.json  : field stats of the segment
+//   tabDir/dbmeta.inferred.json  : a dbmeta.json proposal merged from all
+//                                  segments, which can be used to recreate
+//                                  the collection with typed columns
+// promote() applies the inferred types to the closed table by
+// DbTable::alterRowSchema, which rebuilds all segments with a new
+// "SchemaVersion" of dbmeta.json.
+class SchemaInference : public terark::RefCounter {
+public:
+	struct FieldStat {
+		llong rows = 0;
+		int   minLen = INT_MAX; // of String
+		int   maxLen = 0;       // of String
+		std::map<int, llong> types; // BSONType -> rows
+		void add(const BSONElement&);
+		void merge(const FieldStat&);
+		void toBson(BSONObjBuilder&) const;
+		void fromBson(const BSONObj&);
+	};
+	typedef hash_strmap<FieldStat> FieldStatMap;
+
+	explicit SchemaInference(const fs::path& tabDir);
+	~SchemaInference();
+
+	terark::db::ConvRowObserver* createObserver(const Schema* rowSchema);
+	void mergeSegment(const FieldStatMap&, llong rows, const fs::path& segDir);
+
+	// true for collections created by MongoTerarkDB_DynamicCreateCollection
+	static bool isDynamicCollection(const fs::path& tabDir);
+
+	// must be called before the table is opened, fields which are present
+	// in all of at least MongoTerarkDB_PromoteMinRows(default 100000) rows
+	// with one type are promoted, a row missing a promoted field or having
+	// another type aborts the promotion and the table is not changed,
+	// returns true if the table is altered.
+	// rows inserted after promotion without a promoted field are read back
+	// with a zero value of the column, so it is enabled by the env
+	// MongoTerarkDB_PromoteInferredSchema
+	bool promote();
+
+	static void statsToBson(const FieldStatMap&, llong rows, BSONObjBuilder&);
+	static void proposeDbMeta(const FieldStatMap&, llong rows, BSONObjBuilder&);
+
+private:
+	void load();
+	void save() const;
+
+	std::mutex   m_mutex;
+	fs::path     m_tabDir;
+	FieldStatMap m_fields;
+	llong        m_rows;
+	llong        m_version; // "InferenceVersion", increased on each merged segment
+};
+typedef boost::intrusive_ptr<SchemaInference> SchemaInferencePtr;
+
+} } // namespace mongo::terarkdb
+
+#endif /* SRC_TERARKDB_SCHEMA_INFERENCE_H_ */
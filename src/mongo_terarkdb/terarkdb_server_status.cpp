@@ -66,7 +66,11 @@ TerarkDbServerStatusSection::generateSection(OperationContext* txn,
     BSONObjBuilder bob;
 
 //    TerarkDbRecoveryUnit::appendGlobalStats(bob);
-
+    {
+        BSONObjBuilder tables(bob.subobjStart("tables"));
+        _engine->appendTableStats(tables);
+        tables.done();
+    }
     return bob.obj();
 }
 
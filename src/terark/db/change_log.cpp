@@ -0,0 +1,361 @@
+#include "change_log.hpp"
+#include <terark/util/throw.hpp>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <chrono>
+#include <limits.h>
+#include <string.h>
+
+namespace terark { namespace db {
+
+namespace fs = boost::filesystem;
+
+// record: [seq u64][time u64][type u8][recId u64][dataLen u32][data]
+static void encodeHeader(byte* p, llong seq, llong time, byte type, llong recId, size_t dataLen) {
+	uint64_t u64 = seq;
+	uint32_t u32 = uint32_t(dataLen);
+	memcpy(p, &u64, 8); p += 8;
+	u64 = time;
+	memcpy(p, &u64, 8); p += 8;
+	*p++ = type;
+	u64 = recId;
+	memcpy(p, &u64, 8); p += 8;
+	memcpy(p, &u32, 4);
+}
+
+static void decodeHeader(const byte* p, llong* seq, llong* time, byte* type, llong* recId, size_t* dataLen) {
+	uint64_t u64;
+	uint32_t u32;
+	memcpy(&u64, p, 8); p += 8; *seq = llong(u64);
+	memcpy(&u64, p, 8); p += 8; *time = llong(u64);
+	*type = *p++;
+	memcpy(&u64, p, 8); p += 8; *recId = llong(u64);
+	memcpy(&u32, p, 4); *dataLen = u32;
+}
+
+ChangeLog::ChangeLog(PathRef dir, llong fileSize) : m_dir(dir.string()) {
+	m_fileSize = fileSize;
+	m_nextSeq = 1;
+	m_lastTime = 0;
+	m_curFileBytes = 0;
+	load();
+}
+
+ChangeLog::~ChangeLog() {
+}
+
+std::string ChangeLog::getFilePath(llong firstSeq) const {
+	char szBuf[32];
+	snprintf(szBuf, sizeof(szBuf), "%016lld.log", firstSeq);
+	return (fs::path(m_dir) / szBuf).string();
+}
+
+// a truncated tail record is the result of a crash while appending,
+// it is removed
+void ChangeLog::load() {
+	fs::create_directories(m_dir);
+	for (auto& ent : fs::directory_iterator(m_dir)) {
+		std::string fname = ent.path().filename().string();
+		llong seq = -1;
+		if (fstring(fname).endsWith(".log") && sscanf(fname.c_str(), "%lld", &seq) == 1) {
+			m_files.push_back(seq);
+		}
+	}
+	if (m_files.empty()) {
+		openFileNoLock(m_nextSeq);
+		return;
+	}
+	std::sort(m_files.begin(), m_files.end());
+	llong lastFileSeq = m_files.back();
+	std::string fpath = getFilePath(lastFileSeq);
+	valvec<byte> buf(size_t(fs::file_size(fpath)), valvec_no_init());
+	if (!buf.empty()) {
+		FileStream fp(fpath, "rb");
+		fp.ensureRead(buf.data(), buf.size());
+	}
+	llong expected = lastFileSeq;
+	size_t pos = 0;
+	while (pos + HeaderSize <= buf.size()) {
+		llong seq, time, recId;
+		byte type;
+		size_t dataLen;
+		decodeHeader(buf.data() + pos, &seq, &time, &type, &recId, &dataLen);
+		if (pos + HeaderSize + dataLen > buf.size()) {
+			break;
+		}
+		if (seq != expected || (Upsert != type && Remove != type)) {
+			THROW_STD(invalid_argument
+				, "bad record: seq = %lld, expected = %lld, type = %d, at offset %zd of %s"
+				, seq, expected, type, pos, fpath.c_str());
+		}
+		expected = seq + 1;
+		m_lastTime = time;
+		pos += HeaderSize + dataLen;
+	}
+	if (pos < buf.size()) {
+		fprintf(stderr
+			, "WARN: ChangeLog: truncated tail record at %zd of %s, removed\n"
+			, pos, fpath.c_str());
+		fs::resize_file(fpath, pos);
+	}
+	m_nextSeq = expected;
+	m_curFileBytes = pos;
+	m_fp.open(fpath, "ab");
+	fprintf(stderr, "INFO: ChangeLog: %s: files = %zd, seq = [%lld, %lld)\n"
+		, m_dir.c_str(), m_files.size(), m_files[0], m_nextSeq);
+}
+
+void ChangeLog::openFileNoLock(llong firstSeq) {
+	if (m_fp.isOpen()) {
+		m_fp.close();
+	}
+	m_fp.open(getFilePath(firstSeq), "ab");
+	m_files.push_back(firstSeq);
+	m_curFileBytes = 0;
+}
+
+void ChangeLog::writeNoLock(const byte* data, size_t len) {
+	m_fp.ensureWrite(data, len);
+	m_curFileBytes += len;
+}
+
+void ChangeLog::encode(valvec<byte>* records, OpType type, llong recId, fstring data) {
+	size_t oldsize = records->size();
+	records->resize_no_init(oldsize + HeaderSize);
+	encodeHeader(records->data() + oldsize, 0, 0, type, recId, data.size());
+	records->append((const byte*)data.data(), data.size());
+}
+
+// the wall clock may go backwards, time of records must not
+llong ChangeLog::nowTimeNoLock() {
+	using namespace std::chrono;
+	llong now = duration_cast<microseconds>(
+					system_clock::now().time_since_epoch()).count();
+	m_lastTime = std::max(m_lastTime, now);
+	return m_lastTime;
+}
+
+llong ChangeLog::append(OpType type, llong recId, fstring data) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_curFileBytes >= m_fileSize) {
+		openFileNoLock(m_nextSeq);
+	}
+	byte header[HeaderSize];
+	encodeHeader(header, m_nextSeq, nowTimeNoLock(), type, recId, data.size());
+	writeNoLock(header, HeaderSize);
+	writeNoLock((const byte*)data.data(), data.size());
+	return m_nextSeq++;
+}
+
+llong ChangeLog::appendBatch(const valvec<byte>& records, size_t num) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_curFileBytes >= m_fileSize) {
+		openFileNoLock(m_nextSeq);
+	}
+	const llong firstSeq = m_nextSeq;
+	const llong now = nowTimeNoLock();
+	for (size_t pos = 0; pos < records.size(); ) {
+		llong seq, time, recId;
+		byte type;
+		size_t dataLen;
+		decodeHeader(records.data() + pos, &seq, &time, &type, &recId, &dataLen);
+		byte header[HeaderSize];
+		encodeHeader(header, m_nextSeq++, now, type, recId, dataLen);
+		writeNoLock(header, HeaderSize);
+		writeNoLock(records.data() + pos + HeaderSize, dataLen);
+		pos += HeaderSize + dataLen;
+	}
+	if (m_nextSeq - firstSeq != llong(num)) {
+		THROW_STD(logic_error, "records = %lld, num = %zd", m_nextSeq - firstSeq, num);
+	}
+	return firstSeq;
+}
+
+llong ChangeLog::firstSeq() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_files.empty() ? m_nextSeq : m_files[0];
+}
+
+llong ChangeLog::nextSeq() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_nextSeq;
+}
+
+void ChangeLog::flush() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_fp.flush();
+}
+
+size_t ChangeLog::truncateBefore(llong seq) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t num = 0;
+	// the writing file is never removed
+	while (num + 1 < m_files.size() && m_files[num + 1] <= seq) {
+		std::string fpath = getFilePath(m_files[num]);
+		fprintf(stderr, "INFO: ChangeLog: remove %s\n", fpath.c_str());
+		fs::remove(fpath);
+		num++;
+	}
+	m_files.erase_i(0, num);
+	return num;
+}
+
+// the file which contains seq, or the first file if seq was truncated
+bool ChangeLog::getFile(llong seq, llong* fileSeq, bool* isLast) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_files.empty()) {
+		return false;
+	}
+	size_t upp = std::upper_bound(m_files.begin(), m_files.end(), seq) - m_files.begin();
+	size_t idx = upp ? upp - 1 : 0;
+	*fileSeq = m_files[idx];
+	*isLast = idx + 1 == m_files.size();
+	return true;
+}
+
+ChangeLogIterator* ChangeLog::createIterator(llong startSeq) {
+	return new ChangeLogIterator(this, startSeq);
+}
+
+// returns false if the file has been truncated, time of an empty file
+// is LLONG_MAX, it has no records before any time
+static bool readFirstTime(const std::string& fpath, llong* time) {
+	byte header[ChangeLog::HeaderSize];
+	FileStream fp;
+	if (!fp.xopen(fpath, "rb")) {
+		return false;
+	}
+	if (fp.read(header, sizeof(header)) != sizeof(header)) {
+		*time = LLONG_MAX;
+		return true;
+	}
+	llong seq, recId;
+	byte type;
+	size_t dataLen;
+	decodeHeader(header, &seq, time, &type, &recId, &dataLen);
+	return true;
+}
+
+llong ChangeLog::seqOfTime(llong time) {
+	flush();
+	valvec<llong> files;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		files = m_files;
+	}
+	// the last file whose first record is before time, records of
+	// previous files are all before time
+	size_t lo = 0, hi = files.size();
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		llong firstTime;
+		if (readFirstTime(getFilePath(files[mid]), &firstTime) && firstTime >= time)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	if (0 == lo) {
+		return firstSeq();
+	}
+	ChangeLogIterator iter(this, files[lo-1]);
+	ChangeLog::Record rec;
+	while (iter.next(&rec)) {
+		if (rec.time >= time)
+			return rec.seq;
+	}
+	return iter.nextSeq();
+}
+
+ChangeLogIterator::ChangeLogIterator(ChangeLog* log, llong startSeq)
+  : m_log(log) {
+	m_nextSeq = startSeq;
+	m_fileSeq = -1;
+	m_fileOffset = 0;
+	m_bufPos = 0;
+}
+
+ChangeLogIterator::~ChangeLogIterator() {
+}
+
+bool ChangeLogIterator::openFile() {
+	llong fileSeq;
+	bool isLast;
+	if (!m_log->getFile(m_nextSeq, &fileSeq, &isLast)) {
+		return false;
+	}
+	m_fp.open(m_log->getFilePath(fileSeq), "rb");
+	m_fileSeq = fileSeq;
+	m_fileOffset = 0;
+	m_bufPos = 0;
+	m_buf.erase_all();
+	return true;
+}
+
+// ensure len bytes are available at m_bufPos
+bool ChangeLogIterator::fill(size_t len) {
+	size_t avail = m_buf.size() - m_bufPos;
+	if (avail >= len) {
+		return true;
+	}
+	if (m_bufPos) {
+		memmove(m_buf.data(), m_buf.data() + m_bufPos, avail);
+		m_fileOffset += m_bufPos;
+		m_buf.risk_set_size(avail);
+		m_bufPos = 0;
+	}
+	while (m_buf.size() < len) {
+		size_t oldsize = m_buf.size();
+		size_t want = std::max<size_t>(len - oldsize, 64*1024);
+		m_buf.resize_no_init(oldsize + want);
+		size_t n = m_fp.pread(m_fileOffset + oldsize, m_buf.data() + oldsize, want);
+		m_buf.risk_set_size(oldsize + n);
+		if (0 == n) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ChangeLogIterator::next(ChangeLog::Record* rec) {
+	bool flushed = false;
+	for (;;) {
+		if (m_fileSeq < 0 && !openFile()) {
+			return false;
+		}
+		if (fill(ChangeLog::HeaderSize)) {
+			llong seq, time, recId;
+			byte type;
+			size_t dataLen;
+			decodeHeader(m_buf.data() + m_bufPos, &seq, &time, &type, &recId, &dataLen);
+			if (fill(ChangeLog::HeaderSize + dataLen)) {
+				const byte* data = m_buf.data() + m_bufPos + ChangeLog::HeaderSize;
+				m_bufPos += ChangeLog::HeaderSize + dataLen;
+				if (seq < m_nextSeq) {
+					continue;
+				}
+				rec->seq = seq;
+				rec->time = time;
+				rec->type = ChangeLog::OpType(type);
+				rec->recId = recId;
+				rec->data = fstring(data, dataLen);
+				m_nextSeq = seq + 1;
+				return true;
+			}
+		}
+		// end of the opened file for now
+		llong fileSeq;
+		bool isLast;
+		if (m_log->getFile(m_nextSeq, &fileSeq, &isLast) && fileSeq != m_fileSeq) {
+			m_fp.close();
+			m_fileSeq = -1;
+			continue;
+		}
+		if (flushed) {
+			return false;
+		}
+		m_log->flush();
+		flushed = true;
+	}
+}
+
+} } // namespace terark::db
@@ -0,0 +1,124 @@
+#ifndef __terark_db_change_log_hpp__
+#define __terark_db_change_log_hpp__
+
+#include "db_store.hpp"
+#include <terark/io/FileStream.hpp>
+#include <mutex>
+#include <string>
+
+namespace terark { namespace db {
+
+// Sequence numbered change stream of a table, enabled by "EnableChangeLog"
+// in dbmeta.json.
+//
+// Each successful upsert/remove of DbTable and each committed BatchWriter
+// are appended to log files in tabDir/changelog, a log file is named by the
+// seq of its first record, a new file is started when the current file
+// exceeds "ChangeLogFileSize". Consumers read records by ChangeLogIterator
+// from a seq, and resume from the seq after the last consumed record.
+//
+// Records are identified by record id, "UsePermanentRecordId" should be
+// true, otherwise record ids are changed by table reload. A Remove record
+// also carries the key of the first unique index of the removed row.
+// Records are stamped with wall clock time when appended, seqOfTime finds
+// where to start reading for a point in time.
+class TERARK_DB_DLL ChangeLog : public RefCounter {
+public:
+	enum OpType : byte {
+		Upsert = 'U',
+		Remove = 'D',
+	};
+	struct Record {
+		llong   seq;
+		llong   time; // microseconds since epoch, not decreasing with seq
+		OpType  type;
+		llong   recId;
+		// Upsert: the row, Remove: the unique key, empty if the table has
+		// no unique index, valid until next iteration
+		fstring data;
+	};
+
+	ChangeLog(PathRef dir, llong fileSize);
+	~ChangeLog();
+
+	// returns seq of the record
+	llong append(OpType, llong recId, fstring data);
+
+	// num records encoded by encode() get consecutive seqs and the same
+	// time, returns seq of the first record
+	llong appendBatch(const valvec<byte>& records, size_t num);
+	static void encode(valvec<byte>* records, OpType, llong recId, fstring data);
+
+	llong firstSeq() const; // seq of the oldest record not truncated
+	llong nextSeq() const;  // seq of the next appended record
+	void  flush();
+
+	// seq of the first record whose time >= time, nextSeq() if none,
+	// firstSeq() if time is before the oldest record
+	llong seqOfTime(llong time);
+
+	// a writer holds this from before the commit of a change until the
+	// change is appended, so the seq order is the commit order, it is
+	// taken after the transaction of the change has begun
+	std::mutex& commitMutex() { return m_commitMutex; }
+
+	// remove log files whose records are all less than seq,
+	// returns number of removed files
+	size_t truncateBefore(llong seq);
+
+	class ChangeLogIterator* createIterator(llong startSeq);
+
+	static const size_t HeaderSize = 8 + 8 + 1 + 8 + 4;
+
+private:
+	friend class ChangeLogIterator;
+	void load();
+	void openFileNoLock(llong firstSeq);
+	void writeNoLock(const byte* data, size_t len);
+	std::string getFilePath(llong firstSeq) const;
+	bool getFile(llong seq, llong* fileSeq, bool* isLast) const;
+
+	llong nowTimeNoLock();
+
+	mutable std::mutex m_mutex;
+	std::mutex    m_commitMutex;
+	std::string   m_dir;
+	llong         m_fileSize;
+	valvec<llong> m_files; // first seq of each log file
+	llong         m_nextSeq;
+	llong         m_lastTime;
+	llong         m_curFileBytes;
+	FileStream    m_fp;
+};
+typedef boost::intrusive_ptr<ChangeLog> ChangeLogPtr;
+
+class TERARK_DB_DLL ChangeLogIterator : public RefCounter {
+public:
+	ChangeLogIterator(ChangeLog*, llong startSeq);
+	~ChangeLogIterator();
+
+	// returns false if there are no more records for now, next may be
+	// called again later for records appended after that
+	bool next(ChangeLog::Record*);
+
+	// records before this seq have been returned or skipped, if
+	// the seq jumps, the records are truncated before reading
+	llong nextSeq() const { return m_nextSeq; }
+
+private:
+	bool openFile();
+	bool fill(size_t len);
+
+	ChangeLogPtr  m_log;
+	llong         m_nextSeq;
+	llong         m_fileSeq; // first seq of opened file, -1 if not opened
+	FileStream    m_fp;
+	llong         m_fileOffset; // file offset of m_buf[0]
+	size_t        m_bufPos;
+	valvec<byte>  m_buf;
+};
+typedef boost::intrusive_ptr<ChangeLogIterator> ChangeLogIteratorPtr;
+
+} } // namespace terark::db
+
+#endif // __terark_db_change_log_hpp__
@@ -166,6 +166,8 @@ Schema::Schema() {
 	m_isInplaceUpdatable = false;
 	m_enableLinearScan = false;
 	m_mmapPopulate = false;
+	m_usePread = false;
+	m_keepColumnStored = false;
 	m_keepCols.fill(true);
 	m_minFragLen = 0;
 	m_maxFragLen = 0;
@@ -1927,27 +1929,67 @@ const llong  DEFAULT_compressingWorkMemSize = 2LL * 1024 * 1024 * 1024;
 const llong  DEFAULT_maxWritingSegmentSize  = 3LL * 1024 * 1024 * 1024;
 const size_t DEFAULT_minMergeSegNum         = TERARK_IF_DEBUG(2, 5);
 const double DEFAULT_purgeDeleteThreshold   = 0.10;
+const llong  DEFAULT_changeLogFileSize      = 64LL * 1024 * 1024;
 
 SchemaConfig::SchemaConfig() {
 	m_compressingWorkMemSize = DEFAULT_compressingWorkMemSize;
 	m_maxWritingSegmentSize = DEFAULT_maxWritingSegmentSize;
+	m_rowCacheSize = 0;
+	m_changeLogFileSize = DEFAULT_changeLogFileSize;
 	m_minMergeSegNum = DEFAULT_minMergeSegNum;
+	m_mergePolicyType = "tiered";
 	m_purgeDeleteThreshold = DEFAULT_purgeDeleteThreshold;
 	m_usePermanentRecordId = false;
 	m_enableSnapshot = false;
+	m_enableChangeLog = false;
+	m_ttlColumnId = size_t(-1);
+	m_ttlSeconds = 0;
+	m_autoStoreSelect = false;
+	m_autoStoreSpeedWeight = 0.3;
+	m_autoStoreSampleSize = 4*1024*1024;
+	m_schemaVersion = 0;
+	m_residencyBudget = -1;
 }
 SchemaConfig::~SchemaConfig() {
 }
 
+llong SchemaConfig::getExpireTime(fstring d) const {
+	assert(hasTTL());
+	const ColumnType type = m_rowSchema->getColumnType(m_ttlColumnId);
+	llong t;
+	if (ColumnType::Sint32 == type && 4 == d.size()) {
+		int32_t x; memcpy(&x, d.data(), 4); t = x;
+	}
+	else if (ColumnType::Uint32 == type && 4 == d.size()) {
+		uint32_t x; memcpy(&x, d.data(), 4); t = x;
+	}
+	else if (ColumnType::Sint64 == type && 8 == d.size()) {
+		int64_t x; memcpy(&x, d.data(), 8); t = x;
+	}
+	else if (ColumnType::Uint64 == type && 8 == d.size()) {
+		uint64_t x; memcpy(&x, d.data(), 8);
+		t = x > uint64_t(LLONG_MAX) ? LLONG_MAX : llong(x);
+	}
+	else {
+		return LLONG_MAX; // bad data never expires
+	}
+	if (t > LLONG_MAX - m_ttlSeconds)
+		return LLONG_MAX;
+	return t + m_ttlSeconds;
+}
+
 void SchemaConfig::compileSchema() {
 	m_indexSchemaSet->compileSchemaSet(m_rowSchema.get());
 	febitvec hasIndex(m_rowSchema->columnNum(), false);
+	febitvec isColumnStored(m_rowSchema->columnNum(), false);
 	const size_t indexNum = this->getIndexNum();
 	for (size_t i = 0; i < indexNum; ++i) {
 		const Schema& schema = *m_indexSchemaSet->m_nested.elem_at(i);
 		const size_t colnum = schema.columnNum();
 		for (size_t j = 0; j < colnum; ++j) {
 			hasIndex.set1(schema.parentColumnId(j));
+			if (!schema.m_keepColumnStored)
+				isColumnStored.set1(schema.parentColumnId(j));
 		}
 	}
 
@@ -1979,8 +2021,8 @@ void SchemaConfig::compileSchema() {
 			[&](fstring colname, const ColumnMeta&) {
 			size_t pos = m_rowSchema->m_columnsMeta.find_i(colname);
 			assert(pos < m_rowSchema->m_columnsMeta.end_i());
-			bool ret = hasIndex[pos];
-			hasIndex.set1(pos); // now it is column stored
+			bool ret = isColumnStored[pos];
+			isColumnStored.set1(pos); // now it is column stored
 			return ret;
 		});
 	}
@@ -1992,8 +2034,8 @@ void SchemaConfig::compileSchema() {
 	}
 
 	SchemaPtr restAll(new Schema());
-	for (size_t i = 0; i < hasIndex.size(); ++i) {
-		if (!hasIndex[i]) {
+	for (size_t i = 0; i < isColumnStored.size(); ++i) {
+		if (!isColumnStored[i]) {
 			fstring    colname = m_rowSchema->getColumnName(i);
 			ColumnMeta colmeta = m_rowSchema->getColumnMeta(i);
 			restAll->m_columnsMeta.insert_i(colname, colmeta);
@@ -2126,6 +2168,12 @@ parseJsonColgroup(Schema& schema, const terark::json& js, int sufarrMinFreq) {
 	schema.m_minFragLen = getJsonValue(js, "minFragLen", 0);
 	schema.m_sufarrMinFreq = getJsonValue(js, "sufarrMinFreq", sufarrMinFreq);
 	schema.m_mmapPopulate = getJsonValue(js, "mmapPopulate", false);
+	schema.m_usePread = getJsonValue(js, "usePread", false);
+	if (schema.m_usePread && schema.m_isInplaceUpdatable) {
+		THROW_STD(invalid_argument
+			, "colgroup '%s': usePread and inplaceUpdatable can not be both true"
+			, schema.m_name.c_str());
+	}
 	//  512: rank_select_se_512
 	//  256: rank_select_se_256
 	// -256: rank_select_il_256
@@ -2605,13 +2653,73 @@ if (colgroupsIter != meta.end()) {
 	m_compressingWorkMemSize = getJsonSizeValue(meta, "CompressingWorkMemSize", m_compressingWorkMemSize);
 	m_maxWritingSegmentSize = getJsonSizeValue(meta, "MaxWrSegSize", DEFAULT_maxWritingSegmentSize);
 	m_maxWritingSegmentSize = getJsonSizeValue(meta, "MaxWritingSegmentSize", m_maxWritingSegmentSize);
+	m_rowCacheSize = getJsonSizeValue(meta, "RowCacheSize", 0);
 
 	m_minMergeSegNum = getJsonValue(
 		meta, "MinMergeSegNum", DEFAULT_minMergeSegNum);
 	m_purgeDeleteThreshold = getJsonValue(
 		meta, "PurgeDeleteThreshold", DEFAULT_purgeDeleteThreshold);
+{
+	// "MergePolicy": "type" or {"type": "type", params...}
+	m_mergePolicyType = "tiered";
+	m_mergePolicyConf.clear();
+	auto it = meta.find("MergePolicy");
+	if (meta.end() != it) {
+		if (it.value().is_string()) {
+			m_mergePolicyType = it.value().get<std::string>();
+		}
+		else if (it.value().is_object()) {
+			m_mergePolicyType = getJsonValue(it.value(), "type", m_mergePolicyType);
+			m_mergePolicyConf = it.value().dump();
+		}
+		else {
+			THROW_STD(invalid_argument, "MergePolicy must be a string or an object");
+		}
+	}
+}
 
 	m_enableSnapshot = getJsonValue(meta, "EnableSnapshot", false);
+	m_enableChangeLog = getJsonValue(meta, "EnableChangeLog", false);
+	m_changeLogFileSize = getJsonSizeValue(meta, "ChangeLogFileSize", DEFAULT_changeLogFileSize);
+	m_ttlSeconds = getJsonValue(meta, "TTLSeconds", llong(0));
+	if (m_ttlSeconds < 0) {
+		THROW_STD(invalid_argument,
+			"TTLSeconds=%lld must not be negative", m_ttlSeconds);
+	}
+	m_autoStoreSelect = getJsonValue(meta, "AutoStoreSelect", false);
+	m_autoStoreSpeedWeight = limitInBound(
+		getJsonValue(meta, "AutoStoreSpeedWeight", 0.3), 0.0, 1.0);
+	m_autoStoreSampleSize = getJsonSizeValue(meta, "AutoStoreSampleSize", 4*1024*1024);
+	m_residencyBudget = getJsonSizeValue(meta, "ResidencyBudget", llong(-1));
+	m_schemaVersion = getJsonValue(meta, "SchemaVersion", llong(0));
+	if (m_schemaVersion < 0) {
+		THROW_STD(invalid_argument,
+			"SchemaVersion=%lld must not be negative", m_schemaVersion);
+	}
+{
+	std::string ttlColumn = getJsonValue(meta, "TTLColumn", std::string());
+	if (!ttlColumn.empty()) {
+		const size_t k = m_rowSchema->getColumnId(ttlColumn);
+		if (k == m_rowSchema->columnNum()) {
+			THROW_STD(invalid_argument,
+				"TTLColumn=%s is not in RowSchema", ttlColumn.c_str());
+		}
+		switch (m_rowSchema->getColumnType(k)) {
+		default:
+			THROW_STD(invalid_argument,
+				"TTLColumn=%s must be Sint32/Uint32/Sint64/Uint64", ttlColumn.c_str());
+		case ColumnType::Sint32:
+		case ColumnType::Uint32:
+		case ColumnType::Sint64:
+		case ColumnType::Uint64:
+			break;
+		}
+		if (m_enableSnapshot) {
+			THROW_STD(invalid_argument, "TTLColumn can not be used with EnableSnapshot");
+		}
+		m_ttlColumnId = k;
+	}
+}
 {
 	// PermanentRecordId means record id will not be changed by table reload
 	auto it = meta.find("UsePermanentRecordId");
@@ -2680,6 +2788,7 @@ if (tableIndex != meta.end()) {
 //		indexSchema->m_isPrimary = getJsonValue(index, "primary", false);
 		indexSchema->m_isUnique  = getJsonValue(index, "unique" , false);
 		indexSchema->m_enableLinearScan = getJsonValue(index, "enableLinearScan", false);
+		indexSchema->m_keepColumnStored = getJsonValue(index, "keepColumnStored", false);
 		indexSchema->m_rankSelectClass = getJsonValue(index, "rs", 512);
 		indexSchema->m_nltNestLevel = (byte)limitInBound(
 			getJsonValue(index, "nltNestLevel", DEFAULT_nltNestLevel), 1u, 20u);
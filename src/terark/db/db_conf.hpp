@@ -10,6 +10,7 @@
 #include <boost/intrusive_ptr.hpp>
 #include <boost/type_traits/is_arithmetic.hpp>
 #include <boost/version.hpp>
+#include <functional>
 #include "db_dll_decl.hpp"
 
 #if BOOST_VERSION < 106000
@@ -276,6 +277,11 @@ namespace terark { namespace db {
 		bool   m_isInplaceUpdatable: 1;
 		bool   m_enableLinearScan  : 1;
 		bool   m_mmapPopulate : 1;
+		bool   m_usePread : 1; // read fixlen/zint colgroup by PreadPool
+		// just for index schema, columns of the index are also kept in
+		// colgroups, set for indices added by DbTable::addIndex, thus
+		// colgroup files of existing segments are still valid
+		bool   m_keepColumnStored : 1;
 		static_bitmap<MaxProjColumns> m_keepCols;
 
 		// used for ordered index, m_indexOrder.is1(i) means i'th column
@@ -523,16 +529,39 @@ namespace terark { namespace db {
 		valvec<Colproject> m_colproject; // parallel with m_rowSchema
 		llong    m_compressingWorkMemSize;
 		llong    m_maxWritingSegmentSize;
+		llong    m_rowCacheSize; // 0 means disable row cache
+		llong    m_changeLogFileSize;
 		size_t   m_minMergeSegNum;
+		std::string m_mergePolicyType; // "MergePolicy", see MergePolicy
+		std::string m_mergePolicyConf; // json text, empty for no params
 		size_t   m_bestUniqueIndexId;
 		double   m_purgeDeleteThreshold;
 		std::string m_tableClass;
 		bool     m_usePermanentRecordId;
 		bool     m_enableSnapshot;
+		bool     m_enableChangeLog;
+		size_t   m_ttlColumnId; // size_t(-1) if TTL is disabled
+		llong    m_ttlSeconds;
+		// store of colgroups chosen by trial compressing samples on
+		// conversion, by cost = ratio^(1-w) * decodeTime^w
+		bool     m_autoStoreSelect;
+		double   m_autoStoreSpeedWeight; // w in [0, 1]
+		llong    m_autoStoreSampleSize;
+		// "SchemaVersion", increased by DbTable::alterRowSchema, each
+		// ReadonlySegment records the version it was built with
+		llong    m_schemaVersion;
+		// "ResidencyBudget", max bytes of files pinned by ResidencyManager,
+		// -1 for no limit other than the global budget
+		llong    m_residencyBudget;
 
 		SchemaConfig();
 		~SchemaConfig();
 
+		// a row expires at "TTLColumn" + "TTLSeconds", in seconds since
+		// epoch, ttlColData is the TTLColumn of the row
+		bool  hasTTL() const { return size_t(-1) != m_ttlColumnId; }
+		llong getExpireTime(fstring ttlColData) const;
+
 		const Schema& getIndexSchema(size_t indexId) const {
 			assert(indexId < getIndexNum());
 			return *m_indexSchemaSet->m_nested.elem_at(indexId);
@@ -571,6 +600,13 @@ namespace terark { namespace db {
 	};
 	typedef boost::intrusive_ptr<SchemaConfig> SchemaConfigPtr;
 
+	// converts a row of a SchemaConfig to a row of the next SchemaVersion,
+	// see DbTable::alterRowSchema
+	typedef std::function<void(fstring oldRow, valvec<byte>* newRow)> RowTranscoder;
+
+	// size with an optional K/M/G/T/P suffix, "B" may follow, such as "64MB"
+	TERARK_DB_DLL llong parseSizeValue(fstring str);
+
 	struct TERARK_DB_DLL DbConf {
 		std::string dir;
 	};
@@ -19,6 +19,51 @@ static inline void RefcntPtr_release(T*& p) {
 	}
 }
 
+DbStats::DbStats() {
+	clear();
+}
+
+void DbStats::clear() {
+	lookupCnt = 0;
+	lookupSegProbeCnt = 0;
+	seekCnt = 0;
+	seekSegProbeCnt = 0;
+	getValueCnt = 0;
+	wrSegDecodeBytes = 0;
+	rwLockCnt = 0;
+	rwLockWaitNs = 0;
+	rwLockHoldNs = 0;
+	segCtxResyncCnt = 0;
+	batchCommitCnt = 0;
+	batchCommitNs = 0;
+	rowCacheHitCnt = 0;
+	rowCacheMissCnt = 0;
+	cgDecodeBytes.fill(DbStatCounter(0));
+}
+
+void DbStats::add(const DbStats& y) {
+	lookupCnt         += y.lookupCnt;
+	lookupSegProbeCnt += y.lookupSegProbeCnt;
+	seekCnt           += y.seekCnt;
+	seekSegProbeCnt   += y.seekSegProbeCnt;
+	getValueCnt       += y.getValueCnt;
+	wrSegDecodeBytes  += y.wrSegDecodeBytes;
+	rwLockCnt         += y.rwLockCnt;
+	rwLockWaitNs      += y.rwLockWaitNs;
+	rwLockHoldNs      += y.rwLockHoldNs;
+	segCtxResyncCnt   += y.segCtxResyncCnt;
+	batchCommitCnt    += y.batchCommitCnt;
+	batchCommitNs     += y.batchCommitNs;
+	rowCacheHitCnt    += y.rowCacheHitCnt;
+	rowCacheMissCnt   += y.rowCacheMissCnt;
+	if (cgDecodeBytes.size() < y.cgDecodeBytes.size()) {
+		cgDecodeBytes.resize(y.cgDecodeBytes.size(), 0);
+	}
+	for (size_t i = 0; i < y.cgDecodeBytes.size(); ++i) {
+		cgDecodeBytes[i] += y.cgDecodeBytes[i];
+	}
+}
+
 DbContext::SegCtx*
 DbContext::SegCtx::create(ReadableSegment* seg, size_t indexNum) {
 	size_t memsize = sizeof(SegCtx) + sizeof(IndexIteratorPtr) * (indexNum-1);
@@ -26,18 +71,21 @@ DbContext::SegCtx::create(ReadableSegment* seg, size_t indexNum) {
 	seg->add_ref();
 	p->seg = seg;
 	p->wrtStoreIter = NULL;
+	p->lookupCnt = 0;
+	p->indexNum = uint32_t(indexNum);
 	for (size_t i = 0; i < indexNum; ++i) {
 		p->indexIter[i] = NULL;
 	}
 	return p;
 }
-void DbContext::SegCtx::destory(SegCtx*& rp, size_t indexNum) {
+void DbContext::SegCtx::destory(SegCtx*& rp) {
 	SegCtx* p = rp;
-	for (size_t i = 0; i < indexNum; ++i) {
+	for (size_t i = 0; i < p->indexNum; ++i) {
 		RefcntPtr_release(p->indexIter[i]);
 	}
 	RefcntPtr_release(p->wrtStoreIter);
 	assert(NULL != p->seg);
+	p->publishStat();
 #if 0
 	if (p->seg->get_refcount() == 1) {
 		fprintf(stderr, "INFO: last refcnt, DbContext::SegCtx::destory(%s)\n"
@@ -48,19 +96,30 @@ void DbContext::SegCtx::destory(SegCtx*& rp, size_t indexNum) {
 	::free(p);
 	rp = NULL;
 }
-void DbContext::SegCtx::reset(SegCtx* p, size_t indexNum, ReadableSegment* seg) {
-	for (size_t i = 0; i < indexNum; ++i) {
+void DbContext::SegCtx::reset(SegCtx*& p, size_t indexNum, ReadableSegment* seg) {
+	if (p->indexNum < indexNum) {
+		destory(p);
+		p = create(seg, indexNum);
+		return;
+	}
+	for (size_t i = 0; i < p->indexNum; ++i) {
 		RefcntPtr_release(p->indexIter[i]);
 	}
 	RefcntPtr_release(p->wrtStoreIter);
 	assert(NULL != p->seg);
+	p->publishStat();
 	p->seg->release();
 	p->seg = seg;
 	seg->add_ref();
 }
 
+void DbContext::SegCtx::publishStat() {
+	seg->m_lookupCnt += lookupCnt;
+	lookupCnt = 0;
+}
+
 DbContextLink::DbContextLink() {
-//	m_prev = m_next = this;
+	m_prev = m_next = this;
 }
 
 DbContextLink::~DbContextLink() {
@@ -72,32 +131,37 @@ static std::atomic<size_t> g_dbCtxCreatedCnt;
 DbContext::DbContext(const DbTable* tab)
   : m_tab(const_cast<DbTable*>(tab))
 {
-// must calling the constructor in lock tab->m_rwMutex
-	size_t oldtab_segArrayUpdateSeq = tab->getSegArrayUpdateSeq();
-//	tab->registerDbContext(this);
+// does not need lock tab->m_rwMutex, segments are from a SegArrayVersion
+	SegArrayVersionPtr ver = tab->getSegArrayVersion();
 	regexMatchMemLimit = 16*1024*1024; // 16MB
-	size_t indexNum = tab->getIndexNum();
-	size_t segNum = tab->getSegNum();
+	scanReadAheadRows = getEnvLong("TerarkDB_ScanReadAheadRows", 0);
+	m_schema = ver->m_schema;
+	size_t indexNum = m_schema->getIndexNum();
+	size_t segNum = ver->m_segments.size();
 	m_segCtx.resize(segNum, NULL);
 	SegCtx** sctx = m_segCtx.data();
 	for (size_t i = 0; i < segNum; ++i) {
-		sctx[i] = SegCtx::create(tab->getSegmentPtr(i), indexNum);
+		sctx[i] = SegCtx::create(ver->m_segments[i].get(), indexNum);
 	}
-	m_wrSegPtr = tab->m_wrSeg.get();
+	m_wrSegPtr = ver->m_wrSeg.get();
 	if (m_wrSegPtr) {
 		m_transaction.reset(m_wrSegPtr->createTransaction());
 	}
-	m_rowNumVec.assign(tab->m_rowNumVec);
+	m_rowNumVec.assign(ver->m_rowNumVec);
+	segArrayUpdateSeq = ver->m_updateSeq;
 
 	// record id is also used as a snapshot version
-	m_mySnapshotVersion = tab->m_rowNum - 1;
+	llong rowNum = m_rowNumVec.empty() ? 0 : m_rowNumVec.back();
+	if (segArrayUpdateSeq == tab->m_segArrayUpdateSeq && !m_rowNumVec.empty()) {
+		rowNum = m_rowNumVec.back() = tab->m_rowNum;
+	}
+	m_mySnapshotVersion = rowNum - 1;
 	m_isUserDefineSnapshot = false;
 
-	segArrayUpdateSeq = tab->m_segArrayUpdateSeq;
 	syncIndex = true;
 	isUpsertOverwritten = 0;
-	TERARK_RT_assert(tab->getSegArrayUpdateSeq() == oldtab_segArrayUpdateSeq,
-					 std::logic_error);
+	m_stats.cgDecodeBytes.resize(tab->getColgroupNum(), 0);
+	tab->registerDbContext(this);
 	g_dbCtxLiveCnt++;
 	g_dbCtxCreatedCnt++;
 	if (getEnvBool("TerarkDB_TrackBuggyObjectLife")) {
@@ -107,33 +171,52 @@ DbContext::DbContext(const DbTable* tab)
 }
 
 DbContext::~DbContext() {
-//	m_tab->unregisterDbContext(this);
+	m_tab->unregisterDbContext(this);
 	this->m_transaction.reset(); // destory before m_segCtx
-	size_t indexNum = m_tab->getIndexNum();
 	for (auto& x : m_segCtx) {
 		assert(NULL != x);
-		SegCtx::destory(x, indexNum);
+		SegCtx::destory(x);
 	}
 	g_dbCtxLiveCnt--;
 }
 
+// in lock tab->m_rwMutex, the published SegArrayVersion is the latest
 void DbContext::doSyncSegCtxNoLock(const DbTable* tab) {
 	assert(tab == m_tab);
 	assert(this->segArrayUpdateSeq < tab->getSegArrayUpdateSeq());
+	SegArrayVersionPtr ver = tab->getSegArrayVersion();
+	TERARK_RT_assert(ver->m_updateSeq == tab->getSegArrayUpdateSeq(),
+					 std::logic_error);
+	doSyncSegCtx(*ver);
+	m_rowNumVec.back() = tab->m_rowNumVec.back();
 	if (!m_isUserDefineSnapshot) {
 		m_mySnapshotVersion = tab->m_rowNum - 1;
 	}
-	size_t indexNum = tab->getIndexNum();
-	size_t oldtab_segArrayUpdateSeq = tab->getSegArrayUpdateSeq();
+}
+
+// ver must be newer than the version this DbContext has synced
+void DbContext::doSyncSegCtx(const SegArrayVersion& ver) {
+	assert(this->segArrayUpdateSeq < ver.m_updateSeq);
+	m_stats.segCtxResyncCnt++;
+	if (!m_isUserDefineSnapshot) {
+		m_mySnapshotVersion = ver.m_rowNumVec.back() - 1;
+	}
+	m_schema = ver.m_schema;
+	size_t indexNum = m_schema->getIndexNum();
 	size_t oldSegNum = m_segCtx.size();
-	size_t segNum = tab->getSegNum();
+	size_t segNum = ver.m_segments.size();
 	if (m_segCtx.size() < segNum) {
 		m_segCtx.resize(segNum, NULL);
 		for (size_t i = oldSegNum; i < segNum; ++i)
-			m_segCtx[i] = SegCtx::create(tab->getSegmentPtr(i), indexNum);
+			m_segCtx[i] = SegCtx::create(ver.m_segments[i].get(), indexNum);
 	}
-	if (tab->m_wrSeg.get() != m_wrSegPtr) {
-		auto new_wrseg = tab->m_wrSeg.get();
+	// DbTable::addIndex adds an index to m_wrSeg in place, the transaction
+	// must be re-created for the new index
+	bool wrSegIndexAdded = m_wrSegPtr && oldSegNum &&
+		m_segCtx[oldSegNum-1]->seg == m_wrSegPtr &&
+		m_segCtx[oldSegNum-1]->indexNum < m_wrSegPtr->m_indices.size();
+	if (ver.m_wrSeg.get() != m_wrSegPtr || wrSegIndexAdded) {
+		auto new_wrseg = ver.m_wrSeg.get();
 		assert(DbTransaction::started != m_transaction->m_status);
 		m_transaction.reset();
 		if (new_wrseg) {
@@ -143,26 +226,31 @@ void DbContext::doSyncSegCtxNoLock(const DbTable* tab) {
 	}
 	SegCtx** sctx = m_segCtx.data();
 	for (size_t i = 0; i < segNum; ++i) {
-		ReadableSegment* seg = tab->getSegmentPtr(i);
+		ReadableSegment* seg = ver.m_segments[i].get();
 		if (NULL == sctx[i]) {
 			sctx[i] = SegCtx::create(seg, indexNum);
 			continue;
 		}
-		if (sctx[i]->seg == seg)
+		if (sctx[i]->seg == seg) {
+			if (sctx[i]->indexNum < indexNum)
+				SegCtx::reset(sctx[i], indexNum, seg); // index added
 			continue;
+		}
 		for (size_t j = i; j < oldSegNum; ++j) {
 			assert(NULL != sctx[j]);
 			if (sctx[j]->seg == seg) {
 				for (size_t k = i; k < j; ++k) {
 					// this should be a merged segments range
 					assert(NULL != sctx[k]);
-					SegCtx::destory(sctx[k], indexNum);
+					SegCtx::destory(sctx[k]);
 				}
 				for (size_t k = 0; k < oldSegNum - j; ++k) {
 					sctx[i + k] = sctx[j + k];
 					sctx[j + k] = NULL;
 				}
 				oldSegNum -= j - i;
+				if (sctx[i]->indexNum < indexNum)
+					SegCtx::reset(sctx[i], indexNum, seg);
 				goto Done;
 			}
 		}
@@ -173,19 +261,17 @@ void DbContext::doSyncSegCtxNoLock(const DbTable* tab) {
 	}
 	for (size_t i = segNum; i < m_segCtx.size(); ++i) {
 		if (sctx[i])
-			SegCtx::destory(sctx[i], indexNum);
+			SegCtx::destory(sctx[i]);
 	}
 	for (size_t i = 0; i < segNum; ++i) {
 		TERARK_RT_assert(NULL != sctx[i], std::logic_error);
 		TERARK_RT_assert(NULL != sctx[i]->seg, std::logic_error);
-		TERARK_RT_assert(tab->getSegmentPtr(i) == sctx[i]->seg, std::logic_error);
+		TERARK_RT_assert(ver.m_segments[i].get() == sctx[i]->seg, std::logic_error);
 	}
 	m_segCtx.risk_set_size(segNum);
-	m_rowNumVec.assign(tab->m_rowNumVec);
+	m_rowNumVec.assign(ver.m_rowNumVec);
 	TERARK_RT_assert(m_rowNumVec.size() == segNum + 1, std::logic_error);
-	TERARK_RT_assert(tab->getSegArrayUpdateSeq() == oldtab_segArrayUpdateSeq,
-					 std::logic_error);
-	segArrayUpdateSeq = tab->getSegArrayUpdateSeq();
+	segArrayUpdateSeq = ver.m_updateSeq;
 }
 
 StoreIterator* DbContext::getWrtStoreIterNoLock(size_t segIdx) {
@@ -205,8 +291,9 @@ StoreIterator* DbContext::getWrtStoreIterNoLock(size_t segIdx) {
 IndexIterator* DbContext::getIndexIterNoLock(size_t segIdx, size_t indexId) {
 // can be slightly not sync with tab
 	assert(segIdx < m_segCtx.size());
-	assert(indexId < m_tab->getIndexNum());
+	assert(indexId < m_schema->getIndexNum());
 	SegCtx* sc = m_segCtx[segIdx];
+	assert(indexId < sc->indexNum);
 	auto& indexIter = sc->indexIter[indexId];
 	if (indexIter == nullptr) {
 		indexIter = m_segCtx[segIdx]->seg->m_indices[indexId]->createIndexIterForward(this);
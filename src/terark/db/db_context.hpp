@@ -2,6 +2,7 @@
 #define __terark_db_db_context_hpp__
 
 #include "db_conf.hpp"
+#include <atomic>
 
 namespace terark {
 	class BaseDFA;
@@ -11,13 +12,62 @@ namespace terark { namespace db {
 
 typedef boost::intrusive_ptr<class DbTable> DbTablePtr;
 typedef boost::intrusive_ptr<class StoreIterator> StoreIteratorPtr;
+class SegArrayVersion;
+
+// A counter written by one thread and read by DbTable::getStats from
+// other threads, relaxed load and store, no read-modify-write
+class DbStatCounter {
+	std::atomic<llong> m_val;
+public:
+	DbStatCounter(llong val = 0) : m_val(val) {}
+	DbStatCounter(const DbStatCounter& y) : m_val(y.get()) {}
+	DbStatCounter& operator=(const DbStatCounter& y) { set(y.get()); return *this; }
+	DbStatCounter& operator+=(llong inc) { set(get() + inc); return *this; }
+	DbStatCounter& operator++() { set(get() + 1); return *this; }
+	void operator++(int) { set(get() + 1); }
+	llong get() const { return m_val.load(std::memory_order_relaxed); }
+	void  set(llong val) { m_val.store(val, std::memory_order_relaxed); }
+	operator llong() const { return get(); }
+};
+
+// Runtime statistics counters of a DbContext, a DbContext is used by one
+// thread at a time, DbTable::getStats aggregates counters of all live and
+// destroyed DbContext of the table.
+// Time is in nano seconds
+struct TERARK_DB_DLL DbStats {
+	DbStatCounter lookupCnt;         // indexSearchExact and indexKeyExists
+	DbStatCounter lookupSegProbeCnt; // segments probed by lookups
+	DbStatCounter seekCnt;           // TableIndexIter seekLowerBound/seekUpperBound
+	DbStatCounter seekSegProbeCnt;   // segment index iterators seeked by seekCnt
+	DbStatCounter getValueCnt;
+	DbStatCounter wrSegDecodeBytes;  // bytes read from WritableSegment
+	DbStatCounter rwLockCnt;         // DbTable::m_rwMutex acquired by writers
+	DbStatCounter rwLockWaitNs;
+	DbStatCounter rwLockHoldNs;
+	DbStatCounter segCtxResyncCnt;   // DbContext::doSyncSegCtxNoLock
+	DbStatCounter batchCommitCnt;
+	DbStatCounter batchCommitNs;
+	DbStatCounter rowCacheHitCnt;
+	DbStatCounter rowCacheMissCnt;
+	// ReadonlySegment, indexed by colgroupId, size is fixed when the
+	// DbContext is created
+	valvec<DbStatCounter> cgDecodeBytes;
+
+	DbStats();
+	void clear();
+	void add(const DbStats& y);
+	void addDecodeBytes(size_t cgId, size_t bytes) {
+		if (cgId < cgDecodeBytes.size())
+			cgDecodeBytes[cgId] += bytes;
+	}
+};
 
 class TERARK_DB_DLL DbContextLink : public RefCounter {
 	friend class DbTable;
 protected:
 	DbContextLink();
 	~DbContextLink();
-//	DbContextLink *m_prev, *m_next;
+	DbContextLink *m_prev, *m_next;
 };
 class TERARK_DB_DLL DbContext : public DbContextLink {
 	friend class DbTable;
@@ -25,6 +75,7 @@ public:
 	explicit DbContext(const DbTable* tab);
 	~DbContext();
 
+	void doSyncSegCtx(const SegArrayVersion& ver);
 	void doSyncSegCtxNoLock(const DbTable* tab);
 	void trySyncSegCtxNoLock(const DbTable* tab);
 	void trySyncSegCtxSpeculativeLock(const DbTable* tab);
@@ -69,6 +120,9 @@ public:
 
 	void selectOneColgroup(llong id, size_t cgId, valvec<byte>* cgData);
 
+	void getValuesBatch(const llong* ids, size_t num, valvec<byte>* vals, valvec<size_t>* offsets);
+	void selectColumnsBatch(const llong* ids, size_t num, const size_t* colsId, size_t colsNum, valvec<byte>* colsData, valvec<size_t>* offsets);
+
 	void selectColumnsNoLock(llong id, const valvec<size_t>& cols, valvec<byte>* colsData);
 	void selectColumnsNoLock(llong id, const size_t* colsId, size_t colsNum, valvec<byte>* colsData);
 	void selectOneColumnNoLock(llong id, size_t columnId, valvec<byte>* colsData);
@@ -85,6 +139,8 @@ public:
 	struct SegCtx {
 		class ReadableSegment* seg;
 		class StoreIterator* wrtStoreIter;
+		uint32_t lookupCnt; // published to seg->m_lookupCnt in batches
+		uint32_t indexNum;  // DbTable::addIndex may increase index num
 		class IndexIterator* indexIter[1];
 	private:
 		friend class DbContext;
@@ -93,14 +149,22 @@ public:
 		SegCtx(const SegCtx&) = delete;
 		SegCtx& operator=(const SegCtx&) = delete;
 		static SegCtx* create(ReadableSegment* seg, size_t indexNum);
-		static void destory(SegCtx*& p, size_t indexNum);
-		static void reset(SegCtx* p, size_t indexNum, ReadableSegment* seg);
+		static void destory(SegCtx*& p);
+		static void reset(SegCtx*& p, size_t indexNum, ReadableSegment* seg);
+	public:
+		static const uint32_t StatBatch = 256;
+		void countLookup() {
+			if (terark_unlikely(++lookupCnt == StatBatch))
+				publishStat();
+		}
+		void publishStat();
 	};
 	DbTable* m_tab;
 	class WritableSegment* m_wrSegPtr;
 	std::unique_ptr<class DbTransaction> m_transaction;
 	valvec<SegCtx*> m_segCtx;
 	valvec<llong>   m_rowNumVec; // copy of DbTable::m_rowNumVec
+	SchemaConfigPtr m_schema;    // schema of the synced SegArrayVersion
 	llong           m_mySnapshotVersion;
 	std::string  errMsg;
 	valvec<byte> buf1;
@@ -114,7 +178,12 @@ public:
 	ColumnVec    cols1;
 	ColumnVec    cols2;
 	valvec<llong> exactMatchRecIdvec;
+	DbStats      m_stats;
 	size_t regexMatchMemLimit;
+	// if not 0, forward scan of ReadonlySegment decodes batches of this
+	// many rows ahead on a helper thread, for large sequential scans, the
+	// default is env TerarkDB_ScanReadAheadRows
+	size_t scanReadAheadRows;
 	size_t segArrayUpdateSeq;
 	bool syncIndex;
 	bool m_isUserDefineSnapshot;
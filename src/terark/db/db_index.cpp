@@ -90,10 +90,34 @@ WritableIndex::~WritableIndex() {
 IndexIterator::IndexIterator() {
 	// m_isUniqueInSchema is just for a minor performance improve
 	m_isUniqueInSchema = false;
+	m_appliesEndBound = false;
+	m_endBoundInclusive = false;
+	m_endBoundSchema = NULL;
 }
 IndexIterator::~IndexIterator() {
 }
 
+void IndexIterator::setEndBound(fstring bound, bool inclusive,
+								const Schema& schema) {
+	m_endBound.assign(bound);
+	m_endBoundInclusive = inclusive;
+	m_endBoundSchema = &schema;
+}
+
+void IndexIterator::clearEndBound() {
+	m_endBound.erase_all();
+	m_endBoundSchema = NULL;
+}
+
+bool IndexIterator::isPastEndBoundImpl(fstring key, bool forward) const {
+	assert(NULL != m_endBoundSchema);
+	int cmp = m_endBoundSchema->compareData(key, m_endBound);
+	if (forward)
+		return cmp > 0 || (cmp == 0 && !m_endBoundInclusive);
+	else
+		return cmp < 0 || (cmp == 0 && !m_endBoundInclusive);
+}
+
 int
 IndexIterator::seekUpperBound(fstring key, llong* id, valvec<byte>* retKey) {
 	int ret = seekLowerBound(key, id, retKey);
@@ -10,6 +10,16 @@ typedef boost::intrusive_ptr<class ReadableIndex> ReadableIndexPtr;
 class TERARK_DB_DLL IndexIterator : public RefCounter {
 protected:
 	bool m_isUniqueInSchema;
+	bool m_appliesEndBound; // set by iters which check the end bound
+	bool m_endBoundInclusive;
+	const Schema* m_endBoundSchema; // NULL if there is no end bound
+	valvec<byte>  m_endBound;
+
+	bool isPastEndBound(fstring key, bool forward) const {
+		return m_endBoundSchema && isPastEndBoundImpl(key, forward);
+	}
+	bool isPastEndBoundImpl(fstring key, bool forward) const;
+
 public:
 	IndexIterator();
 	virtual ~IndexIterator();
@@ -37,6 +47,17 @@ public:
 	///         if the return value is 0, it has the same effect as reset
 	virtual size_t seekMaxPrefix(fstring key, llong* id, valvec<byte>* retKey);
 
+	/// keys past the end bound are not returned by increment and seek:
+	///   forward  iter: key > bound, or key == bound && !inclusive
+	///   backward iter: key < bound, or key == bound && !inclusive
+	/// the bound is kept by reset and seek until clearEndBound,
+	/// if appliesEndBound() is false, the bound is just saved, the caller
+	/// (such as the iter of DbTable) should check the keys by itself
+	virtual void setEndBound(fstring bound, bool inclusive, const Schema&);
+	virtual void clearEndBound();
+	bool hasEndBound() const { return m_endBoundSchema != NULL; }
+	bool appliesEndBound() const { return m_appliesEndBound; }
+
 	inline bool isUniqueInSchema() const { return m_isUniqueInSchema; }
 };
 typedef boost::intrusive_ptr<IndexIterator> IndexIteratorPtr;
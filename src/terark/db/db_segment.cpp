@@ -5,6 +5,8 @@
 #include "fixed_len_key_index.hpp"
 #include "fixed_len_store.hpp"
 #include "appendonly.hpp"
+#include "row_cache.hpp"
+#include "rate_limiter.hpp"
 #include <terark/util/autoclose.hpp>
 #include <terark/io/FileStream.hpp>
 #include <terark/io/StreamBuffer.hpp>
@@ -14,6 +16,7 @@
 #include <terark/num_to_str.hpp>
 #include <terark/util/mmap.hpp>
 #include <terark/util/sortable_strvec.hpp>
+#include <terark/util/linebuf.hpp>
 #include <terark/util/truncate_file.hpp>
 
 //#define TERARK_DB_ENABLE_DFA_META
@@ -32,11 +35,17 @@
 #include "json.hpp"
 
 #include <boost/scope_exit.hpp>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
 
 //#define SLOW_DEBUG_CHECK
 
 namespace terark { namespace db {
 
+static const char g_storeSelectFile[] = "store-select.json";
+
 namespace fs = boost::filesystem;
 
 
@@ -49,6 +58,9 @@ ReadableSegment::ReadableSegment() {
 	m_bookUpdates = false;
 	m_withPurgeBits = false;
 	m_isPurgedMmap = nullptr;
+	m_lookupCnt = 0;
+	m_seekCnt = 0;
+	m_cacheId = RowCache::newSegmentCacheId();
 }
 ReadableSegment::~ReadableSegment() {
 	if (m_isDelMmap) {
@@ -97,13 +109,17 @@ void ReadableSegment::saveIsDel(PathRef dir) const {
 		// need not to save, mmap is sys memory
 		return;
 	}
+	saveIsDel_aux(dir, m_isDel);
+}
+
+void ReadableSegment::saveIsDel_aux(PathRef dir, const febitvec& isDel) {
 	fs::path isDelFpath = dir / "IsDel";
 	fs::path tmpFpath = isDelFpath + ".tmp";
 	{
 		NativeDataOutput<FileStream> file;
 		file.open(tmpFpath.string().c_str(), "wb");
-		file << uint64_t(m_isDel.size());
-		file.ensureWrite(m_isDel.bldata(), m_isDel.mem_size());
+		file << uint64_t(isDel.size());
+		file.ensureWrite(isDel.bldata(), isDel.mem_size());
 	}
 	fs::rename(tmpFpath, isDelFpath);
 }
@@ -278,6 +294,8 @@ ReadonlySegment::ReadonlySegment() {
 	m_dataInflateSize = 0;
 	m_isFreezed = true;
 	m_isPurgedMmap = 0;
+	m_maxExpireTime = LLONG_MIN;
+	m_buildTime = llong(time(NULL));
 }
 ReadonlySegment::~ReadonlySegment() {
 	if (m_isPurgedMmap) {
@@ -316,8 +334,26 @@ const {
 	getValueByPhysicId(getPhysicId(id), val, ctx);
 }
 
+// rows of updatable colgroups may be changed inplace, they are not cached
 void
 ReadonlySegment::getValueByPhysicId(size_t id, valvec<byte>* val, DbContext* ctx)
+const {
+	RowCache* rowCache = ctx->m_tab->m_rowCache.get();
+	if (NULL == rowCache || !m_schema->m_updatableColgroups.empty()) {
+		getValueByPhysicIdNoCache(id, val, ctx);
+		return;
+	}
+	if (rowCache->get(m_cacheId, id, val)) {
+		ctx->m_stats.rowCacheHitCnt++;
+		return;
+	}
+	ctx->m_stats.rowCacheMissCnt++;
+	getValueByPhysicIdNoCache(id, val, ctx);
+	rowCache->put(m_cacheId, id, *val);
+}
+
+void
+ReadonlySegment::getValueByPhysicIdNoCache(size_t id, valvec<byte>* val, DbContext* ctx)
 const {
 	val->risk_set_size(0);
 	ctx->buf1.risk_set_size(0);
@@ -330,6 +366,7 @@ const {
 		if (iSchema.m_keepCols.has_any1()) {
 			size_t oldsize = ctx->buf1.size();
 			m_colgroups[i]->getValueAppend(id, &ctx->buf1, ctx);
+			ctx->m_stats.addDecodeBytes(i, ctx->buf1.size() - oldsize);
 			iSchema.parseRowAppend(ctx->buf1, oldsize, &ctx->cols1);
 		}
 		else {
@@ -370,6 +407,12 @@ ReadonlySegment::indexSearchExactAppend(size_t mySegIdx, size_t indexId,
 	size_t oldsize = recIdvec->size();
 	auto index = m_indices[indexId].get();
 	index->searchExactAppend(key, recIdvec, ctx);
+	physicToLiveLogicIds(recIdvec, oldsize, ctx);
+}
+
+void
+ReadonlySegment::physicToLiveLogicIds(valvec<llong>* recIdvec, size_t oldsize,
+									  DbContext* ctx) const {
 	if (recIdvec->size() == oldsize) {
 		return;
 	}
@@ -426,9 +469,17 @@ ReadonlySegment::selectColumns(llong recId,
 							   valvec<byte>* colsData, DbContext* ctx)
 const {
 	assert(recId >= 0);
-	recId = getPhysicId(size_t(recId));
+	selectColumnsByPhysicId(getPhysicId(size_t(recId)), colsId, colsNum, colsData, ctx);
+}
+
+void
+ReadonlySegment::selectColumnsByPhysicId(size_t physicId,
+							   const size_t* colsId, size_t colsNum,
+							   valvec<byte>* colsData, DbContext* ctx)
+const {
 	colsData->erase_all();
 	ctx->buf1.erase_all();
+	ctx->cols1.erase_all();
 	ctx->offsets.resize_fill(m_colgroups.size(), UINT32_MAX);
 	auto offsets = ctx->offsets.data();
 	for(size_t i = 0; i < colsNum; ++i) {
@@ -439,7 +490,8 @@ const {
 		const Schema& schema = m_schema->getColgroupSchema(colgroupId);
 		if (offsets[colgroupId] == UINT32_MAX) {
 			offsets[colgroupId] = ctx->cols1.size();
-			m_colgroups[colgroupId]->getValueAppend(recId, &ctx->buf1, ctx);
+			m_colgroups[colgroupId]->getValueAppend(physicId, &ctx->buf1, ctx);
+			ctx->m_stats.addDecodeBytes(colgroupId, ctx->buf1.size() - oldsize);
 			schema.parseRowAppend(ctx->buf1, oldsize, &ctx->cols1);
 		}
 		fstring d = ctx->cols1[offsets[colgroupId] + cp.subColumnId];
@@ -464,9 +516,11 @@ const {
 //		, m_schema->m_colproject.size(), colgroupId, schema.columnNum());
 	if (schema.columnNum() == 1) {
 		m_colgroups[colgroupId]->getValue(recId, colsData, ctx);
+		ctx->m_stats.addDecodeBytes(colgroupId, colsData->size());
 	}
 	else {
 		m_colgroups[colgroupId]->getValue(recId, &ctx->buf1, ctx);
+		ctx->m_stats.addDecodeBytes(colgroupId, ctx->buf1.size());
 		schema.parseRow(ctx->buf1, &ctx->cols1);
 		colsData->erase_all();
 		colsData->append(ctx->cols1[cp.subColumnId]);
@@ -484,6 +538,7 @@ void ReadonlySegment::selectColgroups(llong recId,
 		}
 		llong physicId = this->getPhysicId(recId);
 		m_colgroups[cgId]->getValue(physicId, &cgDataVec[i], ctx);
+		ctx->m_stats.addDecodeBytes(cgId, cgDataVec[i].size());
 	}
 }
 
@@ -502,7 +557,7 @@ public:
 			m_id++;
 		if (terark_likely(size_t(m_id) < rows)) {
 			*id = m_id++;
-			owner->getValueByLogicId(*id, val, m_ctx.get());
+			owner->getValueByPhysicIdNoCache(owner->getPhysicId(*id), val, m_ctx.get());
 			return true;
 		}
 		return false;
@@ -539,7 +594,7 @@ public:
 			 --m_id;
 		if (terark_likely(m_id > 0)) {
 			*id = --m_id;
-			owner->getValueByLogicId(*id, val, m_ctx.get());
+			owner->getValueByPhysicIdNoCache(owner->getPhysicId(*id), val, m_ctx.get());
 			return true;
 		}
 		return false;
@@ -562,9 +617,252 @@ public:
 		m_id = owner->m_isDel.size();
 	}
 };
+// Forward scan with read-ahead, rows are decoded in batches of at most
+// ctx->scanReadAheadRows rows and ReadAheadMaxBytes bytes by a helper
+// thread into a double buffer: the consumer reads the front batch while the
+// helper decodes the back batch. Stores which map rows to file ranges
+// (FixedLenStore, ZipIntStore) also get WILLNEED hints for the batch after
+// the back batch, the other stores (nlt, DictZip) are paged in by decoding.
+// The helper is started by the first increment and joined at the end of
+// the segment, so a table scan, which walks segments one by one, has at
+// most one helper thread and one helper DbContext at a time.
+// Deleted rows are skipped by the helper and checked again on consuming,
+// because rows may be deleted after they were decoded.
+class ReadonlySegment::MyStoreIterReadAhead : public StoreIterator {
+	static const size_t ReadAheadMaxBytes = 8*1024*1024;
+	struct Batch {
+		valvec<llong>    ids;
+		valvec<size_t>   offsets; // ids.size() + 1
+		valvec<byte>     data;
+		llong            endId; // logic id after this batch
+	};
+	DbContextPtr m_ctx;
+	DbContextPtr m_helperCtx; // helper thread can not share m_ctx
+	Batch   m_batch[2];
+	size_t  m_front;  // index of the batch being consumed
+	size_t  m_pos;    // consume position in front batch
+	size_t  m_batchRows;
+	llong   m_nextBeg;  // increment restarts from it if !m_primed
+	bool    m_primed;   // front batch is valid
+	bool    m_pending;  // helper is filling the back batch
+	bool    m_started;
+	bool    m_stop;
+	llong   m_requestBeg; // helper fills back batch from this logic id
+	std::exception_ptr m_helperError;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::thread m_thread;
+
+	const ReadonlySegment* owner() const {
+		return static_cast<const ReadonlySegment*>(m_store.get());
+	}
+	void fill(Batch& b, llong beg) {
+		auto seg = owner();
+		llong rows = seg->m_isDel.size();
+		seg->adviseWillNeed(beg + m_batchRows, beg + 2 * m_batchRows);
+		b.ids.erase_all();
+		b.data.erase_all();
+		b.offsets.erase_all();
+		b.offsets.push_back(0);
+		valvec<byte>& val = m_helperCtx->row1;
+		llong id = beg;
+		for (; id < rows && b.ids.size() < m_batchRows
+				&& b.data.size() < ReadAheadMaxBytes; ++id) {
+			if (seg->m_isDel[id])
+				continue;
+			seg->getValueByPhysicIdNoCache(seg->getPhysicId(id), &val, m_helperCtx.get());
+			b.ids.push_back(id);
+			b.data.append(val);
+			b.offsets.push_back(b.data.size());
+		}
+		b.endId = id;
+	}
+	void helperThreadFunc() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for (;;) {
+			m_cond.wait(lock, [this]{ return m_stop || m_pending; });
+			if (m_stop)
+				break;
+			llong beg = m_requestBeg;
+			Batch& back = m_batch[1 - m_front];
+			lock.unlock();
+			try {
+				fill(back, beg);
+			}
+			catch (...) {
+				lock.lock();
+				m_helperError = std::current_exception();
+				m_pending = false;
+				m_cond.notify_all();
+				continue;
+			}
+			lock.lock();
+			m_pending = false;
+			m_cond.notify_all();
+		}
+	}
+	void requestFill(llong beg) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_requestBeg = beg;
+		m_pending = true;
+		m_cond.notify_all();
+	}
+	void waitFill() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [this]{ return !m_pending; });
+		if (m_helperError) {
+			std::exception_ptr ex = m_helperError;
+			m_helperError = nullptr;
+			std::rethrow_exception(ex);
+		}
+	}
+	void startHelper() {
+		m_helperCtx.reset(m_ctx->m_tab->createDbContextNoLock());
+		m_stop = false;
+		m_thread = std::thread(&MyStoreIterReadAhead::helperThreadFunc, this);
+		m_started = true;
+	}
+	void stopHelper() {
+		if (m_started) {
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cond.wait(lock, [this]{ return !m_pending; });
+				m_stop = true;
+				m_cond.notify_all();
+			}
+			m_thread.join();
+			m_started = false;
+			m_helperCtx.reset();
+			m_helperError = nullptr;
+		}
+	}
+	void restart(llong beg) {
+		if (m_started)
+			waitFill(); // the back batch would be discarded
+		else
+			startHelper();
+		Batch& front = m_batch[m_front];
+		front.ids.erase_all();
+		front.endId = beg;
+		m_pos = 0;
+		m_primed = true;
+		requestFill(beg);
+	}
+	void unprime(llong nextBeg) {
+		if (m_started)
+			waitFill(); // m_batch may be being filled
+		m_nextBeg = nextBeg;
+		m_primed = false;
+	}
+public:
+	MyStoreIterReadAhead(const ReadonlySegment* owner, DbContext* ctx)
+	  : m_ctx(ctx) {
+		m_store.reset(const_cast<ReadonlySegment*>(owner));
+		m_batchRows = ctx->scanReadAheadRows;
+		m_front = 0;
+		m_pos = 0;
+		m_nextBeg = 0;
+		m_primed = false;
+		m_pending = false;
+		m_started = false;
+		m_stop = false;
+		m_requestBeg = 0;
+		m_batch[0].endId = 0;
+	}
+	~MyStoreIterReadAhead() {
+		stopHelper();
+	}
+	bool increment(llong* id, valvec<byte>* val) override {
+		auto seg = owner();
+		llong rows = seg->m_isDel.size();
+		if (terark_unlikely(!m_primed)) {
+			if (m_nextBeg >= rows)
+				return false;
+			restart(m_nextBeg);
+		}
+		for (;;) {
+			Batch& front = m_batch[m_front];
+			while (m_pos < front.ids.size()) {
+				size_t i = m_pos++;
+				llong  k = front.ids[i];
+				if (seg->m_isDel[k])
+					continue;
+				*id = k;
+				val->assign(front.data.data() + front.offsets[i],
+							front.offsets[i+1] - front.offsets[i]);
+				return true;
+			}
+			if (front.endId >= rows) {
+				stopHelper(); // nothing is pending at the end
+				return false;
+			}
+			waitFill();
+			m_front = 1 - m_front;
+			m_pos = 0;
+			llong nextBeg = m_batch[m_front].endId;
+			if (nextBeg < rows) {
+				requestFill(nextBeg);
+			}
+		}
+	}
+	bool seekExact(llong id, valvec<byte>* val) override {
+		auto seg = owner();
+		llong rows = seg->m_isDel.size();
+		if (terark_likely(id >= 0 && id < rows)) {
+			// do not check m_isDel, always success!
+			seg->getValueByLogicId(id, val, m_ctx.get());
+			unprime(id + 1); // point lookups do not start the helper
+			return true;
+		}
+		fprintf(stderr, "ERROR: %s: id = %lld, rows = %lld\n"
+			, BOOST_CURRENT_FUNCTION, id, rows);
+		return false;
+	}
+	void reset() override {
+		unprime(0);
+	}
+};
+
 StoreIterator* ReadonlySegment::createStoreIterForward(DbContext* ctx) const {
+	if (ctx && ctx->scanReadAheadRows) {
+		return new MyStoreIterReadAhead(this, ctx);
+	}
 	return new MyStoreIterForward(this, ctx);
 }
+
+void ReadonlySegment::prefetchLogicId(size_t logicId) const {
+	if (!m_isPurged.empty() && logicId < m_isPurged.size()) {
+		ReadableStore::prefetchMem(m_isPurged.bldata() + logicId / WordBits);
+	}
+}
+
+void
+ReadonlySegment::prefetchPhysicId(size_t physicId, const size_t* cgIdvec, size_t cgNum)
+const {
+	if (cgIdvec) {
+		for (size_t i = 0; i < cgNum; ++i)
+			m_colgroups[cgIdvec[i]]->prefetchRecord(physicId);
+		return;
+	}
+	for (size_t i = 0; i < m_colgroups.size(); ++i) {
+		if (m_schema->getColgroupSchema(i).m_keepCols.has_any1())
+			m_colgroups[i]->prefetchRecord(physicId);
+	}
+}
+
+void ReadonlySegment::adviseWillNeed(llong logicBeg, llong logicEnd) const {
+	llong rows = m_isDel.size();
+	logicEnd = std::min(logicEnd, rows);
+	if (logicBeg >= logicEnd)
+		return;
+	llong physicBeg = getPhysicId(size_t(logicBeg));
+	llong physicEnd = logicEnd < rows
+					? getPhysicId(size_t(logicEnd))
+					: llong(m_isPurged.empty() ? rows : m_isPurged.max_rank0());
+	for (size_t i = 0; i < m_colgroups.size(); ++i) {
+		m_colgroups[i]->adviseWillNeed(physicBeg, physicEnd);
+	}
+}
 StoreIterator* ReadonlySegment::createStoreIterBackward(DbContext* ctx) const {
 	return new MyStoreIterBackward(this, ctx);
 }
@@ -649,6 +947,106 @@ namespace {
 	};
 }
 
+// Candidates are built from a strided sample of about AutoStoreSampleSize
+// bytes, a candidate which can not be built(such as buildStore returns NULL
+// or throws) is skipped
+void
+ReadonlySegment::selectStoreByTrial(const Schema& schema, ReadableStore* tmpStore,
+									PathRef trialDir, DbContext* ctx,
+									StoreSelection* sel) const {
+	const size_t fixlen = schema.getFixedRowLen();
+	const llong  rows = tmpStore->numDataRows();
+	const llong  sampleSize = std::max<llong>(m_schema->m_autoStoreSampleSize, 1);
+	const llong  step = std::max<llong>(tmpStore->dataInflateSize() / sampleSize, 1);
+	const double w = m_schema->m_autoStoreSpeedWeight;
+	sel->kind = NULL;
+	sel->sampleRows = 0;
+	sel->sampleBytes = 0;
+	sel->trials.clear();
+	fs::remove_all(trialDir); // left by a crash
+	fs::create_directories(trialDir);
+	BOOST_SCOPE_EXIT(&trialDir) {
+		boost::system::error_code ec;
+		fs::remove_all(trialDir, ec);
+	} BOOST_SCOPE_EXIT_END;
+
+	SortableStrVec sample;
+	std::unique_ptr<SeqReadAppendonlyStore> sampleStore(
+		new SeqReadAppendonlyStore(trialDir, schema));
+	{
+		StoreIteratorPtr iter = tmpStore->ensureStoreIterForward(NULL);
+		valvec<byte> buf;
+		llong id = -1;
+		while (iter->increment(&id, &buf) && id < rows) {
+			if (id % step)
+				continue;
+			if (fixlen)
+				sample.m_strpool.append(buf);
+			else
+				sample.push_back(buf);
+			sampleStore->append(buf, NULL);
+			sel->sampleRows++;
+		}
+		sampleStore->shrinkToFit();
+	}
+	sel->sampleBytes = sample.str_size();
+	if (0 == sel->sampleRows) {
+		return;
+	}
+	auto measure = [&](const char* kind, const std::function<ReadableStore*()>& build) {
+		ReadableStorePtr store;
+		try {
+			store = build();
+		}
+		catch (const std::exception& ex) {
+			fprintf(stderr, "INFO: colgroup %s: trial of %s failed: %s\n"
+				, schema.m_name.c_str(), kind, ex.what());
+		}
+		if (!store || store->numDataRows() != sel->sampleRows) {
+			return;
+		}
+		valvec<byte> val;
+		profiling pf;
+		llong t0 = pf.now();
+		for (llong id = 0; id < sel->sampleRows; ++id) {
+			val.erase_all();
+			store->getValueAppend(id, &val, ctx);
+		}
+		StoreSelection::Trial t;
+		t.kind = kind;
+		t.storageSize = store->dataStorageSize();
+		t.decodeNs = double(pf.ns(t0, pf.now())) / sel->sampleRows;
+		double ratio = std::max(double(t.storageSize) / std::max<llong>(sel->sampleBytes, 1), 1e-6);
+		t.cost = pow(ratio, 1 - w) * pow(std::max(t.decodeNs, 1.0), w);
+		sel->trials.push_back(t);
+		if (!sel->kind || t.cost < sel->trials[sel->bestIdx].cost) {
+			sel->kind = kind;
+			sel->bestIdx = sel->trials.size() - 1;
+		}
+	};
+	if (fixlen) {
+		measure("fixlen", [&]() {
+			std::unique_ptr<FixedLenStore> store(new FixedLenStore(trialDir, schema));
+			SortableStrVec strVec(sample);
+			store->build(strVec);
+			store->load(trialDir / ("colgroup-" + schema.m_name + ".fixlen"));
+			return store.release();
+		});
+	}
+	if (!schema.should_use_FixedLenStore()) {
+		measure("build", [&]() {
+			SortableStrVec strVec(sample);
+			return this->buildStore(schema, strVec);
+		});
+	}
+	if (schema.m_dictZipLocalMatch && schema.m_dictZipSampleRatio >= 0.0) {
+		measure("dictzip", [&]() {
+			StoreIteratorPtr iter = sampleStore->ensureStoreIterForward(NULL);
+			return this->buildDictZipStore(schema, trialDir, *iter, NULL, NULL);
+		});
+	}
+}
+
 ///@param iter record id from iter is physical id
 ///@param isDel new logical deletion mark
 ///@param isPurged physical deletion mark
@@ -715,20 +1113,58 @@ ReadonlySegment::convFrom(DbTable* tab, size_t segIdx)
 	assert(input->m_isFreezed);
 	assert(input->m_updateList.empty());
 	assert(input->m_bookUpdates == false);
+	tab->markExpiredRows(input.get(), ctx.get()); // dropped as deleted
 	input->m_updateList.reserve(1024);
 	input->m_bookUpdates = true;
 	m_isDel = input->m_isDel; // make a copy, input->m_isDel[*] may be changed
 //	m_delcnt = m_isDel.popcnt(); // recompute delcnt
+	assert(input->m_isDel.size() > 0);
+	ConvRowObserverPtr observer(tab->createConvRowObserver(*m_schema->m_rowSchema));
+	if (m_isDel.popcnt() == m_isDel.size()) {
+		// all rows are deleted or expired, there is nothing to build, the
+		// data is dropped and just the row id range is kept as purged rows,
+		// ids of later segments must not be changed, merge will fold it away
+		fprintf(stderr
+			, "INFO: convFrom: %s: all %zd rows are deleted, data dropped\n"
+			, m_segDir.string().c_str(), m_isDel.size());
+		size_t indexNum = m_schema->getIndexNum();
+		size_t colgroupNum = m_schema->getColgroupNum();
+		m_delcnt = m_isDel.size();
+		m_indices.resize(indexNum);
+		m_colgroups.resize(colgroupNum);
+		for (size_t i = 0; i < indexNum; ++i) {
+			m_indices[i] = new EmptyIndexStore();
+			m_colgroups[i] = m_indices[i]->getReadableStore();
+		}
+		ReadableStorePtr store = new EmptyIndexStore();
+		m_colgroups.fill(indexNum, colgroupNum-indexNum, store);
+	}
+	else {
+		buildFrom(input.get(), NULL, observer.get(), tmpDir, ctx.get());
+	}
+	if (observer) {
+		observer->complete(tmpDir);
+		observer.reset();
+	}
+	completeAndReload(tab, segIdx, &*input);
+
+	fs::rename(tmpDir, m_segDir);
+	input->deleteSegment();
+}
+
+llong
+ReadonlySegment::buildFrom(ReadableSegment* input, const RowTranscoder* transcode,
+						   ConvRowObserver* observer, PathRef tmpDir, DbContext* ctx)
+{
 	llong logicRowNum = input->m_isDel.size();
 	llong newRowNum = 0;
-	assert(logicRowNum > 0);
 	size_t indexNum = m_schema->getIndexNum();
-{
 	TempFileList colgroupTempFiles(tmpDir, *m_schema->m_colgroupSchemaSet);
+	BgRateLimiter::Pacer pacer;
 {
 	ColumnVec columns(m_schema->columnNum(), valvec_reserve());
-	valvec<byte> buf;
-	StoreIteratorPtr iter(input->createStoreIterForward(ctx.get()));
+	valvec<byte> buf, newRow;
+	StoreIteratorPtr iter(input->createStoreIterForward(ctx));
 	llong prevId = -1;
 	llong id = -1;
 	while (iter->increment(&id, &buf) && id < logicRowNum) {
@@ -736,8 +1172,15 @@ ReadonlySegment::convFrom(DbTable* tab, size_t segIdx)
 		assert(id < logicRowNum);
 		assert(prevId < id);
 		if (!m_isDel[id]) {
+			if (transcode) {
+				(*transcode)(buf, &newRow);
+				buf.swap(newRow);
+			}
 			m_schema->m_rowSchema->parseRow(buf, &columns);
 			colgroupTempFiles.writeColgroups(columns);
+			pacer.pace(buf.size());
+			if (observer)
+				observer->observe(buf);
 			newRowNum++;
 			m_isDel.beg_end_set1(prevId+1, id);
 			prevId = id;
@@ -745,7 +1188,9 @@ ReadonlySegment::convFrom(DbTable* tab, size_t segIdx)
 	}
 	llong inputRowNum = id + 1;
 	assert(inputRowNum <= logicRowNum);
-	if (inputRowNum < logicRowNum) {
+	// iterator of a ReadonlySegment skips deleted rows at tail
+	if (inputRowNum < logicRowNum &&
+			m_isDel.one_seq_len(inputRowNum) < size_t(logicRowNum - inputRowNum)) {
 		fprintf(stderr
 			, "WARN: inputRows[real=%lld saved=%lld], some data have lost\n"
 			, inputRowNum, logicRowNum);
@@ -768,33 +1213,63 @@ ReadonlySegment::convFrom(DbTable* tab, size_t segIdx)
 		colgroupTempFiles.collectData(i, iter.get(), strVec);
 		m_indices[i] = this->buildIndex(schema, strVec);
 		m_colgroups[i] = m_indices[i]->getReadableStore();
+		pacer.pace(0); // rows are paced when written to temp files
 		if (!schema.m_enableLinearScan) {
 			iter.reset();
 			tmpStore->deleteFiles();
 		}
 	}
+	terark::json storeSelectMeta;
 	for (size_t i = indexNum; i < colgroupTempFiles.size(); ++i) {
 		const Schema& schema = m_schema->getColgroupSchema(i);
 		auto tmpStore = colgroupTempFiles.getStore(i);
+		const char* kind = "build";
 		if (schema.should_use_FixedLenStore()) {
-			m_colgroups[i] = tmpStore;
-			continue;
+			kind = "fixlen";
 		}
 		// dictZipLocalMatch is true by default
 		// dictZipLocalMatch == false is just for experiment
 		// dictZipLocalMatch should always be true in production
 		// dictZipSampleRatio < 0 indicate don't use dictZip
-		if (schema.m_dictZipLocalMatch && schema.m_dictZipSampleRatio >= 0.0) {
+		else if (schema.m_dictZipLocalMatch && schema.m_dictZipSampleRatio >= 0.0) {
 			double sRatio = schema.m_dictZipSampleRatio;
 			double avgLen = double(tmpStore->dataInflateSize()) / newRowNum;
 			if (sRatio > 0 || (sRatio < FLT_EPSILON && avgLen > 100)) {
-				StoreIteratorPtr iter = tmpStore->ensureStoreIterForward(NULL);
-				m_colgroups[i] = buildDictZipStore(schema, tmpDir, *iter, NULL, NULL);
-				iter.reset();
-				tmpStore->deleteFiles();
-				continue;
+				kind = "dictzip";
 			}
 		}
+		if (m_schema->m_autoStoreSelect && !schema.m_isInplaceUpdatable && newRowNum > 0) {
+			StoreSelection sel;
+			selectStoreByTrial(schema, tmpStore, tmpDir / "store-trial", ctx, &sel);
+			auto& js = storeSelectMeta[schema.m_name];
+			js["default"] = kind;
+			js["sampleRows"] = sel.sampleRows;
+			js["sampleBytes"] = sel.sampleBytes;
+			for (auto& t : sel.trials) {
+				auto& jt = js["trials"][t.kind];
+				jt["storageSize"] = t.storageSize;
+				jt["decodeNs"] = t.decodeNs;
+				jt["cost"] = t.cost;
+			}
+			if (sel.kind) {
+				kind = sel.kind;
+			}
+			js["kind"] = kind;
+			fprintf(stderr, "INFO: %s: colgroup %s: store = %s\n"
+				, tmpDir.string().c_str(), schema.m_name.c_str(), kind);
+		}
+		if (strcmp(kind, "fixlen") == 0) {
+			m_colgroups[i] = tmpStore;
+			continue;
+		}
+		if (strcmp(kind, "dictzip") == 0) {
+			StoreIteratorPtr iter = tmpStore->ensureStoreIterForward(NULL);
+			m_colgroups[i] = buildDictZipStore(schema, tmpDir, *iter, NULL, NULL);
+			pacer.pace(0);
+			iter.reset();
+			tmpStore->deleteFiles();
+			continue;
+		}
 		size_t maxMem = m_schema->m_compressingWorkMemSize;
 		llong rows = 0;
 		valvec<ReadableStorePtr> parts;
@@ -803,16 +1278,51 @@ ReadonlySegment::convFrom(DbTable* tab, size_t segIdx)
 			SortableStrVec strVec;
 			rows += colgroupTempFiles.collectData(i, iter.get(), strVec, maxMem);
 			parts.push_back(this->buildStore(schema, strVec));
+			pacer.pace(0);
 		}
 		m_colgroups[i] = parts.size()==1 ? parts[0] : new MultiPartStore(parts);
 		iter.reset();
 		tmpStore->deleteFiles();
 	}
+	if (!storeSelectMeta.empty()) {
+		std::string str = storeSelectMeta.dump(2);
+		FileStream fp((tmpDir / g_storeSelectFile).string().c_str(), "wb");
+		fp.ensureWrite(str.data(), str.size());
+	}
+	return newRowNum;
 }
-	completeAndReload(tab, segIdx, &*input);
 
-	fs::rename(tmpDir, m_segDir);
-	input->deleteSegment();
+static terark::json loadStoreSelectMeta(PathRef segDir) {
+	fs::path fpath = segDir / g_storeSelectFile;
+	if (!fs::exists(fpath)) {
+		return terark::json::object();
+	}
+	LineBuf buf;
+	buf.read_all(fpath.string());
+	return terark::json::parse(std::string(buf.p, buf.n));
+}
+
+std::string
+ReadonlySegment::loadStoreKind(PathRef segDir, const std::string& colgroupName) {
+	terark::json meta = loadStoreSelectMeta(segDir);
+	auto iter = meta.find(colgroupName);
+	if (meta.end() == iter) {
+		return std::string();
+	}
+	auto kind = iter.value().find("kind");
+	if (iter.value().end() == kind) {
+		return std::string();
+	}
+	return kind.value().get<std::string>();
+}
+
+void ReadonlySegment::saveStoreKind(PathRef segDir, const std::string& colgroupName,
+									const std::string& kind) {
+	terark::json meta = loadStoreSelectMeta(segDir);
+	meta[colgroupName]["kind"] = kind;
+	std::string str = meta.dump(2);
+	FileStream fp((segDir / g_storeSelectFile).string().c_str(), "wb");
+	fp.ensureWrite(str.data(), str.size());
 }
 
 void
@@ -939,6 +1449,7 @@ ReadonlySegment::completeAndReload(DbTable* tab, size_t segIdx,
 	assert(tab->m_segments[segIdx].get() == input);
 	tab->m_segments[segIdx] = this;
 	tab->m_segArrayUpdateSeq++;
+	tab->publishSegArrayNoLock();
 }
 
 // dstBaseId is for merge update
@@ -972,6 +1483,7 @@ void pushRecord(SortableStrVec& strVec, const ReadableStore& store,
 				llong physicId, size_t fixlen, DbContext* ctx) {
 	size_t oldsize = strVec.str_size();
 	store.getValueAppend(physicId, &strVec.m_strpool, ctx);
+	BgRateLimiter::Pacer::paceCurrent(strVec.str_size() - oldsize);
 	if (!fixlen) {
 		SortableStrVec::SEntry ent;
 		ent.offset = oldsize;
@@ -1029,6 +1541,7 @@ ReadonlySegment::purgeDeletedRecords(DbTable* tab, size_t segIdx) {
 	fprintf(stderr, "INFO: thread-%s: purging %s\n"
 		, strThreadId.c_str()
 		, input->m_segDir.string().c_str());
+	tab->markExpiredRows(input.get(), ctx.get()); // dropped as deleted
 	m_isDel = input->m_isDel; // make a copy, input->m_isDel[*] may be changed
 	m_delcnt = m_isDel.popcnt(); // recompute delcnt
 	m_indices.resize(m_schema->getIndexNum());
@@ -1036,12 +1549,21 @@ ReadonlySegment::purgeDeletedRecords(DbTable* tab, size_t segIdx) {
 	auto tmpSegDir = m_segDir + ".tmp";
 	fs::create_directories(tmpSegDir);
 	try {
+		BgRateLimiter::Pacer pacer;
 		for (size_t i = 0; i < m_indices.size(); ++i) {
 			m_indices[i] = purgeIndex(i, input.get(), ctx.get());
 			m_colgroups[i] = m_indices[i]->getReadableStore();
+			pacer.pace(0); // rows are paced in purgeIndex
 		}
 		for (size_t i = m_indices.size(); i < m_colgroups.size(); ++i) {
 			m_colgroups[i] = purgeColgroup(i, input.get(), ctx.get(), tmpSegDir);
+			pacer.pace(0); // rows are paced in purgeColgroup
+		}
+		// purgeColgroup keeps the kinds of input
+		if (fs::exists(input->m_segDir / g_storeSelectFile)) {
+			fs::copy_file(input->m_segDir / g_storeSelectFile,
+						  tmpSegDir / g_storeSelectFile,
+						  fs::copy_option::overwrite_if_exists);
 		}
 		completeAndReload(tab, segIdx, &*input);
 		assert(input->m_segDir == this->m_segDir);
@@ -1096,6 +1618,7 @@ ReadonlySegment::purgeIndex(size_t indexId, ReadonlySegment* input, DbContext* c
 				TERARK_RT_assert(hasRow, std::logic_error);
 				TERARK_RT_assert(physicId <= logicId, std::logic_error);
 				strVec.push_back(rec);
+				BgRateLimiter::Pacer::paceCurrent(rec.size());
 			}
 		}
 	}
@@ -1116,6 +1639,85 @@ ReadonlySegment::purgeIndex(size_t indexId, ReadonlySegment* input, DbContext* c
 	return this->buildIndex(schema, strVec);
 }
 
+// build an index which is not in this segment, index keys are read from
+// colgroups, including deleted records, just as convFrom
+ReadableIndexPtr
+ReadonlySegment::buildIndexFromColgroups(const Schema& indexSchema,
+										 DbContext* ctx)
+const {
+	const size_t physicRows = getPhysicRows();
+	if (0 == physicRows) {
+		return new EmptyIndexStore();
+	}
+	const size_t colsNum = indexSchema.columnNum();
+	const size_t fixlen = indexSchema.getFixedRowLen();
+	valvec<size_t> colsId(colsNum);
+	for (size_t i = 0; i < colsNum; ++i) {
+		colsId[i] = indexSchema.parentColumnId(i);
+	}
+	SortableStrVec strVec;
+	valvec<byte> key;
+	for (size_t physicId = 0; physicId < physicRows; ++physicId) {
+		selectColumnsByPhysicId(physicId, colsId.data(), colsNum, &key, ctx);
+		if (fixlen) {
+			assert(key.size() == fixlen);
+			strVec.m_strpool.append(key);
+		}
+		else {
+			strVec.push_back(key);
+		}
+	}
+	return this->buildIndex(indexSchema, strVec);
+}
+
+// this is a sibling of input with an added index, it shares the files
+// of input, m_schema must have been set with the added index, input
+// must not be changed concurrently
+void ReadonlySegment::initWithAddedIndex(ReadonlySegment* input,
+										 ReadableIndex* index) {
+	const size_t indexNum = input->m_indices.size();
+	assert(m_schema->getIndexNum() == indexNum + 1);
+	assert(m_schema->getColgroupNum() == input->m_colgroups.size() + 1);
+	assert(m_segDir == input->m_segDir);
+	m_indices.reserve(indexNum + 1);
+	m_indices.append(input->m_indices);
+	m_indices.push_back(index);
+	m_colgroups.reserve(input->m_colgroups.size() + 1);
+	m_colgroups.append(input->m_colgroups.begin(), indexNum);
+	m_colgroups.push_back(index->getReadableStore());
+	m_colgroups.append(input->m_colgroups.begin() + indexNum,
+					   input->m_colgroups.size() - indexNum);
+	if (input->m_isDelMmap) {
+		// IsDel is mmaped as shared & writable, just map it again
+		m_isDelMmap = loadIsDel_aux(m_segDir, m_isDel);
+	}
+	else {
+		m_isDel = input->m_isDel;
+		m_isDirty = input->m_isDirty;
+		input->m_isDirty = false; // don't save IsDel on destroy
+	}
+	m_delcnt = input->m_delcnt;
+	if (input->m_isPurgedMmap) {
+		size_t bytes = 0;
+		auto fpath = m_segDir / "IsPurged.rs";
+		m_isPurgedMmap = (byte*)mmap_load(fpath.string(), &bytes);
+		m_isPurged.risk_mmap_from(m_isPurgedMmap, bytes);
+	}
+	else {
+		m_isPurged = input->m_isPurged;
+	}
+	m_withPurgeBits = input->m_withPurgeBits;
+	m_deletionTime = input->m_deletionTime;
+	m_buildTime = input->m_buildTime;
+	m_hasLockFreePointSearch = input->m_hasLockFreePointSearch;
+	m_dataInflateSize = input->m_dataInflateSize;
+	m_dataMemSize = input->m_dataMemSize;
+	m_totalStorageSize = input->m_totalStorageSize + index->indexStorageSize();
+	m_cacheId = input->m_cacheId; // same rows, share cached rows
+	m_lookupCnt = input->m_lookupCnt.load();
+	m_seekCnt = input->m_seekCnt.load();
+}
+
 ReadableStorePtr
 ReadonlySegment::purgeColgroup(size_t colgroupId, ReadonlySegment* input, DbContext* ctx, PathRef tmpSegDir) {
 	assert(m_isDel.size() == input->m_isDel.size());
@@ -1126,7 +1728,9 @@ ReadonlySegment::purgeColgroup(size_t colgroupId, ReadonlySegment* input, DbCont
 	const llong inputRowNum = input->m_isDel.size();
 	const Schema& schema = m_schema->getColgroupSchema(colgroupId);
 	const auto& colgroup = *input->m_colgroups[colgroupId];
-	if (schema.should_use_FixedLenStore()) {
+	// the kind chosen by "AutoStoreSelect" when input was built
+	const std::string kind = loadStoreKind(input->m_segDir, schema.m_name);
+	if (schema.should_use_FixedLenStore() || "fixlen" == kind) {
 		FixedLenStorePtr store = new FixedLenStore(tmpSegDir, schema);
 		store->reserveRows(m_isDel.size() - m_delcnt);
 		llong physicId = 0;
@@ -1138,6 +1742,7 @@ ReadonlySegment::purgeColgroup(size_t colgroupId, ReadonlySegment* input, DbCont
 					colgroup.getValue(physicId, &buf, ctx);
 					assert(buf.size() == schema.getFixedRowLen());
 					store->append(buf, ctx);
+					BgRateLimiter::Pacer::paceCurrent(buf.size());
 				}
 				physicId++;
 			}
@@ -1145,12 +1750,14 @@ ReadonlySegment::purgeColgroup(size_t colgroupId, ReadonlySegment* input, DbCont
 		assert(!isPurged || llong(input->m_isPurged.max_rank0()) == physicId);
 		return store;
 	}
-	if (schema.m_dictZipLocalMatch && schema.m_dictZipSampleRatio >= 0.0) {
+	bool useDictZip = "dictzip" == kind;
+	if (kind.empty() && schema.m_dictZipLocalMatch && schema.m_dictZipSampleRatio >= 0.0) {
 		double avgLen = 1.0 * colgroup.dataInflateSize() / colgroup.numDataRows();
-		if (schema.m_dictZipSampleRatio > FLT_EPSILON || avgLen > 100) {
-			StoreIteratorPtr iter = colgroup.ensureStoreIterForward(ctx);
-			return buildDictZipStore(schema, tmpSegDir, *iter, isDel, &input->m_isPurged);
-		}
+		useDictZip = schema.m_dictZipSampleRatio > FLT_EPSILON || avgLen > 100;
+	}
+	if (useDictZip) {
+		StoreIteratorPtr iter = colgroup.ensureStoreIterForward(ctx);
+		return buildDictZipStore(schema, tmpSegDir, *iter, isDel, &input->m_isPurged);
 	}
 	std::unique_ptr<SeqReadAppendonlyStore> seqStore;
 	if (schema.m_enableLinearScan) {
@@ -1212,10 +1819,53 @@ ReadonlySegment::purgeColgroup(size_t colgroupId, ReadonlySegment* input, DbCont
 }
 
 void ReadonlySegment::load(PathRef segDir) {
+	loadSegmentMeta(segDir);
 	ReadableSegment::load(segDir);
 	removePurgeBitsForCompactIdspace(segDir);
 }
 
+static const char g_segmentMetaFile[] = "segment-meta.json";
+
+void ReadonlySegment::saveSegmentMeta(PathRef segDir) const {
+	terark::json meta;
+	meta["SchemaVersion"] = m_schema->m_schemaVersion;
+	meta["BuildTime"] = m_buildTime;
+	std::string str = meta.dump(2);
+	FileStream fp((segDir / g_segmentMetaFile).string().c_str(), "wb");
+	fp.ensureWrite(str.data(), str.size());
+}
+
+void ReadonlySegment::loadSegmentMeta(PathRef segDir) {
+	fs::path fpath = segDir / g_segmentMetaFile;
+	llong version = 0; // segments built before "SchemaVersion"
+	llong buildTime = -1;
+	if (fs::exists(fpath)) {
+		LineBuf buf;
+		buf.read_all(fpath.string());
+		auto meta = terark::json::parse(std::string(buf.p, buf.n));
+		auto iter = meta.find("SchemaVersion");
+		if (meta.end() != iter) {
+			version = iter.value().get<llong>();
+		}
+		iter = meta.find("BuildTime");
+		if (meta.end() != iter) {
+			buildTime = iter.value().get<llong>();
+		}
+	}
+	if (buildTime < 0) {
+		// segments built before "BuildTime", the dir mtime is the best guess
+		boost::system::error_code ec;
+		std::time_t t = fs::last_write_time(segDir, ec);
+		buildTime = ec ? 0 : llong(t);
+	}
+	m_buildTime = buildTime;
+	if (version != m_schema->m_schemaVersion) {
+		THROW_STD(invalid_argument
+			, "%s: SchemaVersion = %lld, but SchemaVersion of dbmeta.json = %lld"
+			, segDir.string().c_str(), version, m_schema->m_schemaVersion);
+	}
+}
+
 void ReadonlySegment::removePurgeBitsForCompactIdspace(PathRef segDir) {
 //	assert(m_isDel.size() > 0);
 	assert(m_isDelMmap != NULL);
@@ -1303,6 +1953,7 @@ void ReadonlySegment::save(PathRef segDir) const {
 		return;
 	}
 	savePurgeBits(segDir);
+	saveSegmentMeta(segDir);
 	ReadableSegment::save(segDir);
 }
 
@@ -1320,6 +1971,7 @@ void ReadonlySegment::loadRecordStore(PathRef segDir) {
 	if (!m_colgroups.empty()) {
 		THROW_STD(invalid_argument, "m_colgroups must be empty");
 	}
+	m_cacheId = RowCache::newSegmentCacheId();
 	// indices must be loaded first
 	assert(m_indices.size() == m_schema->getIndexNum());
 
@@ -1798,6 +2450,9 @@ void WritableSegment::flushSegment() {
 	if (m_tobeDel) {
 		return;
 	}
+	if (m_mergeLog) {
+		m_mergeLog->flush();
+	}
 	if (m_isDirty) {
 		save(m_segDir);
 		m_isDirty = false;
@@ -1814,6 +2469,9 @@ void WritableSegment::saveRecordStore(PathRef segDir) const {
 		store->save(segDir / "colgroup-" + schema.m_name);
 	}
 	m_wrtStore->save(segDir / "__wrtStore__");
+	if (m_mergeLog && segDir != m_segDir) {
+		m_mergeLog->saveCopy(segDir / MergeOperandLog::FileName);
+	}
 }
 
 void WritableSegment::loadRecordStore(PathRef segDir) {
@@ -1835,6 +2493,10 @@ WritableSegment* WritableSegment::getWritableSegment() const {
 	return const_cast<WritableSegment*>(this);
 }
 
+size_t WritableSegment::mergeLogMemSize() const {
+	return m_mergeLog ? m_mergeLog->memSize() : 0;
+}
+
 llong WritableSegment::totalStorageSize() const {
 	llong size = m_wrtStore->dataStorageSize() + totalIndexSize();
 	for (size_t colgroupId : m_schema->m_updatableColgroups) {
@@ -2006,6 +2668,9 @@ const {
 	else {
 		ctx->getWrSegWrtStoreData(this, subId, buf);
 	}
+	if (ctx) {
+		ctx->m_stats.wrSegDecodeBytes += buf->size();
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////
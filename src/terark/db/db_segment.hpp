@@ -7,6 +7,9 @@
 #include <terark/rank_select.hpp>
 #include <tbb/spin_rw_mutex.h>
 #include <tbb/tbb_thread.h>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 namespace terark {
 	class SortableStrVec;
@@ -14,6 +17,8 @@ namespace terark {
 
 namespace terark { namespace db {
 
+class MergeOperandLog;
+
 typedef tbb::spin_rw_mutex        SpinRwMutex;
 typedef SpinRwMutex::scoped_lock  SpinRwLock;
 
@@ -60,6 +65,7 @@ public:
 	llong totalIndexSize() const;
 
 	void saveIsDel(PathRef segDir) const;
+	static void saveIsDel_aux(PathRef segDir, const febitvec& isDel);
 	void loadIsDel(PathRef segDir);
 	byte*loadIsDel_aux(PathRef segDir, febitvec& isDel) const;
 	void closeIsDel();
@@ -99,6 +105,12 @@ public:
 	bool        m_hasLockFreePointSearch;
 	bool        m_bookUpdates;
 	bool        m_withPurgeBits;  // just for ReadonlySegment
+
+	// statistics, DbContext and TableIndexIter publish them in batches
+	mutable std::atomic<llong> m_lookupCnt;
+	mutable std::atomic<llong> m_seekCnt;
+
+	llong m_cacheId; // key of DbTable::m_rowCache, renewed on load
 };
 typedef boost::intrusive_ptr<ReadableSegment> ReadableSegmentPtr;
 
@@ -135,11 +147,27 @@ public:
 
 	void getValueByLogicId(size_t id, valvec<byte>* val, DbContext*) const;
 	void getValueByPhysicId(size_t id, valvec<byte>* val, DbContext*) const;
+	void getValueByPhysicIdNoCache(size_t id, valvec<byte>* val, DbContext*) const;
+	void adviseWillNeed(llong logicBeg, llong logicEnd) const;
+
+	// software prefetch for batched fetch, prefetchLogicId should be issued
+	// a few records before getPhysicId and prefetchPhysicId on the same id,
+	// NULL cgIdvec means colgroups of the whole row
+	void prefetchLogicId(size_t logicId) const;
+	void prefetchPhysicId(size_t physicId, const size_t* cgIdvec, size_t cgNum) const;
+
+	void selectColumnsByPhysicId(size_t physicId, const size_t* colsId, size_t colsNum,
+								 valvec<byte>* colsData, DbContext*) const;
 
 	void indexSearchExactAppend(size_t mySegIdx, size_t indexId,
 								fstring key, valvec<llong>* recIdvec,
 								DbContext*) const override;
 
+	// physic ids in recIdvec[oldsize, size) returned by m_indices are
+	// translated to logic ids, deleted ones are removed
+	void physicToLiveLogicIds(valvec<llong>* recIdvec, size_t oldsize,
+							  DbContext*) const;
+
 	void selectColumns(llong recId, const size_t* colsId, size_t colsNum,
 					   valvec<byte>* colsData, DbContext*) const override;
 	void selectOneColumn(llong recId, size_t columnId,
@@ -169,14 +197,46 @@ protected:
 							  const bm_uint_t* isDel, const febitvec* isPurged)
 			const;
 
+	// builds indices and colgroups in tmpDir from live rows of input,
+	// m_isDel must be a copy of input->m_isDel, rows are converted by
+	// transcode if it is not NULL, returns number of live rows
+	llong buildFrom(ReadableSegment* input, const RowTranscoder* transcode,
+					class ConvRowObserver*, PathRef tmpDir, DbContext*);
 	void completeAndReload(class DbTable*, size_t segIdx,
 						   class ReadableSegment* input);
 	void syncUpdateRecordNoLock(size_t dstBaseId, size_t logicId,
 								const ReadableSegment* input);
 
 	ReadableIndexPtr purgeIndex(size_t indexId, ReadonlySegment* input, DbContext* ctx);
+
+	///@{ for DbTable::addIndex
+	ReadableIndexPtr buildIndexFromColgroups(const Schema& indexSchema, DbContext*) const;
+	void initWithAddedIndex(ReadonlySegment* input, ReadableIndex* index);
+	///@}
 	ReadableStorePtr purgeColgroup(size_t colgroupId, ReadonlySegment* input, DbContext* ctx, PathRef tmpSegDir);
 
+	// for "AutoStoreSelect", kinds are "fixlen", "build" and "dictzip"
+	struct StoreSelection {
+		struct Trial {
+			const char* kind;
+			llong  storageSize; // of the sample
+			double decodeNs;    // per row
+			double cost;
+		};
+		const char* kind; // chosen, NULL if no candidate is available
+		size_t bestIdx;   // of trials
+		llong  sampleRows;
+		llong  sampleBytes;
+		std::vector<Trial> trials;
+	};
+	void selectStoreByTrial(const Schema&, ReadableStore* tmpStore,
+							PathRef trialDir, DbContext*, StoreSelection*) const;
+	// kind of the colgroup recorded in "store-select.json" of segDir,
+	// empty if not recorded, purge and merge keep the recorded kind
+	static std::string loadStoreKind(PathRef segDir, const std::string& colgroupName);
+	static void saveStoreKind(PathRef segDir, const std::string& colgroupName,
+							  const std::string& kind);
+
 	void loadRecordStore(PathRef segDir) override;
 	void saveRecordStore(PathRef segDir) const override;
 
@@ -184,14 +244,26 @@ protected:
 	void removePurgeBitsForCompactIdspace(PathRef segDir);
 	void savePurgeBits(PathRef segDir) const;
 
+	///@{ "segment-meta.json", load throws if the "SchemaVersion" of the
+	///   segment is not m_schema->m_schemaVersion, "BuildTime" is loaded
+	///   into m_buildTime
+	void saveSegmentMeta(PathRef segDir) const;
+	void loadSegmentMeta(PathRef segDir);
+	///@}
+
 protected:
 	friend class DbTable;
 	friend class TableIndexIter;
 	class MyStoreIterForward;  friend class MyStoreIterForward;
 	class MyStoreIterBackward; friend class MyStoreIterBackward;
+	class MyStoreIterReadAhead; friend class MyStoreIterReadAhead;
 	llong  m_dataInflateSize;
 	llong  m_dataMemSize;
 	llong  m_totalStorageSize;
+	llong  m_maxExpireTime; // of live rows for TTL, LLONG_MIN if unknown
+	// unix time the rows were built, kept by merge, purge and alterRowSchema
+	// for time based merge policies
+	llong  m_buildTime;
 };
 typedef boost::intrusive_ptr<ReadonlySegment> ReadonlySegmentPtr;
 
@@ -344,6 +416,10 @@ public:
 
 	ReadableStorePtr  m_wrtStore;
 	valvec<uint32_t>  m_deletedWrIdSet;
+	// pending operands of DbTable::mergeRow, NULL if the table has no
+	// merge operator, the log file is in m_segDir
+	std::unique_ptr<MergeOperandLog> m_mergeLog;
+	size_t mergeLogMemSize() const;
 };
 typedef boost::intrusive_ptr<WritableSegment> WritableSegmentPtr;
 
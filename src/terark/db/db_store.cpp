@@ -1,4 +1,8 @@
 #include "db_store.hpp"
+#if !defined(_MSC_VER)
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
 
 namespace terark { namespace db {
 
@@ -186,6 +190,24 @@ ReadableStore::ensureStoreIterBackward(DbContext* ctx) const {
 	return new DefaultStoreIterBackward(const_cast<ReadableStore*>(this), ctx);
 }
 
+void ReadableStore::adviseWillNeed(llong beg, llong end) const {
+}
+
+void ReadableStore::prefetchRecord(llong id) const {
+}
+
+void ReadableStore::adviseWillNeedMem(const void* mem, size_t len) {
+#if !defined(_MSC_VER)
+	static const size_t pageSize = sysconf(_SC_PAGESIZE);
+	if (NULL == mem || 0 == len)
+		return;
+	size_t beg = size_t(mem) & ~(pageSize - 1);
+	size_t end = size_t(mem) + len;
+	// ignore error, it is just a hint
+	madvise((void*)beg, end - beg, MADV_WILLNEED);
+#endif
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 AppendableStore::~AppendableStore() {
@@ -242,6 +264,28 @@ const {
 	m_parts[upp-1]->getValueAppend(id - baseId, val, ctx);
 }
 
+void MultiPartStore::adviseWillNeed(llong beg, llong end) const {
+	assert(m_parts.size() + 1 == m_rowNumVec.size());
+	end = std::min(end, llong(m_rowNumVec.back()));
+	if (beg >= end)
+		return;
+	size_t i = upper_bound_a(m_rowNumVec, uint32_t(beg)) - 1;
+	for (; i < m_parts.size() && m_rowNumVec[i] < end; ++i) {
+		llong baseId = m_rowNumVec[i];
+		llong partBeg = std::max(beg, baseId) - baseId;
+		llong partEnd = std::min(end, llong(m_rowNumVec[i+1])) - baseId;
+		m_parts[i]->adviseWillNeed(partBeg, partEnd);
+	}
+}
+
+void MultiPartStore::prefetchRecord(llong id) const {
+	assert(m_parts.size() + 1 == m_rowNumVec.size());
+	if (id >= llong(m_rowNumVec.back()))
+		return;
+	size_t upp = upper_bound_a(m_rowNumVec, uint32_t(id));
+	m_parts[upp-1]->prefetchRecord(id - m_rowNumVec[upp-1]);
+}
+
 class MultiPartStore::MyStoreIterForward : public StoreIterator {
 	size_t m_partIdx = 0;
 	llong  m_id = 0;
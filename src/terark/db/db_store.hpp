@@ -4,6 +4,9 @@
 #include "db_conf.hpp"
 #include "db_context.hpp"
 #include <boost/filesystem.hpp>
+#if defined(_MSC_VER)
+	#include <xmmintrin.h>
+#endif
 
 namespace boost { namespace filesystem {
 	inline path operator+(const path& x, terark::fstring y) {
@@ -81,6 +84,24 @@ public:
 	virtual AppendableStore* getAppendableStore();
 	virtual UpdatableStore* getUpdatableStore();
 
+	///@{ read-ahead hint: records in [beg, end) will be read soon,
+	///   default does nothing, mmapped stores issue madvise(WILLNEED)
+	virtual void adviseWillNeed(llong beg, llong end) const;
+	static void adviseWillNeedMem(const void* mem, size_t len);
+	///@}
+
+	///@{ software prefetch hint for batched fetch: record id will be read
+	///   after a few other records, it should not block on cache misses
+	virtual void prefetchRecord(llong id) const;
+	static void prefetchMem(const void* mem) {
+	#if defined(__GNUC__)
+		__builtin_prefetch(mem);
+	#elif defined(_MSC_VER)
+		_mm_prefetch((const char*)mem, _MM_HINT_T0);
+	#endif
+	}
+	///@}
+
 	void getValue(llong id, valvec<byte>* val, DbContext* ctx) const {
 		val->risk_set_size(0);
 		getValueAppend(id, val, ctx);
@@ -126,6 +147,8 @@ public:
 	void getValueAppend(llong id, valvec<byte>* val, DbContext*) const override;
 	StoreIterator* createStoreIterForward(DbContext*) const override;
 	StoreIterator* createStoreIterBackward(DbContext*) const override;
+	void adviseWillNeed(llong beg, llong end) const override;
+	void prefetchRecord(llong id) const override;
 
 	void load(PathRef segDir) override;
 	void save(PathRef segDir) const override;
@@ -1,6 +1,8 @@
 #include "db_table.hpp"
 #include "db_segment.hpp"
 #include "appendonly.hpp"
+#include "residency.hpp"
+#include "rate_limiter.hpp"
 #include <terark/db/fixed_len_store.hpp>
 #include <terark/util/autoclose.hpp>
 #include <terark/util/linebuf.hpp>
@@ -18,6 +20,7 @@
 #include <terark/util/concurrent_queue.hpp>
 #include <float.h>
 #include <terark/util/profiling.hpp>
+#include "json.hpp"
 
 #undef min
 #undef max
@@ -45,12 +48,58 @@ const size_t DEFAULT_maxSegNum = 4095;
 	} BOOST_SCOPE_EXIT_END
 #endif
 
+namespace {
+	// accumulate elapsed time of a background task into DbTable::BgTaskStat
+	class BgTaskTimer {
+		DbTable::BgTaskStat& m_stat;
+		profiling m_pf;
+		llong     m_t0;
+		llong     m_bytes;
+	public:
+		explicit BgTaskTimer(DbTable::BgTaskStat& stat) : m_stat(stat) {
+			m_t0 = m_pf.now();
+			m_bytes = 0;
+		}
+		~BgTaskTimer() { m_stat.add(m_pf.ns(m_t0, m_pf.now()), m_bytes); }
+		void addBytes(llong bytes) { m_bytes += bytes; }
+	};
+
+	const profiling g_statPf;
+
+	// MyRwLock which accounts wait and hold time of DbTable::m_rwMutex,
+	// wait + hold is reported to BgRateLimiter as the foreground latency
+	class StatRwLock : public MyRwLock {
+		DbStats& m_stats;
+		llong    m_t0;
+		llong    m_t1;
+	public:
+		StatRwLock(MyRwMutex& mtx, bool write, DbStats& stats)
+		  : m_stats(stats) {
+			m_t0 = g_statPf.now();
+			acquire(mtx, write);
+			m_t1 = g_statPf.now();
+			stats.rwLockCnt++;
+			stats.rwLockWaitNs += g_statPf.ns(m_t0, m_t1);
+		}
+		~StatRwLock() {
+			llong t2 = g_statPf.now();
+			m_stats.rwLockHoldNs += g_statPf.ns(m_t1, t2);
+			BgRateLimiter::instance().reportFgLatency(g_statPf.ns(m_t0, t2));
+		}
+	};
+}
+
 DbTable* DbTable::open(PathRef dbPath) {
+	return open(dbPath, ConvRowObserverFactory());
+}
+
+DbTable* DbTable::open(PathRef dbPath, const ConvRowObserverFactory& fac) {
 	fs::path jsonFile = dbPath / "dbmeta.json";
 	SchemaConfigPtr sconf = new SchemaConfig();
 	sconf->loadJsonFile(jsonFile.string());
 	std::unique_ptr<DbTable> tab(createTable(sconf->m_tableClass));
 	tab->m_schema = sconf;
+	tab->m_convRowObserverFactory = fac;
 	tab->doLoad(dbPath);
 	return tab.release();
 }
@@ -59,7 +108,10 @@ DbTable::DbTable() {
 	m_tableScanningRefCount = 0;
 	m_tobeDrop = false;
 	m_isMerging = false;
+	m_rotationBlocked = false;
 	m_purgeStatus = PurgeStatus::none;
+	m_expireTTLInQueue = false;
+	m_nextExpireTTLTime = 0;
 	m_segments.reserve(DEFAULT_maxSegNum);
 	m_rowNumVec.reserve(DEFAULT_maxSegNum+1);
 	m_mergeSeqNum = 0;
@@ -68,11 +120,18 @@ DbTable::DbTable() {
 	m_rowNum = 0;
 	m_oldestSnapshotVersion = 0;
 	m_segArrayUpdateSeq = 1;
+	m_segArrayVersion = nullptr;
+	m_mergeKeyNum = 0;
+	publishSegArrayNoLock();
 //	m_ctxListHead = new DbContextLink();
 }
 
 DbTable::~DbTable() {
+	ResidencyManager::instance().removeTable(this);
 	m_wrSeg = nullptr;
+	if (SegArrayVersion* ver = m_segArrayVersion.exchange(nullptr)) {
+		ver->release(); // no readers now
+	}
 //	fprintf(stderr, "INFO: DbTable::~DbTable(): m_dir = %s\n", m_dir.string().c_str());
 //	fprintf(stderr, "INFO: DbTable::~DbTable(): m_segments.size = %zd\n", m_segments.size());
 	if (m_dir.empty()) {
@@ -303,6 +362,9 @@ static SortableStrVec getWorkingSegDirList(PathRef mergeDir) {
 		if (fstr.startsWith("wr-") || fstr.startsWith("rd-")) {
 			segDirList.push_back(fname);
 		}
+		else if (fstr == "dbmeta.json") {
+			// left by DbTable::alterRowSchema
+		}
 		else {
 			fprintf(stderr, "WARN: Skip unknown dir: %s\n", segDir.c_str());
 		}
@@ -311,6 +373,28 @@ static SortableStrVec getWorkingSegDirList(PathRef mergeDir) {
 	return segDirList;
 }
 
+// records before the first segment which were dropped by
+// dropLeadingSegments, saved in each merge dir
+static const char g_headRowNumFile[] = "head-rownum.txt";
+
+static void saveHeadRowNum(PathRef mergeDir, llong headRowNum) {
+	FileStream fp((mergeDir / g_headRowNumFile).string().c_str(), "w");
+	fp.puts(std::to_string(headRowNum));
+}
+
+static llong loadHeadRowNum(PathRef mergeDir) {
+	fs::path fpath = mergeDir / g_headRowNumFile;
+	if (!fs::exists(fpath)) {
+		return 0;
+	}
+	FileStream fp(fpath.string().c_str(), "r");
+	llong headRowNum = -1;
+	if (fscanf(fp, "%lld", &headRowNum) != 1 || headRowNum < 0) {
+		THROW_STD(invalid_argument, "bad file: %s", fpath.string().c_str());
+	}
+	return headRowNum;
+}
+
 void DbTable::load(PathRef dir) {
 	if (!m_segments.empty()) {
 		THROW_STD(invalid_argument, "Invalid: m_segment.size=%ld is not empty",
@@ -346,6 +430,33 @@ void DbTable::doLoad(PathRef dir) {
 	m_dir = dir;
 	discoverMergeDir(m_dir);
 	fs::path mergeDir = getMergePath(m_dir, m_mergeSeqNum);
+	if (fs::exists(mergeDir / "dbmeta.json")) {
+		// left by alterRowSchema, which was committed but crashed before
+		// dbmeta.json was replaced
+		SchemaConfigPtr newConf = new SchemaConfig();
+		newConf->loadJsonFile((mergeDir / "dbmeta.json").string());
+		if (newConf->m_schemaVersion > m_schema->m_schemaVersion) {
+			fprintf(stderr, "WARN: %s: roll forward dbmeta.json to SchemaVersion = %lld\n"
+				, m_dir.string().c_str(), newConf->m_schemaVersion);
+			fs::path tmpFile = m_dir / "dbmeta.json.tmp";
+			fs::copy_file(mergeDir / "dbmeta.json", tmpFile,
+						  fs::copy_option::overwrite_if_exists);
+			fs::rename(tmpFile, m_dir / "dbmeta.json");
+			m_schema = newConf;
+		}
+	}
+	if (m_schema->m_rowCacheSize > 0) {
+		m_rowCache.reset(new RowCache(size_t(m_schema->m_rowCacheSize)));
+	}
+	if (m_schema->m_enableChangeLog) {
+		if (!m_schema->m_usePermanentRecordId) {
+			fprintf(stderr
+				, "WARN: %s: EnableChangeLog without UsePermanentRecordId, record ids are changed by reload\n"
+				, m_dir.string().c_str());
+		}
+		m_changeLog = new ChangeLog(m_dir / "changelog", m_schema->m_changeLogFileSize);
+	}
+	m_mergePolicy = MergePolicy::create(m_schema->m_mergePolicyType, m_schema->m_mergePolicyConf);
 	SortableStrVec segDirList = getWorkingSegDirList(mergeDir);
 	for (size_t i = 0; i < segDirList.size(); ++i) {
 		std::string fname = segDirList[i].str();
@@ -401,6 +512,13 @@ void DbTable::doLoad(PathRef dir) {
 		}
 		if (i < m_segments.size()-1 && m_segments[i]->getWritableStore()) {
 			m_segments[i]->m_isFreezed = true;
+			if (fs::exists(m_segments[i]->m_segDir / MergeOperandLog::FileName)) {
+				// converted by setMergeOperator after operands are loaded
+				fprintf(stderr
+					, "WARN: %s has pending merge operands, setMergeOperator must be called\n"
+					, m_segments[i]->m_segDir.string().c_str());
+				continue;
+			}
 			this->putToCompressionQueue(i);
 		}
 	}
@@ -420,14 +538,16 @@ void DbTable::doLoad(PathRef dir) {
 		m_wrSeg.reset(seg); // old wr seg at end
 	}
 	m_rowNumVec.resize_no_init(m_segments.size() + 1);
-	llong baseId = 0;
+	llong baseId = loadHeadRowNum(mergeDir);
 	for (size_t i = 0; i < m_segments.size(); ++i) {
 		m_rowNumVec[i] = baseId;
 		baseId += m_segments[i]->numDataRows();
 	}
 	m_rowNumVec.back() = baseId; // the end guard
 	m_rowNum = baseId;
+	publishSegArrayNoLock();
 	runLockFile.close();
+	ResidencyManager::instance().addTable(this);
 }
 
 size_t DbTable::findSegIdx(size_t segIdxBeg, ReadableSegment* seg) const {
@@ -476,33 +596,21 @@ protected:
 		llong  baseId;
 	};
 	valvec<OneSeg> m_segs;
+	ColumnVec m_ttlCols;
 
 	void init(const DbTable* tab, DbContext* ctx) {
 		this->m_store.reset(const_cast<DbTable*>(tab));
 		this->m_ctx.reset(ctx);
-	// MyStoreIterator creation is rarely used, lock it by m_rwMutex
-		MyRwLock lock(tab->m_rwMutex, false);
-		m_segArrayUpdateSeq = tab->m_segArrayUpdateSeq;
-		m_segs.resize(tab->m_segments.size() + 1);
-		for (size_t i = 0; i < m_segs.size()-1; ++i) {
-			ReadableSegment* seg = tab->m_segments[i].get();
-			m_segs[i].seg = seg;
-		//	m_segs[i].iter = createSegStoreIter(seg);
-			m_segs[i].baseId = tab->m_rowNumVec[i];
-		}
-		m_segs.back().baseId = tab->m_rowNum;
-		lock.upgrade_to_writer();
 		tab->m_tableScanningRefCount++;
-		assert(tab->m_segments.size() > 0);
+		m_segArrayUpdateSeq = 0;
+		syncTabSegs();
+		assert(m_segs.size() > 1);
 	}
 
 	~MyStoreIterBase() {
 		assert(dynamic_cast<const DbTable*>(m_store.get()));
 		auto tab = static_cast<const DbTable*>(m_store.get());
-		{
-			MyRwLock lock(tab->m_rwMutex, true);
-			tab->m_tableScanningRefCount--;
-		}
+		tab->m_tableScanningRefCount--;
 	}
 
 	bool syncTabSegs() {
@@ -517,14 +625,21 @@ protected:
 			m_segs.back().baseId = tab->m_rowNum;
 			return tab->m_rowNum > oldmaxId;
 		}
-		m_segs.resize(tab->m_segments.size() + 1);
+		SegArrayVersionPtr ver = tab->getSegArrayVersion();
+		if (m_segArrayUpdateSeq == ver->m_updateSeq) {
+			return false; // new version is not published yet
+		}
+		m_segs.resize(ver->m_segments.size() + 1);
 		for (size_t i = 0; i < m_segs.size() - 1; ++i) {
-			m_segs[i].seg = tab->m_segments[i];
-			m_segs[i].baseId = tab->m_rowNumVec[i];
+			m_segs[i].seg = ver->m_segments[i];
+			m_segs[i].baseId = ver->m_rowNumVec[i];
 			m_segs[i].iter = nullptr;
 		}
-		m_segs.back().baseId = tab->m_rowNum;
-		m_segArrayUpdateSeq = tab->m_segArrayUpdateSeq;
+		m_segs.back().baseId = ver->m_rowNumVec.back();
+		m_segArrayUpdateSeq = ver->m_updateSeq;
+		if (m_segArrayUpdateSeq == tab->m_segArrayUpdateSeq) {
+			m_segs.back().baseId = tab->m_rowNum;
+		}
 		return true;
 	}
 
@@ -551,15 +666,13 @@ protected:
 				const size_t ProtectNum = 100;
 				if (seg->m_isFreezed || seg->m_isDel.unused() >= ProtectNum) {
 					if (!seg->m_isDel[subId]) {
-						resetOneSegIter(cur);
-						return std::make_pair(upp, cur->iter->seekExact(subId, val));
+						return std::make_pair(upp, seekOneSeg(cur, subId, val));
 					}
 				}
 				else {
 					SpinRwLock lock(seg->m_segMutex, false);
 					if (!seg->m_isDel[subId]) {
-						resetOneSegIter(cur);
-						return std::make_pair(upp, cur->iter->seekExact(subId, val));
+						return std::make_pair(upp, seekOneSeg(cur, subId, val));
 					}
 				}
 			}
@@ -574,6 +687,18 @@ protected:
 			x->iter = createSegStoreIter(x->seg.get());
 	}
 
+	bool seekOneSeg(OneSeg* cur, llong subId, valvec<byte>* val) {
+		resetOneSegIter(cur);
+		if (!cur->iter->seekExact(subId, val))
+			return false;
+		return !isExpiredRow(*val, time(NULL));
+	}
+
+	bool isExpiredRow(fstring row, llong now) {
+		auto tab = static_cast<const DbTable*>(m_store.get());
+		return tab->m_schema->hasTTL() && tab->isRowExpired(row, now, &m_ttlCols);
+	}
+
 	virtual StoreIterator* createSegStoreIter(ReadableSegment*) = 0;
 };
 
@@ -590,12 +715,14 @@ public:
 		assert(dynamic_cast<const DbTable*>(m_store.get()));
 		auto tab = static_cast<const DbTable*>(m_store.get());
 		llong subId = -1;
+		const llong now = tab->m_schema->hasTTL() ? time(NULL) : 0;
 		MyRwLock lock(tab->m_rwMutex, false);
 		while (incrementNoCheckDel(&subId, val)) {
 			assert(subId >= 0);
 			assert(subId < m_segs[m_segIdx].seg->numDataRows());
 			llong baseId = m_segs[m_segIdx].baseId;
-			if (!tab->m_segments[m_segIdx]->m_isDel[subId]) {
+			if (!tab->m_segments[m_segIdx]->m_isDel[subId]
+					&& !isExpiredRow(*val, now)) {
 				*id = baseId + subId;
 				assert(*id < tab->numDataRows());
 				return true;
@@ -650,12 +777,14 @@ public:
 		assert(dynamic_cast<const DbTable*>(m_store.get()));
 		auto tab = static_cast<const DbTable*>(m_store.get());
 		llong subId = -1;
+		const llong now = tab->m_schema->hasTTL() ? time(NULL) : 0;
 		MyRwLock lock(tab->m_rwMutex, false);
 		while (incrementNoCheckDel(&subId, val)) {
 			assert(subId >= 0);
 			assert(subId < m_segs[m_segIdx-1].seg->numDataRows());
 			llong baseId = m_segs[m_segIdx-1].baseId;
-			if (!tab->m_segments[m_segIdx-1]->m_isDel[subId]) {
+			if (!tab->m_segments[m_segIdx-1]->m_isDel[subId]
+					&& !isExpiredRow(*val, now)) {
 				*id = baseId + subId;
 				assert(*id < tab->numDataRows());
 				return true;
@@ -794,10 +923,23 @@ llong BatchWriter::overwriteExisting(fstring row) {
 }
 
 llong BatchWriter::upsertRow(fstring row) {
+	auto ctx = m_ctx.get();
+	auto tab = ctx->m_tab;
+	std::string mergeKey;
+	if (tab->m_mergeOperator) {
+		const Schema& indexSchema = tab->getIndexSchema(tab->m_schema->m_uniqIndices[0]);
+		tab->m_schema->m_rowSchema->parseRow(row, &ctx->cols1);
+		indexSchema.selectParent(ctx->cols1, &ctx->key1);
+		mergeKey.assign((const char*)ctx->key1.data(), ctx->key1.size());
+	}
 	for (size_t retry = 0; retry < 3; ++retry) {
 		llong recId = upsertRowImpl(row);
-		if (recId >= 0)
+		if (recId >= 0) {
+			if (tab->m_mergeOperator)
+				addMergeKey(mergeKey);
+			logChange(ChangeLog::Upsert, recId, row);
 			return recId;
+		}
 		std::this_thread::yield();
 	}
 	TERARK_THROW(NeedRetryException, "Concurrent transaction conflict, retry again");
@@ -852,6 +994,11 @@ FindInFrozenSegments:
 			if (ctx->segArrayUpdateSeq != tab->m_segArrayUpdateSeq) {
 				ctx->doSyncSegCtxNoLock(tab);
 				size_t upp = upper_bound_a(ctx->m_rowNumVec, recId);
+				if (terark_unlikely(0 == upp)) {
+					// dropped by dropLeadingSegments, search again
+					segIdx = size_t(-1);
+					continue;
+				}
 #if !defined(NDEBUG)
 				if (seg != ctx->m_segCtx[upp-1]->seg) {
 					seg = ctx->m_segCtx[upp-1]->seg; // for set break point
@@ -869,6 +1016,7 @@ FindInFrozenSegments:
 				//break;
 			} else {
 				txn->m_removeOnCommit.push_back(recId);
+				logChange(ChangeLog::Remove, recId, ctx->key1);
 			}
 		}
 	}
@@ -884,6 +1032,11 @@ void BatchWriter::removeRow(llong recId) {
 	assert(recId < tab->m_rowNum);
 	assert(tab->m_wrSeg.get() == m_wrSeg);
 	assert(txn == m_txn);
+	if (tab->m_mergeOperator) {
+		std::string key;
+		if (tab->getRowKey(recId, &key, ctx))
+			addMergeKey(key);
+	}
 	ctx->trySyncSegCtxSpeculativeLock(tab);
 	size_t upp = upper_bound_a(ctx->m_rowNumVec, recId);
 	llong baseId = ctx->m_rowNumVec[upp-1];
@@ -901,8 +1054,7 @@ void BatchWriter::removeRow(llong recId) {
 		{
 			if (wrseg->locked_testIsDel(subId))
 				return;
-			else
-				txn->m_removeOnCommit.push_back(recId);
+			txn->m_removeOnCommit.push_back(recId);
 		}
 		valvec<byte> &row = ctx->row1, &key = ctx->key1;
 		ColumnVec& columns = ctx->cols1;
@@ -915,8 +1067,13 @@ void BatchWriter::removeRow(llong recId) {
 				, recId, ex.what());
 		//	throw ReadRecordException("removeRow: pre remove index",
 		//		wrseg->m_segDir.string(), baseId, subId);
+			logChange(ChangeLog::Remove, recId, fstring());
 			return;
 		}
+		if (tab->m_changeLog) {
+			tab->getChangeLogKey(row, &key);
+			logChange(ChangeLog::Remove, recId, key);
+		}
 		sconf.m_rowSchema->parseRow(row, &columns);
 		for (size_t i = 0; i < wrseg->m_indices.size(); ++i) {
 			const Schema& iSchema = sconf.getIndexSchema(i);
@@ -926,19 +1083,94 @@ void BatchWriter::removeRow(llong recId) {
 		txn->storeRemove(subId);
 	}
 	else {
-		if (!seg->m_isDel[subId])
+		if (!seg->m_isDel[subId]) {
 			txn->m_removeOnCommit.push_back(recId);
+			if (tab->m_changeLog) {
+				try {
+					seg->getValue(subId, &ctx->row1, ctx);
+					tab->getChangeLogKey(ctx->row1, &ctx->key1);
+				}
+				catch (const ReadRecordException&) {
+					ctx->key1.erase_all(); // removed concurrently
+				}
+				logChange(ChangeLog::Remove, recId, ctx->key1);
+			}
+		}
+	}
+}
+
+void BatchWriter::logChange(ChangeLog::OpType type, llong recId, fstring data) {
+	if (m_ctx->m_tab->m_changeLog) {
+		ChangeLog::encode(&m_changes, type, recId, data);
+		m_changeNum++;
+	}
+}
+
+// a row written by this batch replaces the pending operands of its key,
+// including the operands staged by this batch before it
+void BatchWriter::addMergeKey(fstring key) {
+	auto& ops = m_mergeOps;
+	ops.erase(std::remove_if(ops.begin(), ops.end(),
+		[key](const std::pair<std::string, std::string>& x) {
+			return fstring(x.first) == key;
+		}), ops.end());
+	m_mergeKeys.push_back(key.str());
+}
+
+void BatchWriter::discardMergeOperands(fstring key) {
+	if (m_ctx->m_tab->m_mergeOperator) {
+		addMergeKey(key);
+	}
+}
+
+void BatchWriter::mergeRow(fstring key, fstring operand) {
+	auto tab = m_ctx->m_tab;
+	if (!tab->m_mergeOperator) {
+		THROW_STD(invalid_argument
+			, "merge operator is not set: %s", tab->m_dir.string().c_str());
 	}
+	m_mergeOps.emplace_back(key.str(), operand.str());
 }
 
+// keys written by this batch are locked in ascending order of their
+// mutexes against concurrent mergeRow, reads of merged rows and
+// collapseMergeOperands, the transaction is started before them
 bool BatchWriter::commit() {
+	if (m_mergeKeys.empty() && m_mergeOps.empty()) {
+		return doCommit();
+	}
+	auto tab = m_ctx->m_tab;
+	valvec<size_t> mutexIdx;
+	for (const std::string& key : m_mergeKeys) {
+		mutexIdx.push_back(DbTable::mergeKeyMutexIdx(key));
+	}
+	for (const auto& op : m_mergeOps) {
+		mutexIdx.push_back(DbTable::mergeKeyMutexIdx(op.first));
+	}
+	tab->lockMergeKeys(&mutexIdx);
+	BOOST_SCOPE_EXIT(tab, &mutexIdx) {
+		tab->unlockMergeKeys(mutexIdx);
+	} BOOST_SCOPE_EXIT_END;
+	return doCommit();
+}
+
+bool BatchWriter::doCommit() {
 	auto tab = m_ctx->m_tab;
+	auto& stats = m_ctx->m_stats;
+	llong t0 = g_statPf.now();
 	DbTransaction* txn(m_ctx->m_transaction.get());
 	auto& ws = *tab->m_wrSeg;
 	assert(&ws == m_wrSeg);
 	assert(txn == m_txn);
 	assert(DbTransaction::started == txn->m_status);
-	bool commitOk = txn->commit();
+	bool commitOk;
+	{
+		auto changeLock = tab->lockChangeLog();
+		commitOk = txn->commit();
+		if (commitOk && m_changeNum) {
+			tab->m_changeLog->appendBatch(m_changes, m_changeNum);
+		}
+	}
 	const size_t batchCnt = 100; // don't lock too long time
 	size_t myDelcnt = 0;
 	if (commitOk) {
@@ -946,10 +1178,13 @@ bool BatchWriter::commit() {
 	//	fprintf(stderr, "TRACE: BatchWriter::commit: txn->m_removeOnCommit.size = %zd\n", txn->m_removeOnCommit.size());
 		for(size_t i = 0; i < txn->m_removeOnCommit.size(); ) {
 			size_t upper = std::min(i + batchCnt, txn->m_removeOnCommit.size());
-			MyRwLock lock(tab->m_rwMutex, false);
+			StatRwLock lock(tab->m_rwMutex, false, stats);
 			for(; i < upper; ++i) {
 				llong recId = txn->m_removeOnCommit[i];
 				size_t upp = upper_bound_a(tab->m_rowNumVec, recId);
+				if (terark_unlikely(0 == upp)) {
+					continue; // dropped by dropLeadingSegments
+				}
 				llong baseId = tab->m_rowNumVec[upp-1];
 				size_t subId = size_t(recId - baseId);
 				auto seg = tab->m_segments[upp-1].get();
@@ -993,7 +1228,7 @@ bool BatchWriter::commit() {
 		myDelcnt = txn->m_removeOnRollback.size();
 	}
 	if (myDelcnt > 0) {
-		MyRwLock lock(tab->m_rwMutex, true);
+		StatRwLock lock(tab->m_rwMutex, true, stats);
 		const size_t segNum = tab->m_segments.size();
 		for(size_t i = 0; i < segNum-1; ++i) {
 			auto seg = tab->m_segments[i].get();
@@ -1005,6 +1240,16 @@ bool BatchWriter::commit() {
 			}
 		}
 	}
+	if (commitOk && (!m_mergeKeys.empty() || !m_mergeOps.empty())) {
+		// the merge key mutexes are locked by the caller
+		tab->applyMergeBatchNoLock(m_wrSeg, m_mergeKeys, m_mergeOps);
+	}
+	m_mergeKeys.clear();
+	m_mergeOps.clear();
+	m_changes.erase_all();
+	m_changeNum = 0;
+	stats.batchCommitCnt++;
+	stats.batchCommitNs += g_statPf.ns(t0, g_statPf.now());
 	return commitOk;
 }
 
@@ -1014,6 +1259,10 @@ void BatchWriter::rollback() {
 	assert(tab->m_wrSeg.get() == m_wrSeg);
 	assert(txn == m_txn);
 	assert(DbTransaction::started == txn->m_status);
+	m_mergeKeys.clear();
+	m_mergeOps.clear();
+	m_changes.erase_all();
+	m_changeNum = 0;
 	txn->rollback();
 	MyRwLock lock(tab->m_rwMutex, false);
 	auto& ws = *tab->m_wrSeg;
@@ -1036,11 +1285,186 @@ StoreIterator* DbTable::createStoreIterBackward(DbContext* ctx) const {
 	return new MyStoreIterBackward(this, ctx);
 }
 
+// DbContext is created from a SegArrayVersion, m_rwMutex is not needed
 DbContext* DbTable::createDbContext() const {
-	MyRwLock lock(m_rwMutex, false);
 	return this->createDbContextNoLock();
 }
 
+SegArrayVersion::SegArrayVersion() {
+	m_updateSeq = 0;
+}
+SegArrayVersion::~SegArrayVersion() {
+}
+
+ConvRowObserver::~ConvRowObserver() {
+}
+
+SegArrayVersionPtr DbTable::getSegArrayVersion() const {
+	EpochDomain::Guard guard(m_segArrayEpoch);
+	return SegArrayVersionPtr(m_segArrayVersion.load());
+}
+
+void DbTable::publishSegArrayNoLock() {
+	SegArrayVersionPtr ver(new SegArrayVersion());
+	ver->m_segments.resize(m_segments.size());
+	for (size_t i = 0; i < m_segments.size(); ++i) {
+		ver->m_segments[i] = m_segments[i];
+	}
+	ver->m_rowNumVec.assign(m_rowNumVec);
+	ver->m_wrSeg = m_wrSeg;
+	ver->m_schema = m_schema;
+	ver->m_updateSeq = m_segArrayUpdateSeq;
+	ver->add_ref(); // owned by m_segArrayVersion
+	SegArrayVersion* old = m_segArrayVersion.exchange(ver.get());
+	if (old) {
+		// readers never block in the epoch, this wait is short
+		m_segArrayEpoch.synchronize();
+		old->release();
+	}
+}
+
+void DbTable::setRowCacheCapacity(size_t capacityBytes) {
+	if (m_rowCache) {
+		m_rowCache->setCapacity(capacityBytes);
+	}
+	else if (capacityBytes) {
+		m_rowCache.reset(new RowCache(capacityBytes));
+	}
+}
+
+void DbTable::registerDbContext(DbContext* ctx) const {
+	std::lock_guard<std::mutex> lock(m_ctxListMutex);
+	ctx->m_prev = &m_ctxListHead;
+	ctx->m_next = m_ctxListHead.m_next;
+	m_ctxListHead.m_next->m_prev = ctx;
+	m_ctxListHead.m_next = ctx;
+}
+
+void DbTable::unregisterDbContext(DbContext* ctx) const {
+	std::lock_guard<std::mutex> lock(m_ctxListMutex);
+	ctx->m_prev->m_next = ctx->m_next;
+	ctx->m_next->m_prev = ctx->m_prev;
+	ctx->m_prev = ctx->m_next = ctx;
+	m_retiredStats.add(ctx->m_stats);
+}
+
+void DbTable::getStats(TableStats* st) const {
+	auto getBg = [](const BgTaskStat& x, TableStats::BgTask* y) {
+		y->cnt = x.cnt;
+		y->nsTime = x.nsTime;
+		y->bytes = x.bytes;
+	};
+	getBg(m_flushStat, &st->flush);
+	getBg(m_convStat , &st->conv );
+	getBg(m_mergeStat, &st->merge);
+	getBg(m_purgeStat, &st->purge);
+	st->segs.clear();
+	{
+		MyRwLock lock(m_rwMutex, false);
+		st->segs.resize(m_segments.size());
+		for (size_t i = 0; i < m_segments.size(); ++i) {
+			const ReadableSegment* seg = m_segments[i].get();
+			auto& s = st->segs[i];
+			s.dir = seg->m_segDir.filename().string();
+			s.rows = m_rowNumVec[i+1] - m_rowNumVec[i];
+			s.lookupCnt = seg->m_lookupCnt;
+			s.seekCnt = seg->m_seekCnt;
+		}
+	}
+	// counters of live DbContext are relaxed atomics, they are updated
+	// by their owner threads concurrently, the sum is not a snapshot
+	std::lock_guard<std::mutex> lock(m_ctxListMutex);
+	st->fg.clear();
+	st->fg.add(m_retiredStats);
+	st->liveCtxNum = 0;
+	for (auto p = m_ctxListHead.m_next; p != &m_ctxListHead; p = p->m_next) {
+		st->fg.add(static_cast<const DbContext*>(p)->m_stats);
+		st->liveCtxNum++;
+	}
+}
+
+std::string DbTable::getStatsJson() const {
+	TableStats st;
+	getStats(&st);
+	terark::json js;
+	auto& fg = js["foreground"];
+	fg["liveContexts"] = st.liveCtxNum;
+	fg["lookup"] = st.fg.lookupCnt.get();
+	fg["lookupSegProbe"] = st.fg.lookupSegProbeCnt.get();
+	fg["seek"] = st.fg.seekCnt.get();
+	fg["seekSegProbe"] = st.fg.seekSegProbeCnt.get();
+	fg["getValue"] = st.fg.getValueCnt.get();
+	fg["rwLockCnt"] = st.fg.rwLockCnt.get();
+	fg["rwLockWaitNs"] = st.fg.rwLockWaitNs.get();
+	fg["rwLockHoldNs"] = st.fg.rwLockHoldNs.get();
+	fg["segCtxResync"] = st.fg.segCtxResyncCnt.get();
+	fg["batchCommit"] = st.fg.batchCommitCnt.get();
+	fg["batchCommitNs"] = st.fg.batchCommitNs.get();
+	fg["rowCacheHit"] = st.fg.rowCacheHitCnt.get();
+	fg["rowCacheMiss"] = st.fg.rowCacheMissCnt.get();
+	if (m_rowCache) {
+		RowCache::Stat cs;
+		m_rowCache->getStat(&cs);
+		auto& rc = js["rowCache"];
+		rc["capacity"] = cs.capacity;
+		rc["usedBytes"] = cs.usedBytes;
+		rc["entries"] = cs.entryNum;
+		rc["hit"] = cs.hitCnt;
+		rc["miss"] = cs.missCnt;
+		rc["insert"] = cs.insertCnt;
+		rc["evict"] = cs.evictCnt;
+	}
+	auto& decode = js["decodeBytes"];
+	decode["writable"] = st.fg.wrSegDecodeBytes.get();
+	// m_schema may be replaced by addIndex, read it from a version, no lock
+	SchemaConfigPtr sconf = getSegArrayVersion()->m_schema;
+	for (size_t i = 0; i < st.fg.cgDecodeBytes.size(); ++i) {
+		if (i < sconf->getColgroupNum())
+			decode[sconf->getColgroupSchema(i).m_name] = st.fg.cgDecodeBytes[i].get();
+	}
+	auto putBg = [&](const char* name, const TableStats::BgTask& x) {
+		auto& bg = js["background"][name];
+		bg["cnt"] = x.cnt;
+		bg["ns"] = x.nsTime;
+		bg["bytes"] = x.bytes;
+	};
+	putBg("flush", st.flush);
+	putBg("convert", st.conv);
+	putBg("merge", st.merge);
+	putBg("purge", st.purge);
+	if (m_mergePolicy) {
+		MergePolicy::Stat ms;
+		m_mergePolicy->getStat(&ms);
+		auto& mp = js["mergePolicy"];
+		mp["type"] = m_mergePolicy->name();
+		mp["convBytes"] = ms.convBytes;
+		mp["mergeBytes"] = ms.mergeBytes;
+		mp["purgeBytes"] = ms.purgeBytes;
+		mp["mergeCnt"] = ms.mergeCnt;
+		mp["writeAmp"] = ms.writeAmp;
+		mp["segNum"] = ms.segNum;
+		mp["targetSegNum"] = ms.targetSegNum;
+	}
+	BgRateLimiter::Stat ls;
+	BgRateLimiter::instance().getStat(&ls);
+	auto& bl = js["bgRateLimiter"];
+	bl["bytes"] = ls.bytes;
+	bl["ioSleepNs"] = ls.ioSleepNs;
+	bl["cpuSleepNs"] = ls.cpuSleepNs;
+	bl["factor"] = ls.factor;
+	bl["fgLatencyNs"] = ls.fgLatencyNs;
+	auto& segs = js["segments"] = terark::json::array();
+	for (auto& s : st.segs) {
+		terark::json one;
+		one["dir"] = s.dir;
+		one["rows"] = s.rows;
+		one["lookup"] = s.lookupCnt;
+		one["seek"] = s.seekCnt;
+		segs.push_back(one);
+	}
+	return js.dump(2);
+}
+
 llong DbTable::existingRows(DbContext* ctx) const {
 	MyRwLock lock(m_rwMutex, false);
 	llong delcnt = 0;
@@ -1048,7 +1472,7 @@ llong DbTable::existingRows(DbContext* ctx) const {
 		auto seg = m_segments[i].get();
 		delcnt += seg->m_delcnt;
 	}
-	fprintf(stderr, "INFO: m_rowNum = %lld, delcnt = %lld\n", m_rowNum, delcnt);
+	fprintf(stderr, "INFO: m_rowNum = %lld, delcnt = %lld\n", llong(m_rowNum), delcnt);
 	llong r = m_rowNum - delcnt;
 	return r;
 }
@@ -1097,27 +1521,35 @@ const {
 	auto rowNumPtr = ctx->m_rowNumVec.data();
 	size_t upp = upper_bound_0(rowNumPtr, ctx->m_rowNumVec.size(), id);
 	assert(upp < ctx->m_rowNumVec.size());
+	if (terark_unlikely(0 == upp)) {
+		THROW_STD(out_of_range, "id = %lld is dropped, headRowNum = %lld"
+			, id, rowNumPtr[0]);
+	}
 	llong baseId = rowNumPtr[upp-1];
 	llong subId = id - baseId;
 	auto seg = ctx->m_segCtx[upp-1]->seg;
+	ctx->m_stats.getValueCnt++;
 	seg->getValueAppend(subId, val, ctx);
 }
 
 bool
 DbTable::maybeCreateNewSegment(MyRwLock& lock) {
 	DebugCheckRowNumVecNoLock(this);
+	maybeAsyncExpireTTL();
 	if (m_isMerging) {
+		if (isWritingSegmentFullNoLock())
+			m_rotationBlocked = true;
 		return false;
 	}
 	if (m_inprogressWritingCount > 1) {
 		return false;
 	}
-	if (m_wrSeg->dataStorageSize() >= m_schema->m_maxWritingSegmentSize) {
+	if (isWritingSegmentFullNoLock()) {
 		if (lock.upgrade_to_writer() ||
 			// if upgrade_to_writer fails, it means the lock has been
 			// temporary released and re-acquired, so we need check
 			// the condition again
-			m_wrSeg->dataStorageSize() >= m_schema->m_maxWritingSegmentSize)
+			isWritingSegmentFullNoLock())
 		{
 			doCreateNewSegmentInLock();
 		}
@@ -1130,16 +1562,26 @@ DbTable::maybeCreateNewSegment(MyRwLock& lock) {
 void DbTable::maybeCreateNewSegmentInWriteLock() {
 	DebugCheckRowNumVecNoLock(this);
 	if (m_isMerging) {
+		if (isWritingSegmentFullNoLock())
+			m_rotationBlocked = true;
 		return;
 	}
 	if (m_inprogressWritingCount > 1) {
 		return;
 	}
-	if (m_wrSeg->dataStorageSize() >= m_schema->m_maxWritingSegmentSize) {
+	if (isWritingSegmentFullNoLock()) {
 		doCreateNewSegmentInLock();
 	}
 }
 
+// pending merge operands are counted, a segment which has no rows is not
+// frozen, its operands are collapsed into rows of itself by mergeRow
+bool DbTable::isWritingSegmentFullNoLock() const {
+	auto wrseg = m_wrSeg.get();
+	llong size = wrseg->dataStorageSize() + llong(wrseg->mergeLogMemSize());
+	return size >= m_schema->m_maxWritingSegmentSize && wrseg->m_isDel.size() > 0;
+}
+
 void
 DbTable::doCreateNewSegmentInLock() {
 	assert(!m_isMerging);
@@ -1169,6 +1611,7 @@ DbTable::doCreateNewSegmentInLock() {
 	m_rowNumVec.push_back(newMaxRowNum);
 	m_newWrSegNum++;
 	m_segArrayUpdateSeq++;
+	publishSegArrayNoLock();
 	oldwrseg->m_deletedWrIdSet.clear(); // free memory
 	// freeze oldwrseg, this may be too slow
 	// auto& oldwrseg = m_segments.ende(2);
@@ -1191,6 +1634,9 @@ DbTable::myCreateWritableSegment(PathRef segDir) const {
 	assert(seg);
 	seg->m_segDir = segDir;
 	seg->m_schema = this->m_schema;
+	if (m_mergeOperator) {
+		seg->m_mergeLog.reset(new MergeOperandLog(segDir / MergeOperandLog::FileName));
+	}
 	if (seg->m_indices.empty()) {
 		seg->m_indices.resize(m_schema->getIndexNum());
 		for (size_t i = 0; i < seg->m_indices.size(); ++i) {
@@ -1215,6 +1661,9 @@ bool DbTable::exists(llong id) const {
 	if (terark_unlikely(id >= llong(m_rowNumVec.back()))) {
 		return false;
 	}
+	if (terark_unlikely(id < m_rowNumVec[0])) {
+		return false; // dropped by dropLeadingSegments
+	}
 	size_t upp = upper_bound_a(m_rowNumVec, id);
 	assert(upp < m_rowNumVec.size());
 	llong baseId = m_rowNumVec[upp-1];
@@ -1234,18 +1683,19 @@ DbTable::insertRow(fstring row, DbContext* txn) {
 		m_schema->m_rowSchema->parseRow(row, &txn->cols1);
 	}
 	IncrementGuard_size_t guard(m_inprogressWritingCount);
-	MyRwLock lock(m_rwMutex, false);
+	StatRwLock lock(m_rwMutex, false, txn->m_stats);
 	assert(m_rowNumVec.size() == m_segments.size()+1);
 	return insertRowImpl(row, txn, lock);
 }
 
 llong
-DbTable::insertRowImpl(fstring row, DbContext* ctx, MyRwLock& lock) {
+DbTable::insertRowImpl(fstring row, DbContext* ctx, MyRwLock& lock,
+					   llong replacedId, fstring replacedKey) {
 	DebugCheckRowNumVecNoLock(this);
 	maybeCreateNewSegment(lock);
 	ctx->trySyncSegCtxNoLock(this);
 	if (!ctx->syncIndex) {
-		return insertRowDoInsert(row, ctx);
+		return insertRowDoInsert(row, ctx, replacedId, replacedKey);
 	}
 	const SchemaConfig& sconf = *m_schema;
 	for (size_t segIdx = 0; segIdx < m_segments.size()-1; ++segIdx) {
@@ -1256,7 +1706,7 @@ DbTable::insertRowImpl(fstring row, DbContext* ctx, MyRwLock& lock) {
 			iSchema.selectParent(ctx->cols1, &ctx->key1);
 			seg->indexSearchExact(segIdx, indexId, ctx->key1, &ctx->exactMatchRecIdvec, ctx);
 			for(llong logicId : ctx->exactMatchRecIdvec) {
-				if (!seg->m_isDel[logicId]) {
+				if (!seg->m_isDel[logicId] && !isExpiredDup(seg, logicId, ctx)) {
 					char szIdstr[96];
 					snprintf(szIdstr, sizeof(szIdstr), "logicId = %lld", logicId);
 					ctx->errMsg = "DupKey=" + iSchema.toJsonStr(ctx->key1)
@@ -1269,14 +1719,16 @@ DbTable::insertRowImpl(fstring row, DbContext* ctx, MyRwLock& lock) {
 			}
 		}
 	}
-	return insertRowDoInsert(row, ctx);
+	return insertRowDoInsert(row, ctx, replacedId, replacedKey);
 }
 
 llong
-DbTable::insertRowDoInsert(fstring row, DbContext* ctx) {
+DbTable::insertRowDoInsert(fstring row, DbContext* ctx,
+						   llong replacedId, fstring replacedKey) {
 	TransactionGuard txn(ctx->m_transaction.get());
 	llong recId = insertRowDoInsertNoCommit(row, ctx);
 	if (recId >= 0) {
+		auto changeLock = lockChangeLog();
 		if (!txn.commit()) {
 			llong wrBaseId = m_rowNumVec.end()[-2];
 			llong subId = recId - wrBaseId;
@@ -1285,6 +1737,10 @@ DbTable::insertRowDoInsert(fstring row, DbContext* ctx) {
 				, "commit failed: %s, baseId=%lld, subId=%lld, seg = %s"
 				, txn.szError(), wrBaseId, subId, ws.m_segDir.string().c_str());
 		}
+		if (replacedId >= 0) {
+			logChange(ChangeLog::Remove, replacedId, replacedKey);
+		}
+		logChange(ChangeLog::Upsert, recId, row);
 	}
 	else {
 		txn.rollback();
@@ -1359,7 +1815,9 @@ DbTable::insertSyncIndex(llong subId, DbTransaction* txn, DbContext* ctx) {
 		const Schema& iSchema = sconf.getIndexSchema(indexId);
 		assert(iSchema.m_isUnique);
 		iSchema.selectParent(ctx->cols1, &ctx->key1);
-		if (!txn->indexInsert(indexId, ctx->key1, subId)) {
+		if (!txn->indexInsert(indexId, ctx->key1, subId) &&
+			(!removeExpiredWrDup(indexId, txn, ctx) ||
+			 !txn->indexInsert(indexId, ctx->key1, subId))) {
 			ctx->errMsg = "DupKey=" + iSchema.toJsonStr(ctx->key1)
 						+ ", in writing seg: " + m_wrSeg->m_segDir.string();
 			goto Fail;
@@ -1385,8 +1843,73 @@ Fail:
 	return false;
 }
 
+// an expired row in the writing segment holding ctx->key1 of unique
+// index indexId is removed from all indices and marked as deleted, as
+// markExpiredRows does, no change log is written. The deletion mark is
+// not undone if txn is rolled back, the row has expired anyway.
+bool
+DbTable::removeExpiredWrDup(size_t indexId, DbTransaction* txn, DbContext* ctx) {
+	if (!m_schema->hasTTL()) {
+		return false;
+	}
+	const SchemaConfig& sconf = *m_schema;
+	auto& ws = *m_wrSeg;
+	const llong now = time(NULL);
+	ws.m_indices[indexId]->searchExact(ctx->key1, &ctx->exactMatchRecIdvec, ctx);
+	bool removed = false;
+	for (llong physicId : ctx->exactMatchRecIdvec) {
+		llong subId = ws.getLogicId(physicId);
+		if (ws.m_isDel[subId]) {
+			continue;
+		}
+		if (!isExpiredNoLock(&ws, subId, now, ctx)) {
+			return false;
+		}
+		txn->storeGetRow(subId, &ctx->row2);
+		sconf.m_rowSchema->parseRow(ctx->row2, &ctx->cols2);
+		for (size_t i = 0; i < ws.m_indices.size(); ++i) {
+			sconf.getIndexSchema(i).selectParent(ctx->cols2, &ctx->key2);
+			txn->indexRemove(i, ctx->key2, subId);
+		}
+		txn->storeRemove(subId);
+		SpinRwLock wsLock(ws.m_segMutex);
+		if (!ws.m_isDel[subId]) {
+			ws.m_deletedWrIdSet.push_back(uint32_t(subId));
+			ws.m_delcnt++;
+			ws.m_isDel.set1(subId);
+			ws.m_isDirty = true;
+			assert(ws.m_isDel.popcnt() == ws.m_delcnt);
+		}
+		removed = true;
+	}
+	return removed;
+}
+
 // dup keys in unique index errors will be ignored
 llong DbTable::upsertRow(fstring row, DbContext* ctx) {
+	if (m_mergeOperator) {
+		// the row replaces pending merge operands of its key, they are
+		// discarded by BatchWriter::commit, see lock order of mergeRow
+		for (size_t retry = 0; retry < 2; ++retry) {
+			BatchWriter bw(this, ctx);
+			llong recId;
+			try {
+				recId = bw.upsertRow(row);
+			}
+			catch (const std::exception&) {
+				bw.rollback();
+				throw;
+			}
+			if (bw.commit()) {
+				return recId;
+			}
+		}
+		TERARK_THROW(NeedRetryException, "Insertion temporary failed, retry later");
+	}
+	return upsertRowRetry(row, ctx);
+}
+
+llong DbTable::upsertRowRetry(fstring row, DbContext* ctx) {
 	for (size_t retry = 0; retry < 2; ++retry) {
 		llong recId = doUpsertRow(row, ctx);
 		if (recId >= 0) {
@@ -1426,7 +1949,7 @@ DbTable::doUpsertRow(fstring row, DbContext* ctx) {
 	const Schema& indexSchema = sconf.getIndexSchema(uniqueIndexId);
 	indexSchema.selectParent(ctx->cols1, &ctx->key1);
 	{
-		MyRwLock lock(m_rwMutex, false);
+		StatRwLock lock(m_rwMutex, false, ctx->m_stats);
 		ctx->trySyncSegCtxNoLock(this);
 	}
 	for (size_t segIdx = 0; segIdx < ctx->m_segCtx.size()-1; ++segIdx) {
@@ -1437,11 +1960,16 @@ DbTable::doUpsertRow(fstring row, DbContext* ctx) {
 			llong subId = ctx->exactMatchRecIdvec[0];
 			llong baseId = ctx->m_rowNumVec[segIdx];
 			assert(ctx->exactMatchRecIdvec.size() == 1);
-			MyRwLock lock(m_rwMutex, false);
+			StatRwLock lock(m_rwMutex, false, ctx->m_stats);
 			if (ctx->segArrayUpdateSeq != m_segArrayUpdateSeq) {
 				ctx->doSyncSegCtxNoLock(this);
 				llong recId = baseId + subId;
 				size_t upp = upper_bound_a(ctx->m_rowNumVec, recId);
+				if (terark_unlikely(0 == upp)) {
+					// dropped by dropLeadingSegments, search again
+					segIdx = size_t(-1);
+					continue;
+				}
 #if !defined(NDEBUG)
 				if (seg != ctx->m_segCtx[upp-1]->seg) {
 					seg = ctx->m_segCtx[upp-1]->seg; // for set break point
@@ -1458,7 +1986,11 @@ DbTable::doUpsertRow(fstring row, DbContext* ctx) {
 			if (seg->m_isDel[subId]) { // should be very rare
 				break;
 			}
-			llong newRecId = insertRowDoInsert(row, ctx);
+			// ctx->key1 is changed by insert
+			std::string oldKey;
+			if (m_changeLog)
+				oldKey.assign((const char*)ctx->key1.data(), ctx->key1.size());
+			llong newRecId = insertRowDoInsert(row, ctx, baseId + subId, oldKey);
 			if (newRecId >= 0) {
 				{
 					SpinRwLock segLock(seg->m_segMutex, true);
@@ -1480,7 +2012,7 @@ DbTable::doUpsertRow(fstring row, DbContext* ctx) {
 			return newRecId;
 		}
 	}
-	MyRwLock lock(m_rwMutex, false);
+	StatRwLock lock(m_rwMutex, false, ctx->m_stats);
 	ctx->trySyncSegCtxNoLock(this);
 	m_wrSeg->indexSearchExact(m_segments.size()-1, uniqueIndexId,
 		ctx->key1, &ctx->exactMatchRecIdvec, ctx);
@@ -1510,10 +2042,14 @@ DbTable::doUpsertRow(fstring row, DbContext* ctx) {
 		updateSyncMultIndex(subId, txn.getTxn(), ctx);
 	}
 	txn.storeUpsert(subId, row);
-	if (!txn.commit()) {
-		TERARK_THROW(CommitException
-			, "commit failed: %s, baseId=%lld, subId=%lld, seg = %s, caller should retry"
-			, txn.szError(), baseId, subId, m_wrSeg->m_segDir.string().c_str());
+	{
+		auto changeLock = lockChangeLog();
+		if (!txn.commit()) {
+			TERARK_THROW(CommitException
+				, "commit failed: %s, baseId=%lld, subId=%lld, seg = %s, caller should retry"
+				, txn.szError(), baseId, subId, m_wrSeg->m_segDir.string().c_str());
+		}
+		logChange(ChangeLog::Upsert, baseId + subId, row);
 	}
 	ctx->isUpsertOverwritten = 1;
 	maybeCreateNewSegment(lock);
@@ -1533,7 +2069,7 @@ llong
 DbTable::updateRow(llong id, fstring row, DbContext* ctx) {
 	m_schema->m_rowSchema->parseRow(row, &ctx->cols1); // new row
 	IncrementGuard_size_t guard(m_inprogressWritingCount);
-	MyRwLock lock(m_rwMutex, false);
+	StatRwLock lock(m_rwMutex, false, ctx->m_stats);
 	DebugCheckRowNumVecNoLock(this);
 	assert(m_rowNumVec.size() == m_segments.size()+1);
 	assert(id < m_rowNumVec.back());
@@ -1542,6 +2078,10 @@ DbTable::updateRow(llong id, fstring row, DbContext* ctx) {
 			, "id=%lld is large/equal than rows=%lld"
 			, id, m_rowNumVec.back());
 	}
+	if (id < m_rowNumVec[0]) {
+		THROW_STD(invalid_argument
+			, "id=%lld is dropped, headRowNum=%lld", id, m_rowNumVec[0]);
+	}
 	size_t j = upper_bound_0(m_rowNumVec.data(), m_rowNumVec.size(), id);
 	assert(j > 0);
 	assert(j < m_rowNumVec.size());
@@ -1585,11 +2125,14 @@ DbTable::updateRow(llong id, fstring row, DbContext* ctx) {
 	}
 	if (j == m_rowNumVec.size()-1) { // id is in m_wrSeg
 		if (ctx->syncIndex) {
+			// logged by updateWithSyncIndex
 			updateWithSyncIndex(subId, row, ctx);
 		}
 		else {
+			auto changeLock = lockChangeLog();
 			m_wrSeg->m_isDirty = true;
 			m_wrSeg->update(subId, row, ctx);
+			logChange(ChangeLog::Upsert, id, row);
 		}
 		return id; // id is not changed
 	}
@@ -1598,7 +2141,13 @@ DbTable::updateRow(llong id, fstring row, DbContext* ctx) {
 		lock.downgrade_to_reader();
 	//	lock.release();
 	//	lock.acquire(m_rwMutex, false);
-		llong recId = insertRowImpl(row, ctx, lock); // id is changed
+		valvec<byte> oldKey;
+		if (m_changeLog) {
+			if (!ctx->syncIndex)
+				seg->getValue(subId, &ctx->row2, ctx);
+			getChangeLogKey(ctx->row2, &oldKey);
+		}
+		llong recId = insertRowImpl(row, ctx, lock, id, oldKey); // id is changed
 		if (recId >= 0) {
 			// mark old subId as deleted
 			SpinRwLock segLock(seg->m_segMutex);
@@ -1630,7 +2179,7 @@ DbTable::updateCheckSegDup(size_t begSeg, size_t numSeg, DbContext* ctx) {
 			rIndex->searchExact(ctx->key1, &ctx->exactMatchRecIdvec, ctx);
 			for(llong physicId : ctx->exactMatchRecIdvec) {
 				llong logicId = seg->getLogicId(physicId);
-				if (!seg->m_isDel[logicId]) {
+				if (!seg->m_isDel[logicId] && !isExpiredDup(seg, logicId, ctx)) {
 					// std::move makes it no temps
 					char szIdstr[96];
 					snprintf(szIdstr, sizeof(szIdstr)
@@ -1686,13 +2235,17 @@ DbTable::updateWithSyncIndex(llong subId, fstring row, DbContext* ctx) {
 	}
 	updateSyncMultIndex(subId, txn.getTxn(), ctx);
 	txn.storeUpsert(subId, row);
+  {
+	auto changeLock = lockChangeLog();
+	llong baseId = m_rowNumVec.ende(2);
 	if (!txn.commit()) {
-		llong baseId = m_rowNumVec.ende(2);
 		TERARK_THROW(CommitException
 			, "commit failed: %s, baseId=%lld, subId=%lld, seg = %s"
 			, txn.szError(), baseId, subId
 			, m_wrSeg->m_segDir.string().c_str());
 	}
+	logChange(ChangeLog::Upsert, baseId + subId, row);
+  }
 	return true;
 Fail:
 	for (size_t j = i; j > 0; ) {
@@ -1727,18 +2280,50 @@ DbTable::updateSyncMultIndex(llong subId, DbTransaction* txn, DbContext* ctx) {
 bool
 DbTable::removeRow(llong id, DbContext* ctx) {
 	assert(ctx != nullptr);
+	if (m_mergeOperator) {
+		// discard pending merge operands of the key, same as upsertRow
+		BatchWriter bw(this, ctx);
+		try {
+			bw.removeRow(id);
+		}
+		catch (const std::exception&) {
+			bw.rollback();
+			throw;
+		}
+		return bw.commit();
+	}
+	return doRemoveRow(id, ctx);
+}
+
+bool
+DbTable::doRemoveRow(llong id, DbContext* ctx) {
 	IncrementGuard_size_t guard(m_inprogressWritingCount);
 	const llong snapshotVersion = this->m_rowNum - 1;
 	assert(snapshotVersion >= id);
-	MyRwLock lock(m_rwMutex, false);
+	StatRwLock lock(m_rwMutex, false, ctx->m_stats);
 	DebugCheckRowNumVecNoLock(this);
 	assert(m_rowNumVec.size() == m_segments.size()+1);
 	assert(id < m_rowNumVec.back());
+	if (terark_unlikely(id < m_rowNumVec[0])) {
+		return false; // dropped by dropLeadingSegments
+	}
 	size_t j = upper_bound_0(m_rowNumVec.data(), m_rowNumVec.size(), id);
 	assert(j < m_rowNumVec.size());
 	llong baseId = m_rowNumVec[j-1];
 	llong subId = id - baseId;
 	auto seg = m_segments[j-1].get();
+	valvec<byte> removedKey;
+	if (m_changeLog) {
+		try {
+			seg->getValue(subId, &ctx->row1, ctx);
+			getChangeLogKey(ctx->row1, &removedKey);
+		}
+		catch (const ReadRecordException&) {
+			return false; // removed concurrently
+		}
+	}
+	// the deletion mark is the commit point of removing
+	auto changeLock = lockChangeLog();
 	if (!seg->m_isFreezed) {
 		auto wrseg = m_wrSeg.get();
 		assert(wrseg == seg);
@@ -1756,6 +2341,9 @@ DbTable::removeRow(llong id, DbContext* ctx) {
 				return false;
 			}
 		}
+		logChange(ChangeLog::Remove, id, removedKey);
+		if (changeLock.owns_lock())
+			changeLock.unlock(); // before the transaction begins
 		if (ctx->syncIndex) {
 			TransactionGuard txn(ctx->m_transaction.get());
 			valvec<byte> &row = ctx->row1, &key = ctx->key1;
@@ -1789,6 +2377,7 @@ DbTable::removeRow(llong id, DbContext* ctx) {
 		}
 	}
 	else { // freezed segment, just set del mark
+		bool removed = false;
 		if (seg->m_deletionTime) {
 			assert(nullptr != m_schema->m_snapshotSchema);
 			llong* deltime = (llong*)seg->getRecordsBasePtr();
@@ -1796,6 +2385,7 @@ DbTable::removeRow(llong id, DbContext* ctx) {
 			if (deltime[subId] != LLONG_MAX) {
 				deltime[subId] = snapshotVersion;
 				seg->addtoUpdateList(size_t(subId));
+				removed = true;
 			}
 		}
 		else {
@@ -1809,8 +2399,14 @@ DbTable::removeRow(llong id, DbContext* ctx) {
 				size_t delcnt = seg->m_isDel.popcnt();
 				assert(delcnt == seg->m_delcnt);
 		#endif
+				removed = true;
 			}
 		}
+		if (removed) {
+			logChange(ChangeLog::Remove, id, removedKey);
+		}
+		if (changeLock.owns_lock())
+			changeLock.unlock();
 		if (checkPurgeDeleteNoLock(seg)) {
 			lock.upgrade_to_writer();
 			asyncPurgeDeleteInLock();
@@ -2024,10 +2620,18 @@ const {
 bool
 DbTable::indexKeyExistsNoLock(size_t indexId, fstring key, DbContext* ctx)
 const {
+	if (indexId >= ctx->m_schema->getIndexNum()) {
+		THROW_STD(out_of_range, "indexId = %zd, indexNum = %zd"
+			, indexId, ctx->m_schema->getIndexNum());
+	}
 	ctx->exactMatchRecIdvec.erase_all();
+	ctx->m_stats.lookupCnt++;
 	size_t segNum = ctx->m_segCtx.size();
 	for (size_t i = 0; i < segNum; ++i) {
-		auto seg = ctx->m_segCtx[i]->seg;
+		auto sctx = ctx->m_segCtx[i];
+		auto seg = sctx->seg;
+		ctx->m_stats.lookupSegProbeCnt++;
+		sctx->countLookup();
 		seg->indexSearchExactAppend(i, indexId, key, &ctx->exactMatchRecIdvec, ctx);
 		if (ctx->exactMatchRecIdvec.size()) {
 			return true;
@@ -2048,7 +2652,11 @@ void
 DbTable::indexSearchExactNoLock(size_t indexId, fstring key, valvec<llong>* recIdvec, DbContext* ctx)
 const {
 	recIdvec->erase_all();
-	const bool isUnique = m_schema->getIndexSchema(indexId).m_isUnique;
+	if (indexId >= ctx->m_schema->getIndexNum()) {
+		THROW_STD(out_of_range, "indexId = %zd, indexNum = %zd"
+			, indexId, ctx->m_schema->getIndexNum());
+	}
+	const bool isUnique = ctx->m_schema->getIndexSchema(indexId).m_isUnique;
 	size_t segNum = ctx->m_segCtx.size();
 #if 0
 	// search older segments first
@@ -2077,10 +2685,14 @@ const {
 //	std::reverse(recIdvec->begin(), recIdvec->end()); // make descending
 #else
 	// search newer segments first
+	ctx->m_stats.lookupCnt++;
 	for (size_t i = segNum; i > 0; ) {
-		auto seg = ctx->m_segCtx[--i]->seg;
+		auto sctx = ctx->m_segCtx[--i];
+		auto seg = sctx->seg;
 		if (seg->m_isDel.size() == seg->m_delcnt)
 			continue;
+		ctx->m_stats.lookupSegProbeCnt++;
+		sctx->countLookup();
 		size_t oldsize = recIdvec->size();
 		seg->indexSearchExactAppend(i, indexId, key, recIdvec, ctx);
 		size_t newsize = recIdvec->size();
@@ -2093,7 +2705,7 @@ const {
 			}
 			if (isUnique) {
 			//	assert(1 == newsize);
-				TERARK_IF_DEBUG(;,return);
+				TERARK_IF_DEBUG(;,break);
 			}
 			if (len >= 2) {
 				std::sort(p, p + len); // don't use std::greater
@@ -2102,6 +2714,126 @@ const {
 		}
 	}
 #endif
+	if (m_schema->hasTTL()) {
+		removeExpiredIds(recIdvec, 0, ctx);
+	}
+}
+
+namespace {
+// a is ascending and shorter than b, common ids are kept in a,
+// b is searched by galloping from the last matched position
+size_t gallopIntersect(llong* a, size_t na, const llong* b, size_t nb) {
+	size_t n = 0, lo = 0;
+	for (size_t i = 0; i < na; ++i) {
+		llong x = a[i];
+		size_t bound = 1;
+		while (lo + bound < nb && b[lo + bound] < x) {
+			bound *= 2;
+		}
+		size_t hi = std::min(lo + bound + 1, nb);
+		lo = std::lower_bound(b + lo + bound/2, b + hi, x) - b;
+		if (lo == nb) {
+			break;
+		}
+		if (b[lo] == x) {
+			a[n++] = x;
+		}
+	}
+	return n;
+}
+} // namespace
+
+void
+DbTable::indexSearchMulti(const IndexCondition* conds, size_t num, bool isAnd,
+						  valvec<llong>* recIdvec, DbContext* ctx)
+const {
+	ctx->trySyncSegCtxSpeculativeLock(this);
+	for (size_t j = 0; j < num; ++j) {
+		if (conds[j].indexId >= ctx->m_schema->getIndexNum()) {
+			THROW_STD(out_of_range, "indexId = %zd, indexNum = %zd"
+				, conds[j].indexId, ctx->m_schema->getIndexNum());
+		}
+	}
+	recIdvec->erase_all();
+	if (0 == num) {
+		return;
+	}
+	valvec<valvec<llong> > lists(num);
+	valvec<size_t> order(num, valvec_no_init());
+	valvec<llong>  segIds;
+	febitvec       bits;
+	size_t segNum = ctx->m_segCtx.size();
+	for (size_t i = 0; i < segNum; ++i) {
+		auto seg = ctx->m_segCtx[i]->seg;
+		if (seg->m_isDel.size() == seg->m_delcnt)
+			continue;
+		auto rdseg = seg->getReadonlySegment();
+		size_t totalIds = 0;
+		for (size_t j = 0; j < num; ++j) {
+			auto& ids = lists[j];
+			ids.erase_all();
+			// ids of ReadonlySegment are physic ids, not checked for deletion
+			if (rdseg)
+				rdseg->m_indices[conds[j].indexId]->searchExactAppend(conds[j].key, &ids, ctx);
+			else
+				seg->indexSearchExactAppend(i, conds[j].indexId, conds[j].key, &ids, ctx);
+			if (!std::is_sorted(ids.begin(), ids.end()))
+				std::sort(ids.begin(), ids.end());
+			if (isAnd && ids.empty())
+				break;
+			totalIds += ids.size();
+		}
+		segIds.erase_all();
+		if (isAnd) {
+			for (size_t j = 0; j < num; ++j) order[j] = j;
+			std::sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+				return lists[x].size() < lists[y].size();
+			});
+			if (lists[order[0]].empty())
+				continue;
+			segIds.swap(lists[order[0]]);
+			for (size_t j = 1; j < num && !segIds.empty(); ++j) {
+				auto& ids = lists[order[j]];
+				segIds.risk_set_size(gallopIntersect(
+					segIds.data(), segIds.size(), ids.data(), ids.size()));
+			}
+		}
+		else {
+			// the writing segment may grow after its ids are collected,
+			// so the bitmap is sized by the max collected id, lists are sorted
+			size_t bitRows = 0;
+			for (size_t j = 0; j < num; ++j) {
+				if (!lists[j].empty())
+					bitRows = std::max(bitRows, size_t(lists[j].back()) + 1);
+			}
+			if (totalIds * 8 > bitRows / 8) {
+				// dense, bitmap is smaller than the id lists
+				bits.resize_fill(bitRows, false);
+				for (size_t j = 0; j < num; ++j)
+					for (llong id : lists[j]) bits.set1(size_t(id));
+				for (size_t k = 0; k < bits.blsize(); ++k) {
+					for (bm_uint_t w = bits.bldata()[k]; w; w &= w - 1)
+						segIds.push_back(k * WordBits + fast_ctz(w));
+				}
+			}
+			else {
+				for (size_t j = 0; j < num; ++j)
+					segIds.append(lists[j]);
+				std::sort(segIds.begin(), segIds.end());
+				segIds.trim(std::unique(segIds.begin(), segIds.end()));
+			}
+		}
+		if (rdseg) {
+			rdseg->physicToLiveLogicIds(&segIds, 0, ctx);
+		}
+		llong baseId = ctx->m_rowNumVec[i];
+		for (llong id : segIds) {
+			recIdvec->push_back(baseId + id);
+		}
+	}
+	if (m_schema->hasTTL()) {
+		removeExpiredIds(recIdvec, 0, ctx);
+	}
 }
 
 // implemented in DfaDbTable
@@ -2127,12 +2859,12 @@ DbTable::indexInsert(size_t indexId, fstring indexKey, llong id,
 {
 	assert(txn != nullptr);
 	assert(id >= 0);
+	MyRwLock lock(m_rwMutex, true);
 	if (indexId >= m_schema->getIndexNum()) {
 		THROW_STD(invalid_argument,
 			"Invalid indexId=%lld, indexNum=%lld",
 			llong(indexId), llong(m_schema->getIndexNum()));
 	}
-	MyRwLock lock(m_rwMutex, true);
 	size_t upp = upper_bound_0(m_rowNumVec.data(), m_rowNumVec.size(), id);
 	assert(upp <= m_segments.size());
 	auto seg = m_segments[upp-1].get();
@@ -2155,12 +2887,12 @@ DbTable::indexRemove(size_t indexId, fstring indexKey, llong id,
 							DbContext* txn)
 {
 	assert(txn != nullptr);
+	MyRwLock lock(m_rwMutex, true);
 	if (indexId >= m_schema->getIndexNum()) {
 		THROW_STD(invalid_argument,
 			"Invalid indexId=%lld, indexNum=%lld",
 			llong(indexId), llong(m_schema->getIndexNum()));
 	}
-	MyRwLock lock(m_rwMutex, true);
 	size_t upp = upper_bound_0(m_rowNumVec.data(), m_rowNumVec.size(), id);
 	assert(upp <= m_segments.size());
 	auto seg = m_segments[upp-1].get();
@@ -2184,16 +2916,16 @@ DbTable::indexUpdate(size_t indexId, fstring indexKey,
 							 DbContext* txn)
 {
 	assert(txn != nullptr);
-	if (indexId >= m_schema->getIndexNum()) {
-		THROW_STD(invalid_argument,
-			"Invalid indexId=%lld, indexNum=%lld",
-			llong(indexId), llong(m_schema->getIndexNum()));
-	}
 	assert(oldId != newId);
 	if (oldId == newId) {
 		return true;
 	}
 	MyRwLock lock(m_rwMutex, false);
+	if (indexId >= m_schema->getIndexNum()) {
+		THROW_STD(invalid_argument,
+			"Invalid indexId=%lld, indexNum=%lld",
+			llong(indexId), llong(m_schema->getIndexNum()));
+	}
 	size_t oldupp = upper_bound_0(m_rowNumVec.data(), m_rowNumVec.size(), oldId);
 	size_t newupp = upper_bound_0(m_rowNumVec.data(), m_rowNumVec.size(), newId);
 	assert(oldupp <= m_segments.size());
@@ -2232,12 +2964,12 @@ DbTable::indexUpdate(size_t indexId, fstring indexKey,
 }
 
 llong DbTable::indexStorageSize(size_t indexId) const {
+	MyRwLock lock(m_rwMutex, false);
 	if (indexId >= m_schema->getIndexNum()) {
 		THROW_STD(invalid_argument,
 			"Invalid indexId=%lld, indexNum=%lld",
 			llong(indexId), llong(m_schema->getIndexNum()));
 	}
-	MyRwLock lock(m_rwMutex, false);
 	llong sum = 0;
 	for (size_t i = 0; i < m_segments.size(); ++i) {
 		sum += m_segments[i]->m_indices[indexId]->indexStorageSize();
@@ -2256,8 +2988,15 @@ class TableIndexIter : public IndexIterator {
 		valvec<byte>       data;
 		llong              subId = -1;
 		llong              baseId;
+		uint32_t           seekCnt = 0; // published to seg->m_seekCnt
 	};
 	valvec<OneSeg> m_segs;
+	static void publishSeekCnt(OneSeg& cur) {
+		if (cur.seekCnt) {
+			cur.seg->m_seekCnt += cur.seekCnt;
+			cur.seekCnt = 0;
+		}
+	}
 	static
 	bool lessThanImp(const Schema* schema, const OneSeg* segs, size_t x, size_t y) {
 		const auto& xkey = segs[x].data;
@@ -2367,10 +3106,20 @@ class TableIndexIter : public IndexIterator {
 
 	IndexIterator* createIter(const ReadableSegment& seg) {
 		auto index = seg.m_indices[m_indexId];
-		if (m_forward)
-			return index->createIndexIterForward(m_ctx.get());
-		else
-			return index->createIndexIterBackward(m_ctx.get());
+		IndexIterator* iter = m_forward
+			? index->createIndexIterForward(m_ctx.get())
+			: index->createIndexIterBackward(m_ctx.get())
+			;
+		if (m_endBoundSchema) {
+			iter->setEndBound(m_endBound, m_endBoundInclusive, m_ischema);
+		}
+		return iter;
+	}
+
+	// a child past the end bound is eof, it is not put into the heap
+	bool isChildPastEndBound(const OneSeg& cur) const {
+		return m_endBoundSchema && !cur.iter->appliesEndBound()
+			&& isPastEndBoundImpl(cur.data, m_forward);
 	}
 
 	size_t syncSegPtr() {
@@ -2378,54 +3127,84 @@ class TableIndexIter : public IndexIterator {
 			return 0;
 		}
 		size_t numChangedSegs = 0;
-		MyRwLock lock(m_tab->m_rwMutex, false);
-		m_oldsegArrayUpdateSeq = m_tab->m_segArrayUpdateSeq;
-		m_segs.resize(m_tab->m_segments.size());
+		SegArrayVersionPtr ver = m_tab->getSegArrayVersion();
+		if (m_oldsegArrayUpdateSeq == ver->m_updateSeq) {
+			return 0; // new version is not published yet
+		}
+		m_oldsegArrayUpdateSeq = ver->m_updateSeq;
+		m_segs.resize(ver->m_segments.size());
 		for (size_t i = 0; i < m_segs.size(); ++i) {
 			auto& cur = m_segs[i];
-			assert(m_tab->m_segments[i]);
-			if (cur.seg != m_tab->m_segments[i]) {
+			assert(ver->m_segments[i]);
+			if (cur.seg != ver->m_segments[i]) {
 				if (cur.seg) { // segment converted
 					cur.subId = -2; // need re-seek position??
+					publishSeekCnt(cur);
 				}
 				cur.iter = nullptr;
-				cur.seg  = m_tab->m_segments[i];
+				cur.seg  = ver->m_segments[i];
 				cur.data.erase_all();
-				cur.baseId = m_tab->m_rowNumVec[i];
+				cur.baseId = ver->m_rowNumVec[i];
 				numChangedSegs++;
 			}
 		}
 		return numChangedSegs;
 	}
 
+	// m_ctx holds the schema, index num only grows, so it is valid for
+	// all SegArrayVersion synced later
+	static const Schema&
+	snapshotIndexSchema(const DbContext& ctx, size_t indexId) {
+		if (indexId >= ctx.m_schema->getIndexNum()) {
+			THROW_STD(out_of_range, "indexId = %zd, indexNum = %zd"
+				, indexId, ctx.m_schema->getIndexNum());
+		}
+		return ctx.m_schema->getIndexSchema(indexId);
+	}
+
 public:
-	TableIndexIter(const DbTable* tab, size_t indexId, bool forward)
+	TableIndexIter(const DbTable* tab, size_t indexId, bool forward, DbContext* ctx)
 	  : m_tab(const_cast<DbTable*>(tab))
-	  , m_ctx(tab->createDbContext())
+	  , m_ctx(ctx ? ctx : tab->createDbContext())
 	  , m_indexId(indexId)
-	  , m_ischema(tab->getIndexSchema(m_indexId))
+	  , m_ischema(snapshotIndexSchema(*m_ctx, indexId))
 	  , m_forward(forward)
 	{
-		assert(tab->m_schema->getIndexSchema(indexId).m_isOrdered);
-		m_isUniqueInSchema = tab->m_schema->getIndexSchema(indexId).m_isUnique;
-		{
-			MyRwLock lock(tab->m_rwMutex);
-			tab->m_tableScanningRefCount++;
-		}
+		assert(m_ischema.m_isOrdered);
+		m_isUniqueInSchema = m_ischema.m_isUnique;
+		tab->m_tableScanningRefCount++;
 		m_oldsegArrayUpdateSeq = 0;
 		m_isHeapBuilt = false;
+		m_appliesEndBound = true;
 	}
 	~TableIndexIter() {
-		MyRwLock lock(m_tab->m_rwMutex);
+		for (auto& cur : m_segs)
+			publishSeekCnt(cur);
 		m_tab->m_tableScanningRefCount--;
 	}
 	void reset() override {
+		for (auto& cur : m_segs)
+			publishSeekCnt(cur);
 		m_heap.erase_all();
 		m_segs.erase_all();
 		m_keyBuf.erase_all();
 		m_oldsegArrayUpdateSeq = 0;
 		m_isHeapBuilt = false;
 	}
+	void setEndBound(fstring bound, bool inclusive, const Schema&) override {
+		IndexIterator::setEndBound(bound, inclusive, m_ischema);
+		for (auto& cur : m_segs) {
+			if (cur.iter)
+				cur.iter->setEndBound(bound, inclusive, m_ischema);
+		}
+	}
+	void clearEndBound() override {
+		IndexIterator::clearEndBound();
+		for (auto& cur : m_segs) {
+			if (cur.iter)
+				cur.iter->clearEndBound();
+		}
+	}
 	bool increment(llong* id, valvec<byte>* key) override {
 		if (terark_unlikely(!m_isHeapBuilt)) {
 			if (syncSegPtr()) {
@@ -2440,7 +3219,8 @@ public:
 			m_heap.reserve(m_segs.size());
 			for (size_t i = 0; i < m_segs.size(); ++i) {
 				auto& cur = m_segs[i];
-				if (cur.iter->increment(&cur.subId, &cur.data)) {
+				if (cur.iter->increment(&cur.subId, &cur.data) &&
+						!isChildPastEndBound(cur)) {
 					m_heap.push_back(i);
 					cur.subId = cur.seg->getLogicId(cur.subId);
 				}
@@ -2470,7 +3250,8 @@ public:
 		auto& cur = m_segs[segIdx];
 		*subId = cur.subId;
 		m_keyBuf.swap(cur.data); // should be assign, but swap is more efficient
-		if (cur.iter->increment(&cur.subId, &cur.data)) {
+		if (cur.iter->increment(&cur.subId, &cur.data) &&
+				!isChildPastEndBound(cur)) {
 			assert(m_heap.back() == segIdx);
 			pushHeap();
 			cur.subId = cur.seg->getLogicId(cur.subId);
@@ -2483,12 +3264,18 @@ public:
 		return segIdx;
 	}
 	bool isDeleted(size_t segIdx, llong subId) {
+		const ReadableSegment* seg = m_segs[segIdx].seg.get();
 		if (m_tab->m_segments.size()-1 == segIdx) {
 			MyRwLock lock(m_tab->m_rwMutex, false);
-			return m_segs[segIdx].seg->m_isDel[subId];
+			if (seg->m_isDel[subId])
+				return true;
 		} else {
-			return m_segs[segIdx].seg->m_isDel[subId];
+			if (seg->m_isDel[subId])
+				return true;
 		}
+		// expired rows are skipped as table iterators do
+		return m_tab->m_schema->hasTTL() &&
+			m_tab->isExpiredNoLock(seg, subId, time(NULL), m_ctx.get());
 	}
 	int seekLowerBound(fstring key, llong* id, valvec<byte>* retKey) override {
 		return seekBound(key, id, retKey, true);
@@ -2540,13 +3327,17 @@ public:
 		}
 		m_heap.erase_all();
 		m_heap.reserve(m_segs.size());
+		m_ctx->m_stats.seekCnt++;
+		m_ctx->m_stats.seekSegProbeCnt += m_segs.size();
 		for(size_t i = 0; i < m_segs.size(); ++i) {
 			auto& cur = m_segs[i];
+			if (terark_unlikely(++cur.seekCnt == DbContext::SegCtx::StatBatch))
+				publishSeekCnt(cur);
 			int ret = inclusive
 					? cur.iter->seekLowerBound(key, &cur.subId, &cur.data)
 					: cur.iter->seekUpperBound(key, &cur.subId, &cur.data)
 					;
-			if (ret >= 0) {
+			if (ret >= 0 && !isChildPastEndBound(cur)) {
 				m_heap.push_back(i);
 				cur.subId = cur.seg->getLogicId(cur.subId);
 			}
@@ -2601,9 +3392,14 @@ public:
 };
 
 IndexIteratorPtr DbTable::createIndexIterForward(size_t indexId) const {
+	return createIndexIterForward(indexId, NULL);
+}
+
+IndexIteratorPtr
+DbTable::createIndexIterForward(size_t indexId, DbContext* ctx) const {
 	assert(indexId < m_schema->getIndexNum());
 	assert(m_schema->getIndexSchema(indexId).m_isOrdered);
-	return new TableIndexIter(this, indexId, true);
+	return new TableIndexIter(this, indexId, true, ctx);
 }
 
 IndexIteratorPtr DbTable::createIndexIterForward(fstring indexCols) const {
@@ -2615,9 +3411,14 @@ IndexIteratorPtr DbTable::createIndexIterForward(fstring indexCols) const {
 }
 
 IndexIteratorPtr DbTable::createIndexIterBackward(size_t indexId) const {
+	return createIndexIterBackward(indexId, NULL);
+}
+
+IndexIteratorPtr
+DbTable::createIndexIterBackward(size_t indexId, DbContext* ctx) const {
 	assert(indexId < m_schema->getIndexNum());
 	assert(m_schema->getIndexSchema(indexId).m_isOrdered);
-	return new TableIndexIter(this, indexId, false);
+	return new TableIndexIter(this, indexId, false, ctx);
 }
 
 IndexIteratorPtr DbTable::createIndexIterBackward(fstring indexCols) const {
@@ -2664,7 +3465,7 @@ DbTable::selectColumnsNoLock(llong id, const valvec<size_t>& cols,
 const {
 //	DebugCheckRowNumVecNoLock(this);
 	llong rows = m_rowNum;
-	if (terark_unlikely(id < 0 || id >= rows)) {
+	if (terark_unlikely(id < ctx->m_rowNumVec[0] || id >= rows)) {
 		THROW_STD(out_of_range, "id = %lld, rows=%lld", id, rows);
 	}
 	size_t upp = upper_bound_a(ctx->m_rowNumVec, id);
@@ -2687,7 +3488,7 @@ DbTable::selectColumnsNoLock(llong id, const size_t* colsId, size_t colsNum,
 const {
 //	DebugCheckRowNumVecNoLock(this);
 	llong rows = m_rowNum;
-	if (terark_unlikely(id < 0 || id >= rows)) {
+	if (terark_unlikely(id < ctx->m_rowNumVec[0] || id >= rows)) {
 		THROW_STD(out_of_range, "id = %lld, rows=%lld", id, rows);
 	}
 	size_t upp = upper_bound_a(ctx->m_rowNumVec, id);
@@ -2696,6 +3497,89 @@ const {
 	seg->selectColumns(id - baseId, colsId, colsNum, colsData, ctx);
 }
 
+// ids are resolved to segments first, then records are fetched in a
+// pipeline: purge bits of the record 2*PrefetchDist ahead and store data
+// of the record PrefetchDist ahead are prefetched
+template<class FetchOne>
+static void
+fetchBatch(const DbContext* ctx, llong rows, const llong* ids, size_t num,
+		   const size_t* cgIdvec, size_t cgNum, valvec<byte>* vals,
+		   valvec<size_t>* offsets, FetchOne fetchOne) {
+	const size_t PrefetchDist = 8;
+	valvec<std::pair<const ReadableSegment*, llong> > loc(num, valvec_no_init());
+	for (size_t i = 0; i < num; ++i) {
+		llong id = ids[i];
+		if (terark_unlikely(id < ctx->m_rowNumVec[0] || id >= rows)) {
+			THROW_STD(out_of_range, "id = %lld, rows=%lld", id, rows);
+		}
+		size_t upp = upper_bound_a(ctx->m_rowNumVec, id);
+		loc[i].first = ctx->m_segCtx[upp-1]->seg;
+		loc[i].second = id - ctx->m_rowNumVec[upp-1];
+	}
+	auto prefetchLogic = [&](size_t i) {
+		if (auto seg = loc[i].first->getReadonlySegment())
+			seg->prefetchLogicId(size_t(loc[i].second));
+	};
+	auto prefetchPhysic = [&](size_t i) {
+		if (auto seg = loc[i].first->getReadonlySegment())
+			seg->prefetchPhysicId(seg->getPhysicId(size_t(loc[i].second)), cgIdvec, cgNum);
+	};
+	for (size_t i = 0; i < std::min(num, 2*PrefetchDist); ++i)
+		prefetchLogic(i);
+	for (size_t i = 0; i < std::min(num, PrefetchDist); ++i)
+		prefetchPhysic(i);
+	valvec<byte> rec;
+	offsets->resize_no_init(num + 1);
+	size_t* offsetsPtr = offsets->data();
+	offsetsPtr[0] = vals->size();
+	for (size_t i = 0; i < num; ++i) {
+		if (i + 2*PrefetchDist < num)
+			prefetchLogic(i + 2*PrefetchDist);
+		if (i + PrefetchDist < num)
+			prefetchPhysic(i + PrefetchDist);
+		fetchOne(loc[i].first, loc[i].second, &rec);
+		vals->append(rec);
+		offsetsPtr[i+1] = vals->size();
+	}
+}
+
+void
+DbTable::getValuesBatch(const llong* ids, size_t num, valvec<byte>* vals,
+						valvec<size_t>* offsets, DbContext* ctx)
+const {
+	ctx->trySyncSegCtxSpeculativeLock(this);
+	ctx->m_stats.getValueCnt += num;
+	fetchBatch(ctx, m_rowNum, ids, num, NULL, 0, vals, offsets,
+		[ctx](const ReadableSegment* seg, llong subId, valvec<byte>* rec) {
+			rec->risk_set_size(0);
+			seg->getValueAppend(subId, rec, ctx);
+		});
+}
+
+void
+DbTable::selectColumnsBatch(const llong* ids, size_t num,
+							const size_t* colsId, size_t colsNum,
+							valvec<byte>* colsData, valvec<size_t>* offsets,
+							DbContext* ctx)
+const {
+	ctx->trySyncSegCtxSpeculativeLock(this);
+	valvec<size_t> cgIdvec;
+	for (size_t i = 0; i < colsNum; ++i) {
+		if (colsId[i] >= m_schema->m_colproject.size()) {
+			THROW_STD(out_of_range, "colsId[%zd] = %zd, columns = %zd"
+				, i, colsId[i], m_schema->m_colproject.size());
+		}
+		size_t cgId = m_schema->m_colproject[colsId[i]].colgroupId;
+		if (std::find(cgIdvec.begin(), cgIdvec.end(), cgId) == cgIdvec.end())
+			cgIdvec.push_back(cgId);
+	}
+	fetchBatch(ctx, m_rowNum, ids, num, cgIdvec.data(), cgIdvec.size(),
+		colsData, offsets,
+		[&](const ReadableSegment* seg, llong subId, valvec<byte>* rec) {
+			seg->selectColumns(subId, colsId, colsNum, rec, ctx);
+		});
+}
+
 void
 DbTable::selectOneColumn(llong id, size_t columnId,
 								valvec<byte>* colsData, DbContext* ctx)
@@ -2710,7 +3594,7 @@ DbTable::selectOneColumnNoLock(llong id, size_t columnId,
 const {
 //	DebugCheckRowNumVecNoLock(this);
 	llong rows = m_rowNum;
-	if (terark_unlikely(id < 0 || id >= rows)) {
+	if (terark_unlikely(id < ctx->m_rowNumVec[0] || id >= rows)) {
 		THROW_STD(out_of_range, "id = %lld, rows=%lld", id, rows);
 	}
 	size_t upp = upper_bound_a(ctx->m_rowNumVec, id);
@@ -2742,7 +3626,7 @@ void DbTable::selectColgroupsNoLock(llong recId,
 						valvec<byte>* cgDataVec, DbContext* ctx) const {
 //	DebugCheckRowNumVecNoLock(this);
 	llong rows = m_rowNum;
-	if (terark_unlikely(recId < 0 || recId >= rows)) {
+	if (terark_unlikely(recId < ctx->m_rowNumVec[0] || recId >= rows)) {
 		THROW_STD(out_of_range, "recId = %lld, rows=%lld", recId, rows);
 	}
 	size_t upp = upper_bound_a(ctx->m_rowNumVec, recId);
@@ -2764,6 +3648,233 @@ void DbTable::selectOneColgroupNoLock(llong recId, size_t cgId,
 	selectColgroupsNoLock(recId, &cgId, 1, cgData, ctx);
 }
 
+ColumnAggregate::ColumnAggregate() {
+	count = 0;
+	sum = 0;
+	min = +DBL_MAX;
+	max = -DBL_MAX;
+}
+
+namespace {
+// lo <= x <= hi, ends are open if not inclusive, Ne is the negated Eq
+template<class T>
+struct ScanRange {
+	T    lo, hi;
+	bool loIncl, hiIncl, negate;
+
+	explicit ScanRange(const ColumnPredicate& pred) {
+		lo = std::numeric_limits<T>::lowest();
+		hi = std::numeric_limits<T>::max();
+		loIncl = hiIncl = true;
+		negate = false;
+		switch (pred.op) {
+		default:
+			THROW_STD(invalid_argument, "bad op = %d", pred.op);
+		case ColumnPredicate::Ne: negate = true; // fall through
+		case ColumnPredicate::Eq: lo = hi = load(pred.lo); break;
+		case ColumnPredicate::Lt: hiIncl = false; // fall through
+		case ColumnPredicate::Le: hi = load(pred.lo); break;
+		case ColumnPredicate::Gt: loIncl = false; // fall through
+		case ColumnPredicate::Ge: lo = load(pred.lo); break;
+		case ColumnPredicate::Between:
+			lo = load(pred.lo);
+			hi = load(pred.hi);
+			break;
+		}
+	}
+	static T load(fstring x) {
+		if (x.size() != sizeof(T)) {
+			THROW_STD(invalid_argument
+				, "operand size = %zd, column size = %zd", x.size(), sizeof(T));
+		}
+		return unaligned_load<T>(x.data());
+	}
+	bool match(T x) const {
+		bool m = (loIncl ? lo <= x : lo < x) && (hiIncl ? x <= hi : x < hi);
+		return m != negate;
+	}
+};
+
+// the inner loop has no branch and is vectorized by the compiler
+template<class T, bool LoIncl, bool HiIncl>
+void scanRangeWords(const T* vals, size_t rows, T lo, T hi, bm_uint_t* words) {
+	for (size_t i = 0; i < rows; i += WordBits) {
+		size_t n = std::min(WordBits, rows - i);
+		bm_uint_t w = 0;
+		for (size_t j = 0; j < n; ++j) {
+			T x = vals[i + j];
+			bool m = (LoIncl ? lo <= x : lo < x) & (HiIncl ? x <= hi : x < hi);
+			w |= bm_uint_t(m) << j;
+		}
+		words[i / WordBits] = w;
+	}
+}
+
+template<class T>
+void scanRange(const ScanRange<T>& r, const T* vals, size_t rows, febitvec* bits) {
+	bits->resize_no_init(rows);
+	bm_uint_t* words = bits->bldata();
+	if (r.loIncl && r.hiIncl)
+		scanRangeWords<T, true , true >(vals, rows, r.lo, r.hi, words);
+	else if (r.loIncl)
+		scanRangeWords<T, true , false>(vals, rows, r.lo, r.hi, words);
+	else if (r.hiIncl)
+		scanRangeWords<T, false, true >(vals, rows, r.lo, r.hi, words);
+	else
+		scanRangeWords<T, false, false>(vals, rows, r.lo, r.hi, words);
+	if (r.negate) {
+		for (size_t k = 0; k < bits->blsize(); ++k)
+			words[k] = ~words[k];
+		if (rows % WordBits)
+			words[rows / WordBits] &= (bm_uint_t(1) << rows % WordBits) - 1;
+	}
+}
+
+// column values of a ReadonlySegment indexed by physic id
+template<class T>
+const T* loadSegColumn(const ReadableStore* store, const Schema& cgSchema,
+					   size_t subColumnId, size_t physicRows,
+					   valvec<T>* buf, DbContext* ctx) {
+	const byte* base = store->getRecordsBasePtr();
+	if (base) {
+		size_t fixlen = cgSchema.getFixedRowLen();
+		const byte* p = base + cgSchema.getColumnMeta(subColumnId).fixedOffset;
+		if (fixlen == sizeof(T) && size_t(p) % sizeof(T) == 0) {
+			return (const T*)p;
+		}
+		buf->resize_no_init(physicRows);
+		for (size_t i = 0; i < physicRows; ++i) {
+			(*buf)[i] = unaligned_load<T>(p + fixlen * i);
+		}
+		return buf->data();
+	}
+	buf->resize_no_init(physicRows);
+	StoreIteratorPtr iter = store->ensureStoreIterForward(ctx);
+	valvec<byte> row;
+	ColumnVec cols;
+	llong id = -1;
+	while (iter->increment(&id, &row)) {
+		assert(id < llong(physicRows));
+		fstring coldata(row);
+		if (cgSchema.columnNum() > 1) {
+			cgSchema.parseRow(row, &cols);
+			coldata = cols[subColumnId];
+		}
+		(*buf)[id] = unaligned_load<T>(coldata.data());
+	}
+	return buf->data();
+}
+
+// rowNum is the end of the writing segment, which is newer than the version
+template<class T>
+void scanColumn(const SchemaConfig& sconf, const SegArrayVersion& ver,
+				llong rowNum, const ColumnPredicate& pred, febitvec* matches,
+				ColumnAggregate* agg, DbContext* ctx) {
+	const ScanRange<T> r(pred);
+	const auto cp = sconf.m_colproject[pred.columnId];
+	const Schema& cgSchema = sconf.getColgroupSchema(cp.colgroupId);
+	auto accept = [&](llong recId, T x) {
+		if (matches) {
+			matches->set1(recId);
+		}
+		if (agg) {
+			agg->count++;
+			agg->sum += double(x);
+			agg->min = std::min(agg->min, double(x));
+			agg->max = std::max(agg->max, double(x));
+		}
+	};
+	valvec<T>    buf;
+	valvec<byte> coldata;
+	febitvec     physicBits, segBits;
+	for (size_t i = 0; i < ver.m_segments.size(); ++i) {
+		auto   seg = ver.m_segments[i].get();
+		llong  baseId = ver.m_rowNumVec[i];
+		llong  endId = ver.m_rowNumVec[i+1];
+		if (i + 1 == ver.m_segments.size() && !seg->getReadonlySegment())
+			endId = rowNum;
+		size_t rows = size_t(std::max(endId - baseId, 0LL));
+		auto   store = seg->getReadonlySegment() ? seg->m_colgroups[cp.colgroupId].get() : nullptr;
+		if (nullptr == store) {
+			// writable segments are small, read them row by row
+			for (size_t j = 0; j < rows; ++j) {
+				if (seg->locked_testIsDel(j))
+					continue;
+				seg->selectOneColumn(j, pred.columnId, &coldata, ctx);
+				T x = unaligned_load<T>(coldata.data());
+				if (r.match(x))
+					accept(baseId + j, x);
+			}
+			continue;
+		}
+		size_t physicRows = seg->getPhysicRows();
+		const T* vals = loadSegColumn<T>(store, cgSchema, cp.subColumnId, physicRows, &buf, ctx);
+		scanRange(r, vals, physicRows, &physicBits);
+		segBits.resize_no_init(rows);
+		bm_uint_t* words = segBits.bldata();
+		if (seg->m_isPurged.empty()) {
+			assert(physicRows == rows);
+			SpinRwLock segLock(seg->m_segMutex, false);
+			const bm_uint_t* isDel = seg->m_isDel.bldata();
+			for (size_t k = 0; k < segBits.blsize(); ++k)
+				words[k] = physicBits.bldata()[k] & ~isDel[k];
+		}
+		else {
+			segBits.fill(false);
+			SpinRwLock segLock(seg->m_segMutex, false);
+			for (size_t j = 0; j < rows; ++j) {
+				if (seg->m_isDel.is0(j) && physicBits.is1(seg->getPhysicId(j)))
+					segBits.set1(j);
+			}
+		}
+		for (size_t k = 0; k < segBits.blsize(); ++k) {
+			for (bm_uint_t w = words[k]; w; w &= w - 1) {
+				size_t j = k * WordBits + fast_ctz(w);
+				accept(baseId + j, vals[seg->getPhysicId(j)]);
+			}
+		}
+	}
+}
+} // namespace
+
+void
+DbTable::scanColumnPredicate(const ColumnPredicate& pred, febitvec* matches,
+							 ColumnAggregate* agg, DbContext* ctx)
+const {
+	SegArrayVersionPtr ver = getSegArrayVersion();
+	const SchemaConfig& sconf = *ver->m_schema;
+	if (pred.columnId >= sconf.columnNum()) {
+		THROW_STD(out_of_range, "columnId = %zd, columnNum = %zd"
+			, pred.columnId, sconf.columnNum());
+	}
+	// m_rowNumVec.back() of the version is stale for the writing segment,
+	// take its end from m_rowNum while the version is the newest
+	llong rowNum = ver->m_rowNumVec.back();
+	if (ver->m_updateSeq == m_segArrayUpdateSeq) {
+		rowNum = m_rowNum;
+	}
+	if (matches) {
+		matches->resize_fill(size_t(std::max(rowNum, ver->m_rowNumVec.back())), false);
+	}
+	const ColumnType type = sconf.m_rowSchema->getColumnMeta(pred.columnId).type;
+	switch (type) {
+	default:
+		THROW_STD(invalid_argument, "column %s is %s, not a fixed length number"
+			, sconf.m_rowSchema->getColumnName(pred.columnId).c_str()
+			, Schema::columnTypeStr(type));
+	case ColumnType::Sint08: scanColumn< int8_t >(sconf, *ver, rowNum, pred, matches, agg, ctx); break;
+	case ColumnType::Uint08: scanColumn<uint8_t >(sconf, *ver, rowNum, pred, matches, agg, ctx); break;
+	case ColumnType::Sint16: scanColumn< int16_t>(sconf, *ver, rowNum, pred, matches, agg, ctx); break;
+	case ColumnType::Uint16: scanColumn<uint16_t>(sconf, *ver, rowNum, pred, matches, agg, ctx); break;
+	case ColumnType::Sint32: scanColumn< int32_t>(sconf, *ver, rowNum, pred, matches, agg, ctx); break;
+	case ColumnType::Uint32: scanColumn<uint32_t>(sconf, *ver, rowNum, pred, matches, agg, ctx); break;
+	case ColumnType::Sint64: scanColumn< int64_t>(sconf, *ver, rowNum, pred, matches, agg, ctx); break;
+	case ColumnType::Uint64: scanColumn<uint64_t>(sconf, *ver, rowNum, pred, matches, agg, ctx); break;
+	case ColumnType::Float32: scanColumn<float >(sconf, *ver, rowNum, pred, matches, agg, ctx); break;
+	case ColumnType::Float64: scanColumn<double>(sconf, *ver, rowNum, pred, matches, agg, ctx); break;
+	}
+}
+
 #if 0
 StoreIteratorPtr
 DbTable::createProjectIterForward(const valvec<size_t>& cols, DbContext* ctx)
@@ -2884,9 +3995,13 @@ public:
 
 	bool needsPurgeBits() const;
 
+	// kind of "AutoStoreSelect" if all segments recorded the same kind
+	std::string commonStoreKind(const std::string& colgroupName) const;
+
 	void mergeFixedLenColgroup(ReadonlySegment* dseg, size_t colgroupId);
 	void mergeGdictZipColgroup(ReadonlySegment* dseg, size_t colgroupId);
-	void mergeAndPurgeColgroup(ReadonlySegment* dseg, size_t colgroupId);
+	void mergeAndPurgeColgroup(ReadonlySegment* dseg, size_t colgroupId,
+							   const std::string& kind);
 };
 
 std::string DbTable::MergeParam::joinPathList() const {
@@ -2899,6 +4014,7 @@ std::string DbTable::MergeParam::joinPathList() const {
 	return str;
 }
 
+// mtime of the segment dir, merge sets it to the newest of the inputs
 bool DbTable::MergeParam::canMerge(DbTable* tab) {
 	// most failed checks should fails here...
 	if (tab->m_isMerging)
@@ -2938,37 +4054,29 @@ bool DbTable::MergeParam::canMerge(DbTable* tab) {
 		this->m_tabSegNum = tab->m_segments.size();
 		DebugCheckRowNumVecNoLock(tab);
 	}
-	size_t sumSegRows = 0;
+	valvec<MergePolicy::SegInfo> segInfo(this->size(), valvec_reserve());
 	for (size_t i = 0; i < this->size(); ++i) {
-		sumSegRows += this->p[i].seg->m_isDel.size();
-	}
-	size_t avgSegRows = sumSegRows / this->size();
-	size_t maxSegRows = avgSegRows * 7/4;
-	if (m_forcePurgeAndMerge) {
-		maxSegRows = avgSegRows * 3;
-	}
-
-	// find max range in which every seg rows < maxSegRows
-	size_t rngBeg = 0, rngLen = 0;
-	for(size_t j = 0; j < this->size(); ) {
-		size_t k = j;
-		for (; k < this->size(); ++k) {
-			if (this->p[k].seg->m_isDel.size() > maxSegRows)
-				break;
-		}
-		if (k - j > rngLen) {
-			rngBeg = j;
-			rngLen = k - j;
-		}
-		j = k + 1;
+		const ReadonlySegment* seg = this->p[i].seg;
+		MergePolicy::SegInfo si;
+		si.rows = seg->m_isDel.size();
+		si.delcnt = seg->m_delcnt;
+		si.storageSize = seg->totalStorageSize();
+		si.buildTime = seg->m_buildTime;
+		segInfo.push_back(si);
+	}
+	MergePolicy::Pick pk;
+	if (!tab->m_mergePolicy->pickSegments(segInfo, m_forcePurgeAndMerge,
+			tab->m_schema->m_minMergeSegNum, &pk)) {
+		tab->m_isMerging = false;
+		return false;
 	}
+	size_t rngBeg = pk.beg, rngLen = pk.len;
 	for (size_t j = 0; j < rngLen; ++j) {
 		this->p[j] = this->p[rngBeg + j];
 	}
 	this->trim(rngLen);
-	if (rngLen < tab->m_schema->m_minMergeSegNum) {
-		tab->m_isMerging = false;
-		return false;
+	if (pk.purge) {
+		m_forcePurgeAndMerge = true;
 	}
 	m_newSegRows = 0;
 	for (size_t j = 0; j < rngLen; ++j) {
@@ -3058,6 +4166,7 @@ mergeIndex(ReadonlySegment* dseg, size_t indexId, DbContext* ctx) {
 			if (!oldpurgeBits || !terark_bit_test(oldpurgeBits, logicId)) {
 				if (!newpurgeBits || !terark_bit_test(newpurgeBits, logicId)) {
 					indexStore->getValue(physicId, &rec, ctx);
+					BgRateLimiter::Pacer::paceCurrent(rec.size());
 					if (fixedIndexRowLen) {
 						assert(rec.size() == fixedIndexRowLen);
 						strVec.m_strpool.append(rec);
@@ -3185,6 +4294,18 @@ bool DbTable::MergeParam::needsPurgeBits() const {
 	return false;
 }
 
+std::string
+DbTable::MergeParam::commonStoreKind(const std::string& colgroupName) const {
+	std::string kind;
+	for (size_t i = 0; i < this->size(); ++i) {
+		std::string k = ReadonlySegment::loadStoreKind(p[i].seg->m_segDir, colgroupName);
+		if (k.empty() || (i && k != kind))
+			return std::string();
+		kind.swap(k);
+	}
+	return kind;
+}
+
 void
 DbTable::MergeParam::
 mergeFixedLenColgroup(ReadonlySegment* dseg, size_t colgroupId) {
@@ -3194,11 +4315,22 @@ mergeFixedLenColgroup(ReadonlySegment* dseg, size_t colgroupId) {
 	byte_t* newBasePtr = dstStore->getRecordsBasePtr();
 	size_t  newPhysicId = 0;
 	size_t  const fixlen = schema.getFixedRowLen();
+	valvec<byte> subRecords;
 	for (auto& e : *this) {
 		auto srcStore = e.seg->m_colgroups[colgroupId];
 		assert(nullptr != srcStore);
 		const byte_t* subBasePtr = srcStore->getRecordsBasePtr();
-		assert(nullptr != subBasePtr);
+		if (nullptr == subBasePtr) {
+			// such as PreadFixedLenStore, records are not mapped
+			llong physicRows = srcStore->numDataRows();
+			subRecords.erase_all();
+			subRecords.reserve(fixlen * size_t(physicRows));
+			for (llong physicId = 0; physicId < physicRows; ++physicId) {
+				srcStore->getValueAppend(physicId, &subRecords, m_ctx.get());
+				BgRateLimiter::Pacer::paceCurrent(fixlen);
+			}
+			subBasePtr = subRecords.data();
+		}
 		if (e.needsRePurge()) {
 			const bm_uint_t* oldIsPurged = e.seg->m_isPurged.bldata();
 			const bm_uint_t* newIsPurged = e.newIsPurged.bldata();
@@ -3209,6 +4341,7 @@ mergeFixedLenColgroup(ReadonlySegment* dseg, size_t colgroupId) {
 					if (!terark_bit_test(newIsPurged, subLogicId)) {
 						memcpy(newBasePtr + fixlen*newPhysicId,
 							   subBasePtr + fixlen*subPhysicId, fixlen);
+						BgRateLimiter::Pacer::paceCurrent(fixlen);
 						newPhysicId++;
 					}
 					subPhysicId++;
@@ -3220,6 +4353,7 @@ mergeFixedLenColgroup(ReadonlySegment* dseg, size_t colgroupId) {
 			assert(physicSubRows == (size_t)srcStore->numDataRows());
 			memcpy(newBasePtr + fixlen * newPhysicId,
 				   subBasePtr , fixlen * physicSubRows);
+			BgRateLimiter::Pacer::paceCurrent(fixlen * physicSubRows);
 			newPhysicId += physicSubRows;
 		}
 	}
@@ -3275,7 +4409,8 @@ mergeGdictZipColgroup(ReadonlySegment* dseg, size_t colgroupId) {
 
 void
 DbTable::MergeParam::
-mergeAndPurgeColgroup(ReadonlySegment* dseg, size_t colgroupId) {
+mergeAndPurgeColgroup(ReadonlySegment* dseg, size_t colgroupId,
+					  const std::string& kind) {
 	assert(dseg->m_isDel.size() == m_newSegRows);
 	assert(m_oldpurgeBits.size() == m_newSegRows);
 	assert(m_newpurgeBits.size() == m_newSegRows);
@@ -3286,7 +4421,11 @@ mergeAndPurgeColgroup(ReadonlySegment* dseg, size_t colgroupId) {
 	//	dseg->m_colgroups[colgroupId]->save(storeFilePath);
 		return;
 	}
-	if (schema.m_dictZipSampleRatio >= 0.0) {
+	if ("dictzip" == kind) {
+		mergeGdictZipColgroup(dseg, colgroupId);
+		return;
+	}
+	if (kind.empty() && schema.m_dictZipSampleRatio >= 0.0) {
 		llong sumLen = 0;
 		llong oldphysicRowNum = m_oldpurgeBits.max_rank0();
 		for (const auto& e : *this) {
@@ -3315,6 +4454,7 @@ mergeAndPurgeColgroup(ReadonlySegment* dseg, size_t colgroupId) {
 			if (!segOldpurgeBits || !terark_bit_test(segOldpurgeBits, logicId)) {
 				if (!segNewpurgeBits || !terark_bit_test(segNewpurgeBits, logicId)) {
 					store->getValue(physicId, &rec, m_ctx.get());
+					BgRateLimiter::Pacer::paceCurrent(rec.size());
 					if (fixedIndexRowLen) {
 						assert(rec.size() == fixedIndexRowLen);
 						strVec.m_strpool.append(rec);
@@ -3380,6 +4520,7 @@ moveStoreFiles(PathRef srcDir, PathRef destDir,
 // must be mapped to logical records id, thus purge bitmap is required for
 // the merged result segment
 void DbTable::merge(MergeParam& toMerge) {
+	BgTaskTimer bgTimer(m_mergeStat);
 	fs::path destMergeDir = getMergePath(m_dir, m_mergeSeqNum+1);
 	if (fs::exists(destMergeDir)) {
 		THROW_STD(logic_error, "dir: '%s' should not existed"
@@ -3395,13 +4536,19 @@ try{
 	fs::create_directories(destSegDir);
 	fs::path   mergingLockFile = destMergeDir / "merging.lock";
 	FileStream mergingLockFp(mergingLockFile.string().c_str(), "wb");
+	if (m_rowNumVec[0]) {
+		saveHeadRowNum(destMergeDir, m_rowNumVec[0]);
+	}
 	ReadonlySegmentPtr dseg = this->myCreateReadonlySegment(destSegDir);
 	const size_t indexNum = m_schema->getIndexNum();
 	const size_t colgroupNum = m_schema->getColgroupNum();
 	dseg->m_indices.resize(indexNum);
 	dseg->m_colgroups.resize(colgroupNum);
-	toMerge.syncPurgeBits(m_schema->m_purgeDeleteThreshold);
 	DbContextPtr ctx(this->createDbContext());
+	for (auto& e : toMerge) {
+		markExpiredRows(e.seg, ctx.get()); // dropped as deleted
+	}
+	toMerge.syncPurgeBits(m_schema->m_purgeDeleteThreshold);
 	toMerge.m_ctx = ctx;
 	dseg->m_isDel.erase_all();
 	dseg->m_isDel.reserve(toMerge.m_newSegRows);
@@ -3431,10 +4578,12 @@ try{
 		dseg->m_isPurged.build_cache(true, false);
 		assert(dseg->m_isPurged.size() == toMerge.m_newSegRows);
 	}
+	BgRateLimiter::Pacer pacer(&m_rotationBlocked);
 	for (size_t i = 0; i < indexNum; ++i) {
 		ReadableIndex* index = toMerge.mergeIndex(dseg.get(), i, ctx.get());
 		dseg->m_indices[i] = index;
 		dseg->m_colgroups[i] = index->getReadableStore();
+		pacer.pace(0); // rows are paced in mergeIndex
 	}
 	for (auto& e : toMerge) {
 		for(auto fpath : fs::directory_iterator(e.seg->m_segDir)) {
@@ -3445,13 +4594,21 @@ try{
 	}
 	for (size_t i = indexNum; i < colgroupNum; ++i) {
 		const Schema& schema = m_schema->getColgroupSchema(i);
-		if (schema.should_use_FixedLenStore()) {
+		// purge by dseg->purgeColgroup keeps the kind of each segment,
+		// the merged segment records the kind if all segments agree
+		const std::string kind = toMerge.commonStoreKind(schema.m_name);
+		if (!kind.empty()) {
+			ReadonlySegment::saveStoreKind(destSegDir, schema.m_name, kind);
+		}
+		if (schema.should_use_FixedLenStore() || "fixlen" == kind) {
 			toMerge.mergeFixedLenColgroup(dseg.get(), i);
+			pacer.pace(0);
 			continue;
 		}
 		if (toMerge.m_newpurgeBits.size() > 0) {
 			assert(toMerge.m_newpurgeBits.size() == toMerge.m_newSegRows);
-			toMerge.mergeAndPurgeColgroup(dseg.get(), i);
+			toMerge.mergeAndPurgeColgroup(dseg.get(), i, kind);
+			pacer.pace(0);
 			continue;
 		}
 		const std::string prefix = "colgroup-" + schema.m_name;
@@ -3470,6 +4627,7 @@ try{
 				auto store = dseg->purgeColgroup(i, e.seg, ctx.get(), tmpDir1);
 				dseg->m_isDel.swap(e.newIsPurged);
 				store->save(tmpDir1 / prefix);
+				pacer.pace(0); // rows are paced in purgeColgroup
 				moveStoreFiles(tmpDir1, destSegDir, prefix, newPartIdx);
 				fs::remove_all(tmpDir1);
 			} else {
@@ -3491,7 +4649,12 @@ try{
 		}
 	}
 
+	dseg->m_buildTime = 0;
+	for (auto& e : toMerge) {
+		dseg->m_buildTime = std::max(dseg->m_buildTime, e.seg->m_buildTime);
+	}
 	dseg->savePurgeBits(destSegDir);
+	dseg->saveSegmentMeta(destSegDir);
 	dseg->saveIndices(destSegDir);
 	dseg->saveIsDel(destSegDir);
 
@@ -3502,6 +4665,8 @@ try{
 	dseg->m_indices.erase_all();
 	dseg->m_colgroups.erase_all();
 	dseg->load(destSegDir);
+	bgTimer.addBytes(dseg->totalStorageSize());
+	m_mergePolicy->onMerge(dseg->totalStorageSize());
 //	assert(dseg->m_isDel.size() == dseg->m_isPurged.size());
 	assert(dseg->m_isDel.size() == toMerge.m_newSegRows);
 
@@ -3518,8 +4683,8 @@ try{
 	valvec<fs::path> newSegPathes(m_segments.size()-1, valvec_reserve());
 	valvec<ReadableSegmentPtr> newSegs(m_segments.capacity(), valvec_reserve());
 	valvec<llong> newRowNumVec(m_rowNumVec.capacity(), valvec_reserve());
-	newRowNumVec.push_back(0);
-	size_t rows = 0;
+	newRowNumVec.push_back(m_rowNumVec[0]);
+	size_t rows = m_rowNumVec[0];
 	auto addseg = [&](const ReadableSegmentPtr& seg) {
 		rows += seg->m_isDel.size();
 		newSegs.push_back(seg);
@@ -3656,7 +4821,9 @@ try{
 		m_rowNumVec.back() = newRowNumVec.back();
 		m_mergeSeqNum++;
 		m_segArrayUpdateSeq++;
+		publishSegArrayNoLock();
 		m_isMerging = false;
+		m_rotationBlocked = false;
 #if defined(SLOW_DEBUG_CHECK)
 		valvec<byte> r1, r2;
 		size_t baseLogicId = 0;
@@ -3684,7 +4851,7 @@ try{
 #endif
 #if 0 // don't do this
 		// m_wrSeg == NULL indicate writing is stopped
-		if (m_wrSeg && m_wrSeg->dataStorageSize() >= m_schema->m_maxWritingSegmentSize) {
+		if (m_wrSeg && isWritingSegmentFullNoLock()) {
 			doCreateNewSegmentInLock();
 		}
 		if (PurgeStatus::pending == m_purgeStatus) {
@@ -3741,13 +4908,21 @@ void DbTable::clear() {
 		m_segments[i] = nullptr;
 	}
 	m_segments.clear();
-	m_rowNumVec.clear();
+	m_rowNumVec.erase_all();
+	m_rowNumVec.push_back(m_rowNum); // keep the end guard
+	m_wrSeg = nullptr;
+	m_mergeKeyNum = 0;
+	m_segArrayUpdateSeq++;
+	publishSegArrayNoLock();
 }
 
 void DbTable::flush() {
 	if (this->m_tobeDrop) {
 		return;
 	}
+	if (m_changeLog) {
+		m_changeLog->flush();
+	}
 	valvec<ReadableSegmentPtr> segsCopy;
 	{
 		MyRwLock lock(m_rwMutex, false);
@@ -3763,130 +4938,1303 @@ void DbTable::flush() {
 	}
 }
 
-static void waitForBackgroundTasks(MyRwMutex& m_rwMutex, size_t& m_bgTaskNum) {
-	size_t retryNum = 0;
-	for (;;retryNum++) {
-		size_t bgTaskNum;
+size_t DbTable::mergeKeyMutexIdx(fstring key) {
+	return fstring_func::hash()(key) & (MergeKeyMutexNum - 1);
+}
+
+// mutexIdx is sorted and made unique, then locked in ascending order
+void DbTable::lockMergeKeys(valvec<size_t>* mutexIdx) const {
+	sort_a(*mutexIdx);
+	mutexIdx->trim(unique_a(*mutexIdx));
+	for (size_t idx : *mutexIdx) {
+		m_mergeKeyMutex[idx].lock();
+	}
+}
+
+void DbTable::unlockMergeKeys(const valvec<size_t>& mutexIdx) const {
+	for (size_t i = mutexIdx.size(); i > 0; --i) {
+		m_mergeKeyMutex[mutexIdx[i-1]].unlock();
+	}
+}
+
+static void
+getMergeLogSegs(const valvec<ReadableSegmentPtr>& segs, valvec<WritableSegmentPtr>* res) {
+	res->erase_all();
+	for (size_t i = 0; i < segs.size(); ++i) {
+		WritableSegment* seg = segs[i]->getWritableSegment();
+		if (seg && seg->m_mergeLog) {
+			res->push_back(seg);
+		}
+	}
+}
+
+// the merge key mutexes of all keys must be locked by the caller,
+// wrseg is the writing segment of the committed batch
+void DbTable::applyMergeBatchNoLock(WritableSegment* wrseg,
+			const std::vector<std::string>& discardKeys,
+			const std::vector<std::pair<std::string, std::string> >& ops) {
+	if (!discardKeys.empty() && hasMergeOperands()) {
+		valvec<WritableSegmentPtr> segs;
 		{
 			MyRwLock lock(m_rwMutex, false);
-			bgTaskNum = m_bgTaskNum;
+			getMergeLogSegs(m_segments, &segs);
 		}
-		if (0 == bgTaskNum)
-			break;
-		if (retryNum % 100 == 0) {
-			fprintf(stderr
-				, "INFO: waitForBackgroundTasks: tasks = %zd, retry = %zd\n"
-				, bgTaskNum, retryNum);
+		for (const std::string& key : discardKeys) {
+			for (size_t i = 0; i < segs.size(); ++i) {
+				if (segs[i]->m_mergeLog->discard(key))
+					m_mergeKeyNum--;
+			}
 		}
-		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	assert(ops.empty() || wrseg->m_mergeLog);
+	for (const auto& op : ops) {
+		if (wrseg->m_mergeLog->append(op.first, op.second))
+			m_mergeKeyNum++;
 	}
 }
 
-void DbTable::compact() {
-	profiling pf;
-	llong t0 = pf.now();
-	llong t1 = t0;
-	for (;;) {
-		MyRwLock lock(m_rwMutex, true);
-		DebugCheckRowNumVecNoLock(this);
-		if (m_isMerging) {
-			lock.release();
-			std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-			llong t2 = pf.now();
-			if (pf.ms(t1, t2) > 10000) { // 10 seconds
-				fprintf(stderr, "INFO: wait for merging: %s, %f seconds\n"
-					, m_dir.string().c_str(), pf.sf(t0, t2));
-				t1 = t2;
-			}
+// operands of frozen writable segments loaded from disk are not collapsed
+// before setMergeOperator, see doLoad
+void DbTable::setMergeOperator(MergeOperator* mergeOp) {
+	MergeOperatorPtr holder(mergeOp);
+	if (m_schema->m_uniqIndices.size() != 1) {
+		THROW_STD(invalid_argument
+			, "merge operator requires exactly one unique index, table %s has %zd"
+			, m_dir.string().c_str(), m_schema->m_uniqIndices.size());
+	}
+	std::lock_guard<std::mutex> collapseLock(m_collapseMergeMutex);
+	MyRwLock lock(m_rwMutex, true);
+	if (NULL == mergeOp && hasMergeOperands()) {
+		THROW_STD(invalid_argument
+			, "can not reset merge operator, table %s has pending operands"
+			, m_dir.string().c_str());
+	}
+	m_mergeOperator = holder;
+	for (size_t i = 0; i < m_segments.size(); ++i) {
+		WritableSegment* seg = m_segments[i]->getWritableSegment();
+		if (!seg) {
 			continue;
 		}
-		if (m_inprogressWritingCount > 0) {
-			lock.release();
-			std::this_thread::sleep_for(std::chrono::milliseconds(50));
-			llong t2 = pf.now();
-			if (pf.ms(t1, t2) > 1000) { // 1 seconds
-				fprintf(stderr, "INFO: wait for inprogress writing: %s, %f seconds\n"
-					, m_dir.string().c_str(), pf.sf(t0, t2));
-				t1 = t2;
+		fs::path fpath = seg->m_segDir / MergeOperandLog::FileName;
+		if (NULL == mergeOp) {
+			if (seg->m_mergeLog) {
+				seg->m_mergeLog.reset(); // it is empty
+				fs::remove(fpath);
 			}
 			continue;
 		}
-		if (m_wrSeg->m_isDel.size() > 0 && 0 == m_inprogressWritingCount) {
-			doCreateNewSegmentInLock();
+		if (seg->m_mergeLog) {
+			continue;
 		}
-		break;
-	}
-	waitForBackgroundTasks(m_rwMutex, m_bgTaskNum);
-
-	MergeParam toMerge;
-	toMerge.m_forcePurgeAndMerge = true;
-	if (toMerge.canMerge(this)) {
-		assert(this->m_isMerging);
-		{
-			MyRwLock lock(m_rwMutex, true);
-			this->m_bgTaskNum++;
+		bool isPending = fs::exists(fpath);
+		seg->m_mergeLog.reset(new MergeOperandLog(fpath));
+		m_mergeKeyNum += seg->m_mergeLog->keyNum();
+		if (isPending && seg->m_isFreezed && seg != m_wrSeg.get()) {
+			putToCompressionQueue(i); // skipped by doLoad
 		}
-		BOOST_SCOPE_EXIT(&m_rwMutex, &m_bgTaskNum){
-			MyRwLock lock(m_rwMutex, true);
-			m_bgTaskNum--;
-		}BOOST_SCOPE_EXIT_END;
-
-		this->merge(toMerge);
 	}
 }
 
-void DbTable::syncFinishWriting() {
-	m_wrSeg = nullptr; // can't write anymore
-	waitForBackgroundTasks(m_rwMutex, m_bgTaskNum);
+// a writing segment which has just operands can not be frozen, its
+// operands are collapsed into rows of itself when the log is too large
+void DbTable::mergeRow(fstring key, fstring operand) {
+	if (!m_mergeOperator) {
+		THROW_STD(invalid_argument
+			, "merge operator is not set: %s", m_dir.string().c_str());
+	}
+	size_t collapseSegIdx = size_t(-1);
 	{
-		MyRwLock lock(m_rwMutex, true);
-		auto wrseg = m_segments.back().get();
-		if (wrseg->m_isDel.empty()) {
-			wrseg->deleteSegment();
-			m_segments.pop_back();
+		std::lock_guard<std::mutex> keyLock(m_mergeKeyMutex[mergeKeyMutexIdx(key)]);
+		MyRwLock lock(m_rwMutex, false);
+		if (!m_wrSeg) {
+			THROW_STD(invalid_argument
+				, "syncFinishWriting('%s') was called, now writing is not allowed"
+				, m_dir.string().c_str());
 		}
-		else if (wrseg->getWritableStore() != nullptr) {
-			wrseg->m_isFreezed = true;
-			putToFlushQueue(m_segments.size()-1);
+		auto wrseg = m_wrSeg.get();
+		assert(wrseg->m_mergeLog);
+		if (wrseg->m_mergeLog->append(key, operand)) {
+			m_mergeKeyNum++;
+		}
+		if (!maybeCreateNewSegment(lock) && wrseg->m_isDel.size() == 0 &&
+			llong(wrseg->mergeLogMemSize()) >= m_schema->m_maxWritingSegmentSize) {
+			collapseSegIdx = m_segments.size() - 1;
 		}
 	}
-	waitForBackgroundTasks(m_rwMutex, m_bgTaskNum);
+	if (size_t(-1) != collapseSegIdx) {
+		collapseMergeOperands(collapseSegIdx);
+	}
 }
 
-void DbTable::asyncPurgeDelete() {
-	MyRwLock lock(m_rwMutex, true);
-	asyncPurgeDeleteInLock();
+bool DbTable::discardMergeOperands(fstring key) {
+	if (!hasMergeOperands()) {
+		return false;
+	}
+	std::lock_guard<std::mutex> keyLock(m_mergeKeyMutex[mergeKeyMutexIdx(key)]);
+	valvec<WritableSegmentPtr> segs;
+	{
+		MyRwLock lock(m_rwMutex, false);
+		getMergeLogSegs(m_segments, &segs);
+	}
+	bool discarded = false;
+	for (size_t i = 0; i < segs.size(); ++i) {
+		if (segs[i]->m_mergeLog->discard(key)) {
+			m_mergeKeyNum--;
+			discarded = true;
+		}
+	}
+	return discarded;
 }
 
-void DbTable::dropTable() {
-	assert(!m_dir.empty());
-	for (auto& seg : m_segments) {
-		seg->deleteSegment();
+bool DbTable::hasMergeOperands(fstring key) const {
+	if (!hasMergeOperands()) {
+		return false;
 	}
-	m_segments.erase_all();
-	m_wrSeg = nullptr;
-	m_tobeDrop = true;
+	MyRwLock lock(m_rwMutex, false);
+	for (size_t i = 0; i < m_segments.size(); ++i) {
+		WritableSegment* seg = m_segments[i]->getWritableSegment();
+		if (seg && seg->m_mergeLog && seg->m_mergeLog->contains(key))
+			return true;
+	}
+	return false;
 }
 
-std::string DbTable::toJsonStr(fstring row) const {
-	return m_schema->m_rowSchema->toJsonStr(row);
+void DbTable::getMergeOperandKeys(std::vector<std::string>* keys) const {
+	keys->clear();
+	if (!hasMergeOperands()) {
+		return;
+	}
+	valvec<WritableSegmentPtr> segs;
+	{
+		MyRwLock lock(m_rwMutex, false);
+		getMergeLogSegs(m_segments, &segs);
+	}
+	std::vector<std::string> segKeys;
+	for (size_t i = 0; i < segs.size(); ++i) {
+		segs[i]->m_mergeLog->getKeys(&segKeys);
+		keys->insert(keys->end(), segKeys.begin(), segKeys.end());
+	}
+	std::sort(keys->begin(), keys->end());
+	keys->erase(std::unique(keys->begin(), keys->end()), keys->end());
 }
 
-boost::filesystem::path
-DbTable::getMergePath(PathRef dir, size_t mergeSeq)
+bool DbTable::getRowByUniqueKey(fstring key, valvec<byte>* row, DbContext* ctx)
 const {
-	auto res = dir;
-	char szBuf[32];
-	snprintf(szBuf, sizeof(szBuf), "g-%04ld", long(mergeSeq));
-	res /= szBuf;
-	return res;
+	size_t uniqIndexId = m_schema->m_uniqIndices[0];
+	indexSearchExact(uniqIndexId, key, &ctx->exactMatchRecIdvec, ctx);
+	if (ctx->exactMatchRecIdvec.empty()) {
+		return false;
+	}
+	try {
+		getValue(ctx->exactMatchRecIdvec[0], row, ctx);
+		return true;
+	}
+	catch (const ReadRecordException&) {
+		return false; // removed concurrently
+	}
 }
 
-boost::filesystem::path
-DbTable::getSegPath(const char* type, size_t segIdx)
-const {
-	return getSegPath2(m_dir, m_mergeSeqNum, type, segIdx);
-}
+void DbTable::getChangeLogKey(fstring row, valvec<byte>* key) const {
+	key->erase_all();
+	if (m_schema->m_uniqIndices.empty()) {
+		return;
+	}
+	ColumnVec cols;
+	m_schema->m_rowSchema->parseRow(row, &cols);
+	getIndexSchema(m_schema->m_uniqIndices[0]).selectParent(cols, key);
+}
+
+bool DbTable::getRowKey(llong id, std::string* key, DbContext* ctx) const {
+	valvec<byte> row;
+	try {
+		getValue(id, &row, ctx);
+	}
+	catch (const std::exception&) {
+		return false;
+	}
+	ColumnVec cols;
+	valvec<byte> keyData;
+	m_schema->m_rowSchema->parseRow(row, &cols);
+	getIndexSchema(m_schema->m_uniqIndices[0]).selectParent(cols, &keyData);
+	key->assign((const char*)keyData.data(), keyData.size());
+	return true;
+}
+
+bool DbTable::getMergedRow(fstring key, valvec<byte>* row, DbContext* ctx)
+const {
+	if (!hasMergeOperands()) {
+		return getRowByUniqueKey(key, row, ctx);
+	}
+	std::lock_guard<std::mutex> keyLock(m_mergeKeyMutex[mergeKeyMutexIdx(key)]);
+	return getMergedRowNoLock(key, row, ctx);
+}
+
+// operands of older segments are applied first
+bool DbTable::getMergedRowNoLock(fstring key, valvec<byte>* row, DbContext* ctx)
+const {
+	valvec<byte> operands, existing;
+	{
+		MyRwLock lock(m_rwMutex, false);
+		for (size_t i = 0; i < m_segments.size(); ++i) {
+			WritableSegment* seg = m_segments[i]->getWritableSegment();
+			if (seg && seg->m_mergeLog)
+				seg->m_mergeLog->get(key, &operands);
+		}
+	}
+	if (operands.empty()) {
+		return getRowByUniqueKey(key, row, ctx);
+	}
+	valvec<fstring> opvec;
+	bool found = getRowByUniqueKey(key, &existing, ctx);
+	MergeOperandLog::decode(operands, &opvec);
+	m_mergeOperator->fullMerge(key, found ? &existing : NULL, opvec, row);
+	return true;
+}
+
+// never throws, it is called in background tasks, a key which failed
+// to collapse keeps its operands. Keys are collapsed by BatchWriter in
+// the lock order of mergeRow, all merge key mutexes are locked for each
+// batch, the rows replace the operands of their keys in all segments.
+bool DbTable::collapseMergeOperands(size_t segIdx) {
+	WritableSegmentPtr seg;
+	{
+		MyRwLock lock(m_rwMutex, false);
+		if (m_tobeDrop || segIdx >= m_segments.size()) {
+			return true;
+		}
+		seg = m_segments[segIdx]->getWritableSegment();
+	}
+	if (!seg) {
+		return true;
+	}
+	if (!seg->m_mergeLog) {
+		// operands on disk are loaded by setMergeOperator
+		return !fs::exists(seg->m_segDir / MergeOperandLog::FileName);
+	}
+	MergeOperandLog* mlog = seg->m_mergeLog.get();
+	if (mlog->empty()) {
+		return true;
+	}
+	std::lock_guard<std::mutex> collapseLock(m_collapseMergeMutex);
+	profiling pf;
+	llong t0 = pf.now();
+	DbContextPtr ctx(createDbContext());
+	std::vector<std::string> keys;
+	mlog->getKeys(&keys);
+	valvec<size_t> allMutexIdx;
+	for (size_t i = 0; i < MergeKeyMutexNum; ++i) {
+		allMutexIdx.push_back(i);
+	}
+	const size_t batchKeys = 1000; // don't lock too long time
+	valvec<byte> newRow;
+	size_t collapsed = 0;
+	for (size_t i = 0; i < keys.size(); ) {
+		size_t upper = std::min(i + batchKeys, keys.size());
+		try {
+			BatchWriter bw(this, ctx.get());
+			lockMergeKeys(&allMutexIdx);
+			BOOST_SCOPE_EXIT(this_, &allMutexIdx) {
+				this_->unlockMergeKeys(allMutexIdx);
+			} BOOST_SCOPE_EXIT_END;
+			size_t num = 0;
+			try {
+				for (; i < upper; ++i) {
+					const std::string& key = keys[i];
+					if (!mlog->contains(key)) {
+						continue; // discarded by upsertRow/removeRow
+					}
+					try {
+						getMergedRowNoLock(key, &newRow, ctx.get());
+					}
+					catch (const std::exception& ex) {
+						fprintf(stderr
+							, "ERROR: collapseMergeOperands: %s: keyLen = %zd, ex.what = %s\n"
+							, m_dir.string().c_str(), key.size(), ex.what());
+						continue;
+					}
+					bw.upsertRow(newRow);
+					num++;
+				}
+			}
+			catch (const std::exception&) {
+				bw.rollback();
+				throw;
+			}
+			if (bw.doCommit()) {
+				collapsed += num;
+			} else {
+				fprintf(stderr
+					, "ERROR: collapseMergeOperands: %s: commit failed: %s\n"
+					, m_dir.string().c_str(), bw.szError());
+			}
+		}
+		catch (const std::exception& ex) {
+			fprintf(stderr
+				, "ERROR: collapseMergeOperands: %s: ex.what = %s\n"
+				, m_dir.string().c_str(), ex.what());
+			i = upper;
+		}
+	}
+	fprintf(stderr
+		, "INFO: collapseMergeOperands: %s: collapsed %zd of %zd keys, %f sec\n"
+		, seg->m_segDir.string().c_str(), collapsed, keys.size(), pf.sf(t0, pf.now()));
+	return mlog->empty();
+}
+
+static void waitForBackgroundTasks(MyRwMutex& m_rwMutex, size_t& m_bgTaskNum) {
+	size_t retryNum = 0;
+	for (;;retryNum++) {
+		size_t bgTaskNum;
+		{
+			MyRwLock lock(m_rwMutex, false);
+			bgTaskNum = m_bgTaskNum;
+		}
+		if (0 == bgTaskNum)
+			break;
+		if (retryNum % 100 == 0) {
+			fprintf(stderr
+				, "INFO: waitForBackgroundTasks: tasks = %zd, retry = %zd\n"
+				, bgTaskNum, retryNum);
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+}
+
+void DbTable::compact() {
+	profiling pf;
+	llong t0 = pf.now();
+	llong t1 = t0;
+	for (;;) {
+		MyRwLock lock(m_rwMutex, true);
+		DebugCheckRowNumVecNoLock(this);
+		if (m_isMerging) {
+			lock.release();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+			llong t2 = pf.now();
+			if (pf.ms(t1, t2) > 10000) { // 10 seconds
+				fprintf(stderr, "INFO: wait for merging: %s, %f seconds\n"
+					, m_dir.string().c_str(), pf.sf(t0, t2));
+				t1 = t2;
+			}
+			continue;
+		}
+		if (m_inprogressWritingCount > 0) {
+			lock.release();
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			llong t2 = pf.now();
+			if (pf.ms(t1, t2) > 1000) { // 1 seconds
+				fprintf(stderr, "INFO: wait for inprogress writing: %s, %f seconds\n"
+					, m_dir.string().c_str(), pf.sf(t0, t2));
+				t1 = t2;
+			}
+			continue;
+		}
+		if (m_wrSeg->m_isDel.size() > 0 && 0 == m_inprogressWritingCount) {
+			doCreateNewSegmentInLock();
+		}
+		break;
+	}
+	waitForBackgroundTasks(m_rwMutex, m_bgTaskNum);
+
+	MergeParam toMerge;
+	toMerge.m_forcePurgeAndMerge = true;
+	if (toMerge.canMerge(this)) {
+		assert(this->m_isMerging);
+		{
+			MyRwLock lock(m_rwMutex, true);
+			this->m_bgTaskNum++;
+		}
+		BOOST_SCOPE_EXIT(&m_rwMutex, &m_bgTaskNum){
+			MyRwLock lock(m_rwMutex, true);
+			m_bgTaskNum--;
+		}BOOST_SCOPE_EXIT_END;
+
+		this->merge(toMerge);
+	}
+}
+
+void DbTable::syncFinishWriting() {
+	m_wrSeg = nullptr; // can't write anymore
+	waitForBackgroundTasks(m_rwMutex, m_bgTaskNum);
+	{
+		MyRwLock lock(m_rwMutex, true);
+		auto wrseg = m_segments.back().get();
+		if (wrseg->m_isDel.empty()) {
+			wrseg->deleteSegment();
+			m_segments.pop_back();
+			m_rowNumVec.pop_back();
+		}
+		else if (wrseg->getWritableStore() != nullptr) {
+			wrseg->m_isFreezed = true;
+			putToFlushQueue(m_segments.size()-1);
+		}
+		m_segArrayUpdateSeq++;
+		publishSegArrayNoLock();
+	}
+	waitForBackgroundTasks(m_rwMutex, m_bgTaskNum);
+}
+
+void DbTable::addIndex(fstring indexJson) {
+	using terark::json;
+	std::lock_guard<std::mutex> addIndexLock(m_addIndexMutex);
+	json index = json::parse(indexJson.str());
+	auto uniqueIter = index.find("unique");
+	if (index.end() != uniqueIter && static_cast<bool>(uniqueIter.value())) {
+		THROW_STD(invalid_argument, "online adding unique index is not supported");
+	}
+	if (!m_schema->m_updatableColgroups.empty()) {
+		THROW_STD(invalid_argument
+			, "online adding index is not supported for table with inplaceUpdatable colgroups");
+	}
+	index["keepColumnStored"] = true;
+	fs::path jsonFile = m_dir / "dbmeta.json";
+	LineBuf metaBuf;
+	metaBuf.read_all(jsonFile.string());
+	json meta = json::parse(std::string(metaBuf.p, metaBuf.n));
+	meta["TableIndex"].push_back(index);
+	std::string newMetaJson = meta.dump(4);
+	SchemaConfigPtr newConf = new SchemaConfig();
+	newConf->loadJsonString(newMetaJson); // throws on dup index name ...
+	const size_t newIndexId = m_schema->getIndexNum();
+	if (newConf->getIndexNum() != newIndexId + 1 ||
+		newConf->getColgroupNum() != m_schema->getColgroupNum() + 1) {
+		THROW_STD(logic_error, "%s does not match the opened table"
+			, jsonFile.string().c_str());
+	}
+	const Schema& indexSchema = newConf->getIndexSchema(newIndexId);
+	const std::string indexFileName = "index-" + indexSchema.m_name;
+	fprintf(stderr, "INFO: addIndex(%s): %s\n"
+		, indexSchema.m_name.c_str(), m_dir.string().c_str());
+
+	typedef std::pair<ReadonlySegmentPtr, ReadableIndexPtr> SegIndex;
+	valvec<SegIndex> built;
+	auto buildIndices = [&](const valvec<ReadonlySegmentPtr>& todo) {
+		size_t threadNum = std::thread::hardware_concurrency();
+		if (const char* env = getenv("TerarkDB_AddIndexThreadsNum")) {
+			threadNum = std::max(atoi(env), 1);
+		}
+		threadNum = std::min(threadNum, todo.size());
+		valvec<ReadableIndexPtr> indices(todo.size());
+		std::atomic_size_t next(0);
+		std::mutex exMutex;
+		std::exception_ptr ex;
+		auto work = [&]() {
+			try {
+				DbContextPtr ctx = this->createDbContext();
+				size_t i;
+				while ((i = next++) < todo.size()) {
+					ReadonlySegment* seg = todo[i].get();
+					if (!fs::exists(seg->m_segDir)) {
+						continue; // being converted or purged, try later
+					}
+					ReadableIndexPtr idx = seg->buildIndexFromColgroups(indexSchema, ctx.get());
+					try {
+						idx->save((seg->m_segDir / indexFileName).string());
+					}
+					catch (const std::exception& saveEx) {
+						fprintf(stderr
+							, "WARN: addIndex: save index to %s: %s, try later\n"
+							, seg->m_segDir.string().c_str(), saveEx.what());
+						continue;
+					}
+					indices[i] = idx;
+				}
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(exMutex);
+				if (!ex)
+					ex = std::current_exception();
+				next = todo.size();
+			}
+		};
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < threadNum; ++i) {
+			threads.emplace_back(work);
+		}
+		work();
+		for (auto& th : threads) {
+			th.join();
+		}
+		if (ex) {
+			std::rethrow_exception(ex);
+		}
+		for (size_t i = 0; i < todo.size(); ++i) {
+			if (indices[i])
+				built.push_back(SegIndex(todo[i], indices[i]));
+		}
+	};
+	auto findBuilt = [&](const ReadableSegment* seg) {
+		size_t i = 0;
+		while (i < built.size() && built[i].first.get() != seg) ++i;
+		return i;
+	};
+	DbContextPtr ctx = createDbContext();
+	// background tasks and writers may keep the table busy for ever,
+	// give up after timeoutSec, the table is not changed
+	double timeoutSec = 600;
+	if (const char* env = getenv("TerarkDB_AddIndexTimeoutSec")) {
+		timeoutSec = std::max(atof(env), 1.0);
+	}
+	profiling pf;
+	llong t0 = pf.now();
+	llong t1 = t0;
+	bool wrSegFreezed = false;
+	for (;;) {
+		SegArrayVersionPtr ver = getSegArrayVersion();
+		// drop indices of segments which have been merged or purged
+		size_t keep = 0;
+		for (size_t i = 0; i < built.size(); ++i) {
+			auto& segs = ver->m_segments;
+			auto seg = built[i].first.get();
+			if (std::find(segs.begin(), segs.end(), seg) != segs.end())
+				built[keep++] = built[i];
+		}
+		built.resize(keep);
+		valvec<ReadonlySegmentPtr> todo;
+		for (auto& seg : ver->m_segments) {
+			auto rdseg = seg->getReadonlySegment();
+			if (rdseg && findBuilt(rdseg) == built.size())
+				todo.push_back(rdseg);
+		}
+		ver = nullptr;
+		buildIndices(todo);
+		MyRwLock lock(m_rwMutex, true);
+		bool ready = !m_isMerging && 0 == m_bgTaskNum && 0 == m_inprogressWritingCount;
+		if (ready && !wrSegFreezed && m_wrSeg && m_wrSeg->m_isDel.size() > 0) {
+			// let rows in m_wrSeg be indexed by a ReadonlySegment, to reduce
+			// the rows to be catched up in lock
+			doCreateNewSegmentInLock();
+			wrSegFreezed = true;
+			ready = false;
+		}
+		for (size_t i = 0; ready && i < m_segments.size(); ++i) {
+			auto seg = m_segments[i].get();
+			if (seg == m_wrSeg.get())
+				ready = i == m_segments.size() - 1;
+			else
+				ready = findBuilt(seg) < built.size();
+		}
+		if (ready) {
+			doAddIndexInLock(newConf, newMetaJson, built, ctx.get());
+			break;
+		}
+		lock.release();
+		llong t2 = pf.now();
+		if (pf.sf(t0, t2) > timeoutSec) {
+			for (auto& x : built) {
+				boost::system::error_code ec;
+				fs::remove(x.first->m_segDir / indexFileName, ec);
+			}
+			THROW_STD(runtime_error
+				, "addIndex(%s): timeout(%f seconds) on waiting background tasks: %s"
+				, indexSchema.m_name.c_str(), timeoutSec, m_dir.string().c_str());
+		}
+		if (pf.ms(t1, t2) > 10000) { // 10 seconds
+			fprintf(stderr, "INFO: addIndex(%s): wait for background tasks: %s, %f seconds\n"
+				, indexSchema.m_name.c_str(), m_dir.string().c_str(), pf.sf(t0, t2));
+			t1 = t2;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	fprintf(stderr, "INFO: addIndex(%s) completed: %s, %zd segments, %f seconds\n"
+		, indexSchema.m_name.c_str(), m_dir.string().c_str()
+		, built.size(), pf.sf(t0, pf.now()));
+}
+
+// all segments except m_wrSeg are ReadonlySegment and in built
+void DbTable::doAddIndexInLock(const SchemaConfigPtr& newConf,
+							   fstring newMetaJson,
+			const valvec<std::pair<ReadonlySegmentPtr, ReadableIndexPtr> >& built,
+							   DbContext* ctx) {
+	const size_t newIndexId = m_schema->getIndexNum();
+	const Schema& indexSchema = newConf->getIndexSchema(newIndexId);
+	const std::string indexFileName = "index-" + indexSchema.m_name;
+
+	// catch up m_wrSeg, all writing are blocked, rows with m_isDel
+	// set are removed or being inserted by a BatchWriter, but
+	// m_inprogressWritingCount is 0, so they are all removed rows
+	ReadableIndexPtr wrIndex;
+	if (m_wrSeg) {
+		auto wrseg = m_wrSeg.get();
+		auto indexPath = (wrseg->m_segDir / indexFileName).string();
+		wrIndex = wrseg->createIndex(indexSchema, indexPath);
+		auto wrIndexWritable = wrIndex->getWritableIndex();
+		valvec<byte> row, key;
+		ColumnVec cols;
+		for (size_t subId = 0; subId < wrseg->m_isDel.size(); ++subId) {
+			if (wrseg->m_isDel[subId])
+				continue;
+			wrseg->getValue(subId, &row, ctx);
+			m_schema->m_rowSchema->parseRow(row, &cols);
+			indexSchema.selectParent(cols, &key);
+			wrIndexWritable->insert(key, subId, ctx);
+		}
+	}
+
+	// write dbmeta.json first, if it failed, nothing was changed
+	fs::path jsonFile = m_dir / "dbmeta.json";
+	fs::path tmpFile = m_dir / "dbmeta.json.tmp";
+	{
+		FileStream fp(tmpFile.string().c_str(), "wb");
+		fp.ensureWrite(newMetaJson.data(), newMetaJson.size());
+	}
+	fs::rename(tmpFile, jsonFile);
+
+	m_retiredSchemas.push_back(m_schema);
+	m_schema = newConf;
+	for (size_t i = 0; i < m_segments.size(); ++i) {
+		auto seg = m_segments[i].get();
+		if (seg == m_wrSeg.get())
+			continue;
+		size_t j = 0;
+		while (built[j].first.get() != seg) ++j;
+		ReadonlySegmentPtr sibling = myCreateReadonlySegment(seg->m_segDir);
+		sibling->initWithAddedIndex(built[j].first.get(), built[j].second.get());
+		m_segments[i] = sibling;
+	}
+	if (m_wrSeg) {
+		// lock free readers may be using m_wrSeg->m_indices
+		valvec<ReadableIndexPtr> indices(m_wrSeg->m_indices);
+		indices.push_back(wrIndex);
+		m_wrSeg->m_indices.swap(indices);
+		m_retiredIndexArrays.emplace_back();
+		m_retiredIndexArrays.back().swap(indices);
+		m_wrSeg->m_schema = newConf;
+	}
+	m_segArrayUpdateSeq++;
+	publishSegArrayNoLock();
+}
+
+void DbTable::alterRowSchema(PathRef dir, fstring newMetaJson,
+							 const RowTranscoder& transcode) {
+	SchemaConfigPtr newConf = new SchemaConfig();
+	newConf->loadJsonString(newMetaJson);
+	DbTablePtr tab(DbTable::open(dir));
+	const SchemaConfig& oldConf = *tab->m_schema;
+	const std::string strDir = dir.string();
+	if (newConf->m_schemaVersion <= oldConf.m_schemaVersion) {
+		THROW_STD(invalid_argument
+			, "%s: new SchemaVersion = %lld must be greater than %lld"
+			, strDir.c_str(), newConf->m_schemaVersion, oldConf.m_schemaVersion);
+	}
+	if (newConf->m_tableClass != oldConf.m_tableClass) {
+		THROW_STD(invalid_argument, "%s: TableClass can not be changed", strDir.c_str());
+	}
+	if (!oldConf.m_updatableColgroups.empty() || !newConf->m_updatableColgroups.empty()) {
+		THROW_STD(invalid_argument
+			, "%s: altering is not supported for table with inplaceUpdatable colgroups"
+			, strDir.c_str());
+	}
+	if (oldConf.m_enableSnapshot || oldConf.m_enableChangeLog) {
+		// deletion time and logged rows are not converted
+		THROW_STD(invalid_argument
+			, "%s: altering is not supported with EnableSnapshot or EnableChangeLog"
+			, strDir.c_str());
+	}
+	bool sameIndices = newConf->getIndexNum() == oldConf.getIndexNum();
+	for (size_t i = 0; sameIndices && i < oldConf.getIndexNum(); ++i) {
+		const Schema& x = oldConf.getIndexSchema(i);
+		const Schema& y = newConf->getIndexSchema(i);
+		sameIndices = x.m_name == y.m_name && x.m_isUnique == y.m_isUnique;
+	}
+	if (!sameIndices) {
+		THROW_STD(invalid_argument, "%s: TableIndex can not be changed", strDir.c_str());
+	}
+	for (auto& seg : tab->m_segments) {
+		if (fs::exists(seg->m_segDir / MergeOperandLog::FileName)) {
+			THROW_STD(invalid_argument
+				, "%s has pending merge operands", seg->m_segDir.string().c_str());
+		}
+	}
+	fprintf(stderr, "INFO: alterRowSchema(%s): SchemaVersion %lld -> %lld\n"
+		, strDir.c_str(), oldConf.m_schemaVersion, newConf->m_schemaVersion);
+	profiling pf;
+	llong t0 = pf.now();
+	tab->syncFinishWriting(); // no background tasks, no writable segment
+	const size_t newMergeSeq = tab->m_mergeSeqNum + 1;
+	fs::path destMergeDir = tab->getMergePath(dir, newMergeSeq);
+	if (fs::exists(destMergeDir)) {
+		THROW_STD(logic_error, "dir: '%s' should not existed"
+			, destMergeDir.string().c_str());
+	}
+	fs::create_directories(destMergeDir);
+	fs::path mergingLockFile = destMergeDir / "merging.lock";
+	FileStream(mergingLockFile.string().c_str(), "wb").close();
+	bool committed = false;
+	BOOST_SCOPE_EXIT(&committed, &destMergeDir) {
+		if (!committed) {
+			boost::system::error_code ec;
+			fs::remove_all(destMergeDir, ec);
+		}
+	} BOOST_SCOPE_EXIT_END;
+	if (tab->m_rowNumVec[0]) {
+		saveHeadRowNum(destMergeDir, tab->m_rowNumVec[0]);
+	}
+	llong rows = 0;
+	{
+		DbContextPtr ctx(tab->createDbContext());
+		for (size_t i = 0; i < tab->m_segments.size(); ++i) {
+			ReadableSegment* seg = tab->m_segments[i].get();
+			fs::path destSegDir = tab->getSegPath2(dir, newMergeSeq, "rd", i);
+			fs::path tmpDir = destSegDir + ".tmp";
+			fs::create_directories(tmpDir);
+			ReadonlySegmentPtr dseg = tab->myCreateReadonlySegment(destSegDir);
+			dseg->m_schema = newConf;
+			tab->markExpiredRows(seg, ctx.get()); // dropped as deleted
+			dseg->m_isDel = seg->m_isDel;
+			if (auto rseg = seg->getReadonlySegment())
+				dseg->m_buildTime = rseg->m_buildTime;
+			rows += dseg->buildFrom(seg, &transcode, NULL, tmpDir, ctx.get());
+			if (dseg->m_delcnt) {
+				dseg->m_isPurged.assign(dseg->m_isDel);
+				dseg->m_isPurged.build_cache(true, false); // need select0
+			}
+			dseg->save(tmpDir);
+			dseg = nullptr;
+			fs::rename(tmpDir, destSegDir);
+		}
+	}
+	{
+		FileStream fp((destMergeDir / "dbmeta.json").string().c_str(), "wb");
+		fp.ensureWrite(newMetaJson.data(), newMetaJson.size());
+	}
+	size_t segNum = tab->m_segments.size();
+	tab = nullptr; // close, the old merge dir is removed by next open
+	fs::remove(mergingLockFile);
+	committed = true;
+	fs::path tmpFile = dir / "dbmeta.json.tmp";
+	{
+		FileStream fp(tmpFile.string().c_str(), "wb");
+		fp.ensureWrite(newMetaJson.data(), newMetaJson.size());
+	}
+	fs::rename(tmpFile, dir / "dbmeta.json");
+	fprintf(stderr, "INFO: alterRowSchema(%s) completed: %zd segments, %lld rows, %f seconds\n"
+		, strDir.c_str(), segNum, rows, pf.sf(t0, pf.now()));
+}
+
+void DbTable::asyncPurgeDelete() {
+	MyRwLock lock(m_rwMutex, true);
+	asyncPurgeDeleteInLock();
+}
+
+llong DbTable::dropLeadingSegments(llong endRecId) {
+	valvec<ReadableSegmentPtr> dropped;
+	llong oldHeadRowNum, newHeadRowNum;
+	fs::path destMergeDir;
+{
+	MyRwLock lock(m_rwMutex, true);
+	// segment index is changed, conv/purge tasks in queue use segment
+	// index, merge moves segment dirs, so don't run with them
+	if (m_isMerging || m_bgTaskNum || m_tobeDrop) {
+		return 0;
+	}
+	size_t dropNum = 0;
+	while (dropNum + 1 < m_segments.size()
+			&& m_segments[dropNum]->getWritableStore() == nullptr
+			&& m_rowNumVec[dropNum + 1] <= endRecId) {
+		dropNum++;
+	}
+	if (0 == dropNum) {
+		return 0;
+	}
+	oldHeadRowNum = m_rowNumVec[0];
+	newHeadRowNum = m_rowNumVec[dropNum];
+	destMergeDir = getMergePath(m_dir, m_mergeSeqNum+1);
+	if (fs::exists(destMergeDir)) {
+		THROW_STD(logic_error, "dir: '%s' should not existed"
+			, destMergeDir.string().c_str());
+	}
+	fs::create_directories(destMergeDir);
+	fs::path mergingLockFile = destMergeDir / "merging.lock";
+	FileStream(mergingLockFile.string().c_str(), "wb").close();
+	valvec<std::pair<fs::path, fs::path> > renamed;
+	valvec<ReadableSegmentPtr> newSegs(m_segments.capacity(), valvec_reserve());
+	valvec<llong> newRowNumVec(m_rowNumVec.capacity(), valvec_reserve());
+	try {
+		saveHeadRowNum(destMergeDir, newHeadRowNum);
+		for (size_t i = dropNum; i < m_segments.size(); ++i) {
+			auto& seg = m_segments[i];
+			size_t New = i - dropNum;
+			if (seg->getWritableStore()) {
+				assert(i == m_segments.size()-1);
+				fs::path Old = seg->m_segDir;
+				fs::path Link = getSegPath2(m_dir, m_mergeSeqNum+1, "wr", New);
+				fs::path Rela = ".." / Old.parent_path().filename() / Old.filename();
+				fs::create_directory_symlink(Rela, Link);
+			}
+			else {
+				fs::path newSegDir = getSegPath2(m_dir, m_mergeSeqNum+1, "rd", New);
+				fs::rename(seg->m_segDir, newSegDir);
+				renamed.emplace_back(seg->m_segDir, newSegDir);
+			}
+			newSegs.push_back(seg);
+			newRowNumVec.push_back(m_rowNumVec[i]);
+		}
+	}
+	catch (const std::exception& ex) {
+		fprintf(stderr, "ERROR: dropLeadingSegments: ex.what = %s, rollback\n"
+			, ex.what());
+		for (auto& x : renamed) {
+			fs::rename(x.second, x.first);
+		}
+		fs::remove_all(destMergeDir);
+		throw;
+	}
+	newRowNumVec.push_back(m_rowNumVec.back());
+	for (auto& x : renamed) {
+		size_t segIdx = &x - renamed.data();
+		newSegs[segIdx]->m_segDir.swap(x.second);
+	}
+	dropped.assign(m_segments.begin(), dropNum);
+	m_segments.swap(newSegs);
+	m_rowNumVec.swap(newRowNumVec);
+	m_mergeSeqNum++;
+	m_segArrayUpdateSeq++;
+	publishSegArrayNoLock();
+	fs::remove(mergingLockFile);
+}
+	for (auto& seg : dropped) {
+		seg->deleteSegment();
+	}
+	fprintf(stderr, "INFO: dropLeadingSegments: dropped %zd segs, records = %lld, new merge dir: %s\n"
+		, dropped.size(), newHeadRowNum - oldHeadRowNum
+		, destMergeDir.string().c_str());
+	return newHeadRowNum - oldHeadRowNum;
+}
+
+bool DbTable::isRowExpired(fstring row, llong now, ColumnVec* cols) const {
+	m_schema->m_rowSchema->parseRow(row, cols);
+	return m_schema->getExpireTime((*cols)[m_schema->m_ttlColumnId]) <= now;
+}
+
+bool
+DbTable::isExpiredNoLock(const ReadableSegment* seg, llong subId, llong now,
+						 DbContext* ctx)
+const {
+	seg->selectOneColumn(subId, m_schema->m_ttlColumnId, &ctx->buf2, ctx);
+	return m_schema->getExpireTime(ctx->buf2) <= now;
+}
+
+// an expired row in a frozen segment does not conflict with a new key,
+// it will be dropped by expireTTL, purge or merge
+bool DbTable::isExpiredDup(const ReadableSegment* seg, llong subId,
+						   DbContext* ctx) const {
+	return m_schema->hasTTL() && isExpiredNoLock(seg, subId, time(NULL), ctx);
+}
+
+bool DbTable::isExpired(llong id, DbContext* ctx) const {
+	if (!m_schema->hasTTL()) {
+		return false;
+	}
+	ctx->trySyncSegCtxSpeculativeLock(this);
+	llong rows = m_rowNum;
+	if (terark_unlikely(id < ctx->m_rowNumVec[0] || id >= rows)) {
+		THROW_STD(out_of_range, "id = %lld, rows=%lld", id, rows);
+	}
+	size_t upp = upper_bound_a(ctx->m_rowNumVec, id);
+	llong baseId = ctx->m_rowNumVec[upp-1];
+	auto seg = ctx->m_segCtx[upp-1]->seg;
+	return isExpiredNoLock(seg, id - baseId, time(NULL), ctx);
+}
+
+void
+DbTable::removeExpiredIds(valvec<llong>* recIdvec, size_t oldsize, DbContext* ctx)
+const {
+	const llong now = time(NULL);
+	llong* ids = recIdvec->data();
+	size_t newsize = oldsize;
+	for (size_t i = oldsize; i < recIdvec->size(); ++i) {
+		llong id = ids[i];
+		size_t upp = upper_bound_a(ctx->m_rowNumVec, id);
+		auto seg = ctx->m_segCtx[upp-1]->seg;
+		if (!isExpiredNoLock(seg, id - ctx->m_rowNumVec[upp-1], now, ctx))
+			ids[newsize++] = id;
+	}
+	recIdvec->risk_set_size(newsize);
+}
+
+// cached in seg unless TTLColumn is inplace updatable
+llong DbTable::maxExpireTime(ReadonlySegment* seg, DbContext* ctx) const {
+	if (LLONG_MIN != seg->m_maxExpireTime) {
+		return seg->m_maxExpireTime;
+	}
+	llong maxTime = LLONG_MIN;
+	const size_t rows = seg->m_isDel.size();
+	for (size_t id = 0; id < rows; ++id) {
+		if (!seg->m_isDel[id]) {
+			seg->selectOneColumn(id, m_schema->m_ttlColumnId, &ctx->buf2, ctx);
+			maxTime = std::max(maxTime, m_schema->getExpireTime(ctx->buf2));
+		}
+	}
+	const auto& updatable = m_schema->m_updatableColgroups;
+	size_t cgId = m_schema->m_colproject[m_schema->m_ttlColumnId].colgroupId;
+	if (std::find(updatable.begin(), updatable.end(), cgId) == updatable.end()) {
+		seg->m_maxExpireTime = maxTime;
+	}
+	return maxTime;
+}
+
+// expired rows are marked as deleted as removeRow does for freezed
+// segments, indices and change log are not touched
+size_t DbTable::markExpiredRows(ReadableSegment* seg, DbContext* ctx) {
+	if (!m_schema->hasTTL() || !seg->m_isFreezed) {
+		return 0;
+	}
+	assert(!seg->m_deletionTime); // TTL is not allowed with snapshot
+	const llong now = time(NULL);
+	ReadonlySegment* rdseg = seg->getReadonlySegment();
+	const bool allExpired = rdseg && maxExpireTime(rdseg, ctx) <= now;
+	const size_t rows = seg->m_isDel.size();
+	size_t num = 0;
+	for (size_t id = 0; id < rows; ++id) {
+		if (seg->m_isDel[id])
+			continue;
+		if (!allExpired && !isExpiredNoLock(seg, id, now, ctx))
+			continue;
+		SpinRwLock wsLock(seg->m_segMutex);
+		if (!seg->m_isDel[id]) {
+			seg->addtoUpdateList(id);
+			seg->m_isDel.set1(id);
+			seg->m_delcnt++;
+			seg->m_isDirty = true;
+			num++;
+		}
+	}
+	if (num) {
+		fprintf(stderr, "INFO: %s: marked %zd expired rows of %zd as deleted\n"
+			, seg->m_segDir.string().c_str(), num, rows);
+	}
+	return num;
+}
+
+llong DbTable::expireTTL() {
+	if (!m_schema->hasTTL()) {
+		return 0;
+	}
+	const llong now = time(NULL);
+	DbContextPtr ctx(createDbContext());
+	SegArrayVersionPtr ver = getSegArrayVersion();
+	const size_t segNum = ver->m_segments.size();
+	size_t leading = 0;
+	for (; leading + 1 < segNum; ++leading) {
+		ReadonlySegment* seg = ver->m_segments[leading]->getReadonlySegment();
+		if (!seg || maxExpireTime(seg, ctx.get()) > now)
+			break;
+	}
+	llong dropped = 0;
+	if (leading) {
+		dropped = dropLeadingSegments(ver->m_rowNumVec[leading]);
+	}
+	size_t marked = 0;
+	for (size_t i = dropped ? leading : 0; i + 1 < segNum; ++i) {
+		ReadonlySegment* seg = ver->m_segments[i]->getReadonlySegment();
+		if (seg && seg->m_delcnt < seg->m_isDel.size()
+				&& maxExpireTime(seg, ctx.get()) <= now) {
+			marked += markExpiredRows(seg, ctx.get());
+		}
+	}
+	if (marked) {
+		asyncPurgeDelete();
+	}
+	return dropped + marked;
+}
+
+static const char g_checkpointManifestFile[] = "checkpoint.json";
+
+// files of a ReadonlySegment which may be changed in place, they are
+// saved from memory by createCheckpoint instead of being linked
+static bool isMutableSegFile(const SchemaConfig& sconf, fstring fname) {
+	if (fname.startsWith("IsDel") || fname == "IsPurged.rs" ||
+		fname == "deletion-time.fixlen" || fname.endsWith(".tmp")) {
+		return true;
+	}
+	for (size_t colgroupId : sconf.m_updatableColgroups) {
+		const Schema& schema = sconf.getColgroupSchema(colgroupId);
+		if (fname == fstring("colgroup-" + schema.m_name + ".fixlen")) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool linkOrCopyFile(PathRef src, PathRef dst) {
+	boost::system::error_code ec;
+	fs::create_hard_link(src, dst, ec);
+	if (!ec) {
+		return true;
+	}
+	fs::copy_file(src, dst); // cross device
+	return false;
+}
+
+void DbTable::createCheckpoint(PathRef dir, PathRef prevCheckpoint) {
+	using terark::json;
+	if (m_tobeDrop) {
+		THROW_STD(invalid_argument, "table is dropped: %s", m_dir.string().c_str());
+	}
+	if (fs::exists(dir)) {
+		THROW_STD(invalid_argument, "checkpoint dir: %s already exists"
+			, dir.string().c_str());
+	}
+	// file list of segment in prevCheckpoint -> its segment dir
+	hash_strmap<std::string> prevSegs;
+	if (!prevCheckpoint.empty()) {
+		fs::path fpath = prevCheckpoint / g_checkpointManifestFile;
+		LineBuf buf;
+		buf.read_all(fpath.string());
+		json prev = json::parse(std::string(buf.p, buf.n));
+		for (auto& seg : prev["segments"]) {
+			if (seg.find("files") != seg.end()) {
+				fs::path segDir = getMergePath(prevCheckpoint, 0)
+								/ seg["dir"].get<std::string>();
+				prevSegs[seg["files"].dump()] = segDir.string();
+			}
+		}
+	}
+	flush();
+	// immutable files of readonly segments are pinned by hard links in
+	// pinDir, which is in the table dir, so linking never fails, they are
+	// linked or copied to dir after all locks are released
+	static std::atomic<size_t> pinSeq(0);
+	const fs::path pinDir = m_dir / ("checkpoint-pin-" + lcast(pinSeq++));
+	const fs::path mergeDir = getMergePath(dir, 0);
+	BOOST_SCOPE_EXIT(&pinDir) {
+		boost::system::error_code ec;
+		fs::remove_all(pinDir, ec);
+	} BOOST_SCOPE_EXIT_END;
+	struct SegSnapshot {
+		ReadableSegmentPtr seg;
+		febitvec isDel;
+		llong    mergeLogSize;
+		fs::path srcDir; // pinned files of readonly segment
+		json     files;
+	};
+	std::vector<SegSnapshot> snap;
+	hash_strmap<size_t> pinned; // segment dir -> idx in snap
+	size_t linkedFiles = 0, copiedFiles = 0;
+	llong  copiedBytes = 0;
+	auto pinSegment = [&](const ReadableSegment* seg) {
+		SortableStrVec names;
+		for (auto& ent : fs::directory_iterator(seg->m_segDir)) {
+			std::string fname = ent.path().filename().string();
+			if (!isMutableSegFile(*m_schema, fname)) {
+				names.push_back(fname);
+			}
+		}
+		names.sort();
+		json files = json::array();
+		for (size_t i = 0; i < names.size(); ++i) {
+			fs::path fpath = seg->m_segDir / names[i].str();
+			json f;
+			f["name"] = names[i].str();
+			f["size"] = llong(fs::file_size(fpath));
+			f["mtime"] = llong(fs::last_write_time(fpath));
+			files.push_back(f);
+		}
+		snap.emplace_back();
+		SegSnapshot& x = snap.back();
+		x.seg = const_cast<ReadableSegment*>(seg);
+		x.mergeLogSize = -1;
+		size_t prevIdx = prevSegs.find_i(files.dump());
+		if (prevSegs.end_i() != prevIdx) {
+			x.srcDir = prevSegs.val(prevIdx);
+		}
+		else {
+			x.srcDir = pinDir / lcast(snap.size()-1);
+			fs::create_directories(x.srcDir);
+			for (auto& f : files) {
+				std::string fname = f["name"];
+				fs::create_hard_link(seg->m_segDir / fname, x.srcDir / fname);
+			}
+		}
+		x.files = std::move(files);
+		pinned[seg->m_segDir.string()] = snap.size()-1;
+	};
+	json manifest;
+	manifest["table"] = m_dir.string();
+	manifest["prevCheckpoint"] = prevCheckpoint.string();
+	auto& segsJs = manifest["segments"] = json::array();
+	valvec<size_t> segSnap; // segments of checkpoint -> idx in snap
+	json  wrSegJs; // the writing segment, if it has merge operands
+	llong headRowNum = 0;
+	try {
+		fs::create_directories(mergeDir);
+		{
+			// read lock prevents segment dirs from being moved by merge,
+			// purge and dropLeadingSegments, but does not block writes
+			MyRwLock lock(m_rwMutex, false);
+			for (size_t i = 0; i < m_segments.size(); ++i) {
+				ReadableSegment* seg = m_segments[i].get();
+				if (seg->getWritableStore() == nullptr) {
+					pinSegment(seg);
+				}
+			}
+		}
+		profiling pf;
+		llong t0 = pf.now();
+		llong t1 = t0;
+		for (;;) {
+			MyRwLock lock(m_rwMutex, true);
+			if (m_isMerging || m_inprogressWritingCount > 0) {
+				// the writing segment can not be frozen now
+				lock.release();
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+				llong t2 = pf.now();
+				if (pf.ms(t1, t2) > 10000) { // 10 seconds
+					fprintf(stderr, "INFO: createCheckpoint(%s): wait for merging or writing, %f seconds\n"
+						, dir.string().c_str(), pf.sf(t0, t2));
+					t1 = t2;
+				}
+				continue;
+			}
+			// writes after freezing go to the new writing segment, which is
+			// not in the checkpoint, so the frozen ones can be saved later
+			if (m_wrSeg->m_isDel.size() > 0) {
+				doCreateNewSegmentInLock();
+			}
+			for (size_t i = 0; i < m_segments.size(); ++i) {
+				ReadableSegment* seg = m_segments[i].get();
+				if (seg == m_wrSeg.get()) {
+					if (seg->getWritableSegment()->mergeLogMemSize() == 0) {
+						break; // empty
+					}
+					// operands without rows, bounded by MaxWritingSegmentSize
+					fs::path destSegDir = getSegPath2(dir, 0, "wr", i);
+					fs::create_directories(destSegDir);
+					seg->save(destSegDir);
+					wrSegJs["rows"] = 0;
+					wrSegJs["dir"] = destSegDir.filename().string();
+					break;
+				}
+				size_t idx = pinned.find_i(seg->m_segDir.string());
+				if (pinned.end_i() != idx && snap[pinned.val(idx)].seg.get() == seg) {
+					idx = pinned.val(idx);
+				}
+				else if (seg->getWritableStore() == nullptr) {
+					pinSegment(seg); // created after pinning
+					idx = snap.size()-1;
+				}
+				else {
+					idx = snap.size();
+					snap.emplace_back();
+					SegSnapshot& x = snap.back();
+					x.seg = seg;
+					auto wrseg = seg->getWritableSegment();
+					x.mergeLogSize = wrseg->m_mergeLog ? wrseg->m_mergeLog->fileSize() : -1;
+				}
+				snap[idx].isDel = seg->m_isDel;
+				segSnap.push_back(idx);
+			}
+			headRowNum = m_rowNumVec[0];
+			fs::copy_file(m_dir / "dbmeta.json", dir / "dbmeta.json");
+			break;
+		}
+		// no locks, segments are kept alive by snap, in place updated
+		// colgroups and deletion time may be newer than the checkpoint
+		for (size_t i = 0; i < segSnap.size(); ++i) {
+			SegSnapshot& x = snap[segSnap[i]];
+			const ReadableSegment* seg = x.seg.get();
+			json one;
+			one["rows"] = llong(x.isDel.size());
+			if (auto wrseg = seg->getWritableSegment()) {
+				fs::path destSegDir = getSegPath2(dir, 0, "wr", i);
+				fs::create_directories(destSegDir);
+				// not ReadableSegment::save, which skips converted segments
+				wrseg->saveRecordStore(destSegDir);
+				wrseg->saveIndices(destSegDir);
+				ReadableSegment::saveIsDel_aux(destSegDir, x.isDel);
+				if (wrseg->m_deletionTime) {
+					wrseg->m_deletionTime->save(destSegDir / "deletion-time");
+				}
+				if (x.mergeLogSize >= 0) {
+					// drop records appended by collapsing after freezing
+					fs::resize_file(destSegDir / MergeOperandLog::FileName, x.mergeLogSize);
+				}
+				one["dir"] = destSegDir.filename().string();
+				segsJs.push_back(one);
+				continue;
+			}
+			fs::path destSegDir = getSegPath2(dir, 0, "rd", i);
+			fs::create_directories(destSegDir);
+			for (auto& f : x.files) {
+				std::string fname = f["name"];
+				if (linkOrCopyFile(x.srcDir / fname, destSegDir / fname)) {
+					linkedFiles++;
+				} else {
+					copiedFiles++;
+					copiedBytes += f["size"].get<llong>();
+				}
+			}
+			one["files"] = x.files;
+			auto rseg = seg->getReadonlySegment();
+			ReadableSegment::saveIsDel_aux(destSegDir, x.isDel);
+			rseg->savePurgeBits(destSegDir);
+			if (rseg->m_deletionTime) {
+				rseg->m_deletionTime->save(destSegDir / "deletion-time");
+			}
+			for (size_t colgroupId : m_schema->m_updatableColgroups) {
+				const Schema& schema = m_schema->getColgroupSchema(colgroupId);
+				rseg->m_colgroups[colgroupId]->save(destSegDir / ("colgroup-" + schema.m_name));
+			}
+			one["dir"] = destSegDir.filename().string();
+			segsJs.push_back(one);
+		}
+		if (!wrSegJs.is_null()) {
+			segsJs.push_back(wrSegJs);
+		}
+		if (headRowNum > 0) {
+			saveHeadRowNum(mergeDir, headRowNum);
+		}
+	}
+	catch (const std::exception& ex) {
+		fprintf(stderr, "ERROR: createCheckpoint(%s): ex.what = %s\n"
+			, dir.string().c_str(), ex.what());
+		fs::remove_all(dir);
+		throw;
+	}
+	fs::path manifestFile = dir / g_checkpointManifestFile;
+	fs::path manifestTemp = dir / (std::string(g_checkpointManifestFile) + ".tmp");
+	FileStream(manifestTemp.string().c_str(), "w").puts(manifest.dump(2));
+	fs::rename(manifestTemp, manifestFile);
+	fprintf(stderr
+		, "INFO: createCheckpoint(%s): segs = %zd, linked files = %zd, copied files = %zd, copied bytes = %lld\n"
+		, dir.string().c_str(), segsJs.size(), linkedFiles, copiedFiles, copiedBytes);
+}
+
+void DbTable::dropTable() {
+	assert(!m_dir.empty());
+	MyRwLock lock(m_rwMutex, true);
+	for (auto& seg : m_segments) {
+		seg->deleteSegment();
+	}
+	m_segments.erase_all();
+	m_rowNumVec.erase_all();
+	m_wrSeg = nullptr;
+	m_mergeKeyNum = 0;
+	m_tobeDrop = true;
+	m_segArrayUpdateSeq++;
+	publishSegArrayNoLock();
+}
+
+std::string DbTable::toJsonStr(fstring row) const {
+	return m_schema->m_rowSchema->toJsonStr(row);
+}
+
+boost::filesystem::path
+DbTable::getMergePath(PathRef dir, size_t mergeSeq)
+const {
+	auto res = dir;
+	char szBuf[32];
+	snprintf(szBuf, sizeof(szBuf), "g-%04ld", long(mergeSeq));
+	res /= szBuf;
+	return res;
+}
+
+boost::filesystem::path
+DbTable::getSegPath(const char* type, size_t segIdx)
+const {
+	return getSegPath2(m_dir, m_mergeSeqNum, type, segIdx);
+}
 
 // static
 boost::filesystem::path
@@ -3947,10 +6295,20 @@ void DbTable::convWritableSegmentToReadonly(size_t segIdx) {
 		m_bgTaskNum--;
 	}BOOST_SCOPE_EXIT_END;
   {
+	BgTaskTimer bgTimer(m_convStat);
 	auto segDir = getSegPath("rd", segIdx);
 	fprintf(stderr, "INFO: convWritableSegmentToReadonly: %s\n", segDir.string().c_str());
+	// rows of collapsed operands go to the new writing segment
+	if (!collapseMergeOperands(segIdx)) {
+		fprintf(stderr
+			, "ERROR: convWritableSegmentToReadonly: %s: merge operands are not collapsed, skipped\n"
+			, segDir.string().c_str());
+		return;
+	}
 	ReadonlySegmentPtr newSeg = myCreateReadonlySegment(segDir);
 	newSeg->convFrom(this, segIdx);
+	bgTimer.addBytes(newSeg->totalStorageSize());
+	m_mergePolicy->onConvert(newSeg->totalStorageSize());
 	fprintf(stderr, "INFO: convWritableSegmentToReadonly: %s done!\n", segDir.string().c_str());
 #if 0
 	fs::path wrSegPath = getSegPath("wr", segIdx);
@@ -3980,6 +6338,7 @@ void DbTable::convWritableSegmentToReadonly(size_t segIdx) {
 			, ex.what());
 	}
 #endif
+	maybeAsyncExpireTTL();
 	if (this->m_isMerging || m_bgTaskNum > 1) {
 		return;
 	}
@@ -4000,9 +6359,11 @@ void DbTable::freezeFlushWritableSegment(size_t segIdx) {
 	if (seg->m_isDelMmap) {
 		return;
 	}
+	BgTaskTimer bgTimer(m_flushStat);
 	fprintf(stderr, "freezeFlushWritableSegment: %s\n", seg->m_segDir.string().c_str());
 	seg->saveIndices(seg->m_segDir);
 	seg->saveRecordStore(seg->m_segDir);
+	bgTimer.addBytes(seg->totalStorageSize());
 	seg->saveIsDel(seg->m_segDir);
 	fprintf(stderr, "freezeFlushWritableSegment: %s done!\n", seg->m_segDir.string().c_str());
 }
@@ -4022,6 +6383,7 @@ void DbTable::runPurgeDelete() {
 		}
 		m_purgeStatus = PurgeStatus::purging;
 	}
+	BgTaskTimer bgTimer(m_purgeStat);
 	for (;;) {
 		double threshold = std::max(m_schema->m_purgeDeleteThreshold, 0.001);
 		size_t segIdx = size_t(-1);
@@ -4048,7 +6410,10 @@ void DbTable::runPurgeDelete() {
 		}
 		try {
 			ReadonlySegmentPtr dest = myCreateReadonlySegment(srcSeg->m_segDir);
+			dest->m_buildTime = srcSeg->m_buildTime;
 			dest->purgeDeletedRecords(this, segIdx);
+			bgTimer.addBytes(dest->totalStorageSize());
+			m_mergePolicy->onPurge(dest->totalStorageSize());
 		}
 		catch (const std::exception&) {
 			break; // would try in merge()
@@ -4156,6 +6521,17 @@ public:
 	PurgeDeleteTask(DbTablePtr tab) : m_tab(tab) {}
 };
 
+// not counted in m_bgTaskNum, dropLeadingSegments refuses to run with
+// other background tasks
+class ExpireTTLTask : public MyTask {
+	DbTablePtr m_tab;
+public:
+	void execute() override {
+		m_tab->runExpireTTL();
+	}
+	ExpireTTLTask(DbTablePtr tab) : m_tab(tab) {}
+};
+
 class WrSegFreezeFlushTask : public MyTask {
 	DbTablePtr m_tab;
 	size_t m_segIdx;
@@ -4238,6 +6614,38 @@ void DbTable::asyncPurgeDeleteInLock() {
 	}
 }
 
+void DbTable::maybeAsyncExpireTTL() {
+	static const llong interval = getEnvLong("TerarkDB_ExpireTTLInterval", 60);
+	if (!m_schema->hasTTL() || g_stopCompress) {
+		return;
+	}
+	const llong now = time(NULL);
+	if (now < m_nextExpireTTLTime) {
+		return;
+	}
+	bool inQueue = false;
+	if (m_expireTTLInQueue.compare_exchange_strong(inQueue, true)) {
+		m_nextExpireTTLTime = now + interval;
+		g_compressQueue.push_back(new ExpireTTLTask(this));
+	}
+}
+
+void DbTable::runExpireTTL() {
+	BOOST_SCOPE_EXIT(&m_expireTTLInQueue) {
+		m_expireTTLInQueue = false;
+	} BOOST_SCOPE_EXIT_END;
+	if (m_tobeDrop) {
+		return;
+	}
+	try {
+		expireTTL();
+	}
+	catch (const std::exception& ex) {
+		fprintf(stderr, "WARN: %s: expireTTL failed: %s\n"
+			, m_dir.string().c_str(), ex.what());
+	}
+}
+
 void DbTable::inLockPutPurgeDeleteTaskToQueue() {
 	assert(!g_stopPutToFlushQueue);
 	if (g_stopPutToFlushQueue) {
@@ -4277,22 +6685,4 @@ void DbTable::safeStopAndWaitForCompress() {
 	assert(g_compressQueue.empty());
 }
 
-/*
-void DbTable::registerDbContext(DbContext* ctx) const {
-	assert(m_ctxListHead != ctx);
-	MyRwLock lock(m_rwMutex);
-	ctx->m_prev = m_ctxListHead;
-	ctx->m_next = m_ctxListHead->m_next;
-	m_ctxListHead->m_next->m_prev = ctx;
-	m_ctxListHead->m_next = ctx;
-}
-
-void DbTable::unregisterDbContext(DbContext* ctx) const {
-	assert(m_ctxListHead != ctx);
-	MyRwLock lock(m_rwMutex);
-	ctx->m_prev->m_next = ctx->m_next;
-	ctx->m_next->m_prev = ctx->m_prev;
-}
-*/
-
 } } // namespace terark::db
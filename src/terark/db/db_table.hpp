@@ -3,9 +3,16 @@
 
 #include "db_store.hpp"
 #include "db_index.hpp"
+#include "row_cache.hpp"
+#include "merge_operator.hpp"
+#include "change_log.hpp"
+#include "merge_policy.hpp"
+#include "epoch_domain.hpp"
 #include <tbb/queuing_rw_mutex.h>
 //#include <tbb/spin_rw_mutex.h>
 #include <atomic>
+#include <functional>
+#include <mutex>
 
 #if defined(TBB_VERSION_MAJOR)
 	#if TBB_VERSION_MAJOR * 1000 + TBB_VERSION_MINOR < 4004
@@ -40,17 +47,81 @@ class TERARK_DB_DLL ReadableSegment;
 class TERARK_DB_DLL ReadonlySegment;
 class TERARK_DB_DLL WritableSegment;
 typedef boost::intrusive_ptr<ReadableSegment> ReadableSegmentPtr;
+typedef boost::intrusive_ptr<ReadonlySegment> ReadonlySegmentPtr;
 typedef boost::intrusive_ptr<WritableSegment> WritableSegmentPtr;
 
+// Immutable version of the segment array of a DbTable, a new version is
+// published in lock DbTable::m_rwMutex each time m_segArrayUpdateSeq is
+// increased, readers get the version by DbTable::getSegArrayVersion()
+// without locking m_rwMutex, old versions are reclaimed by EpochDomain.
+class TERARK_DB_DLL SegArrayVersion : public RefCounter {
+public:
+	SegArrayVersion();
+	~SegArrayVersion();
+	valvec<ReadableSegmentPtr> m_segments;
+	valvec<llong>      m_rowNumVec; // back() is the rowNum when published
+	WritableSegmentPtr m_wrSeg;
+	SchemaConfigPtr    m_schema; // addIndex publishes a new schema
+	size_t             m_updateSeq;
+};
+typedef boost::intrusive_ptr<SegArrayVersion> SegArrayVersionPtr;
+
+// Sees all live rows of a WritableSegment when it is converted to a
+// ReadonlySegment, an observer is created for each conversion with the
+// row schema of the segment, observe() is called in the background
+// conversion thread, complete() is called after all rows are observed,
+// files written into segDir are kept in the new ReadonlySegment dir.
+class TERARK_DB_DLL ConvRowObserver : public RefCounter {
+public:
+	virtual ~ConvRowObserver();
+	virtual void observe(fstring row) = 0;
+	virtual void complete(PathRef segDir) = 0;
+};
+typedef boost::intrusive_ptr<ConvRowObserver> ConvRowObserverPtr;
+typedef std::function<ConvRowObserver*(const Schema& rowSchema)> ConvRowObserverFactory;
+
+// exact match of key on an index, a term of DbTable::indexSearchMulti
+struct TERARK_DB_DLL IndexCondition {
+	size_t  indexId;
+	fstring key;
+};
+
+// Predicate of DbTable::scanColumnPredicate on a fixed length integer or
+// float column, operands are in the binary format of the column
+struct TERARK_DB_DLL ColumnPredicate {
+	enum Op : byte { Eq, Ne, Lt, Le, Gt, Ge, Between };
+	size_t  columnId;
+	Op      op;
+	fstring lo; // operand of all but Between, which is lo <= x <= hi
+	fstring hi;
+};
+
+// Aggregates of matched rows, 64 bit integers beyond 2^53 lose precision
+struct TERARK_DB_DLL ColumnAggregate {
+	llong  count;
+	double sum;
+	double min;
+	double max;
+	ColumnAggregate();
+};
+
 // Now BatchWriter is supported only when table has at most one unique index
 class TERARK_DB_DLL BatchWriter {
 	DECLARE_NONE_COPYABLE_CLASS(BatchWriter);
+	friend class DbTable;
 protected:
 	DbContextPtr     m_ctx;
-	WritableSegment* m_wrSeg; // for debug only
+	WritableSegment* m_wrSeg; // can not be frozen before commit
 	DbTransaction*   m_txn; // for debug only
+	std::vector<std::string> m_mergeKeys; // discard merge operands on commit
+	std::vector<std::pair<std::string, std::string> > m_mergeOps; // key, operand
+	valvec<byte>     m_changes; // appended to the ChangeLog on commit
+	size_t           m_changeNum = 0;
+	void  logChange(ChangeLog::OpType, llong recId, fstring data);
 	llong overwriteExisting(fstring row);
 	llong upsertRowImpl(fstring row);
+	void  addMergeKey(fstring key);
+	bool  doCommit();
 public:
 	explicit BatchWriter(DbTable* tab, DbContext* ctx = NULL);
 	~BatchWriter();
@@ -59,6 +130,11 @@ public:
 	const char* szError() const;
 	llong upsertRow(fstring row);
 	void  removeRow(llong recId);
+	// for a key which has no row but may have pending merge operands
+	void  discardMergeOperands(fstring key);
+	// the operand is applied on top of the rows written by this batch,
+	// it is appended to the operand log on commit
+	void  mergeRow(fstring key, fstring operand);
 	bool  commit();
 	void  rollback();
 };
@@ -84,6 +160,21 @@ public:
 
 	static DbTable* open(PathRef dbPath);
 
+	// same as open, the observer factory is set before segments left by
+	// last run are put to the compression queue, so they are observed
+	static DbTable* open(PathRef dbPath, const ConvRowObserverFactory&);
+
+	// change "RowSchema" and "ColumnGroups" of the closed table in dbPath,
+	// newMetaJson is the new dbmeta.json with same "TableIndex" and a
+	// greater "SchemaVersion", all segments are rebuilt into a new merge
+	// dir from rows converted by transcode, the new merge dir takes a copy
+	// of newMetaJson and the alteration is committed by removing its
+	// "merging.lock", open rolls dbmeta.json forward if it crashed after
+	// the commit, throws and leaves the table unchanged if transcode
+	// throws, such as on a row which does not fit the new schema
+	static void alterRowSchema(PathRef dbPath, fstring newMetaJson,
+							   const RowTranscoder& transcode);
+
 	void load(PathRef dir) override;
 	void save(PathRef dir) const override;
 
@@ -155,6 +246,12 @@ public:
 	void indexSearchExactNoLock(size_t indexId, fstring key, valvec<llong>* recIdvec, DbContext*) const;
 	bool indexKeyExistsNoLock(size_t indexId, fstring key, DbContext*) const;
 
+	// ids of live records matching all (isAnd) or any of conds, evaluated
+	// segment by segment on physic ids, just the result ids are translated
+	// to logic ids and checked for deletion, recIdvec is ascending
+	void indexSearchMulti(const IndexCondition* conds, size_t num, bool isAnd,
+						  valvec<llong>* recIdvec, DbContext*) const;
+
 	virtual	bool indexMatchRegex(size_t indexId, BaseDFA* regexDFA, valvec<llong>* recIdvec, DbContext*) const;
 	virtual	bool indexMatchRegex(size_t indexId, fstring  regexStr, fstring regexOptions, valvec<llong>* recIdvec, DbContext*) const;
 
@@ -164,10 +261,13 @@ public:
 
 	llong indexStorageSize(size_t indexId) const;
 
+	// ctx is shared by the iterator, NULL creates a new DbContext
 	IndexIteratorPtr createIndexIterForward(size_t indexId) const;
+	IndexIteratorPtr createIndexIterForward(size_t indexId, DbContext*) const;
 	IndexIteratorPtr createIndexIterForward(fstring indexCols) const;
 
 	IndexIteratorPtr createIndexIterBackward(size_t indexId) const;
+	IndexIteratorPtr createIndexIterBackward(size_t indexId, DbContext*) const;
 	IndexIteratorPtr createIndexIterBackward(fstring indexCols) const;
 
 	valvec<size_t> getProjectColumns(const hash_strmap<>& colnames) const;
@@ -186,6 +286,24 @@ public:
 
 	void selectOneColgroup(llong id, size_t cgId, valvec<byte>* cgData, DbContext*) const;
 
+	///@{ batched fetch, ids need not be sorted, data of ids[i] are appended
+	///   to vals as [(*offsets)[i], (*offsets)[i+1]), offsets is resized to
+	///   num+1, cache misses of records are overlapped by prefetching
+	void getValuesBatch(const llong* ids, size_t num, valvec<byte>* vals,
+						valvec<size_t>* offsets, DbContext*) const;
+	void selectColumnsBatch(const llong* ids, size_t num,
+							const size_t* colsId, size_t colsNum,
+							valvec<byte>* colsData, valvec<size_t>* offsets,
+							DbContext*) const;
+	///@}
+
+	// columnar scan of one column segment by segment, dense colgroups
+	// such as FixedLenStore are scanned as arrays, ZipIntStore is decoded
+	// by blocks. live rows matching pred are set in matches (resized to
+	// rows of the table) and aggregated to agg, both are optional
+	void scanColumnPredicate(const ColumnPredicate& pred, febitvec* matches,
+							 ColumnAggregate* agg, DbContext*) const;
+
 protected:
 	void selectColumnsNoLock(llong id, const valvec<size_t>& cols,
 					   valvec<byte>* colsData, DbContext*) const;
@@ -222,8 +340,51 @@ public:
 	void flush();
 	void compact();
 	void syncFinishWriting();
+
+	// add a non-unique index online, indexJson is same as an element of
+	// "TableIndex" in dbmeta.json, the index of each ReadonlySegment is
+	// built from its colgroups in parallel, reads are never blocked,
+	// writes are just blocked for the catch up of the writing segment,
+	// throws if background tasks keep running longer than the timeout
+	// set by env TerarkDB_AddIndexTimeoutSec(default 600)
+	void addIndex(fstring indexJson);
 	void asyncPurgeDelete();
 
+	// drop leading ReadonlySegments whose records are all less than
+	// endRecId, such as the oldest records of an oplog or a capped table,
+	// segment dirs are moved to a new merge dir and dropped segments are
+	// deleted without any purge/merge I/O, record ids of remaining rows
+	// are not changed, ids less than getSegArrayVersion()->m_rowNumVec[0]
+	// are no longer valid.
+	// returns number of dropped records, 0 if background tasks are
+	// running, in which case the caller should retry later
+	llong dropLeadingSegments(llong endRecId);
+
+	// TTL by "TTLColumn" in dbmeta.json: expired rows are skipped by table
+	// iterators and index searches, and are dropped as deleted rows without
+	// index or change log writes when a segment is converted, purged or
+	// merged. expireTTL drops leading ReadonlySegments whose rows are all
+	// expired, other all expired ReadonlySegments are purged, it should be
+	// called periodically, returns number of dropped rows. Writes and
+	// segment conversions queue it to compression threads once in
+	// env TerarkDB_ExpireTTLInterval seconds, default 60
+	bool  isExpired(llong id, DbContext*) const;
+	llong expireTTL();
+
+	// create a checkpoint of the table in dir, which can be opened by
+	// DbTable::open, immutable files of ReadonlySegments are hard linked
+	// (copied if linking fails), IsDel, purge bits, inplace updatable
+	// colgroups and writable segments are saved, a manifest of linked
+	// files is written as dir/checkpoint.json at last.
+	// if prevCheckpoint is not empty, segments unchanged since its manifest
+	// are linked from prevCheckpoint, so an incremental backup on another
+	// device just copies segments created after prevCheckpoint.
+	// writes are blocked just while the writing segment is frozen and
+	// IsDel is copied in memory, files are copied after that, it waits
+	// for a running merge because the writing segment can not be frozen
+	void createCheckpoint(PathRef dir,
+						  PathRef prevCheckpoint = boost::filesystem::path());
+
 	void dropTable();
 
 	PathRef getDir() const { return m_dir; }
@@ -238,12 +399,14 @@ public:
 	size_t getSegNum() const { return m_segments.size(); }
 	size_t getWritableSegNum() const;
 	size_t getSegArrayUpdateSeq() const { return this->m_segArrayUpdateSeq; }
+	SegArrayVersionPtr getSegArrayVersion() const; // lock free
 	size_t getSegmentIndexOfRecordIdNoLock(llong recId) const;
 
 	///@{ internal use only
 	void convWritableSegmentToReadonly(size_t segIdx);
 	void freezeFlushWritableSegment(size_t segIdx);
 	void runPurgeDelete();
+	void runExpireTTL();
 	void putToFlushQueue(size_t segIdx);
 	void putToCompressionQueue(size_t segIdx);
 	///@}
@@ -258,20 +421,36 @@ protected:
 
 	class MergeParam; friend class MergeParam;
 	void merge(MergeParam&);
+
+	bool isRowExpired(fstring row, llong now, ColumnVec* cols) const;
+	bool isExpiredNoLock(const ReadableSegment*, llong subId, llong now, DbContext*) const;
+	bool isExpiredDup(const ReadableSegment*, llong subId, DbContext*) const;
+	void removeExpiredIds(valvec<llong>* recIdvec, size_t oldsize, DbContext*) const;
+	llong  maxExpireTime(ReadonlySegment*, DbContext*) const;
+	size_t markExpiredRows(ReadableSegment*, DbContext*);
 	void checkRowNumVecNoLock() const;
 
 	bool maybeCreateNewSegment(MyRwLock&);
 	void maybeCreateNewSegmentInWriteLock();
+	bool isWritingSegmentFullNoLock() const;
 	void doCreateNewSegmentInLock();
-	llong insertRowImpl(fstring row, DbContext*, MyRwLock&);
-	llong insertRowDoInsert(fstring row, DbContext*);
+	// replacedId is logged as removed with replacedKey
+	llong insertRowImpl(fstring row, DbContext*, MyRwLock&,
+						llong replacedId = -1, fstring replacedKey = fstring());
+	llong insertRowDoInsert(fstring row, DbContext*,
+						llong replacedId = -1, fstring replacedKey = fstring());
 	llong insertRowDoInsertNoCommit(fstring row, DbContext*);
 	bool insertSyncIndex(llong subId, DbTransaction*, DbContext*);
+	bool removeExpiredWrDup(size_t indexId, DbTransaction*, DbContext*);
 	bool updateCheckSegDup(size_t begSeg, size_t numSeg, DbContext*);
 	bool updateWithSyncIndex(llong newSubId, fstring row, DbContext*);
 	void updateSyncMultIndex(llong newSubId, DbTransaction*, DbContext*);
 
 	llong doUpsertRow(fstring row, DbContext*);
+	llong upsertRowRetry(fstring row, DbContext*);
+	bool  doRemoveRow(llong id, DbContext*);
+	bool  getRowKey(llong id, std::string* key, DbContext*) const;
+	bool  getRowByUniqueKey(fstring key, valvec<byte>* row, DbContext*) const;
 
 	boost::filesystem::path getMergePath(PathRef dir, size_t mergeSeq) const;
 	boost::filesystem::path getSegPath(const char* type, size_t segIdx) const;
@@ -292,12 +471,103 @@ protected:
 	void asyncPurgeDeleteInLock();
 	void inLockPutPurgeDeleteTaskToQueue();
 
-//	void registerDbContext(DbContext* ctx) const;
-//	void unregisterDbContext(DbContext* ctx) const;
+	void registerDbContext(DbContext* ctx) const;
+	void unregisterDbContext(DbContext* ctx) const;
 
 public:
+	// accumulated statistics of a kind of background task, time is in ns,
+	// bytes is the storage size of the produced segment
+	struct BgTaskStat {
+		std::atomic<llong> cnt;
+		std::atomic<llong> nsTime;
+		std::atomic<llong> bytes;
+		BgTaskStat() : cnt(0), nsTime(0), bytes(0) {}
+		void add(llong ns, llong nBytes) { cnt++; nsTime += ns; bytes += nBytes; }
+	};
+	struct TableStats {
+		struct BgTask { llong cnt, nsTime, bytes; };
+		struct SegStat {
+			std::string dir;
+			llong rows;
+			llong lookupCnt;
+			llong seekCnt;
+		};
+		DbStats   fg; // sum of all live and destroyed DbContext
+		BgTask    flush, conv, merge, purge;
+		std::vector<SegStat> segs;
+		size_t    liveCtxNum;
+	};
+	// per-thread counters are aggregated on read, per segment counters are
+	// published in batches, so they may be a little behind
+	void getStats(TableStats*) const;
+	std::string getStatsJson() const;
+
+	// 0 disables the row cache, if the row cache does not exist, this
+	// function must be called before the table is used concurrently,
+	// such as right after open
+	void setRowCacheCapacity(size_t capacityBytes);
+	RowCache* getRowCache() const { return m_rowCache.get(); }
+
+	// same as setRowCacheCapacity, must be called before the table is
+	// used concurrently, an empty factory disables the observer, segments
+	// converted on open are not observed, use open(dbPath, factory)
+	void setConvRowObserverFactory(const ConvRowObserverFactory& fac)
+	  { m_convRowObserverFactory = fac; }
+	ConvRowObserver* createConvRowObserver(const Schema& rowSchema) const {
+		return m_convRowObserverFactory ? m_convRowObserverFactory(rowSchema) : NULL;
+	}
+
+	// the policy is created from "MergePolicy" on open, same as
+	// setRowCacheCapacity, must be called before the table is used
+	// concurrently
+	void setMergePolicy(MergePolicy* policy) { m_mergePolicy = policy; }
+	MergePolicy* getMergePolicy() const { return m_mergePolicy.get(); }
+
+	// merge operator of deferred read-modify-write, see MergeOperator,
+	// the table must have exactly one unique index, pending operands in
+	// the writable segments are loaded by this function, so it must be
+	// called before the table is used concurrently, such as right after
+	// open, and it must be called on each open while there are operands,
+	// writable segments with operands are not converted until then
+	void setMergeOperator(MergeOperator*);
+	MergeOperator* getMergeOperator() const { return m_mergeOperator.get(); }
+	bool hasMergeOperands() const { return m_mergeKeyNum > 0; }
+	bool hasMergeOperands(fstring key) const;
+
+	// key is the unique index key, the operand is appended to the writing
+	// segment and is applied on read and by collapseMergeOperands. When
+	// the merge operator is set, upsertRow and removeRow are committed by
+	// a BatchWriter, which discards pending operands of the written keys,
+	// insertRow and updateRow don't check pending operands.
+	//
+	// Lock order: the transaction of the writing segment, then the merge
+	// key mutexes in ascending order, then m_rwMutex.
+	void mergeRow(fstring key, fstring operand);
+	// for a key which has no row but may have pending merge operands
+	bool discardMergeOperands(fstring key);
+
+	// the row of key with pending operands applied,
+	// returns false if key does not exist and has no pending operands
+	bool getMergedRow(fstring key, valvec<byte>* row, DbContext*) const;
+
+	// sorted keys which have pending operands, with or without a row
+	void getMergeOperandKeys(std::vector<std::string>* keys) const;
+
+	// write the rows of all keys with pending operands in the writable
+	// segment and drop their operands in all segments, called before the
+	// segment is converted, returns false if some keys are not collapsed
+	bool collapseMergeOperands(size_t segIdx);
+
+	// NULL if "EnableChangeLog" is false in dbmeta.json, see ChangeLog
+	ChangeLog* getChangeLog() const { return m_changeLog.get(); }
+
+	BgTaskStat m_flushStat; // freezeFlushWritableSegment
+	BgTaskStat m_convStat;  // convWritableSegmentToReadonly, exclude merge
+	BgTaskStat m_mergeStat;
+	BgTaskStat m_purgeStat;
+
 	mutable MyRwMutex m_rwMutex;
-	mutable size_t m_tableScanningRefCount;
+	mutable std::atomic_size_t m_tableScanningRefCount;
 	mutable std::atomic_size_t m_inprogressWritingCount;
 protected:
 	enum class PurgeStatus : unsigned {
@@ -307,19 +577,68 @@ protected:
 		purging,
 	};
 
-//	DbContextLink* m_ctxListHead;
+	mutable std::mutex    m_ctxListMutex; // just for m_ctxListHead
+	mutable DbContextLink m_ctxListHead;
+	mutable DbStats       m_retiredStats; // of destroyed DbContext
+	std::unique_ptr<RowCache> m_rowCache; // for ReadonlySegment
+	ConvRowObserverFactory    m_convRowObserverFactory;
+	MergeOperatorPtr    m_mergeOperator;
+	std::atomic<size_t> m_mergeKeyNum; // (segment, key) with operands
+	std::mutex m_collapseMergeMutex;
+	static const size_t MergeKeyMutexNum = 32; // must be power of 2
+	mutable std::mutex m_mergeKeyMutex[MergeKeyMutexNum];
+	static size_t mergeKeyMutexIdx(fstring key);
+	void lockMergeKeys(valvec<size_t>* mutexIdx) const;
+	void unlockMergeKeys(const valvec<size_t>& mutexIdx) const;
+	void applyMergeBatchNoLock(WritableSegment*,
+			const std::vector<std::string>& discardKeys,
+			const std::vector<std::pair<std::string, std::string> >& ops);
+	bool getMergedRowNoLock(fstring key, valvec<byte>* row, DbContext*) const;
+	ChangeLogPtr m_changeLog;
+	MergePolicyPtr m_mergePolicy;
+	void logChange(ChangeLog::OpType type, llong recId, fstring data) {
+		if (m_changeLog)
+			m_changeLog->append(type, recId, data);
+	}
+	// held from before the commit of a change until it is logged
+	std::unique_lock<std::mutex> lockChangeLog() const {
+		if (m_changeLog)
+			return std::unique_lock<std::mutex>(m_changeLog->commitMutex());
+		return std::unique_lock<std::mutex>();
+	}
+	// unique key logged by Remove, empty if there is no unique index
+	void getChangeLogKey(fstring row, valvec<byte>* key) const;
+
+	// replaced by addIndex, lock free readers may still use them
+	valvec<SchemaConfigPtr> m_retiredSchemas;
+	valvec<valvec<ReadableIndexPtr> > m_retiredIndexArrays;
+	std::mutex m_addIndexMutex;
+	void doAddIndexInLock(const SchemaConfigPtr& newConf, fstring newMetaJson,
+						  const valvec<std::pair<ReadonlySegmentPtr, ReadableIndexPtr> >&,
+						  DbContext*);
+	// must be called in writer lock after changing m_segArrayUpdateSeq
+	void publishSegArrayNoLock();
+	std::atomic<SegArrayVersion*> m_segArrayVersion;
+	mutable EpochDomain m_segArrayEpoch;
 	valvec<llong>  m_rowNumVec;
 	valvec<ReadableSegmentPtr> m_segments;
 	WritableSegmentPtr m_wrSeg;
 	size_t m_mergeSeqNum;
 	size_t m_newWrSegNum;
 	size_t m_bgTaskNum;
-	size_t m_segArrayUpdateSeq;
-	llong  m_rowNum;
+	// modified in writer lock, read by lock free readers
+	std::atomic<size_t> m_segArrayUpdateSeq;
+	std::atomic<llong>  m_rowNum;
 	llong  m_oldestSnapshotVersion;
 	bool m_tobeDrop;
 	bool m_isMerging;
+	// writing segment is full but can not be rotated while merging,
+	// the merge is not throttled by BgRateLimiter then
+	std::atomic<bool> m_rotationBlocked;
 	PurgeStatus m_purgeStatus;
+	std::atomic<bool>  m_expireTTLInQueue;
+	std::atomic<llong> m_nextExpireTTLTime;
+	void maybeAsyncExpireTTL();
 
 	// constant once constructed
 	boost::filesystem::path m_dir;
@@ -445,6 +764,14 @@ DbContext::selectOneColgroup(llong id, size_t cgId, valvec<byte>* cgData) {
 	m_tab->selectOneColgroup(id, cgId, cgData, this);
 }
 inline void
+DbContext::getValuesBatch(const llong* ids, size_t num, valvec<byte>* vals, valvec<size_t>* offsets) {
+	m_tab->getValuesBatch(ids, num, vals, offsets, this);
+}
+inline void
+DbContext::selectColumnsBatch(const llong* ids, size_t num, const size_t* colsId, size_t colsNum, valvec<byte>* colsData, valvec<size_t>* offsets) {
+	m_tab->selectColumnsBatch(ids, num, colsId, colsNum, colsData, offsets, this);
+}
+inline void
 DbContext::selectColumnsNoLock(llong id, const valvec<size_t>& cols, valvec<byte>* colsData) {
 	m_tab->selectColumnsNoLock(id, cols, colsData, this);
 }
@@ -496,23 +823,26 @@ void DbContext::trySyncSegCtxNoLock(const DbTable* tab) {
 	}
 }
 
+// does not lock tab->m_rwMutex, so readers are not blocked by writers
 inline
 void DbContext::trySyncSegCtxSpeculativeLock(const DbTable* tab) {
 	if (this->segArrayUpdateSeq != tab->m_segArrayUpdateSeq) {
 		assert(this->segArrayUpdateSeq < tab->m_segArrayUpdateSeq);
-		MyRwLock lock(tab->m_rwMutex, false);
-		this->doSyncSegCtxNoLock(tab);
-		assert(m_segCtx.size() == tab->m_segments.size());
-		assert(m_rowNumVec.size() == tab->m_segments.size()+1);
-		assert(m_rowNumVec.size() == tab->m_rowNumVec.size());
-	}
-	else {
-		llong rowNum = tab->m_rowNum;
-		if (!m_isUserDefineSnapshot) {
-			m_mySnapshotVersion = rowNum - 1;
+		// tab->m_segArrayUpdateSeq is increased before the new version is
+		// published, so ver may be the version we have already synced
+		SegArrayVersionPtr ver = tab->getSegArrayVersion();
+		if (this->segArrayUpdateSeq != ver->m_updateSeq) {
+			this->doSyncSegCtx(*ver);
 		}
-		m_rowNumVec.back() = rowNum;
+		if (this->segArrayUpdateSeq != tab->m_segArrayUpdateSeq) {
+			return; // keep rowNum of ver, it matches segments of ver
+		}
+	}
+	llong rowNum = tab->m_rowNum;
+	if (!m_isUserDefineSnapshot) {
+		m_mySnapshotVersion = rowNum - 1;
 	}
+	m_rowNumVec.back() = rowNum;
 }
 
 } } // namespace terark::db
@@ -283,6 +283,7 @@ public:
 		m_iter.reset(owner->m_dfa->adfa_make_iter());
 		m_hasNext = m_iter->seek_begin();
 		m_owner = owner;
+		m_appliesEndBound = true;
 	}
 
 	void reset() override {
@@ -291,6 +292,9 @@ public:
 
 	bool increment(llong* id, valvec<byte>* key) override {
 		assert(nullptr != key);
+		if (m_hasNext && isPastEndBound(m_iter->word(), true)) {
+			m_hasNext = false;
+		}
 		if (m_hasNext) {
 			size_t state = m_iter->word_state();
 			size_t dawgIdx = m_owner->m_dfa->state_to_word_id(state);
@@ -304,7 +308,8 @@ public:
 
 	int seekLowerBound(fstring key, llong* id, valvec<byte>* retKey) override {
 		assert(nullptr != retKey);
-		if (m_iter->seek_lower_bound(key)) {
+		if (m_iter->seek_lower_bound(key) &&
+				!isPastEndBound(m_iter->word(), true)) {
 			size_t state = m_iter->word_state();
 			size_t dawgIdx = m_owner->m_dfa->state_to_word_id(state);
 			*id = m_owner->m_keyToId.get(dawgIdx);
@@ -340,6 +345,7 @@ public:
 		m_iter.reset(owner->m_dfa->adfa_make_iter());
 		m_hasNext = m_iter->seek_end();
 		m_owner = owner;
+		m_appliesEndBound = true;
 	}
 
 	void reset() override {
@@ -348,6 +354,9 @@ public:
 
 	bool increment(llong* id, valvec<byte>* key) override {
 		assert(nullptr != key);
+		if (m_hasNext && isPastEndBound(m_iter->word(), false)) {
+			m_hasNext = false;
+		}
 		if (m_hasNext) {
 			size_t state = m_iter->word_state();
 			size_t dawgIdx = m_owner->m_dfa->state_to_word_id(state);
@@ -362,7 +371,7 @@ public:
 	int seekLowerBound(fstring key, llong* id, valvec<byte>* retKey) override {
 		assert(nullptr != retKey);
 		if (m_iter->seek_lower_bound(key)) {
-			if (m_iter->word() == key) {
+			if (m_iter->word() == key && !isPastEndBound(key, false)) {
 				size_t state = m_iter->word_state();
 				size_t dawgIdx = m_owner->m_dfa->state_to_word_id(state);
 				*id = m_owner->m_keyToId.get(dawgIdx);
@@ -416,6 +425,7 @@ public:
 	DupableIndexIterForward(const NestLoudsTrieIndex* owner) {
 		m_iter.reset(owner->m_dfa->adfa_make_iter());
 		m_owner = owner;
+		m_appliesEndBound = true;
 		this->reset();
 	}
 
@@ -427,6 +437,9 @@ public:
 
 	bool increment(llong* id, valvec<byte>* key) override {
 		assert(nullptr != key);
+		if (m_hasNext && isPastEndBound(m_iter->word(), true)) {
+			m_hasNext = false;
+		}
 		if (m_hasNext) {
 			assert(m_bitPosCur < m_bitPosUpp);
 			*id = m_owner->m_keyToId.get(m_bitPosCur++);
@@ -440,7 +453,8 @@ public:
 
 	int seekLowerBound(fstring key, llong* id, valvec<byte>* retKey) override {
 		assert(nullptr != retKey);
-		if (m_iter->seek_lower_bound(key)) {
+		if (m_iter->seek_lower_bound(key) &&
+				!isPastEndBound(m_iter->word(), true)) {
 			syncBitPos(true);
 			*id = m_owner->m_keyToId.get(m_bitPosCur++);
 			retKey->assign(m_iter->word());
@@ -469,6 +483,8 @@ public:
 				if (!hasNext)
 					goto NotFoundUpperBound;
 			}
+			if (isPastEndBound(m_iter->word(), true))
+				goto NotFoundUpperBound;
 			syncBitPos(true);
 			*id = m_owner->m_keyToId.get(m_bitPosCur++);
 			retKey->assign(m_iter->word());
@@ -518,6 +534,7 @@ public:
 	DupableIndexIterBackward(const NestLoudsTrieIndex* owner) {
 		m_iter.reset(owner->m_dfa->adfa_make_iter());
 		m_owner = owner;
+		m_appliesEndBound = true;
 		this->reset();
 	}
 
@@ -529,6 +546,9 @@ public:
 
 	bool increment(llong* id, valvec<byte>* key) override {
 		assert(nullptr != key);
+		if (m_hasNext && isPastEndBound(m_iter->word(), false)) {
+			m_hasNext = false;
+		}
 		if (m_hasNext) {
 			assert(m_bitPosCur > m_bitPosLow);
 			*id = m_owner->m_keyToId.get(--m_bitPosCur);
@@ -544,7 +564,7 @@ public:
 		assert(nullptr != retKey);
 		bool hasForwardLowerBound = m_iter->seek_lower_bound(key);
 		if (hasForwardLowerBound) {
-			if (m_iter->word() == key) {
+			if (m_iter->word() == key && !isPastEndBound(key, false)) {
 				syncBitPos(true);
 				*id = m_owner->m_keyToId.get(--m_bitPosCur);
 				retKey->assign(key);
@@ -563,7 +583,7 @@ public:
 	int seekUpperBound(fstring key, llong* id, valvec<byte>* retKey) override {
 		assert(nullptr != retKey);
 		if (m_iter->seek_lower_bound(key)) {
-			if (!m_iter->decr()) {
+			if (!m_iter->decr() || isPastEndBound(m_iter->word(), false)) {
 				m_hasNext = false;
 				m_bitPosCur = size_t(-1);
 				m_bitPosLow = size_t(-1);
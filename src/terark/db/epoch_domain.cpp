@@ -0,0 +1,58 @@
+#include "epoch_domain.hpp"
+#include <thread>
+
+namespace terark { namespace db {
+
+static const size_t EpochDomain_slotNum = 64; // must be power of 2
+
+struct EpochDomain::Slot {
+	std::atomic<size_t> cnt[2]; // active readers of even/odd epoch
+	char padding[64 - 2 * sizeof(std::atomic<size_t>)];
+};
+
+static size_t EpochDomain_mySlot() {
+	static std::atomic<size_t> s_threadSeq(0);
+	static thread_local size_t t_slot = s_threadSeq++;
+	return t_slot & (EpochDomain_slotNum - 1);
+}
+
+EpochDomain::EpochDomain() : m_epoch(0) {
+	m_slots.reset(new Slot[EpochDomain_slotNum]);
+	for (size_t i = 0; i < EpochDomain_slotNum; ++i) {
+		m_slots[i].cnt[0] = 0;
+		m_slots[i].cnt[1] = 0;
+	}
+}
+
+EpochDomain::~EpochDomain() {
+}
+
+size_t EpochDomain::enter() {
+	size_t slot = EpochDomain_mySlot();
+	size_t parity = m_epoch.load() & 1;
+	m_slots[slot].cnt[parity]++;
+	return slot * 2 + parity;
+}
+
+void EpochDomain::leave(size_t ticket) {
+	m_slots[ticket / 2].cnt[ticket % 2]--;
+}
+
+// Flip the epoch twice and wait readers of the old parity drained at each
+// flip. A reader which read the epoch before a flip may increase the
+// counter of the old parity after the writer has seen it 0, but such a
+// reader loads the shared pointer after the writer has replaced it, so it
+// is enough to wait for the readers which are counted on both parities.
+void EpochDomain::synchronize() {
+	std::lock_guard<std::mutex> lock(m_syncMutex);
+	for (int flip = 0; flip < 2; ++flip) {
+		size_t parity = m_epoch.fetch_add(1) & 1;
+		for (size_t i = 0; i < EpochDomain_slotNum; ++i) {
+			while (m_slots[i].cnt[parity].load() != 0) {
+				std::this_thread::yield();
+			}
+		}
+	}
+}
+
+} } // namespace terark::db
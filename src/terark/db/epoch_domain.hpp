@@ -0,0 +1,47 @@
+#ifndef __terark_db_epoch_domain_hpp__
+#define __terark_db_epoch_domain_hpp__
+
+#include "db_dll_decl.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace terark { namespace db {
+
+// Minimal epoch based reclamation for objects which are read lock free.
+//
+// A reader brackets its access to a shared pointer by enter()/leave(), it
+// must not block in between. A writer first makes the old object
+// unreachable (such as by atomic exchange), then synchronize() waits for
+// all readers which entered before that, after which the old object can
+// be freed.
+//
+// Reader counters are sharded into cache line padded slots by thread, so
+// readers of different threads do not contend on one cache line.
+class TERARK_DB_DLL EpochDomain {
+public:
+	EpochDomain();
+	~EpochDomain();
+
+	size_t enter(); // return a ticket for leave
+	void   leave(size_t ticket);
+	void   synchronize();
+
+	class Guard {
+		EpochDomain& m_domain;
+		size_t       m_ticket;
+	public:
+		explicit Guard(EpochDomain& d) : m_domain(d), m_ticket(d.enter()) {}
+		~Guard() { m_domain.leave(m_ticket); }
+	};
+
+private:
+	struct Slot;
+	std::unique_ptr<Slot[]> m_slots;
+	std::atomic<size_t>     m_epoch;
+	std::mutex              m_syncMutex; // serialize synchronize()
+};
+
+} } // namespace terark::db
+
+#endif // __terark_db_epoch_domain_hpp__
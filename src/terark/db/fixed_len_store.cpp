@@ -1,4 +1,5 @@
 #include "fixed_len_store.hpp"
+#include "pread_pool.hpp"
 #include <terark/io/FileStream.hpp>
 #include <terark/io/DataIO.hpp>
 #include <terark/util/mmap.hpp>
@@ -13,10 +14,17 @@
 	#include <unistd.h>
 #endif
 #include <fcntl.h>
+#include <errno.h>
+#include <string.h>
 
 namespace terark { namespace db {
 
-TERARK_DB_REGISTER_STORE("fixlen", FixedLenStore);
+static ReadableStore::RegisterStoreFactory
+regStore_FixedLenStore("fixlen", [](const Schema& schema) -> ReadableStore* {
+	if (schema.m_usePread)
+		return new PreadFixedLenStore(schema);
+	return new FixedLenStore(schema);
+});
 
 struct FixedLenStore::Header {
 	uint64_t rows;
@@ -72,6 +80,21 @@ void FixedLenStore::getValueAppend(llong id, valvec<byte>* val, DbContext*) cons
 	val->append(dataPtr, m_mmapBase->fixlen);
 }
 
+void FixedLenStore::adviseWillNeed(llong beg, llong end) const {
+	if (NULL == m_mmapBase)
+		return;
+	end = std::min(end, llong(m_mmapBase->rows));
+	if (beg < end) {
+		adviseWillNeedMem(m_mmapBase->get_data(beg), size_t(end - beg) * m_mmapBase->fixlen);
+	}
+}
+
+void FixedLenStore::prefetchRecord(llong id) const {
+	if (NULL != m_mmapBase && id < llong(m_mmapBase->rows)) {
+		prefetchMem(m_mmapBase->get_data(id));
+	}
+}
+
 StoreIterator* FixedLenStore::createStoreIterForward(DbContext*) const {
 	return nullptr; // not needed
 }
@@ -237,5 +260,119 @@ void FixedLenStore::deleteFiles() {
 	boost::filesystem::remove(m_fpath);
 }
 
+///////////////////////////////////////////////////////////////////////////
+
+PreadFixedLenStore::PreadFixedLenStore(const Schema& schema) : m_schema(schema) {
+	m_fd = -1;
+	m_fileId = 0;
+	m_rows = 0;
+	m_fixlen = schema.getFixedRowLen();
+}
+
+PreadFixedLenStore::~PreadFixedLenStore() {
+	closeFile();
+}
+
+void PreadFixedLenStore::closeFile() {
+	if (m_fd >= 0) {
+#if defined(_MSC_VER)
+		::_close(int(m_fd));
+#else
+		::close(int(m_fd));
+#endif
+		m_fd = -1;
+	}
+}
+
+llong PreadFixedLenStore::dataInflateSize() const {
+	return m_fixlen * m_rows;
+}
+
+llong PreadFixedLenStore::dataStorageSize() const {
+	return m_fixlen * m_rows;
+}
+
+llong PreadFixedLenStore::numDataRows() const {
+	return m_rows;
+}
+
+void PreadFixedLenStore::getValueAppend(llong id, valvec<byte>* val, DbContext*) const {
+	assert(id >= 0);
+	assert(id < m_rows);
+	size_t oldsize = val->size();
+	val->resize_no_init(oldsize + m_fixlen);
+	PreadPool::instance().read(m_fileId, m_fd
+		, sizeof(FixedLenStore::Header) + m_fixlen * id
+		, m_fixlen, val->data() + oldsize);
+}
+
+void PreadFixedLenStore::adviseWillNeed(llong beg, llong end) const {
+	end = std::min(end, m_rows);
+	if (m_fd >= 0 && beg < end) {
+		PreadPool::instance().prefetch(m_fileId, m_fd
+			, sizeof(FixedLenStore::Header) + m_fixlen * beg
+			, m_fixlen * size_t(end - beg));
+	}
+}
+
+void PreadFixedLenStore::prefetchRecord(llong id) const {
+	if (m_fd >= 0 && id < m_rows) {
+		PreadPool::instance().prefetch(m_fileId, m_fd
+			, sizeof(FixedLenStore::Header) + m_fixlen * id, m_fixlen);
+	}
+}
+
+StoreIterator* PreadFixedLenStore::createStoreIterForward(DbContext*) const {
+	return nullptr; // not needed
+}
+
+StoreIterator* PreadFixedLenStore::createStoreIterBackward(DbContext*) const {
+	return nullptr; // not needed
+}
+
+void PreadFixedLenStore::load(PathRef fpath) {
+	assert(fstring(fpath.string()).endsWith(".fixlen"));
+	assert(m_fd < 0);
+	m_fpath = fpath.string();
+#if defined(_MSC_VER)
+	m_fd = ::_open(m_fpath.c_str(), _O_RDONLY | _O_BINARY);
+#else
+	m_fd = ::open(m_fpath.c_str(), O_RDONLY);
+#endif
+	if (m_fd < 0) {
+		THROW_STD(runtime_error, "open(%s, O_RDONLY) = %s"
+			, m_fpath.c_str(), strerror(errno));
+	}
+	FixedLenStore::Header h;
+	if (PreadPool::preadFull(m_fd, 0, &h, sizeof(h)) != sizeof(h)) {
+		closeFile();
+		THROW_STD(invalid_argument, "bad fixlen file: %s", m_fpath.c_str());
+	}
+	if (h.fixlen != m_fixlen) {
+		closeFile();
+		THROW_STD(invalid_argument, "fixlen = %u, schema fixlen = %zd: %s"
+			, h.fixlen, m_fixlen, m_fpath.c_str());
+	}
+	m_rows = llong(h.rows);
+	m_fileId = PreadPool::newFileId();
+}
+
+void PreadFixedLenStore::save(PathRef path) const {
+	auto fpath = path + ".fixlen";
+	if (fpath == m_fpath) {
+		return;
+	}
+	boost::filesystem::copy_file(m_fpath, fpath,
+		boost::filesystem::copy_option::overwrite_if_exists);
+}
+
+// pages of m_fileId in PreadPool are never hit again, they are evicted
+// as cold pages
+void PreadFixedLenStore::deleteFiles() {
+	closeFile();
+	m_rows = 0;
+	boost::filesystem::remove(m_fpath);
+}
+
 
 }} // namespace terark::db
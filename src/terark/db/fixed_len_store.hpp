@@ -22,6 +22,8 @@ public:
 
 	StoreIterator* createStoreIterForward(DbContext*) const override;
 	StoreIterator* createStoreIterBackward(DbContext*) const override;
+	void adviseWillNeed(llong beg, llong end) const override;
+	void prefetchRecord(llong id) const override;
 
 	void build(SortableStrVec& strVec);
 	void load(PathRef path) override;
@@ -46,6 +48,7 @@ public:
 	void deleteFiles() override;
 
 protected:
+	friend class PreadFixedLenStore;
 	struct  Header;
 	Header* allocFileSize(ullong size);
 	Header* m_mmapBase;
@@ -58,4 +61,37 @@ protected:
 };
 typedef boost::intrusive_ptr<class FixedLenStore> FixedLenStorePtr;
 
+// Readonly fixlen store which is read by pread through PreadPool instead of
+// mmap, for colgroups with "usePread", the data may be larger than RAM and
+// the cached pages are evicted by PreadPool instead of by the OS.
+// getRecordsBasePtr() is NULL, thus it can not be inplaceUpdatable.
+class TERARK_DB_DLL PreadFixedLenStore : public ReadableStore {
+public:
+	explicit PreadFixedLenStore(const Schema& schema);
+	~PreadFixedLenStore();
+
+	llong dataStorageSize() const override;
+	llong dataInflateSize() const override;
+	llong numDataRows() const override;
+	void getValueAppend(llong id, valvec<byte>* val, DbContext*) const override;
+
+	StoreIterator* createStoreIterForward(DbContext*) const override;
+	StoreIterator* createStoreIterBackward(DbContext*) const override;
+	void adviseWillNeed(llong beg, llong end) const override;
+	void prefetchRecord(llong id) const override;
+
+	void load(PathRef path) override;
+	void save(PathRef path) const override;
+	void deleteFiles() override;
+
+protected:
+	void closeFile();
+	intptr_t m_fd;
+	llong    m_fileId; // of PreadPool
+	llong    m_rows;
+	size_t   m_fixlen;
+	std::string m_fpath;
+	const Schema& m_schema;
+};
+
 }} // namespace terark::db
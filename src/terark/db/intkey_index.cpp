@@ -399,20 +399,35 @@ void ZipIntKeyIndex::save(PathRef path) const {
 class ZipIntKeyIndex::MyIndexIterForward : public IndexIterator {
 public:
 	size_t m_keyIdx;
+	size_t m_endKeyIdx; // end bound as key index, keys are not decoded
 	const ZipIntKeyIndex* m_owner;
 
 	MyIndexIterForward(const ZipIntKeyIndex* owner) {
 		m_keyIdx = 0;
+		m_endKeyIdx = owner->m_index.size();
 		m_owner = owner;
+		m_appliesEndBound = true;
 	}
 
 	void reset() override {
 		m_keyIdx = 0;
 	}
 
+	void setEndBound(fstring bound, bool inclusive, const Schema& schema)
+	override {
+		IndexIterator::setEndBound(bound, inclusive, schema);
+		m_endKeyIdx = inclusive ? m_owner->searchUpperBound(bound)
+								: m_owner->searchLowerBound(bound);
+	}
+
+	void clearEndBound() override {
+		IndexIterator::clearEndBound();
+		m_endKeyIdx = m_owner->m_index.size();
+	}
+
 	bool increment(llong* id, valvec<byte>* key) override {
 		assert(nullptr != key);
-		if (m_keyIdx < m_owner->m_index.size()) {
+		if (m_keyIdx < m_endKeyIdx) {
 			*id = m_owner->m_index.get(m_keyIdx++);
 			key->erase_all();
 			m_owner->getValueAppend(*id, key, nullptr);
@@ -424,7 +439,7 @@ public:
 	int seekLowerBound(fstring key, llong* id, valvec<byte>* retKey) override {
 		assert(nullptr != retKey);
 		m_keyIdx = key.empty() ? 0 : m_owner->searchLowerBound(key);
-		if (m_keyIdx < m_owner->m_index.size()) {
+		if (m_keyIdx < m_endKeyIdx) {
 			*id = m_owner->m_index[m_keyIdx];
 			retKey->erase_all();
 			m_owner->getValueAppend(*id, retKey, nullptr);
@@ -437,7 +452,7 @@ public:
 	int seekUpperBound(fstring key, llong* id, valvec<byte>* retKey) override {
 		assert(nullptr != retKey);
 		m_keyIdx = key.empty() ? 0 : m_owner->searchUpperBound(key);
-		if (m_keyIdx < m_owner->m_index.size()) {
+		if (m_keyIdx < m_endKeyIdx) {
 			*id = m_owner->m_index[m_keyIdx];
 			retKey->erase_all();
 			m_owner->getValueAppend(*id, retKey, nullptr);
@@ -451,19 +466,34 @@ public:
 class ZipIntKeyIndex::MyIndexIterBackward : public IndexIterator {
 public:
 	size_t m_keyIdx;
+	size_t m_endKeyIdx; // end bound as key index, keys are not decoded
 	const ZipIntKeyIndex* m_owner;
 
 	MyIndexIterBackward(const ZipIntKeyIndex* owner) {
 		m_keyIdx = owner->m_index.size();
+		m_endKeyIdx = 0;
 		m_owner = owner;
+		m_appliesEndBound = true;
 	}
 
 	void reset() override {
 		m_keyIdx = m_owner->m_index.size();
 	}
 
+	void setEndBound(fstring bound, bool inclusive, const Schema& schema)
+	override {
+		IndexIterator::setEndBound(bound, inclusive, schema);
+		m_endKeyIdx = inclusive ? m_owner->searchLowerBound(bound)
+								: m_owner->searchUpperBound(bound);
+	}
+
+	void clearEndBound() override {
+		IndexIterator::clearEndBound();
+		m_endKeyIdx = 0;
+	}
+
 	bool increment(llong* id, valvec<byte>* key) override {
-		if (m_keyIdx > 0) {
+		if (m_keyIdx > m_endKeyIdx) {
 			*id = m_owner->m_index.get(--m_keyIdx);
 			if (key) {
 				key->erase_all();
@@ -480,7 +510,7 @@ public:
 		} else {
 			m_keyIdx = m_owner->searchUpperBound(key);
 		}
-		if (m_keyIdx > 0) {
+		if (m_keyIdx > m_endKeyIdx) {
 			*id = m_owner->m_index[--m_keyIdx];
 			retKey->erase_all();
 			m_owner->getValueAppend(*id, retKey, nullptr);
@@ -495,7 +525,7 @@ public:
 		} else {
 			m_keyIdx = m_owner->searchLowerBound(key);
 		}
-		if (m_keyIdx > 0) {
+		if (m_keyIdx > m_endKeyIdx) {
 			*id = m_owner->m_index[--m_keyIdx];
 			retKey->erase_all();
 			m_owner->getValueAppend(*id, retKey, nullptr);
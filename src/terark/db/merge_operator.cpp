@@ -0,0 +1,181 @@
+#include "merge_operator.hpp"
+#include <terark/util/throw.hpp>
+#include <boost/filesystem.hpp>
+#include <string.h>
+
+namespace terark { namespace db {
+
+namespace fs = boost::filesystem;
+
+static const byte MergeLog_operand = 'M';
+static const byte MergeLog_discard = 'D';
+
+MergeOperator::~MergeOperator() {
+}
+
+const char MergeOperandLog::FileName[] = "merge-operands.log";
+
+MergeOperandLog::MergeOperandLog(PathRef fpath) : m_fpath(fpath.string()) {
+	m_keyNum = 0;
+	m_memSize = 0;
+	load();
+	m_fp.open(m_fpath, "ab");
+}
+
+MergeOperandLog::~MergeOperandLog() {
+}
+
+static void appendLenData(valvec<byte>* buf, fstring data) {
+	uint32_t len = uint32_t(data.size());
+	buf->append((const byte*)&len, 4);
+	buf->append((const byte*)data.data(), data.size());
+}
+
+void MergeOperandLog::writeRecord(byte type, fstring key, fstring operand) {
+	valvec<byte> rec(1 + 8 + key.size() + operand.size(), valvec_reserve());
+	rec.push_back(type);
+	appendLenData(&rec, key);
+	if (MergeLog_operand == type) {
+		appendLenData(&rec, operand);
+	}
+	m_fp.ensureWrite(rec.data(), rec.size());
+}
+
+bool MergeOperandLog::append(fstring key, fstring operand) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	writeRecord(MergeLog_operand, key, operand);
+	auto ib = m_operands.insert_i(key);
+	appendLenData(&m_operands.val(ib.first), operand);
+	m_memSize += 4 + operand.size();
+	if (ib.second) {
+		m_memSize += key.size();
+		m_keyNum++;
+	}
+	return ib.second;
+}
+
+bool MergeOperandLog::get(fstring key, valvec<byte>* operands) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t idx = m_operands.find_i(key);
+	if (m_operands.end_i() == idx) {
+		return false;
+	}
+	operands->append(m_operands.val(idx));
+	return true;
+}
+
+bool MergeOperandLog::contains(fstring key) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_operands.find_i(key) != m_operands.end_i();
+}
+
+bool MergeOperandLog::discard(fstring key) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t idx = m_operands.find_i(key);
+	if (m_operands.end_i() == idx) {
+		return false;
+	}
+	writeRecord(MergeLog_discard, key, fstring());
+	m_memSize -= key.size() + m_operands.val(idx).size();
+	m_operands.erase_i(idx);
+	m_keyNum--;
+	return true;
+}
+
+void MergeOperandLog::getKeys(std::vector<std::string>* keys) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	keys->clear();
+	keys->reserve(m_operands.size());
+	for (size_t i = m_operands.beg_i(); i < m_operands.end_i(); i = m_operands.next_i(i)) {
+		keys->push_back(m_operands.key(i).str());
+	}
+}
+
+void MergeOperandLog::flush() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_fp.flush();
+}
+
+// the copy may have a torn tail record if operands are being appended
+void MergeOperandLog::saveCopy(PathRef fpath) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_fp.flush();
+	fs::copy_file(m_fpath, fpath, fs::copy_option::overwrite_if_exists);
+}
+
+llong MergeOperandLog::fileSize() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_fp.flush();
+	return llong(fs::file_size(m_fpath));
+}
+
+// a truncated tail record is the result of a crash while appending,
+// it is ignored
+void MergeOperandLog::load() {
+	if (!fs::exists(m_fpath)) {
+		return;
+	}
+	valvec<byte> buf(size_t(fs::file_size(m_fpath)), valvec_no_init());
+	if (!buf.empty()) {
+		FileStream fp(m_fpath, "rb");
+		fp.ensureRead(buf.data(), buf.size());
+	}
+	size_t pos = 0, goodPos = 0, recNum = 0;
+	auto readLenData = [&](fstring* data) {
+		if (pos + 4 > buf.size()) return false;
+		uint32_t len;
+		memcpy(&len, buf.data() + pos, 4);
+		if (pos + 4 + len > buf.size()) return false;
+		*data = fstring(buf.data() + pos + 4, len);
+		pos += 4 + len;
+		return true;
+	};
+	while (pos < buf.size()) {
+		byte type = buf[pos++];
+		fstring key, operand;
+		if (!readLenData(&key)) {
+			break;
+		}
+		if (MergeLog_operand == type) {
+			if (!readLenData(&operand)) {
+				break;
+			}
+			appendLenData(&m_operands[key], operand);
+		}
+		else if (MergeLog_discard == type) {
+			m_operands.erase(key);
+		}
+		else {
+			THROW_STD(invalid_argument
+				, "bad record type = %d at offset %zd of %s"
+				, type, pos - 1, m_fpath.c_str());
+		}
+		recNum++;
+		goodPos = pos;
+	}
+	if (goodPos < buf.size()) {
+		fprintf(stderr
+			, "WARN: MergeOperandLog: truncated tail record at %zd of %s, ignored\n"
+			, goodPos, m_fpath.c_str());
+		fs::resize_file(m_fpath, goodPos);
+	}
+	m_keyNum = m_operands.size();
+	for (size_t i = m_operands.beg_i(); i < m_operands.end_i(); i = m_operands.next_i(i)) {
+		m_memSize += m_operands.key(i).size() + m_operands.val(i).size();
+	}
+	fprintf(stderr
+		, "INFO: MergeOperandLog: loaded %zd records, %zd keys: %s\n"
+		, recNum, m_operands.size(), m_fpath.c_str());
+}
+
+void MergeOperandLog::decode(const valvec<byte>& operands, valvec<fstring>* vec) {
+	vec->erase_all();
+	for (size_t pos = 0; pos < operands.size(); ) {
+		uint32_t len;
+		memcpy(&len, operands.data() + pos, 4);
+		vec->push_back(fstring(operands.data() + pos + 4, len));
+		pos += 4 + len;
+	}
+}
+
+} } // namespace terark::db
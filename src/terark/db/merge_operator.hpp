@@ -0,0 +1,79 @@
+#ifndef __terark_db_merge_operator_hpp__
+#define __terark_db_merge_operator_hpp__
+
+#include "db_store.hpp"
+#include <terark/hash_strmap.hpp>
+#include <terark/io/FileStream.hpp>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace terark { namespace db {
+
+// Deferred read-modify-write of a table with one unique index, such as
+// counters and append only lists. DbTable::mergeRow just appends the
+// operand to the MergeOperandLog of the writing segment, the key is not
+// searched in any segment. Pending operands are applied by fullMerge on
+// read and are collapsed into regular rows by converting the segment.
+class TERARK_DB_DLL MergeOperator : public RefCounter {
+public:
+	virtual ~MergeOperator();
+	// existingRow is NULL if the key does not exist, operands are in the
+	// order of mergeRow, newRow must be a full row whose unique key is key
+	virtual void fullMerge(fstring key, const valvec<byte>* existingRow,
+						   const valvec<fstring>& operands,
+						   valvec<byte>* newRow) const = 0;
+	virtual const char* name() const = 0;
+};
+typedef boost::intrusive_ptr<MergeOperator> MergeOperatorPtr;
+
+// Pending merge operands of a writable segment, keyed by unique index key.
+//
+// Operands are kept in memory and appended to the log file in the segment
+// dir, which is replayed on open. The log lives and dies with its segment,
+// its memory is counted in the size of the writing segment, so it is
+// bounded by MaxWritingSegmentSize, and it is emptied by collapsing the
+// operands before the segment is converted to a readonly segment.
+class TERARK_DB_DLL MergeOperandLog {
+public:
+	static const char FileName[]; // in the segment dir
+
+	explicit MergeOperandLog(PathRef fpath);
+	~MergeOperandLog();
+
+	bool   empty() const { return 0 == m_keyNum; }
+	size_t keyNum() const { return m_keyNum; }
+	size_t memSize() const { return m_memSize; }
+
+	// returns true if key had no operands
+	bool append(fstring key, fstring operand);
+	// operands are appended to *operands
+	bool get(fstring key, valvec<byte>* operands) const;
+	bool contains(fstring key) const;
+	bool discard(fstring key);
+	void getKeys(std::vector<std::string>* keys) const;
+
+	void flush();
+	void saveCopy(PathRef fpath) const;
+	// flushed size of the log file, records are only appended to it
+	llong fileSize() const;
+
+	// operands returned by get are encoded, this splits them
+	static void decode(const valvec<byte>& operands, valvec<fstring>* vec);
+
+private:
+	void load();
+	void writeRecord(byte type, fstring key, fstring operand);
+
+	mutable std::mutex   m_mutex;
+	hash_strmap<valvec<byte> > m_operands;
+	std::atomic<size_t>  m_keyNum;
+	std::atomic<size_t>  m_memSize;
+	std::string          m_fpath;
+	mutable FileStream   m_fp;
+};
+
+} } // namespace terark::db
+
+#endif // __terark_db_merge_operator_hpp__
@@ -0,0 +1,241 @@
+#include "merge_policy.hpp"
+#include "json.hpp"
+#include <terark/hash_strmap.hpp>
+#include <terark/util/throw.hpp>
+#include <time.h>
+
+namespace terark { namespace db {
+
+// msvc std::function is not memmovable, use SafeCopy
+typedef hash_strmap < MergePolicy::Factory
+					, fstring_func::hash_align
+					, fstring_func::equal_align
+					, ValueInline, SafeCopy
+					>
+MergePolicyFactoryMap;
+static MergePolicyFactoryMap& s_getPolicyFactory() {
+	static MergePolicyFactoryMap instance;
+	return instance;
+}
+
+MergePolicy::RegisterPolicy::RegisterPolicy(fstring type, const Factory& f) {
+	auto ib = s_getPolicyFactory().insert_i(type, f);
+	assert(ib.second);
+	if (!ib.second) {
+		THROW_STD(invalid_argument, "duplicate MergePolicy: %.*s",
+			type.ilen(), type.data());
+	}
+}
+
+MergePolicy* MergePolicy::create(fstring type, const std::string& jsonConf) {
+	auto& factoryMap = s_getPolicyFactory();
+	size_t idx = factoryMap.find_i(type);
+	if (idx >= factoryMap.end_i()) {
+		THROW_STD(invalid_argument, "MergePolicy = '%.*s' is not registered",
+			type.ilen(), type.data());
+	}
+	MergePolicy* policy = factoryMap.val(idx)(jsonConf);
+	assert(policy);
+	return policy;
+}
+
+static terark::json parseConf(const std::string& jsonConf) {
+	if (jsonConf.empty())
+		return terark::json::object();
+	return terark::json::parse(jsonConf);
+}
+
+template<class Value>
+static Value getParam(const terark::json& js, const char* key, const Value& Default) {
+	auto iter = js.find(key);
+	if (js.end() != iter)
+		return static_cast<Value>(iter.value());
+	return Default;
+}
+
+MergePolicy::MergePolicy(const std::string& jsonConf)
+  : m_convBytes(0), m_mergeBytes(0), m_purgeBytes(0), m_mergeCnt(0)
+  , m_segNum(0)
+{
+	auto js = parseConf(jsonConf);
+	m_targetSegNum = getParam(js, "targetSegNum", size_t(0));
+}
+
+MergePolicy::~MergePolicy() {
+}
+
+bool MergePolicy::pickSegments(const valvec<SegInfo>& segs, bool forced,
+							   size_t minSegNum, Pick* pk) {
+	m_segNum = segs.size();
+	if (segs.empty()) {
+		return false;
+	}
+	if (m_targetSegNum && segs.size() > m_targetSegNum) {
+		minSegNum = std::min<size_t>(minSegNum, 2);
+	}
+	pk->beg = 0;
+	pk->len = 0;
+	pk->purge = false;
+	if (!pick(segs, forced, minSegNum, pk)) {
+		return false;
+	}
+	assert(pk->beg + pk->len <= segs.size());
+	return pk->len >= std::max<size_t>(minSegNum, 1);
+}
+
+// the first longest run of segments which satisfy pred
+bool MergePolicy::longestRun(const valvec<SegInfo>& segs, size_t minSegNum,
+							 Pick* pk, const std::function<bool(size_t)>& pred) {
+	size_t rngBeg = 0, rngLen = 0;
+	for (size_t j = 0; j < segs.size(); ) {
+		size_t k = j;
+		while (k < segs.size() && pred(k))
+			++k;
+		if (k - j > rngLen) {
+			rngBeg = j;
+			rngLen = k - j;
+		}
+		j = k + 1;
+	}
+	pk->beg = rngBeg;
+	pk->len = rngLen;
+	return rngLen >= minSegNum;
+}
+
+void MergePolicy::getStat(Stat* st) const {
+	st->convBytes = m_convBytes;
+	st->mergeBytes = m_mergeBytes;
+	st->purgeBytes = m_purgeBytes;
+	st->mergeCnt = m_mergeCnt;
+	st->writeAmp = 0;
+	if (st->convBytes) {
+		st->writeAmp = double(st->convBytes + st->mergeBytes + st->purgeBytes)
+					 / st->convBytes;
+	}
+	st->segNum = m_segNum;
+	st->targetSegNum = m_targetSegNum;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+class TieredMergePolicy : public MergePolicy {
+	double m_ratio;
+	double m_forceRatio;
+public:
+	explicit TieredMergePolicy(const std::string& jsonConf)
+	  : MergePolicy(jsonConf) {
+		auto js = parseConf(jsonConf);
+		m_ratio = getParam(js, "ratio", 1.75);
+		m_forceRatio = getParam(js, "forceRatio", 3.0);
+	}
+	const char* name() const override { return "tiered"; }
+	bool pick(const valvec<SegInfo>& segs, bool forced,
+			  size_t minSegNum, Pick* pk) override {
+		llong sumSegRows = 0;
+		for (auto& s : segs)
+			sumSegRows += s.rows;
+		llong avgSegRows = sumSegRows / segs.size();
+		llong maxSegRows = llong(avgSegRows * (forced ? m_forceRatio : m_ratio));
+		return longestRun(segs, minSegNum, pk,
+			[&](size_t i) { return segs[i].rows <= maxSegRows; });
+	}
+};
+TERARK_DB_REGISTER_MERGE_POLICY("tiered", TieredMergePolicy);
+
+class SizeRatioMergePolicy : public MergePolicy {
+	double m_ratio;
+public:
+	explicit SizeRatioMergePolicy(const std::string& jsonConf)
+	  : MergePolicy(jsonConf) {
+		auto js = parseConf(jsonConf);
+		m_ratio = getParam(js, "ratio", 1.0);
+	}
+	const char* name() const override { return "size_ratio"; }
+	bool pick(const valvec<SegInfo>& segs, bool forced,
+			  size_t minSegNum, Pick* pk) override {
+		double ratio = forced ? m_ratio * 2 : m_ratio;
+		for (size_t end = segs.size(); end > 0; --end) {
+			llong  sum = segs[end-1].storageSize;
+			size_t beg = end - 1;
+			while (beg > 0 && segs[beg-1].storageSize <= ratio * sum) {
+				sum += segs[--beg].storageSize;
+			}
+			if (end - beg > pk->len) {
+				pk->beg = beg;
+				pk->len = end - beg;
+			}
+		}
+		return pk->len >= minSegNum;
+	}
+};
+TERARK_DB_REGISTER_MERGE_POLICY("size_ratio", SizeRatioMergePolicy);
+
+class TimeWindowMergePolicy : public MergePolicy {
+	llong m_windowSeconds;
+public:
+	explicit TimeWindowMergePolicy(const std::string& jsonConf)
+	  : MergePolicy(jsonConf) {
+		auto js = parseConf(jsonConf);
+		m_windowSeconds = std::max<llong>(getParam(js, "windowSeconds", llong(86400)), 1);
+	}
+	const char* name() const override { return "time_window"; }
+	bool pick(const valvec<SegInfo>& segs, bool forced,
+			  size_t minSegNum, Pick* pk) override {
+		llong curWindow = llong(::time(NULL)) / m_windowSeconds;
+		auto window = [&](size_t i) { return segs[i].buildTime / m_windowSeconds; };
+		for (size_t j = 0; j < segs.size(); ) {
+			size_t k = j + 1;
+			while (k < segs.size() && window(k) == window(j))
+				++k;
+			if ((forced || window(j) != curWindow) && k - j > pk->len) {
+				pk->beg = j;
+				pk->len = k - j;
+			}
+			j = k;
+		}
+		return pk->len >= minSegNum;
+	}
+};
+TERARK_DB_REGISTER_MERGE_POLICY("time_window", TimeWindowMergePolicy);
+
+class GarbageRatioMergePolicy : public MergePolicy {
+	double m_garbageRatio;
+	size_t m_maxSegNum;
+public:
+	explicit GarbageRatioMergePolicy(const std::string& jsonConf)
+	  : MergePolicy(jsonConf) {
+		auto js = parseConf(jsonConf);
+		m_garbageRatio = getParam(js, "garbageRatio", 0.3);
+		m_maxSegNum = getParam(js, "maxSegNum", size_t(8));
+	}
+	const char* name() const override { return "garbage_ratio"; }
+	bool pick(const valvec<SegInfo>& segs, bool forced,
+			  size_t minSegNum, Pick* pk) override {
+		size_t maxLen = std::max(m_maxSegNum, minSegNum);
+		double bestRatio = -1;
+		for (size_t i = 0; i < segs.size(); ++i) {
+			llong rows = 0, delcnt = 0;
+			for (size_t j = i; j < segs.size() && j - i < maxLen; ++j) {
+				rows += segs[j].rows;
+				delcnt += segs[j].delcnt;
+				size_t len = j - i + 1;
+				if (len < minSegNum || 0 == rows)
+					continue;
+				double ratio = double(delcnt) / rows;
+				if (ratio > bestRatio || (ratio == bestRatio && len > pk->len)) {
+					bestRatio = ratio;
+					pk->beg = i;
+					pk->len = len;
+				}
+			}
+		}
+		if (bestRatio < 0 || (!forced && bestRatio < m_garbageRatio)) {
+			return false;
+		}
+		pk->purge = true;
+		return true;
+	}
+};
+TERARK_DB_REGISTER_MERGE_POLICY("garbage_ratio", GarbageRatioMergePolicy);
+
+} } // namespace terark::db
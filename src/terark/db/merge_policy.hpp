@@ -0,0 +1,97 @@
+#ifndef __terark_db_merge_policy_hpp__
+#define __terark_db_merge_policy_hpp__
+
+#include "db_conf.hpp"
+#include <atomic>
+#include <functional>
+
+namespace terark { namespace db {
+
+// Chooses the readonly segments to be merged by DbTable, configured by
+// "MergePolicy" in dbmeta.json, which is a policy type or an object of
+// "type" and the params of the policy:
+//
+//   "tiered"        the default, the longest run of segments whose rows are
+//                   less than "ratio"(1.75) times of average rows,
+//                   "forceRatio"(3.0) when the merge is forced
+//   "size_ratio"    the longest run from newer to older segments, in which
+//                   an older segment is not larger than "ratio"(1.0) times
+//                   of the sum of the newer segments
+//   "time_window"   the longest run of segments built in the same window of
+//                   "windowSeconds"(86400), the current window is skipped
+//   "garbage_ratio" the run of at most "maxSegNum"(8) segments which has the
+//                   highest deleted ratio, if it is at least "garbageRatio"
+//                   (0.3), deleted rows are purged by the merge
+//
+// If there are more readonly segments than "targetSegNum"(0 is no target),
+// a run may be as short as 2 segments, instead of "MinMergeSegNum".
+//
+// A merge always takes a run of adjacent segments, record ids are ordered
+// by segments. Write amplification is the bytes written by conversion,
+// merge and purge divided by the bytes written by conversion.
+class TERARK_DB_DLL MergePolicy : public RefCounter {
+public:
+	struct SegInfo {
+		llong rows; // include deleted rows
+		llong delcnt;
+		llong storageSize;
+		llong buildTime; // seconds since epoch
+	};
+	struct Pick {
+		size_t beg;
+		size_t len;
+		bool   purge; // purge all deleted rows in the merge
+	};
+	struct Stat {
+		llong  convBytes;
+		llong  mergeBytes;
+		llong  purgeBytes;
+		llong  mergeCnt;
+		double writeAmp;
+		size_t segNum; // readonly segments at the last pick
+		size_t targetSegNum;
+	};
+	typedef std::function<MergePolicy*(const std::string& jsonConf)> Factory;
+	struct RegisterPolicy {
+		RegisterPolicy(fstring type, const Factory& f);
+	};
+#define TERARK_DB_REGISTER_MERGE_POLICY(type, PolicyClass) \
+	static MergePolicy::RegisterPolicy \
+		regMergePolicy_##PolicyClass(type, [](const std::string& jsonConf) { \
+			return new PolicyClass(jsonConf); });
+
+	static MergePolicy* create(fstring type, const std::string& jsonConf);
+
+	explicit MergePolicy(const std::string& jsonConf);
+	~MergePolicy();
+	virtual const char* name() const = 0;
+
+	// segs are the readonly segments from older to newer,
+	// returns false if nothing should be merged now
+	bool pickSegments(const valvec<SegInfo>& segs, bool forced,
+					  size_t minSegNum, Pick*);
+
+	void onConvert(llong bytes) { m_convBytes += bytes; }
+	void onPurge(llong bytes) { m_purgeBytes += bytes; }
+	void onMerge(llong bytes) { m_mergeBytes += bytes; m_mergeCnt++; }
+	void getStat(Stat*) const;
+
+protected:
+	virtual bool pick(const valvec<SegInfo>&, bool forced,
+					  size_t minSegNum, Pick*) = 0;
+
+	static bool longestRun(const valvec<SegInfo>&, size_t minSegNum, Pick*,
+						   const std::function<bool(size_t i)>& pred);
+
+	size_t m_targetSegNum;
+	std::atomic<llong>  m_convBytes;
+	std::atomic<llong>  m_mergeBytes;
+	std::atomic<llong>  m_purgeBytes;
+	std::atomic<llong>  m_mergeCnt;
+	std::atomic<size_t> m_segNum;
+};
+typedef boost::intrusive_ptr<MergePolicy> MergePolicyPtr;
+
+} } // namespace terark::db
+
+#endif // __terark_db_merge_policy_hpp__
@@ -0,0 +1,245 @@
+#include "pread_pool.hpp"
+#include "db_conf.hpp"
+#include <terark/util/throw.hpp>
+#include <mutex>
+#include <string.h>
+#include <errno.h>
+#include <unordered_map>
+#include <vector>
+#if defined(_MSC_VER)
+	#include <io.h>
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+namespace terark { namespace db {
+
+static const size_t PreadPool_shardNum = 32; // must be power of 2
+static const size_t PreadPool_defaultCapacity = size_t(256) << 20;
+
+class PreadPool::Shard {
+	struct Key {
+		llong fileId;
+		llong pageNo;
+		bool operator==(const Key& y) const {
+			return fileId == y.fileId && pageNo == y.pageNo;
+		}
+	};
+	struct KeyHash {
+		size_t operator()(const Key& k) const {
+			return size_t(k.fileId * 0x9E3779B97F4A7C15ULL ^ k.pageNo);
+		}
+	};
+	struct Frame {
+		Key  key;
+		bool used = false;
+		bool referenced = false;
+	};
+	mutable std::mutex m_mutex;
+	std::unordered_map<Key, size_t, KeyHash> m_map; // key to frame index
+	std::vector<Frame> m_frames;
+	valvec<byte> m_data; // m_frames.size() pages
+	size_t m_used = 0; // frames in [0, m_used) have been used
+	size_t m_hand = 0; // CLOCK hand
+	llong  m_hitCnt = 0;
+	llong  m_missCnt = 0;
+	llong  m_evictCnt = 0;
+
+	size_t allocFrame() {
+		if (m_used < m_frames.size()) {
+			return m_used++;
+		}
+		for (;;) {
+			if (m_hand >= m_frames.size())
+				m_hand = 0;
+			Frame& f = m_frames[m_hand];
+			if (f.referenced) {
+				f.referenced = false; // give a second chance
+				m_hand++;
+			}
+			else {
+				m_map.erase(f.key);
+				m_evictCnt++;
+				return m_hand++;
+			}
+		}
+	}
+
+public:
+	bool get(llong fileId, llong pageNo, size_t pageOffset, size_t len, byte* dst) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto iter = m_map.find(Key{fileId, pageNo});
+		if (m_map.end() == iter) {
+			m_missCnt++;
+			return false;
+		}
+		Frame& f = m_frames[iter->second];
+		f.referenced = true;
+		memcpy(dst, m_data.data() + iter->second * PageSize + pageOffset, len);
+		m_hitCnt++;
+		return true;
+	}
+
+	bool contains(llong fileId, llong pageNo) const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_map.count(Key{fileId, pageNo}) != 0;
+	}
+
+	void put(llong fileId, llong pageNo, const byte* page, size_t len) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_frames.empty()) {
+			return;
+		}
+		Key key{fileId, pageNo};
+		auto ib = m_map.insert(std::make_pair(key, size_t(-1)));
+		if (!ib.second) {
+			return; // another thread has put it
+		}
+		size_t idx = allocFrame();
+		Frame& f = m_frames[idx];
+		f.key = key;
+		f.used = true;
+		f.referenced = false;
+		memcpy(m_data.data() + idx * PageSize, page, len);
+		ib.first->second = idx;
+	}
+
+	void setCapacity(size_t capacity) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		size_t frameNum = capacity / PageSize;
+		m_map.clear();
+		m_frames.clear();
+		m_frames.resize(frameNum);
+		m_data.clear();
+		m_data.resize_no_init(frameNum * PageSize);
+		m_used = 0;
+		m_hand = 0;
+	}
+
+	void addStat(Stat* st) const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		st->hitCnt   += m_hitCnt;
+		st->missCnt  += m_missCnt;
+		st->evictCnt += m_evictCnt;
+		st->pageNum  += m_map.size();
+	}
+};
+
+PreadPool& PreadPool::instance() {
+	static PreadPool pool;
+	return pool;
+}
+
+PreadPool::PreadPool() {
+	m_shards.reset(new Shard[PreadPool_shardNum]);
+	size_t capacity = PreadPool_defaultCapacity;
+	if (const char* env = getenv("TerarkDB_PreadPoolSize")) {
+		capacity = size_t(std::max<llong>(parseSizeValue(env), 0));
+	}
+	setCapacity(capacity);
+}
+
+PreadPool::~PreadPool() {
+}
+
+llong PreadPool::newFileId() {
+	static std::atomic<llong> s_fileId(0);
+	return ++s_fileId;
+}
+
+PreadPool::Shard&
+PreadPool::getShard(llong fileId, llong pageNo) const {
+	size_t h = size_t(pageNo * 0x9E3779B97F4A7C15ULL + fileId);
+	return m_shards[(h >> 32 ^ h) & (PreadPool_shardNum - 1)];
+}
+
+size_t
+PreadPool::preadFull(intptr_t fd, llong offset, void* buf, size_t len) {
+	size_t total = 0;
+	while (total < len) {
+#if defined(_MSC_VER)
+		OVERLAPPED ov;
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = DWORD(offset + total);
+		ov.OffsetHigh = DWORD((offset + total) >> 32);
+		DWORD n = 0;
+		HANDLE hFile = (HANDLE)_get_osfhandle(int(fd));
+		if (!ReadFile(hFile, (char*)buf + total, DWORD(len - total), &n, &ov)) {
+			DWORD err = GetLastError();
+			if (ERROR_HANDLE_EOF == err)
+				break;
+			THROW_STD(runtime_error, "ReadFile(offset = %lld) = %d"
+				, offset + llong(total), int(err));
+		}
+#else
+		ssize_t n = ::pread(int(fd), (char*)buf + total, len - total, offset + total);
+		if (n < 0) {
+			if (EINTR == errno)
+				continue;
+			THROW_STD(runtime_error, "pread(offset = %lld) = %s"
+				, offset + llong(total), strerror(errno));
+		}
+#endif
+		if (0 == n)
+			break;
+		total += n;
+	}
+	return total;
+}
+
+void
+PreadPool::read(llong fileId, intptr_t fd, llong offset, size_t len, byte* dst) {
+	while (len) {
+		llong  pageNo = offset / PageSize;
+		size_t pageOffset = size_t(offset % PageSize);
+		size_t n = std::min(len, PageSize - pageOffset);
+		Shard& shard = getShard(fileId, pageNo);
+		if (!shard.get(fileId, pageNo, pageOffset, n, dst)) {
+			byte page[PageSize];
+			size_t got = preadFull(fd, pageNo * PageSize, page, PageSize);
+			if (got < pageOffset + n) {
+				THROW_STD(runtime_error
+					, "short read: offset = %lld, len = %zd, page got = %zd"
+					, offset, n, got);
+			}
+			memcpy(dst, page + pageOffset, n);
+			shard.put(fileId, pageNo, page, got);
+		}
+		dst += n;
+		offset += n;
+		len -= n;
+	}
+}
+
+void
+PreadPool::prefetch(llong fileId, intptr_t fd, llong offset, size_t len) {
+#if defined(POSIX_FADV_WILLNEED)
+	llong beg = offset / PageSize;
+	llong end = (offset + llong(len) + PageSize - 1) / PageSize;
+	for (llong pageNo = beg; pageNo < end; ++pageNo) {
+		if (!getShard(fileId, pageNo).contains(fileId, pageNo)) {
+			// ignore error, it is just a hint
+			posix_fadvise(int(fd), pageNo * PageSize, PageSize, POSIX_FADV_WILLNEED);
+		}
+	}
+#endif
+}
+
+void PreadPool::setCapacity(size_t capacityBytes) {
+	m_capacity = capacityBytes;
+	for (size_t i = 0; i < PreadPool_shardNum; ++i) {
+		m_shards[i].setCapacity(capacityBytes / PreadPool_shardNum);
+	}
+}
+
+void PreadPool::getStat(Stat* st) const {
+	memset(st, 0, sizeof(*st));
+	for (size_t i = 0; i < PreadPool_shardNum; ++i) {
+		m_shards[i].addStat(st);
+	}
+	st->capacity = m_capacity;
+}
+
+} } // namespace terark::db
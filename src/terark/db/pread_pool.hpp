@@ -0,0 +1,59 @@
+#ifndef __terark_db_pread_pool_hpp__
+#define __terark_db_pread_pool_hpp__
+
+#include "db_dll_decl.hpp"
+#include <terark/fstring.hpp>
+#include <terark/valvec.hpp>
+#include <atomic>
+#include <memory>
+
+namespace terark { namespace db {
+
+// Buffer pool of file pages for stores which are read by pread instead of
+// mmap, such as colgroups with "usePread" for larger than RAM data.
+//
+// Pages are keyed by (fileId, pageNo), a store gets a new fileId each time
+// it is opened, pages of closed files are evicted by the CLOCK hand as cold
+// pages, no explicit invalidation is needed.
+//
+// Sharded by key hash, each shard has its own mutex and CLOCK ring, a miss
+// is read without the shard lock. The capacity is set by setCapacity or env
+// TerarkDB_PreadPoolSize, such as "1G", default is 256M.
+class TERARK_DB_DLL PreadPool {
+public:
+	static const size_t PageSize = 8 * 1024;
+	struct Stat {
+		llong hitCnt;
+		llong missCnt;
+		llong evictCnt;
+		llong pageNum;
+		llong capacity;
+	};
+	static PreadPool& instance();
+	static llong newFileId();
+
+	// read [offset, offset+len) of the file, throws on short read
+	void read(llong fileId, intptr_t fd, llong offset, size_t len, byte* dst);
+
+	// async read ahead by the OS for pages not in the pool
+	void prefetch(llong fileId, intptr_t fd, llong offset, size_t len);
+
+	void   setCapacity(size_t capacityBytes);
+	size_t capacity() const { return m_capacity; }
+	void   getStat(Stat*) const;
+
+	// pread which retries on EINTR, returns less than len just at EOF
+	static size_t preadFull(intptr_t fd, llong offset, void* buf, size_t len);
+
+private:
+	PreadPool();
+	~PreadPool();
+	class Shard;
+	Shard& getShard(llong fileId, llong pageNo) const;
+	std::unique_ptr<Shard[]> m_shards;
+	std::atomic<size_t> m_capacity;
+};
+
+} } // namespace terark::db
+
+#endif // __terark_db_pread_pool_hpp__
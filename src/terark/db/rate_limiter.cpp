@@ -0,0 +1,211 @@
+#include "rate_limiter.hpp"
+#include "db_conf.hpp"
+#include <algorithm>
+#include <assert.h>
+#include <chrono>
+#include <thread>
+#include <stdlib.h>
+#include <stdio.h>
+
+namespace terark { namespace db {
+
+static const llong  FeedbackWindowNs = 100 * 1000 * 1000;
+static const double MinFactor = 1.0 / 64;
+static const llong  MaxSleepSliceNs = 100 * 1000 * 1000;
+static const llong  PaceChunkBytes = 1024 * 1024;
+
+BgRateLimiter& BgRateLimiter::instance() {
+	static BgRateLimiter inst;
+	return inst;
+}
+
+BgRateLimiter::BgRateLimiter()
+  : m_bytesPerSec(0), m_cpuShare(1.0), m_latencyTargetNs(0)
+  , m_fgLatencySum(0), m_fgLatencyCnt(0)
+  , m_bytes(0), m_ioSleepNs(0), m_cpuSleepNs(0)
+{
+	m_tokens = 0;
+	m_lastRefill = m_pf.now();
+	m_windowStart = m_lastRefill;
+	m_factor = 1.0;
+	m_lastFgLatency = 0;
+	if (const char* env = getenv("TerarkDB_BgBytesPerSec")) {
+		setBytesPerSec(parseSizeValue(env));
+	}
+	if (const char* env = getenv("TerarkDB_BgCpuShare")) {
+		setCpuShare(atof(env));
+	}
+	if (const char* env = getenv("TerarkDB_BgLatencyTargetUs")) {
+		setLatencyTarget(atoll(env) * 1000);
+	}
+}
+
+void BgRateLimiter::setBytesPerSec(llong bytesPerSec) {
+	m_bytesPerSec = std::max<llong>(bytesPerSec, 0);
+	fprintf(stderr, "INFO: BgRateLimiter: bytesPerSec = %lld\n", m_bytesPerSec.load());
+}
+
+void BgRateLimiter::setCpuShare(double share) {
+	if (share <= 0 || share > 1) {
+		fprintf(stderr, "WARN: BgRateLimiter: cpuShare = %f is out of (0, 1], use 1\n", share);
+		share = 1.0;
+	}
+	m_cpuShare = share;
+	fprintf(stderr, "INFO: BgRateLimiter: cpuShare = %f\n", share);
+}
+
+void BgRateLimiter::setLatencyTarget(llong ns) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_latencyTargetNs = std::max<llong>(ns, 0);
+	m_fgLatencySum = 0;
+	m_fgLatencyCnt = 0;
+	m_windowStart = m_pf.now();
+	m_factor = 1.0;
+	fprintf(stderr, "INFO: BgRateLimiter: latencyTarget = %lld ns\n", m_latencyTargetNs.load());
+}
+
+// AIMD on the mean foreground latency of each window
+double BgRateLimiter::adjustFactor() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	llong target = m_latencyTargetNs;
+	if (0 == target) {
+		return m_factor = 1.0;
+	}
+	llong now = m_pf.now();
+	if (m_pf.ns(m_windowStart, now) < FeedbackWindowNs) {
+		return m_factor;
+	}
+	llong cnt = m_fgLatencyCnt.exchange(0);
+	llong sum = m_fgLatencySum.exchange(0);
+	m_windowStart = now;
+	if (cnt) {
+		m_lastFgLatency = sum / cnt;
+		if (m_lastFgLatency > target)
+			m_factor = std::max(m_factor * 0.5, MinFactor);
+		else
+			m_factor = std::min(m_factor * 1.1, 1.0);
+	}
+	else {
+		m_factor = std::min(m_factor * 1.1, 1.0); // no foreground writes
+	}
+	return m_factor;
+}
+
+void BgRateLimiter::sleepNs(llong ns) {
+	std::this_thread::sleep_for(std::chrono::nanoseconds(ns));
+}
+
+void BgRateLimiter::request(llong bytes) {
+	m_bytes += bytes;
+	double factor = adjustFactor();
+	bool first = true;
+	for (;;) {
+		llong sleep;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			double rate = double(m_bytesPerSec) * factor;
+			llong now = m_pf.now();
+			if (rate <= 0) {
+				m_tokens = 0;
+				m_lastRefill = now;
+				return;
+			}
+			// at most 1 second of burst
+			m_tokens = std::min(m_tokens + rate * m_pf.sf(m_lastRefill, now), rate);
+			m_lastRefill = now;
+			if (first) {
+				m_tokens -= bytes;
+				first = false;
+			}
+			if (m_tokens >= 0) {
+				return;
+			}
+			sleep = std::min(llong(-m_tokens / rate * 1e9), MaxSleepSliceNs);
+		}
+		sleepNs(sleep);
+		m_ioSleepNs += sleep;
+		factor = adjustFactor();
+	}
+}
+
+// sleeps in slices to follow changes of the share, the whole sleep is paid,
+// a capped sleep would let long busy periods exceed the share,
+// the sleep stops once *cancel is true
+void BgRateLimiter::pause(llong busyNs, const std::atomic<bool>* cancel) {
+	llong slept = 0;
+	for (;;) {
+		if (cancel && *cancel) {
+			return;
+		}
+		double share = m_cpuShare * adjustFactor();
+		if (share >= 1.0 || busyNs <= 0) {
+			return;
+		}
+		llong sleep = llong(busyNs * (1 - share) / share) - slept;
+		if (sleep <= 0) {
+			return;
+		}
+		sleep = std::min(sleep, MaxSleepSliceNs);
+		sleepNs(sleep);
+		slept += sleep;
+		m_cpuSleepNs += sleep;
+	}
+}
+
+void BgRateLimiter::getStat(Stat* st) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	st->bytes = m_bytes;
+	st->ioSleepNs = m_ioSleepNs;
+	st->cpuSleepNs = m_cpuSleepNs;
+	st->factor = m_factor;
+	st->fgLatencyNs = m_lastFgLatency;
+}
+
+static thread_local BgRateLimiter::Pacer* t_pacer = NULL;
+
+BgRateLimiter::Pacer::Pacer(const std::atomic<bool>* unthrottled)
+  : m_limiter(BgRateLimiter::instance()), m_unthrottled(unthrottled) {
+	m_t0 = m_pf.now();
+	m_pendingBytes = 0;
+	m_prev = t_pacer;
+	t_pacer = this;
+}
+
+BgRateLimiter::Pacer::~Pacer() {
+	assert(t_pacer == this);
+	t_pacer = m_prev;
+	if (m_unthrottled && *m_unthrottled) {
+		m_limiter.m_bytes += m_pendingBytes;
+		return;
+	}
+	m_limiter.pause(m_pf.ns(m_t0, m_pf.now()), m_unthrottled);
+	if (m_pendingBytes) {
+		m_limiter.request(m_pendingBytes);
+	}
+}
+
+void BgRateLimiter::Pacer::paceCurrent(llong bytes) {
+	if (Pacer* pacer = t_pacer) {
+		pacer->pace(bytes);
+	}
+}
+
+void BgRateLimiter::Pacer::pace(llong bytes) {
+	m_pendingBytes += bytes;
+	llong t1 = m_pf.now();
+	llong busy = m_pf.ns(m_t0, t1);
+	if (m_pendingBytes < PaceChunkBytes && busy < FeedbackWindowNs) {
+		return;
+	}
+	if (m_unthrottled && *m_unthrottled) {
+		m_limiter.m_bytes += m_pendingBytes;
+	}
+	else {
+		m_limiter.pause(busy, m_unthrottled);
+		m_limiter.request(m_pendingBytes);
+	}
+	m_pendingBytes = 0;
+	m_t0 = m_pf.now();
+}
+
+} } // namespace terark::db
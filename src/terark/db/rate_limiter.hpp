@@ -0,0 +1,106 @@
+#ifndef __terark_db_rate_limiter_hpp__
+#define __terark_db_rate_limiter_hpp__
+
+#include "db_dll_decl.hpp"
+#include <terark/stdtypes.hpp>
+#include <terark/util/profiling.hpp>
+#include <atomic>
+#include <mutex>
+
+namespace terark { namespace db {
+
+// Limits write bandwidth and cpu usage of background tasks: conversion of
+// writable segments, purge and merge, all tables share the limits.
+//
+// Bandwidth is a token bucket of bytes per second, a background task takes
+// tokens for the bytes of rows it reads and writes as it goes, and sleeps if
+// the bucket is in debt. Cpu share in (0, 1] is a duty cycle, a task sleeps
+// busyTime*(1-share)/share after each busy period, the sleep is not capped.
+//
+// In latency feedback mode, foreground write latencies are reported by
+// DbTable(or by the application for reads by reportFgLatency), when the
+// mean latency in a window exceeds the target, both limits are scaled down
+// by half, and scaled up slowly when the latency is below the target.
+//
+// All limits can be changed at any time, they are disabled by default, the
+// initial values are read from env:
+//   TerarkDB_BgBytesPerSec, such as "64M"
+//   TerarkDB_BgCpuShare, such as "0.5"
+//   TerarkDB_BgLatencyTargetUs, such as "2000"
+class TERARK_DB_DLL BgRateLimiter {
+public:
+	struct Stat {
+		llong  bytes;      // requested by background tasks
+		llong  ioSleepNs;  // slept for bandwidth
+		llong  cpuSleepNs; // slept for cpu share
+		double factor;     // current scale of the latency feedback
+		llong  fgLatencyNs; // mean foreground latency in the last window
+	};
+	static BgRateLimiter& instance();
+
+	void   setBytesPerSec(llong bytesPerSec); // 0 is unlimited
+	llong  getBytesPerSec() const { return m_bytesPerSec; }
+	void   setCpuShare(double share); // 1.0 is unlimited
+	double getCpuShare() const { return m_cpuShare; }
+	void   setLatencyTarget(llong ns); // 0 disables feedback
+	llong  getLatencyTarget() const { return m_latencyTargetNs; }
+
+	// called by background tasks, may sleep
+	void request(llong bytes);
+	void pause(llong busyNs, const std::atomic<bool>* cancel = NULL);
+
+	void reportFgLatency(llong ns) {
+		if (m_latencyTargetNs) {
+			m_fgLatencySum += ns;
+			m_fgLatencyCnt++;
+		}
+	}
+
+	void getStat(Stat*) const;
+
+	// used in a background task, time between pace calls is busy time.
+	// A Pacer is the current one of its thread during its life, row loops
+	// deep in index and store builds call paceCurrent.
+	// If *unthrottled is true, bytes are counted without sleeping, such as
+	// a merge which blocks rotation of a full writing segment.
+	class TERARK_DB_DLL Pacer {
+		BgRateLimiter& m_limiter;
+		profiling m_pf;
+		llong m_t0;
+		llong m_pendingBytes;
+		Pacer* m_prev;
+		const std::atomic<bool>* m_unthrottled;
+	public:
+		explicit Pacer(const std::atomic<bool>* unthrottled = NULL);
+		// bytes are accumulated and requested in chunks
+		void pace(llong bytes);
+		~Pacer();
+		// no-op if the thread has no Pacer
+		static void paceCurrent(llong bytes);
+	};
+
+private:
+	BgRateLimiter();
+	double adjustFactor(); // returns current factor
+	void sleepNs(llong ns);
+
+	mutable std::mutex m_mutex; // for token bucket and feedback window
+	std::atomic<llong>  m_bytesPerSec;
+	std::atomic<double> m_cpuShare;
+	std::atomic<llong>  m_latencyTargetNs;
+	std::atomic<llong>  m_fgLatencySum;
+	std::atomic<llong>  m_fgLatencyCnt;
+	std::atomic<llong>  m_bytes;
+	std::atomic<llong>  m_ioSleepNs;
+	std::atomic<llong>  m_cpuSleepNs;
+	double m_tokens;
+	llong  m_lastRefill;
+	llong  m_windowStart;
+	double m_factor;
+	llong  m_lastFgLatency;
+	profiling m_pf;
+};
+
+} } // namespace terark::db
+
+#endif // __terark_db_rate_limiter_hpp__
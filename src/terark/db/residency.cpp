@@ -0,0 +1,417 @@
+#include "residency.hpp"
+#include "db_table.hpp"
+#include "db_segment.hpp"
+#include "json.hpp"
+#include <terark/util/mmap.hpp>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <string.h>
+#include <errno.h>
+#if defined(_MSC_VER)
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+namespace terark { namespace db {
+
+namespace fs = boost::filesystem;
+
+static const int RebalanceIntervalSec = 10;
+
+ResidencyManager& ResidencyManager::instance() {
+	static ResidencyManager inst;
+	return inst;
+}
+
+ResidencyManager::ResidencyManager() {
+	m_budget = 0;
+	m_pinnedBytes = 0;
+	m_hugePageForStores = false;
+	m_mlockFailed = false;
+	m_stop = false;
+	if (const char* env = getenv("TerarkDB_ResidencyBudget")) {
+		m_budget = std::max<llong>(parseSizeValue(env), 0);
+		fprintf(stderr, "INFO: ResidencyManager: budget = %lld\n", m_budget);
+	}
+}
+
+ResidencyManager::~ResidencyManager() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cond.notify_all();
+	if (m_thread.joinable()) {
+		m_thread.join();
+	}
+	for (auto& kv : m_pinned) {
+		unmapFile(kv.second);
+	}
+	m_pinned.clear();
+}
+
+void ResidencyManager::setBudget(llong bytes) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_budget = std::max<llong>(bytes, 0);
+		startThreadNoLock();
+	}
+	rebalance();
+}
+
+llong ResidencyManager::getBudget() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_budget;
+}
+
+void ResidencyManager::setHugePageForStores(bool val) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_hugePageForStores = val;
+}
+
+void ResidencyManager::addTable(const DbTable* tab) {
+	SegArrayVersionPtr ver = tab->getSegArrayVersion();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	TableEntry& te = m_tables[tab];
+	te.lastAccessCnt = accessCount(tab);
+	te.score = 0;
+	te.budget = ver && ver->m_schema ? ver->m_schema->m_residencyBudget : -1;
+	startThreadNoLock();
+}
+
+// files of a removed table are unpinned now, the table dir may be
+// removed after this, mappings should not keep the files alive
+void ResidencyManager::removeTable(const DbTable* tab) {
+	std::lock_guard<std::mutex> rebalanceLock(m_rebalanceMutex);
+	std::vector<PinnedFile> unpinned;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_tables.erase(tab)) {
+			return;
+		}
+		std::string dir = tab->getDir().string();
+		dir.push_back(fs::path::preferred_separator);
+		for (auto iter = m_pinned.lower_bound(dir); iter != m_pinned.end(); ) {
+			if (!fstring(iter->first).startsWith(dir)) {
+				break;
+			}
+			unpinned.push_back(iter->second);
+			m_pinnedBytes -= iter->second.size;
+			m_pinned.erase(iter++);
+		}
+	}
+	for (auto& pf : unpinned) {
+		unmapFile(pf);
+	}
+}
+
+// the global budget, or sum of budgets of the tables if it is 0
+llong ResidencyManager::effectiveBudgetNoLock() const {
+	if (m_budget > 0) {
+		return m_budget;
+	}
+	llong sum = 0;
+	for (auto& kv : m_tables) {
+		sum += std::max<llong>(kv.second.budget, 0);
+	}
+	return sum;
+}
+
+void ResidencyManager::startThreadNoLock() {
+	if (effectiveBudgetNoLock() > 0 && !m_thread.joinable() && !m_tables.empty()) {
+		m_thread = std::thread(&ResidencyManager::threadProc, this);
+	}
+}
+
+void ResidencyManager::threadProc() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (!m_stop) {
+		m_cond.wait_for(lock, std::chrono::seconds(RebalanceIntervalSec));
+		if (m_stop) {
+			break;
+		}
+		lock.unlock();
+		try {
+			rebalance();
+		}
+		catch (const std::exception& ex) {
+			fprintf(stderr, "WARN: ResidencyManager: rebalance failed: %s\n", ex.what());
+		}
+		lock.lock();
+	}
+}
+
+llong ResidencyManager::accessCount(const DbTable* tab) {
+	SegArrayVersionPtr ver = tab->getSegArrayVersion();
+	if (!ver) {
+		return 0;
+	}
+	llong cnt = 0;
+	for (auto& seg : ver->m_segments) {
+		cnt += seg->m_lookupCnt + seg->m_seekCnt;
+	}
+	return cnt;
+}
+
+void
+ResidencyManager::collectFiles(const DbTable* tab, double score,
+							   std::vector<Candidate>* out) {
+	SegArrayVersionPtr ver = tab->getSegArrayVersion();
+	if (!ver) {
+		return;
+	}
+	for (auto& seg : ver->m_segments) {
+		ReadonlySegment* rdseg = seg->getReadonlySegment();
+		if (!rdseg) {
+			continue;
+		}
+		// the segment dir may be removed by a concurrent merge
+		boost::system::error_code ec;
+		fs::directory_iterator iter(rdseg->m_segDir, ec), end;
+		for (; !ec && iter != end; iter.increment(ec)) {
+			std::string fname = iter->path().filename().string();
+			fstring fn(fname);
+			bool isIndex = fn.startsWith("index-");
+			if (!isIndex && !fn.startsWith("colgroup-")) {
+				continue;
+			}
+			if (fn.endsWith(".tmp")) {
+				continue;
+			}
+			boost::system::error_code ec2;
+			llong size = llong(fs::file_size(iter->path(), ec2));
+			if (ec2 || 0 == size) {
+				continue;
+			}
+			out->push_back({iter->path().string(), size, isIndex, score, tab});
+		}
+	}
+}
+
+void ResidencyManager::rebalance() {
+	// tables can not be removed until rebalance completes
+	std::lock_guard<std::mutex> rebalanceLock(m_rebalanceMutex);
+	std::map<const DbTable*, TableEntry> tables;
+	llong budget;
+	bool  hugePage;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (auto& kv : m_tables) {
+			TableEntry& te = kv.second;
+			llong cnt = accessCount(kv.first);
+			// merged segments are new objects, counts may go backward
+			llong delta = std::max<llong>(cnt - te.lastAccessCnt, 0);
+			te.lastAccessCnt = cnt;
+			te.score = te.score / 2 + delta;
+		}
+		tables = m_tables;
+		budget = effectiveBudgetNoLock();
+		hugePage = m_hugePageForStores;
+	}
+	std::vector<Candidate> cands;
+	if (budget > 0) {
+		for (auto& kv : tables) {
+			if (kv.second.budget != 0)
+				collectFiles(kv.first, kv.second.score, &cands);
+		}
+	}
+	std::sort(cands.begin(), cands.end(),
+		[](const Candidate& x, const Candidate& y) {
+			if (x.isIndex != y.isIndex)
+				return x.isIndex;
+			if (x.score != y.score)
+				return x.score > y.score;
+			return x.path < y.path;
+		});
+	std::set<std::string> keep;
+	std::map<const DbTable*, llong> tableUsed;
+	llong used = 0;
+	for (size_t i = 0; i < cands.size(); ++i) {
+		// a smaller file after a skipped big file may still fit
+		const Candidate& c = cands[i];
+		llong tabBudget = tables[c.tab].budget;
+		llong& tabUsed = tableUsed[c.tab];
+		if (used + c.size <= budget &&
+				(tabBudget < 0 || tabUsed + c.size <= tabBudget)) {
+			keep.insert(c.path);
+			used += c.size;
+			tabUsed += c.size;
+		}
+	}
+	std::vector<PinnedFile> unpinned;
+	std::vector<const Candidate*> topin;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (auto iter = m_pinned.begin(); iter != m_pinned.end(); ) {
+			if (keep.count(iter->first)) {
+				++iter;
+			} else {
+				unpinned.push_back(iter->second);
+				m_pinnedBytes -= iter->second.size;
+				m_pinned.erase(iter++);
+			}
+		}
+		for (size_t i = 0; i < cands.size(); ++i) {
+			if (keep.count(cands[i].path) && !m_pinned.count(cands[i].path))
+				topin.push_back(&cands[i]);
+		}
+	}
+	for (auto& pf : unpinned) {
+		unmapFile(pf);
+	}
+	for (const Candidate* c : topin) {
+		PinnedFile pf;
+		if (mapFile(*c, hugePage, &pf)) {
+			// only rebalance adds files, and it is serialized
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pinned[c->path] = pf;
+			m_pinnedBytes += pf.size;
+		}
+	}
+}
+
+bool ResidencyManager::mapFile(const Candidate& c, bool hugePage, PinnedFile* ppf) {
+	PinnedFile& pf = *ppf;
+	pf.size = 0;
+	pf.isIndex = c.isIndex;
+	pf.isLocked = false;
+	try {
+		pf.base = mmap_load(c.path, &pf.size);
+	}
+	catch (const std::exception& ex) {
+		fprintf(stderr, "WARN: ResidencyManager: mmap %s failed: %s\n"
+			, c.path.c_str(), ex.what());
+		return false;
+	}
+#if defined(_MSC_VER)
+	pf.isLocked = VirtualLock(pf.base, pf.size) ? true : false;
+	if (!pf.isLocked) { // just touch the pages
+		volatile byte sum = 0;
+		for (size_t i = 0; i < pf.size; i += 4096)
+			sum += ((const byte*)pf.base)[i];
+	}
+#else
+  #if defined(MADV_HUGEPAGE)
+	if (!c.isIndex && hugePage) {
+		madvise(pf.base, pf.size, MADV_HUGEPAGE);
+	}
+  #endif
+	pf.isLocked = mlock(pf.base, pf.size) == 0;
+	if (!pf.isLocked) {
+		if (!m_mlockFailed) {
+			m_mlockFailed = true;
+			fprintf(stderr
+				, "WARN: ResidencyManager: mlock failed: %s, use MADV_WILLNEED\n"
+				, strerror(errno));
+		}
+		madvise(pf.base, pf.size, MADV_WILLNEED);
+	}
+#endif
+	return true;
+}
+
+void ResidencyManager::unmapFile(const PinnedFile& pf) {
+	if (pf.isLocked) {
+#if defined(_MSC_VER)
+		VirtualUnlock(pf.base, pf.size);
+#else
+		munlock(pf.base, pf.size);
+#endif
+	}
+	mmap_close(pf.base, pf.size);
+}
+
+static llong residentBytesOf(const void* base, size_t size) {
+#if defined(_MSC_VER)
+	return -1;
+#else
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	size_t pages = (size + pageSize - 1) / pageSize;
+	valvec<unsigned char> vec(pages, 0);
+  #if defined(__APPLE__)
+	int err = mincore((void*)base, size, (char*)vec.data());
+  #else
+	int err = mincore((void*)base, size, vec.data());
+  #endif
+	if (err) {
+		return -1;
+	}
+	size_t resident = 0;
+	for (size_t i = 0; i < pages; ++i) {
+		resident += vec[i] & 1;
+	}
+	return llong(std::min(resident * pageSize, size));
+#endif
+}
+
+void
+ResidencyManager::getFileStats(const DbTable* tab, std::vector<FileStat>* stats)
+const {
+	std::vector<Candidate> files;
+	collectFiles(tab, 0, &files);
+	stats->clear();
+	stats->reserve(files.size());
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (auto& f : files) {
+		FileStat st;
+		st.path = f.path;
+		st.fileSize = f.size;
+		st.residentBytes = -1;
+		st.isIndex = f.isIndex;
+		auto iter = m_pinned.find(f.path);
+		st.isPinned = m_pinned.end() != iter;
+		if (st.isPinned) {
+			st.residentBytes = residentBytesOf(iter->second.base, iter->second.size);
+		}
+		else {
+			// a temporary mapping, mincore reports the shared page cache
+			try {
+				size_t size = 0;
+				void* base = mmap_load(f.path, &size);
+				st.residentBytes = residentBytesOf(base, size);
+				mmap_close(base, size);
+			}
+			catch (const std::exception&) {
+				// the file was removed by a concurrent merge
+			}
+		}
+		stats->push_back(std::move(st));
+	}
+}
+
+std::string ResidencyManager::getStatsJson(const DbTable* tab) const {
+	std::vector<FileStat> stats;
+	getFileStats(tab, &stats);
+	json js;
+	llong fileBytes = 0, residentBytes = 0, pinned = 0;
+	json& files = js["files"];
+	files = json::array();
+	for (auto& st : stats) {
+		json f;
+		f["path"] = st.path;
+		f["kind"] = st.isIndex ? "index" : "store";
+		f["size"] = st.fileSize;
+		f["resident"] = st.residentBytes;
+		f["pinned"] = st.isPinned;
+		files.push_back(std::move(f));
+		fileBytes += st.fileSize;
+		residentBytes += std::max<llong>(st.residentBytes, 0);
+		pinned += st.isPinned ? st.fileSize : 0;
+	}
+	js["fileBytes"] = fileBytes;
+	js["residentBytes"] = residentBytes;
+	js["pinnedBytes"] = pinned;
+	js["budget"] = getBudget();
+	return js.dump(2);
+}
+
+llong ResidencyManager::pinnedBytes() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_pinnedBytes;
+}
+
+} } // namespace terark::db
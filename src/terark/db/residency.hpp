@@ -0,0 +1,108 @@
+#ifndef __terark_db_residency_hpp__
+#define __terark_db_residency_hpp__
+
+#include "db_store.hpp"
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace terark { namespace db {
+
+class TERARK_DB_DLL DbTable;
+
+// Keeps mmapped files of ReadonlySegments in memory within a global budget.
+//
+// Files are ranked by kind then by access frequency of their tables:
+// index files ("index-*") of all tables come first, then store files
+// ("colgroup-*"), in each kind hotter tables come first. Files in the
+// budget are mapped again by the manager and locked by mlock, if mlock
+// fails(such as RLIMIT_MEMLOCK) they are just advised by MADV_WILLNEED.
+// The page cache is shared, so mappings of the stores are kept resident.
+//
+// The budget is 0(disabled) by default, it is set by setBudget or env
+// TerarkDB_ResidencyBudget, such as "8G". A table may limit its pinned
+// files by "ResidencyBudget" in dbmeta.json, if the global budget is 0,
+// the sum of budgets of the tables is used, so a table can be kept
+// resident by its dbmeta.json alone. Files are rebalanced every few
+// seconds in a background thread and when rebalance() is called, files
+// are mapped and locked out of m_mutex.
+class TERARK_DB_DLL ResidencyManager {
+public:
+	struct FileStat {
+		std::string path;
+		llong fileSize;
+		llong residentBytes; // -1 if unknown
+		bool  isIndex;
+		bool  isPinned;
+	};
+
+	static ResidencyManager& instance();
+
+	void  setBudget(llong bytes);
+	llong getBudget() const;
+
+	// MADV_HUGEPAGE for store files pinned later, just effective on
+	// kernels which support huge pages for read only file mappings
+	void setHugePageForStores(bool val);
+
+	void addTable(const DbTable*);
+	void removeTable(const DbTable*);
+
+	void rebalance();
+
+	void getFileStats(const DbTable*, std::vector<FileStat>*) const;
+	std::string getStatsJson(const DbTable*) const;
+	llong pinnedBytes() const;
+
+private:
+	ResidencyManager();
+	~ResidencyManager();
+
+	struct PinnedFile {
+		void*  base;
+		size_t size;
+		bool   isIndex;
+		bool   isLocked; // false if just advised
+	};
+	struct TableEntry {
+		llong  lastAccessCnt;
+		double score;  // decayed access count
+		llong  budget; // "ResidencyBudget", -1 for no limit
+	};
+	struct Candidate {
+		std::string path;
+		llong  size;
+		bool   isIndex;
+		double score;
+		const DbTable* tab;
+	};
+
+	static llong accessCount(const DbTable*);
+	static void collectFiles(const DbTable*, double score, std::vector<Candidate>*);
+	bool mapFile(const Candidate&, bool hugePage, PinnedFile*);
+	static void unmapFile(const PinnedFile&);
+	llong effectiveBudgetNoLock() const;
+	void startThreadNoLock();
+	void threadProc();
+
+	// serializes rebalance and removeTable, so tables being rebalanced are
+	// alive, locked before m_mutex, which is not locked on file mapping
+	std::mutex m_rebalanceMutex;
+	mutable std::mutex m_mutex;
+	std::map<const DbTable*, TableEntry> m_tables;
+	std::map<std::string, PinnedFile>   m_pinned;
+	llong  m_budget;
+	llong  m_pinnedBytes;
+	bool   m_hugePageForStores;
+	bool   m_mlockFailed; // warn once, in m_rebalanceMutex
+	bool   m_stop;
+	std::condition_variable m_cond;
+	std::thread m_thread;
+};
+
+} } // namespace terark::db
+
+#endif // __terark_db_residency_hpp__
@@ -0,0 +1,179 @@
+#include "row_cache.hpp"
+#include <mutex>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace terark { namespace db {
+
+static const size_t RowCache_shardNum = 32; // must be power of 2
+// estimated memory overhead of an entry: slot + hash node
+static const size_t RowCache_entryOverhead = 64;
+
+class RowCache::Shard {
+	struct Key {
+		llong segId;
+		llong physicId;
+		bool operator==(const Key& y) const {
+			return segId == y.segId && physicId == y.physicId;
+		}
+	};
+	struct KeyHash {
+		size_t operator()(const Key& k) const {
+			return size_t(k.segId * 0x9E3779B97F4A7C15ULL ^ k.physicId);
+		}
+	};
+	struct Slot {
+		Key  key;
+		std::string data;
+		bool used = false;
+		bool referenced = false;
+	};
+	mutable std::mutex m_mutex;
+	std::unordered_map<Key, size_t, KeyHash> m_map; // key to slot index
+	std::vector<Slot>  m_slots;
+	std::vector<size_t> m_freeSlots;
+	size_t m_hand = 0; // CLOCK hand
+	size_t m_usedBytes = 0;
+	size_t m_capacity = 0;
+	llong  m_hitCnt = 0;
+	llong  m_missCnt = 0;
+	llong  m_insertCnt = 0;
+	llong  m_evictCnt = 0;
+
+	void evictOne() {
+		assert(m_map.size() > 0);
+		for (;;) {
+			if (m_hand >= m_slots.size())
+				m_hand = 0;
+			Slot& s = m_slots[m_hand];
+			if (s.used) {
+				if (s.referenced) {
+					s.referenced = false; // give a second chance
+				}
+				else {
+					m_map.erase(s.key);
+					m_usedBytes -= s.data.size() + RowCache_entryOverhead;
+					std::string().swap(s.data);
+					s.used = false;
+					m_freeSlots.push_back(m_hand);
+					m_evictCnt++;
+					m_hand++;
+					return;
+				}
+			}
+			m_hand++;
+		}
+	}
+
+public:
+	bool get(llong segId, llong physicId, valvec<byte>* val) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto iter = m_map.find(Key{segId, physicId});
+		if (m_map.end() == iter) {
+			m_missCnt++;
+			return false;
+		}
+		Slot& s = m_slots[iter->second];
+		s.referenced = true;
+		val->assign((const byte*)s.data.data(), s.data.size());
+		m_hitCnt++;
+		return true;
+	}
+
+	void put(llong segId, llong physicId, fstring val) {
+		size_t bytes = val.size() + RowCache_entryOverhead;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (bytes > m_capacity / 8) {
+			return; // too large, don't let it flush the whole shard
+		}
+		Key key{segId, physicId};
+		auto ib = m_map.insert(std::make_pair(key, size_t(-1)));
+		if (!ib.second) {
+			return; // another thread has put it
+		}
+		while (m_usedBytes + bytes > m_capacity && m_map.size() > 1) {
+			evictOne();
+		}
+		size_t idx;
+		if (m_freeSlots.empty()) {
+			idx = m_slots.size();
+			m_slots.emplace_back();
+		}
+		else {
+			idx = m_freeSlots.back();
+			m_freeSlots.pop_back();
+		}
+		Slot& s = m_slots[idx];
+		s.key = key;
+		s.data.assign(val.data(), val.size());
+		s.used = true;
+		s.referenced = false;
+		ib.first->second = idx;
+		m_usedBytes += bytes;
+		m_insertCnt++;
+	}
+
+	void setCapacity(size_t capacity) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_capacity = capacity;
+		while (m_usedBytes > m_capacity && !m_map.empty()) {
+			evictOne();
+		}
+	}
+
+	void addStat(Stat* st) const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		st->hitCnt    += m_hitCnt;
+		st->missCnt   += m_missCnt;
+		st->insertCnt += m_insertCnt;
+		st->evictCnt  += m_evictCnt;
+		st->usedBytes += m_usedBytes;
+		st->entryNum  += m_map.size();
+	}
+};
+
+RowCache::RowCache(size_t capacityBytes) {
+	m_shards.reset(new Shard[RowCache_shardNum]);
+	setCapacity(capacityBytes);
+}
+
+RowCache::~RowCache() {
+}
+
+RowCache::Shard&
+RowCache::getShard(llong segId, llong physicId) const {
+	size_t h = size_t(physicId * 0x9E3779B97F4A7C15ULL + segId);
+	return m_shards[(h >> 32 ^ h) & (RowCache_shardNum - 1)];
+}
+
+bool RowCache::get(llong segId, llong physicId, valvec<byte>* val) {
+	return getShard(segId, physicId).get(segId, physicId, val);
+}
+
+void RowCache::put(llong segId, llong physicId, fstring val) {
+	getShard(segId, physicId).put(segId, physicId, val);
+}
+
+void RowCache::setCapacity(size_t capacityBytes) {
+	m_capacity = capacityBytes;
+	for (size_t i = 0; i < RowCache_shardNum; ++i) {
+		m_shards[i].setCapacity(capacityBytes / RowCache_shardNum);
+	}
+}
+
+void RowCache::getStat(Stat* st) const {
+	memset(st, 0, sizeof(*st));
+	for (size_t i = 0; i < RowCache_shardNum; ++i) {
+		m_shards[i].addStat(st);
+	}
+	st->capacity = m_capacity;
+}
+
+llong RowCache::newSegmentCacheId() {
+	static std::atomic<llong> s_segCacheId(0);
+	return ++s_segCacheId;
+}
+
+} } // namespace terark::db
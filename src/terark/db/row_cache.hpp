@@ -0,0 +1,52 @@
+#ifndef __terark_db_row_cache_hpp__
+#define __terark_db_row_cache_hpp__
+
+#include "db_dll_decl.hpp"
+#include <terark/fstring.hpp>
+#include <terark/valvec.hpp>
+#include <atomic>
+#include <memory>
+
+namespace terark { namespace db {
+
+// Memory bounded cache of decoded rows of ReadonlySegment, keyed by
+// (ReadableSegment::m_cacheId, physicId).
+//
+// A segment gets a new m_cacheId each time it is loaded, segments replaced
+// by merge or purge are never looked up again, their entries are evicted
+// by the CLOCK hand as cold entries, no explicit invalidation is needed.
+//
+// Sharded by key hash, each shard has its own mutex and CLOCK ring.
+class TERARK_DB_DLL RowCache {
+public:
+	struct Stat {
+		llong hitCnt;
+		llong missCnt;
+		llong insertCnt;
+		llong evictCnt;
+		llong usedBytes;
+		llong entryNum;
+		llong capacity;
+	};
+	explicit RowCache(size_t capacityBytes);
+	~RowCache();
+
+	bool get(llong segId, llong physicId, valvec<byte>* val);
+	void put(llong segId, llong physicId, fstring val);
+
+	void   setCapacity(size_t capacityBytes);
+	size_t capacity() const { return m_capacity; }
+	void   getStat(Stat*) const;
+
+	static llong newSegmentCacheId();
+
+private:
+	class Shard;
+	Shard& getShard(llong segId, llong physicId) const;
+	std::unique_ptr<Shard[]> m_shards;
+	std::atomic<size_t> m_capacity;
+};
+
+} } // namespace terark::db
+
+#endif // __terark_db_row_cache_hpp__
@@ -1,10 +1,21 @@
 #include "zip_int_store.hpp"
+#include "pread_pool.hpp"
 #include <terark/io/FileStream.hpp>
 #include <terark/io/DataIO.hpp>
+#include <terark/io/var_int.hpp>
 #include <terark/num_to_str.hpp>
 #include <terark/util/mmap.hpp>
 #include <terark/util/sortable_strvec.hpp>
 
+#if defined(_MSC_VER)
+	#include <io.h>
+#else
+	#include <unistd.h>
+#endif
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+
 namespace terark { namespace db {
 
 ZipIntStore::ZipIntStore(const Schema& schema) : m_schema(schema) {
@@ -13,21 +24,43 @@ ZipIntStore::ZipIntStore(const Schema& schema) : m_schema(schema) {
 	m_minValue = 0;
 	m_mmapBase = nullptr;
 	m_mmapSize = 0;
+	m_blockRows = 0;
+	m_fd = -1;
+	m_fileId = 0;
+	m_preadBase = 0;
+	m_preadSize = 0;
+	m_preadRows = 0;
+	m_preadBits = 0;
 }
 ZipIntStore::~ZipIntStore() {
+	closeFile();
 	if (m_mmapBase) {
 		m_dedup.risk_release_ownership();
 		m_index.risk_release_ownership();
+		m_blockOffsets.risk_release_ownership();
+		m_blockData.risk_release_ownership();
 		mmap_close(m_mmapBase, m_mmapSize);
 	}
 }
 
+void ZipIntStore::closeFile() {
+	if (m_fd >= 0) {
+#if defined(_MSC_VER)
+		::_close(int(m_fd));
+#else
+		::close(int(m_fd));
+#endif
+		m_fd = -1;
+	}
+}
+
 llong ZipIntStore::dataStorageSize() const {
-	return m_dedup.mem_size() + m_index.mem_size();
+	return m_dedup.mem_size() + m_index.mem_size()
+		+ m_blockOffsets.mem_size() + m_blockData.size() + m_preadSize;
 }
 
 llong ZipIntStore::dataInflateSize() const {
-	size_t rows = m_index.size() ? m_index.size() : m_dedup.size();
+	size_t rows = size_t(numDataRows());
 	switch (m_intType) {
 	default:
 		THROW_STD(invalid_argument,
@@ -44,56 +77,489 @@ llong ZipIntStore::dataInflateSize() const {
 }
 
 llong ZipIntStore::numDataRows() const {
+	if (m_fd >= 0)
+		return m_preadRows;
+	if (m_blockRows)
+		return m_blockRows;
 	return m_index.size() ? m_index.size() : m_dedup.size();
 }
 
-template<class Int>
-void ZipIntStore::valueAppend(size_t recIdx, valvec<byte>* key) const {
+/////////////////////////////////////////////////////////////////////////////
+// block layout:
+//   mode(1 byte), bits(1 byte), excNum(1 byte), var_uint base,
+//   var_int minDelta(delta mode only), bit packed values,
+//   excNum * (pos(1 byte), var_uint high bits)
+// FOR  : offset[i] = base + value[i]
+// delta: offset[0] = base, offset[i] = offset[i-1] + minDelta + value[i]
+// values which need more than bits are exceptions, their low bits are
+// packed as others and high bits are patched after unpack.
+
+namespace {
+	enum BlockMode : byte {
+		BlockMode_FOR = 0,
+		BlockMode_Delta = 1,
+	};
+	struct BlockHeader {
+		byte   mode;
+		byte   bits;
+		byte   excNum;
+		ullong base;
+		llong  minDelta;
+		const byte* packed;
+		const byte* exceptions;
+	};
+}
+
+static const byte*
+parseBlockHeader(const byte* p, size_t rows, BlockHeader* h) {
+	h->mode = p[0];
+	h->bits = p[1];
+	h->excNum = p[2];
+	h->base = load_var_uint64(p + 3, &p);
+	h->minDelta = BlockMode_Delta == h->mode ? load_var_int64(p, &p) : 0;
+	h->packed = p;
+	h->exceptions = p + (rows * h->bits + 7) / 8;
+	return h->exceptions;
+}
+
+// need 8 bytes readable after the packed values
+static inline ullong
+loadBits(const byte* packed, size_t bitpos, size_t bits, ullong mask) {
+	const byte* p = packed + bitpos / 8;
+	size_t shift = bitpos % 8;
+	ullong val = unaligned_load<ullong>(p) >> shift;
+	if (shift + bits > 64) {
+		val |= ullong(p[8]) << (64 - shift);
+	}
+	return val & mask;
+}
+
+static inline ullong bitsMask(size_t bits) {
+	return 64 == bits ? ullong(-1) : (ullong(1) << bits) - 1;
+}
+
+// word at a time unpack, bits <= 56 never spans 9 bytes and the loop
+// has no branch in its body
+static void
+unpackBits(const byte* packed, size_t rows, size_t bits, ullong* values) {
+	if (0 == bits) {
+		std::fill_n(values, rows, 0);
+		return;
+	}
+	const ullong mask = bitsMask(bits);
+	if (bits <= 56) {
+		for (size_t i = 0, bitpos = 0; i < rows; ++i, bitpos += bits) {
+			values[i] = unaligned_load<ullong>(packed + bitpos/8) >> (bitpos%8) & mask;
+		}
+	}
+	else {
+		for (size_t i = 0; i < rows; ++i) {
+			values[i] = loadBits(packed, i * bits, bits, mask);
+		}
+	}
+}
+
+static void
+packBits(const ullong* values, size_t rows, size_t bits, valvec<byte>* out) {
+	size_t oldsize = out->size();
+	size_t packedBytes = (rows * bits + 7) / 8;
+	out->resize(oldsize + packedBytes + 9, 0); // 9 for writing last value
+	byte* packed = out->data() + oldsize;
+	const ullong mask = bitsMask(bits);
+	for (size_t i = 0; i < rows && bits; ++i) {
+		size_t bitpos = i * bits;
+		byte*  p = packed + bitpos / 8;
+		size_t shift = bitpos % 8;
+		ullong val = values[i] & mask;
+		unaligned_save<ullong>(p, unaligned_load<ullong>(p) | val << shift);
+		if (shift + bits > 64) {
+			p[8] |= byte(val >> (64 - shift));
+		}
+	}
+	out->risk_set_size(oldsize + packedBytes);
+}
+
+static inline size_t uintBits(ullong x) {
+	return x ? terark_bsr_u64(x) + 1 : 0;
+}
+
+// patched frame of reference: the bit width which minimize
+// the size of packed values plus exceptions
+static size_t chooseBits(const ullong* values, size_t rows, size_t* cost) {
+	size_t cnt[65] = {0};
+	size_t maxBits = 0;
+	for (size_t i = 0; i < rows; ++i) {
+		size_t bits = uintBits(values[i]);
+		cnt[bits]++;
+		maxBits = std::max(maxBits, bits);
+	}
+	size_t bestBits = maxBits;
+	size_t bestCost = (rows * maxBits + 7) / 8;
+	size_t excNum = 0;
+	for (size_t bits = maxBits; bits-- > 0; ) {
+		excNum += cnt[bits + 1];
+		size_t excBytes = 1 + (maxBits - bits + 6) / 7; // pos + var_uint
+		size_t c = (rows * bits + 7) / 8 + excNum * excBytes;
+		if (c < bestCost) {
+			bestCost = c;
+			bestBits = bits;
+		}
+	}
+	*cost = bestCost;
+	return bestBits;
+}
+
+static void
+encodeBlock(const ullong* offsets, size_t rows, valvec<byte>* out) {
+	ullong forValues[ZipIntStore::BlockSize];
+	ullong deltaValues[ZipIntStore::BlockSize];
+	ullong base = *std::min_element(offsets, offsets + rows);
+	for (size_t i = 0; i < rows; ++i) {
+		forValues[i] = offsets[i] - base;
+	}
+	llong minDelta = 0;
+	if (rows > 1) {
+		minDelta = llong(offsets[1] - offsets[0]);
+		for (size_t i = 2; i < rows; ++i) {
+			minDelta = std::min(minDelta, llong(offsets[i] - offsets[i-1]));
+		}
+	}
+	deltaValues[0] = 0;
+	for (size_t i = 1; i < rows; ++i) {
+		deltaValues[i] = offsets[i] - offsets[i-1] - ullong(minDelta);
+	}
+	size_t forCost, deltaCost;
+	size_t forBits = chooseBits(forValues, rows, &forCost);
+	size_t deltaBits = chooseBits(deltaValues, rows, &deltaCost);
+	byte   mode = BlockMode_FOR;
+	size_t bits = forBits;
+	const ullong* values = forValues;
+	if (rows > 1 && deltaCost + 9 < forCost) { // 9 for var_int minDelta
+		mode = BlockMode_Delta;
+		bits = deltaBits;
+		values = deltaValues;
+		base = offsets[0];
+	}
+	byte  buf[32];
+	byte* p = buf;
+	*p++ = mode;
+	*p++ = byte(bits);
+	*p++ = 0; // excNum, set later
+	p = save_var_uint64(p, base);
+	if (BlockMode_Delta == mode) {
+		p = save_var_int64(p, minDelta);
+	}
+	size_t headerPos = out->size();
+	out->append(buf, p - buf);
+	packBits(values, rows, bits, out);
+	const ullong mask = bitsMask(bits);
+	size_t excNum = 0;
+	for (size_t i = 0; i < rows; ++i) {
+		if (values[i] & ~mask) {
+			p = buf;
+			*p++ = byte(i);
+			p = save_var_uint64(p, values[i] >> bits);
+			out->append(buf, p - buf);
+			excNum++;
+		}
+	}
+	assert(excNum <= 255);
+	(*out)[headerPos + 2] = byte(excNum);
+}
+
+static void
+decodeBlockData(const byte* block, size_t rows, ullong* offsets) {
+	BlockHeader h;
+	const byte* p = parseBlockHeader(block, rows, &h);
+	unpackBits(h.packed, rows, h.bits, offsets);
+	for (size_t k = 0; k < h.excNum; ++k) {
+		size_t pos = *p++;
+		assert(pos < rows);
+		offsets[pos] |= load_var_uint64(p, &p) << h.bits;
+	}
+	if (BlockMode_Delta == h.mode) {
+		ullong prev = h.base;
+		offsets[0] = prev;
+		for (size_t i = 1; i < rows; ++i) {
+			prev += ullong(h.minDelta) + offsets[i];
+			offsets[i] = prev;
+		}
+	}
+	else {
+		for (size_t i = 0; i < rows; ++i) {
+			offsets[i] += h.base;
+		}
+	}
+}
+
+// returns the encoded block, it is read into buf if m_fd >= 0
+const byte* ZipIntStore::blockPtr(size_t blockIdx, valvec<byte>* buf) const {
+	size_t beg = m_blockOffsets.get(blockIdx);
+	if (m_fd < 0) {
+		return m_blockData.data() + beg;
+	}
+	// block data has 8 bytes padding after the last block
+	size_t len = m_blockOffsets.get(blockIdx + 1) - beg + 8;
+	buf->resize_no_init(len);
+	PreadPool::instance().read(m_fileId, m_fd, m_preadBase + beg, len, buf->data());
+	return buf->data();
+}
+
+size_t ZipIntStore::decodeBlock(size_t blockIdx, ullong* offsets) const {
+	size_t rows = std::min(BlockSize, m_blockRows - blockIdx * BlockSize);
+	valvec<byte> buf;
+	decodeBlockData(blockPtr(blockIdx, &buf), rows, offsets);
+	return rows;
+}
+
+// FOR block: unpack one value, delta block: decode the block
+ullong ZipIntStore::blockValue(size_t recIdx) const {
+	size_t blockIdx = recIdx / BlockSize;
+	size_t subIdx = recIdx % BlockSize;
+	size_t rows = std::min(BlockSize, m_blockRows - blockIdx * BlockSize);
+	valvec<byte> buf;
+	const byte* block = blockPtr(blockIdx, &buf);
+	BlockHeader h;
+	const byte* p = parseBlockHeader(block, rows, &h);
+	if (BlockMode_Delta == h.mode) {
+		ullong offsets[BlockSize];
+		decodeBlockData(block, rows, offsets);
+		return offsets[subIdx];
+	}
+	ullong val = loadBits(h.packed, subIdx * h.bits, h.bits, bitsMask(h.bits));
+	for (size_t k = 0; k < h.excNum; ++k) {
+		size_t pos = *p++;
+		ullong high = load_var_uint64(p, &p);
+		if (pos == subIdx) {
+			val |= high << h.bits;
+			break;
+		}
+	}
+	return h.base + val;
+}
+
+ullong ZipIntStore::preadBits(size_t idx) const {
+	if (0 == m_preadBits) {
+		return 0;
+	}
+	size_t bitpos = idx * m_preadBits;
+	size_t len = (bitpos % 8 + m_preadBits + 7) / 8;
+	byte buf[16] = {0}; // loadBits needs 8 bytes after the value
+	PreadPool::instance().read(m_fileId, m_fd, m_preadBase + bitpos / 8, len, buf);
+	return loadBits(buf, bitpos % 8, m_preadBits, bitsMask(m_preadBits));
+}
+
+// returns the size of blocks
+size_t ZipIntStore::zipBlocks(const UintVecMin0& dup) {
+	size_t rows = dup.size();
+	size_t blocks = (rows + BlockSize - 1) / BlockSize;
+	valvec<size_t> offsets(blocks + 1, valvec_reserve());
+	ullong values[BlockSize];
+	m_blockData.erase_all();
+	for (size_t i = 0; i < blocks; ++i) {
+		size_t beg = i * BlockSize;
+		size_t num = std::min(BlockSize, rows - beg);
+		for (size_t j = 0; j < num; ++j) {
+			values[j] = dup.get(beg + j);
+		}
+		offsets.push_back(m_blockData.size());
+		encodeBlock(values, num, &m_blockData);
+	}
+	offsets.push_back(m_blockData.size());
+	m_blockData.resize(m_blockData.size() + 8, 0); // padding
+	m_blockOffsets.build_from(offsets);
+	return m_blockOffsets.mem_size() + m_blockData.size();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+ullong ZipIntStore::offsetValue(size_t recIdx) const {
+	if (m_blockRows) {
+		return blockValue(recIdx);
+	}
+	if (m_fd >= 0) { // m_dedup is empty if the per row vector is dedup
+		ullong x = preadBits(recIdx);
+		return m_dedup.size() ? m_dedup.get(size_t(x)) : x;
+	}
 	if (m_index.size()) {
 		size_t idx = m_index.get(recIdx);
 		assert(idx < m_dedup.size());
-		Int iValue = Int(m_minValue + m_dedup.get(idx));
-		unaligned_save<Int>(key->grow_no_init(sizeof(Int)), iValue);
-	}
-	else {
-		Int iValue = Int(m_minValue + m_dedup.get(recIdx));
-		unaligned_save<Int>(key->grow_no_init(sizeof(Int)), iValue);
+		return m_dedup.get(idx);
 	}
+	return m_dedup.get(recIdx);
 }
 
-void ZipIntStore::getValueAppend(llong id, valvec<byte>* val, DbContext*) const {
-	assert(id < numDataRows());
-	assert(id >= 0);
-	size_t idx = size_t(id);
+void ZipIntStore::appendValue(ullong offset, valvec<byte>* val) const {
+	llong iValue = llong(m_minValue + offset);
 	switch (m_intType) {
 	default:
 		THROW_STD(invalid_argument, "Bad m_intType=%s", Schema::columnTypeStr(m_intType));
-	case ColumnType::Sint08: valueAppend< int8_t >(idx, val); break;
-	case ColumnType::Uint08: valueAppend<uint8_t >(idx, val); break;
-	case ColumnType::Sint16: valueAppend< int16_t>(idx, val); break;
-	case ColumnType::Uint16: valueAppend<uint16_t>(idx, val); break;
-	case ColumnType::Sint32: valueAppend< int32_t>(idx, val); break;
-	case ColumnType::Uint32: valueAppend<uint32_t>(idx, val); break;
-	case ColumnType::Sint64: valueAppend< int64_t>(idx, val); break;
-	case ColumnType::Uint64: valueAppend<uint64_t>(idx, val); break;
+	case ColumnType::Sint08: unaligned_save< int8_t >(val->grow_no_init(1), iValue); break;
+	case ColumnType::Uint08: unaligned_save<uint8_t >(val->grow_no_init(1), iValue); break;
+	case ColumnType::Sint16: unaligned_save< int16_t>(val->grow_no_init(2), iValue); break;
+	case ColumnType::Uint16: unaligned_save<uint16_t>(val->grow_no_init(2), iValue); break;
+	case ColumnType::Sint32: unaligned_save< int32_t>(val->grow_no_init(4), iValue); break;
+	case ColumnType::Uint32: unaligned_save<uint32_t>(val->grow_no_init(4), iValue); break;
+	case ColumnType::Sint64: unaligned_save< int64_t>(val->grow_no_init(8), iValue); break;
+	case ColumnType::Uint64: unaligned_save<uint64_t>(val->grow_no_init(8), iValue); break;
 	case ColumnType::VarSint: {
 		byte  buf[16];
-		byte* end = save_var_int64(buf, int64_t(m_minValue + m_dedup.get(idx)));
+		byte* end = save_var_int64(buf, int64_t(iValue));
 		val->append(buf, end - buf);
 		break; }
 	case ColumnType::VarUint: {
 		byte  buf[16];
-		byte* end = save_var_uint64(buf, uint64_t(m_minValue + m_dedup.get(idx)));
+		byte* end = save_var_uint64(buf, uint64_t(iValue));
 		val->append(buf, end - buf);
 		break; }
 	}
 }
 
+void ZipIntStore::getValueAppend(llong id, valvec<byte>* val, DbContext*) const {
+	assert(id < numDataRows());
+	assert(id >= 0);
+	appendValue(offsetValue(size_t(id)), val);
+}
+
+void ZipIntStore::adviseWillNeed(llong beg, llong end) const {
+	if (m_fd >= 0) {
+		end = std::min(end, llong(m_preadRows));
+		if (beg >= end)
+			return;
+		size_t begByte, endByte;
+		if (m_blockRows) {
+			begByte = m_blockOffsets.get(size_t(beg) / BlockSize);
+			endByte = m_blockOffsets.get((size_t(end) + BlockSize - 1) / BlockSize);
+		} else {
+			begByte = size_t(beg) * m_preadBits / 8;
+			endByte = (size_t(end) * m_preadBits + 7) / 8;
+		}
+		PreadPool::instance().prefetch(m_fileId, m_fd
+			, m_preadBase + begByte, endByte - begByte);
+		return;
+	}
+	if (m_blockRows) {
+		end = std::min(end, llong(m_blockRows));
+		if (beg < end) {
+			size_t begByte = m_blockOffsets.get(size_t(beg) / BlockSize);
+			size_t endByte = m_blockOffsets.get((size_t(end) + BlockSize - 1) / BlockSize);
+			adviseWillNeedMem(m_blockData.data() + begByte, endByte - begByte);
+		}
+		return;
+	}
+	// m_dedup is small when m_index is used, it is hot in most cases
+	const UintVecMin0& vec = m_index.size() ? m_index : m_dedup;
+	end = std::min(end, llong(vec.size()));
+	if (beg < end) {
+		size_t bits = vec.uintbits();
+		size_t begByte = size_t(beg) * bits / 8;
+		size_t endByte = (size_t(end) * bits + 7) / 8;
+		adviseWillNeedMem(vec.data() + begByte, endByte - begByte);
+	}
+}
+
+// the block offset is prefetched for block codec, the block is decoded
+// on fetch, prefetching it needs the offset which is a cache miss
+void ZipIntStore::prefetchRecord(llong id) const {
+	if (m_fd >= 0) {
+		adviseWillNeed(id, id + 1);
+		return;
+	}
+	const UintVecMin0& vec = m_blockRows ? m_blockOffsets
+						   : m_index.size() ? m_index : m_dedup;
+	size_t i = m_blockRows ? size_t(id) / BlockSize : size_t(id);
+	if (i < vec.size()) {
+		prefetchMem(vec.data() + i * vec.uintbits() / 8);
+	}
+}
+
+// decodes a whole block once for BlockSize rows
+class ZipIntStore::MyStoreIterBase : public StoreIterator {
+protected:
+	size_t m_id;
+	size_t m_blockIdx;
+	ullong m_offsets[BlockSize];
+
+	MyStoreIterBase(const ZipIntStore* store) {
+		m_store.reset(const_cast<ZipIntStore*>(store));
+		m_blockIdx = size_t(-1);
+	}
+	const ZipIntStore* store() const {
+		return static_cast<const ZipIntStore*>(m_store.get());
+	}
+	void getValue(size_t id, valvec<byte>* val) {
+		auto zis = store();
+		size_t blockIdx = id / BlockSize;
+		if (blockIdx != m_blockIdx) {
+			zis->decodeBlock(blockIdx, m_offsets);
+			m_blockIdx = blockIdx;
+		}
+		val->erase_all();
+		zis->appendValue(m_offsets[id % BlockSize], val);
+	}
+public:
+	bool seekExact(llong id, valvec<byte>* val) override {
+		if (id < 0 || id >= llong(store()->m_blockRows)) {
+			return false;
+		}
+		getValue(size_t(id), val);
+		m_id = size_t(id);
+		return true;
+	}
+};
+
+class ZipIntStore::MyStoreIterForward : public MyStoreIterBase {
+public:
+	MyStoreIterForward(const ZipIntStore* store) : MyStoreIterBase(store) {
+		m_id = 0;
+	}
+	bool increment(llong* id, valvec<byte>* val) override {
+		if (m_id < store()->m_blockRows) {
+			getValue(m_id, val);
+			*id = m_id++;
+			return true;
+		}
+		return false;
+	}
+	bool seekExact(llong id, valvec<byte>* val) override {
+		if (MyStoreIterBase::seekExact(id, val)) {
+			m_id++;
+			return true;
+		}
+		return false;
+	}
+	void reset() override {
+		m_id = 0;
+	}
+};
+
+class ZipIntStore::MyStoreIterBackward : public MyStoreIterBase {
+public:
+	MyStoreIterBackward(const ZipIntStore* store) : MyStoreIterBase(store) {
+		m_id = store->m_blockRows;
+	}
+	bool increment(llong* id, valvec<byte>* val) override {
+		if (m_id > 0) {
+			getValue(--m_id, val);
+			*id = m_id;
+			return true;
+		}
+		return false;
+	}
+	void reset() override {
+		m_id = store()->m_blockRows;
+	}
+};
+
 StoreIterator* ZipIntStore::createStoreIterForward(DbContext*) const {
+	if (m_blockRows)
+		return new MyStoreIterForward(this);
 	return nullptr; // not needed
 }
 
 StoreIterator* ZipIntStore::createStoreIterBackward(DbContext*) const {
+	if (m_blockRows)
+		return new MyStoreIterBackward(this);
 	return nullptr; // not needed
 }
 
@@ -117,6 +583,15 @@ void ZipIntStore::zipValues(const void* data, size_t size) {
 	size_t indexBits = terark_bsr_u32(dedup.size()-1) + 1;
 	size_t indexSize = (indexBits      * rows         + 7) / 8;
 	size_t dedupSize = (dup.uintbits() * dedup.size() + 7) / 8;
+	size_t blockSize = zipBlocks(dup);
+	if (blockSize < std::min(dedupSize + indexSize, dup.mem_size())) {
+		m_blockRows = rows;
+		m_dedup.clear();
+		return;
+	}
+	m_blockOffsets.clear();
+	m_blockData.clear();
+	m_blockRows = 0;
 	if (dedupSize + indexSize < dup.mem_size()) {
 		valvec<uint32_t> index(rows, valvec_no_init());
 		for(size_t i = 0; i < rows; ++i) {
@@ -179,11 +654,12 @@ namespace {
 	struct ZipIntStoreHeader {
 		uint32_t rows;
 		uint32_t uniqNum;
-		uint8_t  intBits;
+		uint8_t  intBits; // bits of block offsets if useBlocks
 		uint8_t  intType;
-		uint16_t padding1;
+		uint8_t  useBlocks;
+		uint8_t  padding1;
 		uint32_t padding2;
-		uint64_t padding3;
+		uint64_t blockDataSize;
 		 int64_t minValue;
 	};
 	BOOST_STATIC_ASSERT(sizeof(ZipIntStoreHeader) == 32);
@@ -191,14 +667,93 @@ namespace {
 
 TERARK_DB_REGISTER_STORE("zint", ZipIntStore);
 
+// reads num x bits from the file into vec, which owns the memory
+static void
+preadUintVec(intptr_t fd, llong offset, size_t num, size_t bits,
+			 UintVecMin0* vec, const std::string& fpath) {
+	vec->risk_set_data(nullptr, num, bits); // just for mem_size
+	size_t bytes = vec->mem_size();
+	byte*  data = (byte*)malloc(bytes);
+	if (NULL == data) {
+		vec->risk_release_ownership();
+		throw std::bad_alloc();
+	}
+	vec->risk_set_data(data, num, bits);
+	if (PreadPool::preadFull(fd, offset, data, bytes) != bytes) {
+		THROW_STD(invalid_argument, "bad zint file: %s", fpath.c_str());
+	}
+}
+
+void ZipIntStore::loadByPread(PathRef fpath) {
+	std::string fname = fpath.string();
+	m_fpath = fname;
+#if defined(_MSC_VER)
+	m_fd = ::_open(fname.c_str(), _O_RDONLY | _O_BINARY);
+#else
+	m_fd = ::open(fname.c_str(), O_RDONLY);
+#endif
+	if (m_fd < 0) {
+		THROW_STD(runtime_error, "open(%s, O_RDONLY) = %s"
+			, fname.c_str(), strerror(errno));
+	}
+	ZipIntStoreHeader header;
+	if (PreadPool::preadFull(m_fd, 0, &header, sizeof(header)) != sizeof(header)) {
+		closeFile();
+		THROW_STD(invalid_argument, "bad zint file: %s", fname.c_str());
+	}
+	size_t rows = header.rows;
+	m_intType = ColumnType(header.intType);
+	m_minValue  = header.minValue;
+	m_preadRows = rows;
+	llong offset = sizeof(header);
+	try {
+		if (header.useBlocks) {
+			size_t blocks = (rows + BlockSize - 1) / BlockSize;
+			preadUintVec(m_fd, offset, blocks + 1, header.intBits, &m_blockOffsets, fname);
+			m_preadBase = offset + m_blockOffsets.mem_size();
+			m_preadSize = size_t(header.blockDataSize);
+			m_blockRows = rows;
+		}
+		else if (header.uniqNum != rows) {
+			assert(header.uniqNum < rows);
+			preadUintVec(m_fd, offset, header.uniqNum, header.intBits, &m_dedup, fname);
+			m_preadBase = offset + m_dedup.mem_size();
+			m_preadBits = terark_bsr_u32(header.uniqNum - 1) + 1;
+			m_preadSize = (rows * m_preadBits + 7) / 8;
+		}
+		else {
+			m_preadBase = offset;
+			m_preadBits = header.intBits;
+			m_preadSize = (rows * m_preadBits + 7) / 8;
+		}
+	}
+	catch (const std::exception&) {
+		closeFile();
+		throw;
+	}
+	m_fileId = PreadPool::newFileId();
+}
+
 void ZipIntStore::load(PathRef fpath) {
 	assert(fstring(fpath.string()).endsWith(".zint"));
+	if (m_schema.m_usePread) {
+		loadByPread(fpath);
+		return;
+	}
 	bool writable = false;
 	m_mmapBase = (byte_t*)mmap_load(fpath.string(), &m_mmapSize, writable, m_schema.m_mmapPopulate);
 	auto header = (const ZipIntStoreHeader*)m_mmapBase;
 	size_t rows = header->rows;
 	m_intType = ColumnType(header->intType);
 	m_minValue  = header->minValue;
+	if (header->useBlocks) {
+		size_t blocks = (rows + BlockSize - 1) / BlockSize;
+		m_blockOffsets.risk_set_data((byte*)(header+1), blocks + 1, header->intBits);
+		auto blockData = (byte*)(header+1) + m_blockOffsets.mem_size();
+		m_blockData.risk_set_data(blockData, size_t(header->blockDataSize));
+		m_blockRows = rows;
+		return;
+	}
 	m_dedup.risk_set_data((byte*)(header+1), header->uniqNum, header->intBits);
 	if (header->uniqNum != rows) {
 		assert(header->uniqNum < rows);
@@ -210,6 +765,13 @@ void ZipIntStore::load(PathRef fpath) {
 
 void ZipIntStore::save(PathRef path) const {
 	auto fpath = path + ".zint";
+	if (m_fd >= 0) { // block data is not in memory
+		if (fpath != m_fpath) {
+			boost::filesystem::copy_file(m_fpath, fpath,
+				boost::filesystem::copy_option::overwrite_if_exists);
+		}
+		return;
+	}
 	NativeDataOutput<FileStream> dio;
 	dio.open(fpath.string().c_str(), "wb");
 	ZipIntStoreHeader header;
@@ -217,10 +779,18 @@ void ZipIntStore::save(PathRef path) const {
 	header.uniqNum = m_dedup.size();
 	header.intBits = byte(m_dedup.uintbits());
 	header.intType = byte(m_intType);
+	header.useBlocks = m_blockRows ? 1 : 0;
 	header.padding1 = 0;
 	header.padding2 = 0;
-	header.padding3 = 0;
+	header.blockDataSize = m_blockData.size();
 	header.minValue = int64_t(m_minValue);
+	if (m_blockRows) {
+		header.intBits = byte(m_blockOffsets.uintbits());
+		dio.ensureWrite(&header, sizeof(header));
+		dio.ensureWrite(m_blockOffsets.data(), m_blockOffsets.mem_size());
+		dio.ensureWrite(m_blockData.data(), m_blockData.size());
+		return;
+	}
 	dio.ensureWrite(&header, sizeof(header));
 	dio.ensureWrite(m_dedup.data(), m_dedup.mem_size());
 	dio.ensureWrite(m_index.data(), m_index.mem_size());
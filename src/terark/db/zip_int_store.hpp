@@ -7,7 +7,20 @@
 
 namespace terark { namespace db {
 
+// Values are stored as offsets to m_minValue, by one of:
+//   1. m_dedup: global bit packing
+//   2. m_dedup + m_index: sorted unique values and per row index
+//   3. blocks of BlockSize rows, each block is frame of reference or
+//      delta coded with its own bit width and patched exceptions,
+//      good for timestamps, counters and auto increment ids
+// the smallest one is chosen by build.
+// With "usePread" of the colgroup, block offsets and the dedup values of
+// m_index are loaded in memory, block data and the per row vector are read
+// by PreadPool instead of mmap.
 class TERARK_DB_DLL ZipIntStore : public ReadableStore {
+	class MyStoreIterBase;
+	class MyStoreIterForward;
+	class MyStoreIterBackward;
 public:
 	explicit ZipIntStore(const Schema& schema);
 	~ZipIntStore();
@@ -18,22 +31,45 @@ public:
 	void getValueAppend(llong id, valvec<byte>* val, DbContext*) const override;
 	StoreIterator* createStoreIterForward(DbContext*) const override;
 	StoreIterator* createStoreIterBackward(DbContext*) const override;
+	void adviseWillNeed(llong beg, llong end) const override;
+	void prefetchRecord(llong id) const override;
 
 	void build(ColumnType intType, SortableStrVec& strVec);
 	void load(PathRef path) override;
 	void save(PathRef path) const override;
 
+	static const size_t BlockSize = 128;
+
 protected:
 	UintVecMin0 m_dedup;
 	UintVecMin0 m_index;
+	UintVecMin0 m_blockOffsets; // blocks+1 offsets into m_blockData
+	valvec<byte> m_blockData;   // has 8 bytes padding for unaligned loads
+	size_t      m_blockRows;    // 0 if blocks are not used
 	byte_t*     m_mmapBase;
 	size_t      m_mmapSize;
 	llong       m_minValue; // may be unsigned
 	ColumnType  m_intType;
 	const Schema& m_schema;
+	intptr_t    m_fd;         // >= 0 if read by PreadPool
+	llong       m_fileId;     // of PreadPool
+	llong       m_preadBase;  // file offset of block data or per row vector
+	size_t      m_preadSize;
+	size_t      m_preadRows;
+	size_t      m_preadBits;  // of per row vector
+	std::string m_fpath;
 
-	template<class Int>
-	void valueAppend(size_t recIdx, valvec<byte>* res) const;
+	const byte* blockPtr(size_t blockIdx, valvec<byte>* buf) const;
+	ullong preadBits(size_t idx) const;
+	void loadByPread(PathRef fpath);
+	void closeFile();
+
+	ullong offsetValue(size_t recIdx) const;
+	void appendValue(ullong offset, valvec<byte>* val) const;
+
+	size_t decodeBlock(size_t blockIdx, ullong* offsets) const;
+	ullong blockValue(size_t recIdx) const;
+	size_t zipBlocks(const UintVecMin0& dup);
 
 	template<class Int>
 	void zipValues(const void* data, size_t size);
@@ -0,0 +1,861 @@
+// terark_db_bench: db_bench style performance harness for terark-db
+//
+// Usage:
+//   terark_db_bench --db=/tmp/terark_db_bench
+//       --benchmarks=fillseq,readrandom,seekrandom,readseq,mixed
+//       --num=1000000 --threads=4 --json=result.json
+//
+// The table is created by dbmeta.json, which is generated from command line
+// options or copied from --schema=file.json, TableClass is forced to
+// --table_class(default MockDbTable). The first index must be a unique index
+// of one column, it is used as the benchmark key.
+
+#include <terark/db/db_table.hpp>
+#include <terark/db/db_context.hpp>
+#include <terark/db/json.hpp>
+#include <terark/io/FileStream.hpp>
+#include <terark/io/var_int.hpp>
+#include <terark/util/linebuf.hpp>
+#include <terark/util/profiling.hpp>
+#include <terark/bitmanip.hpp>
+#include <terark/num_to_str.hpp>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#undef min
+#undef max
+
+using namespace terark;
+using namespace terark::db;
+namespace fs = boost::filesystem;
+
+namespace {
+
+struct BenchOptions {
+	std::string benchmarks = "fillseq,fillrandom,overwrite,readrandom,"
+							 "readmissing,seekrandom,readseq,readreverse,"
+							 "regex,mixed";
+	std::string db = "/tmp/terark_db_bench";
+	std::string schema; // optional dbmeta.json template
+	std::string tableClass = "MockDbTable";
+	std::string jsonOut; // "-" means stdout
+	std::string regex = "^0*[1-9]*7$";
+	std::string maxWrSegSize = "32M";
+	std::string compressMem = "64M";
+	llong num = 100000;
+	llong reads = -1; // -1 means same as num
+	llong seekNexts = 0;
+	llong regexOps = 10;
+	int   threads = 1;
+	int   valueSize = 100;
+	int   readPercent = 90; // for mixed
+	int   seed = 301;
+	bool  useExistingDb = false;
+};
+
+// log-linear histogram of latencies in nanoseconds, 16 sub buckets per
+// power of two, relative error is less than 1/16
+class Histogram {
+	static const size_t SubBits = 4;
+	static const size_t SubNum = size_t(1) << SubBits;
+	static const size_t BucketNum = SubNum + (64 - SubBits) * SubNum;
+	llong m_buckets[BucketNum];
+	llong m_cnt;
+	llong m_sum;
+	llong m_min;
+	llong m_max;
+
+	static size_t bucketOf(ullong v) {
+		if (v < SubNum)
+			return size_t(v);
+		size_t e = 63 - fast_clz64(v); // e >= SubBits
+		size_t sub = size_t(v >> (e - SubBits)) & (SubNum - 1);
+		return SubNum + (e - SubBits) * SubNum + sub;
+	}
+	static ullong bucketLower(size_t idx) {
+		if (idx < SubNum)
+			return idx;
+		size_t e = (idx - SubNum) / SubNum + SubBits;
+		size_t sub = (idx - SubNum) % SubNum;
+		return (ullong(SubNum) + sub) << (e - SubBits);
+	}
+	static ullong bucketUpper(size_t idx) {
+		if (idx + 1 < BucketNum)
+			return bucketLower(idx + 1);
+		return ullong(-1);
+	}
+
+public:
+	Histogram() { clear(); }
+	void clear() {
+		memset(m_buckets, 0, sizeof(m_buckets));
+		m_cnt = 0;
+		m_sum = 0;
+		m_min = LLONG_MAX;
+		m_max = 0;
+	}
+	void add(llong ns) {
+		if (ns < 0)
+			ns = 0;
+		m_buckets[bucketOf(ullong(ns))]++;
+		m_cnt++;
+		m_sum += ns;
+		m_min = std::min(m_min, ns);
+		m_max = std::max(m_max, ns);
+	}
+	void merge(const Histogram& y) {
+		for (size_t i = 0; i < BucketNum; ++i)
+			m_buckets[i] += y.m_buckets[i];
+		m_cnt += y.m_cnt;
+		m_sum += y.m_sum;
+		m_min = std::min(m_min, y.m_min);
+		m_max = std::max(m_max, y.m_max);
+	}
+	llong count() const { return m_cnt; }
+	double average() const { return m_cnt ? double(m_sum) / m_cnt : 0.0; }
+	llong min() const { return m_cnt ? m_min : 0; }
+	llong max() const { return m_max; }
+	double percentile(double p) const {
+		if (0 == m_cnt)
+			return 0.0;
+		double threshold = m_cnt * (p / 100.0);
+		llong cumulative = 0;
+		for (size_t i = 0; i < BucketNum; ++i) {
+			cumulative += m_buckets[i];
+			if (cumulative >= threshold) {
+				// linear interpolation inside the bucket
+				double lo = double(bucketLower(i));
+				double hi = double(bucketUpper(i));
+				double left = double(cumulative - m_buckets[i]);
+				double pos = m_buckets[i] ? (threshold - left) / m_buckets[i] : 0;
+				double r = lo + (hi - lo) * pos;
+				r = std::max(r, double(m_min));
+				r = std::min(r, double(m_max));
+				return r;
+			}
+		}
+		return double(m_max);
+	}
+};
+
+struct BgStatSnapshot {
+	llong cnt[4];
+	llong nsTime[4];
+	static const char* name(size_t i) {
+		static const char* names[] = { "flush", "convert", "merge", "purge" };
+		return names[i];
+	}
+	void take(const DbTable* tab) {
+		const DbTable::BgTaskStat* stats[4] = {
+			&tab->m_flushStat, &tab->m_convStat,
+			&tab->m_mergeStat, &tab->m_purgeStat,
+		};
+		for (size_t i = 0; i < 4; ++i) {
+			cnt[i] = stats[i]->cnt;
+			nsTime[i] = stats[i]->nsTime;
+		}
+	}
+};
+
+struct ThreadState {
+	int tid;
+	std::mt19937_64 rand;
+	DbContextPtr ctx;
+	Histogram hist;
+	llong ops = 0;
+	llong bytes = 0;
+	llong found = 0;
+	llong reads = 0;
+	llong writes = 0;
+	std::string errMsg;
+	// buffers for generating rows and keys, DbContext buffers are used
+	// by DbTable internally, so they can not be used here
+	valvec<byte> key;
+	valvec<byte> colData;
+	valvec<uint32_t> offsets;
+	ColumnVec cols;
+	ThreadState(int id, int seed) : tid(id), rand(seed + id) {}
+};
+
+class Benchmark {
+	const BenchOptions& m_opt;
+	DbTablePtr m_tab;
+	size_t m_keyIndexId = 0;
+	size_t m_keyColumnId = 0;
+	std::string m_randomData; // source of column content
+	profiling m_pf;
+	json m_results = json::array();
+
+	// column data for key number k, stored in buf
+	void makeKeyCol(llong k, valvec<byte>* buf) const {
+		const Schema& rowSchema = m_tab->rowSchema();
+		const ColumnMeta& colmeta = rowSchema.getColumnMeta(m_keyColumnId);
+		buf->erase_all();
+		switch (colmeta.type) {
+		default:
+			THROW_STD(invalid_argument, "unsupported key column type: %s"
+				, Schema::columnTypeStr(colmeta.type));
+		case ColumnType::Uint08: case ColumnType::Sint08:
+		case ColumnType::Uint16: case ColumnType::Sint16:
+		case ColumnType::Uint32: case ColumnType::Sint32:
+		case ColumnType::Uint64: case ColumnType::Sint64:
+			// little endian truncation, ok for benchmark
+			buf->append((const byte*)&k, colmeta.fixedLen);
+			break;
+		case ColumnType::Float64: {
+			double d = double(k);
+			buf->append((const byte*)&d, 8);
+			break; }
+		case ColumnType::VarSint: {
+			byte tmp[10];
+			buf->append(tmp, save_var_int64(tmp, k) - tmp);
+			break; }
+		case ColumnType::VarUint: {
+			byte tmp[10];
+			buf->append(tmp, save_var_uint64(tmp, ullong(k)) - tmp);
+			break; }
+		case ColumnType::Fixed: {
+			char tmp[32];
+			int len = snprintf(tmp, sizeof(tmp), "%016lld", k);
+			buf->resize(colmeta.fixedLen, '0');
+			size_t n = std::min<size_t>(len, colmeta.fixedLen);
+			memcpy(buf->end() - n, tmp + len - n, n);
+			break; }
+		case ColumnType::StrZero:
+		case ColumnType::Binary:
+		case ColumnType::CarBin: {
+			char tmp[32];
+			int len = snprintf(tmp, sizeof(tmp), "%016lld", k);
+			buf->append(tmp, len);
+			break; }
+		}
+	}
+
+	void makeRandomCol(const ColumnMeta& colmeta, std::mt19937_64& rand,
+					   valvec<byte>* buf) const {
+		auto slice = [&](size_t len) {
+			size_t pos = size_t(rand() % (m_randomData.size() - len));
+			buf->append(m_randomData.data() + pos, len);
+		};
+		switch (colmeta.type) {
+		default:
+			THROW_STD(invalid_argument, "unsupported column type: %s"
+				, Schema::columnTypeStr(colmeta.type));
+		case ColumnType::Uint08: case ColumnType::Sint08:
+		case ColumnType::Uint16: case ColumnType::Sint16:
+		case ColumnType::Uint32: case ColumnType::Sint32:
+		case ColumnType::Uint64: case ColumnType::Sint64: {
+			ullong x = rand();
+			buf->append((const byte*)&x, colmeta.fixedLen);
+			break; }
+		case ColumnType::Uint128: case ColumnType::Sint128: {
+			ullong x[2] = { rand(), rand() };
+			buf->append((const byte*)x, 16);
+			break; }
+		case ColumnType::Float32: {
+			float f = float(rand() % 1000000) / 100;
+			buf->append((const byte*)&f, 4);
+			break; }
+		case ColumnType::Float64: {
+			double d = double(rand() % 100000000) / 100;
+			buf->append((const byte*)&d, 8);
+			break; }
+		case ColumnType::Uuid:
+		case ColumnType::Fixed:
+			slice(colmeta.fixedLen);
+			break;
+		case ColumnType::VarSint: {
+			byte tmp[10];
+			buf->append(tmp, save_var_int64(tmp, llong(rand() >> 20)) - tmp);
+			break; }
+		case ColumnType::VarUint: {
+			byte tmp[10];
+			buf->append(tmp, save_var_uint64(tmp, rand() >> 20) - tmp);
+			break; }
+		case ColumnType::StrZero:
+		case ColumnType::Binary:
+		case ColumnType::CarBin:
+			slice(m_opt.valueSize);
+			break;
+		}
+	}
+
+	void makeRow(llong k, ThreadState& ts, valvec<byte>* row) {
+		const Schema& rowSchema = m_tab->rowSchema();
+		const size_t colnum = rowSchema.columnNum();
+		auto& coldata = ts.colData;
+		auto& offsets = ts.offsets;
+		coldata.erase_all();
+		offsets.resize_no_init(colnum + 1);
+		for (size_t i = 0; i < colnum; ++i) {
+			offsets[i] = uint32_t(coldata.size());
+			if (i == m_keyColumnId) {
+				makeKeyCol(k, &ts.key);
+				coldata.append(ts.key);
+			} else {
+				makeRandomCol(rowSchema.getColumnMeta(i), ts.rand, &coldata);
+			}
+		}
+		offsets[colnum] = uint32_t(coldata.size());
+		ColumnVec& cols = ts.cols;
+		cols.erase_all();
+		cols.m_base = coldata.data();
+		for (size_t i = 0; i < colnum; ++i) {
+			cols.push_back(offsets[i], offsets[i+1] - offsets[i]);
+		}
+		rowSchema.combineRow(cols, row);
+	}
+
+	llong numReads() const {
+		return m_opt.reads < 0 ? m_opt.num : m_opt.reads;
+	}
+
+	template<class OneOp>
+	void runThreads(int threadNum, OneOp op,
+					std::vector<std::unique_ptr<ThreadState> >* states) {
+		for (int i = 0; i < threadNum; ++i) {
+			states->emplace_back(new ThreadState(i, m_opt.seed));
+			states->back()->ctx = m_tab->createDbContext();
+		}
+		if (1 == threadNum) {
+			op(*(*states)[0]);
+			return;
+		}
+		std::vector<std::thread> thr;
+		for (int i = 0; i < threadNum; ++i) {
+			ThreadState* ts = (*states)[i].get();
+			thr.emplace_back([ts,&op]() { op(*ts); });
+		}
+		for (auto& t : thr) t.join();
+	}
+
+	// operations
+	void doWrite(ThreadState& ts, bool seq, bool upsert, llong ops) {
+		valvec<byte> row;
+		for (llong i = 0; i < ops; ++i) {
+			llong k = seq ? i : llong(ts.rand() % m_opt.num);
+			makeRow(k, ts, &row);
+			llong t0 = m_pf.now();
+			llong recId = upsert ? ts.ctx->upsertRow(row) : ts.ctx->insertRow(row);
+			ts.hist.add(m_pf.ns(t0, m_pf.now()));
+			if (recId < 0 && ts.errMsg.empty()) {
+				ts.errMsg = ts.ctx->errMsg;
+			}
+			ts.ops++;
+			ts.writes++;
+			ts.bytes += row.size();
+		}
+	}
+	// upsert keys which are already in the table, keys not written by a
+	// fill benchmark are skipped, the existence lookup is not timed
+	void doOverwrite(ThreadState& ts, llong ops) {
+		valvec<byte> row;
+		valvec<llong> recIdvec;
+		for (llong i = 0; i < ops; ++i) {
+			llong k = llong(ts.rand() % m_opt.num);
+			makeKeyCol(k, &ts.key);
+			ts.ctx->indexSearchExact(m_keyIndexId, ts.key, &recIdvec);
+			if (recIdvec.empty())
+				continue;
+			makeRow(k, ts, &row);
+			llong t0 = m_pf.now();
+			llong recId = ts.ctx->upsertRow(row);
+			ts.hist.add(m_pf.ns(t0, m_pf.now()));
+			if (recId < 0 && ts.errMsg.empty()) {
+				ts.errMsg = ts.ctx->errMsg;
+			}
+			ts.found++;
+			ts.ops++;
+			ts.writes++;
+			ts.bytes += row.size();
+		}
+	}
+	void doReadRandom(ThreadState& ts, bool missing) {
+		valvec<byte> val;
+		valvec<llong> recIdvec;
+		for (llong i = 0, n = numReads(); i < n; ++i) {
+			llong k = llong(ts.rand() % m_opt.num);
+			if (missing)
+				k += m_opt.num; // out of the written key range
+			makeKeyCol(k, &ts.key);
+			llong t0 = m_pf.now();
+			ts.ctx->indexSearchExact(m_keyIndexId, ts.key, &recIdvec);
+			if (!recIdvec.empty()) {
+				ts.ctx->getValue(recIdvec[0], &val);
+				ts.found++;
+				ts.bytes += val.size();
+			}
+			ts.hist.add(m_pf.ns(t0, m_pf.now()));
+			ts.ops++;
+			ts.reads++;
+		}
+	}
+	void doSeekRandom(ThreadState& ts) {
+		valvec<byte> key;
+		IndexIteratorPtr iter = m_tab->createIndexIterForward(m_keyIndexId, ts.ctx.get());
+		for (llong i = 0, n = numReads(); i < n; ++i) {
+			llong k = llong(ts.rand() % m_opt.num);
+			makeKeyCol(k, &ts.key);
+			llong recId = -1;
+			llong t0 = m_pf.now();
+			int ret = iter->seekLowerBound(ts.key, &recId, &key);
+			if (ret >= 0) {
+				ts.found += (0 == ret);
+				for (llong j = 0; j < m_opt.seekNexts; ++j) {
+					if (!iter->increment(&recId, &key))
+						break;
+				}
+			}
+			ts.hist.add(m_pf.ns(t0, m_pf.now()));
+			ts.ops++;
+			ts.reads++;
+		}
+	}
+	void doScan(ThreadState& ts, bool forward) {
+		valvec<byte> val;
+		StoreIteratorPtr iter = forward ? ts.ctx->createTableIterForward()
+										: ts.ctx->createTableIterBackward();
+		llong recId = -1;
+		llong t0 = m_pf.now();
+		while (iter->increment(&recId, &val)) {
+			llong t1 = m_pf.now();
+			ts.hist.add(m_pf.ns(t0, t1));
+			t0 = t1;
+			ts.ops++;
+			ts.reads++;
+			ts.found++;
+			ts.bytes += val.size();
+		}
+	}
+	void doRegex(ThreadState& ts, std::string* impl) {
+		valvec<llong> recIdvec;
+		valvec<byte> key;
+		const std::regex re(m_opt.regex);
+		for (llong i = 0; i < m_opt.regexOps; ++i) {
+			llong t0 = m_pf.now();
+			recIdvec.erase_all();
+			bool native = false;
+			try {
+				native = ts.ctx->indexMatchRegex(m_keyIndexId,
+									m_opt.regex, fstring(), &recIdvec);
+			}
+			catch (const std::invalid_argument&) {
+				// table class has no native regex support
+			}
+			if (native) {
+				*impl = "native";
+			}
+			else {
+				// fallback: linear scan of the key index
+				*impl = "index-scan";
+				IndexIteratorPtr iter = m_tab->createIndexIterForward(m_keyIndexId, ts.ctx.get());
+				llong recId = -1;
+				while (iter->increment(&recId, &key)) {
+					if (std::regex_search((const char*)key.begin(),
+										  (const char*)key.end(), re))
+						recIdvec.push_back(recId);
+				}
+			}
+			ts.hist.add(m_pf.ns(t0, m_pf.now()));
+			ts.found += recIdvec.size();
+			ts.ops++;
+			ts.reads++;
+		}
+	}
+	void doMixed(ThreadState& ts) {
+		valvec<byte> row, val;
+		valvec<llong> recIdvec;
+		for (llong i = 0, n = numReads(); i < n; ++i) {
+			llong k = llong(ts.rand() % m_opt.num);
+			bool isRead = int(ts.rand() % 100) < m_opt.readPercent;
+			llong t0;
+			if (isRead) {
+				makeKeyCol(k, &ts.key);
+				t0 = m_pf.now();
+				ts.ctx->indexSearchExact(m_keyIndexId, ts.key, &recIdvec);
+				if (!recIdvec.empty()) {
+					ts.ctx->getValue(recIdvec[0], &val);
+					ts.found++;
+					ts.bytes += val.size();
+				}
+				ts.reads++;
+			}
+			else {
+				makeRow(k, ts, &row);
+				t0 = m_pf.now();
+				ts.ctx->upsertRow(row);
+				ts.bytes += row.size();
+				ts.writes++;
+			}
+			ts.hist.add(m_pf.ns(t0, m_pf.now()));
+			ts.ops++;
+		}
+	}
+
+	void report(const std::string& name, int threadNum, llong nsElapsed,
+				const std::vector<std::unique_ptr<ThreadState> >& states,
+				const BgStatSnapshot& bg0, const BgStatSnapshot& bg1,
+				const std::string& note) {
+		Histogram hist;
+		llong ops = 0, bytes = 0, found = 0, reads = 0, writes = 0;
+		std::string errMsg;
+		for (auto& ts : states) {
+			hist.merge(ts->hist);
+			ops += ts->ops;
+			bytes += ts->bytes;
+			found += ts->found;
+			reads += ts->reads;
+			writes += ts->writes;
+			if (errMsg.empty())
+				errMsg = ts->errMsg;
+		}
+		double sec = nsElapsed / 1e9;
+		double opsPerSec = sec > 0 ? ops / sec : 0;
+		double mbPerSec = sec > 0 ? bytes / 1048576.0 / sec : 0;
+		printf("%-12s : %11.3f micros/op; %10.1f ops/sec; %7.1f MB/s; %lld ops"
+			, name.c_str(), ops ? nsElapsed / 1e3 * threadNum / ops : 0.0
+			, opsPerSec, mbPerSec, ops);
+		if (reads)
+			printf("; (%lld of %lld found)", found, reads);
+		if (!note.empty())
+			printf("; %s", note.c_str());
+		printf("\n");
+		printf("%-12s   latency(us): avg %.3f p50 %.3f p99 %.3f p999 %.3f max %.3f\n"
+			, "", hist.average() / 1e3
+			, hist.percentile(50.0) / 1e3
+			, hist.percentile(99.0) / 1e3
+			, hist.percentile(99.9) / 1e3
+			, hist.max() / 1e3);
+		json bg = json::object();
+		for (size_t i = 0; i < 4; ++i) {
+			llong cnt = bg1.cnt[i] - bg0.cnt[i];
+			llong nsTime = bg1.nsTime[i] - bg0.nsTime[i];
+			if (cnt)
+				printf("%-12s   background %-7s: %lld tasks, %.3f sec\n"
+					, "", BgStatSnapshot::name(i), cnt, nsTime / 1e9);
+			json one = json::object();
+			one["count"] = cnt;
+			one["seconds"] = nsTime / 1e9;
+			bg[BgStatSnapshot::name(i)] = one;
+		}
+		if (!errMsg.empty())
+			printf("%-12s   first error: %s\n", "", errMsg.c_str());
+		fflush(stdout);
+
+		json lat = json::object();
+		lat["count"] = hist.count();
+		lat["avg_us"] = hist.average() / 1e3;
+		lat["min_us"] = hist.min() / 1e3;
+		lat["p50_us"] = hist.percentile(50.0) / 1e3;
+		lat["p99_us"] = hist.percentile(99.0) / 1e3;
+		lat["p999_us"] = hist.percentile(99.9) / 1e3;
+		lat["max_us"] = hist.max() / 1e3;
+		json res = json::object();
+		res["name"] = name;
+		res["threads"] = threadNum;
+		res["ops"] = ops;
+		res["reads"] = reads;
+		res["writes"] = writes;
+		res["found"] = found;
+		res["bytes"] = bytes;
+		res["seconds"] = sec;
+		res["ops_per_sec"] = opsPerSec;
+		res["mb_per_sec"] = mbPerSec;
+		res["latency"] = lat;
+		res["background"] = bg;
+		if (!note.empty())
+			res["note"] = note;
+		if (!errMsg.empty())
+			res["first_error"] = errMsg;
+		m_results.push_back(res);
+	}
+
+	void runOne(const std::string& name) {
+		std::vector<std::unique_ptr<ThreadState> > states;
+		std::string note;
+		int threadNum = m_opt.threads;
+		BgStatSnapshot bg0, bg1;
+		bg0.take(m_tab.get());
+		llong t0 = m_pf.now();
+		if ("fillseq" == name) {
+			threadNum = 1;
+			runThreads(1, [&](ThreadState& ts) {
+				doWrite(ts, true, false, m_opt.num);
+			}, &states);
+		}
+		else if ("fillrandom" == name) {
+			llong ops = m_opt.num / threadNum;
+			runThreads(threadNum, [&](ThreadState& ts) {
+				doWrite(ts, false, true, ops);
+			}, &states);
+		}
+		else if ("overwrite" == name) {
+			llong ops = m_opt.num / threadNum;
+			runThreads(threadNum, [&](ThreadState& ts) {
+				doOverwrite(ts, ops);
+			}, &states);
+			llong overwritten = 0;
+			for (auto& ts : states)
+				overwritten += ts->ops;
+			if (0 == overwritten) {
+				fprintf(stderr, "WARN: overwrite: no existing keys, run a fill benchmark first\n");
+			}
+			note = "existing keys only, skipped=" + std::to_string(ops * threadNum - overwritten);
+		}
+		else if ("readrandom" == name || "readmissing" == name) {
+			bool missing = "readmissing" == name;
+			runThreads(threadNum, [&](ThreadState& ts) {
+				doReadRandom(ts, missing);
+			}, &states);
+		}
+		else if ("seekrandom" == name) {
+			runThreads(threadNum, [&](ThreadState& ts) {
+				doSeekRandom(ts);
+			}, &states);
+		}
+		else if ("readseq" == name || "readreverse" == name) {
+			bool forward = "readseq" == name;
+			runThreads(threadNum, [&](ThreadState& ts) {
+				doScan(ts, forward);
+			}, &states);
+		}
+		else if ("regex" == name) {
+			std::vector<std::string> impl(threadNum);
+			runThreads(threadNum, [&](ThreadState& ts) {
+				doRegex(ts, &impl[ts.tid]);
+			}, &states);
+			note = "impl=" + impl[0] + " regex=" + m_opt.regex;
+		}
+		else if ("mixed" == name) {
+			runThreads(threadNum, [&](ThreadState& ts) {
+				doMixed(ts);
+			}, &states);
+			note = "readPercent=" + std::to_string(m_opt.readPercent);
+		}
+		else if ("compact" == name) {
+			threadNum = 1;
+			m_tab->compact();
+		}
+		else if ("flush" == name) {
+			threadNum = 1;
+			m_tab->flush();
+		}
+		else {
+			fprintf(stderr, "WARN: unknown benchmark: %s\n", name.c_str());
+			return;
+		}
+		llong t1 = m_pf.now();
+		bg1.take(m_tab.get());
+		report(name, threadNum, m_pf.ns(t0, t1), states, bg0, bg1, note);
+	}
+
+	void prepareDir() {
+		fs::path dir = m_opt.db;
+		if (!m_opt.useExistingDb) {
+			fs::remove_all(dir);
+		}
+		fs::create_directories(dir);
+		fs::path metaFile = dir / "dbmeta.json";
+		if (m_opt.useExistingDb && fs::exists(metaFile)) {
+			return;
+		}
+		json meta;
+		if (!m_opt.schema.empty()) {
+			LineBuf alljson;
+			alljson.read_all(m_opt.schema);
+			meta = json::parse(alljson.p);
+		}
+		else {
+			meta = json::parse(R"({
+				"RowSchema": {
+					"columns": {
+						"key"  : { "type": "strzero" },
+						"value": { "type": "binary" }
+					}
+				},
+				"TableIndex": [
+					{ "fields": "key", "ordered": true, "unique": true }
+				]
+			})");
+			meta["MaxWritingSegmentSize"] = m_opt.maxWrSegSize;
+			meta["CompressingWorkMemSize"] = m_opt.compressMem;
+		}
+		meta["TableClass"] = m_opt.tableClass;
+		std::string jstr = meta.dump(2);
+		FileStream fp(metaFile.string().c_str(), "w");
+		fp.ensureWrite(jstr.data(), jstr.size());
+	}
+
+	void setupKey() {
+		if (m_tab->getIndexNum() == 0) {
+			THROW_STD(invalid_argument, "table must have at least one index");
+		}
+		const Schema& indexSchema = m_tab->getIndexSchema(m_keyIndexId);
+		if (indexSchema.columnNum() != 1 || !indexSchema.m_isUnique) {
+			THROW_STD(invalid_argument,
+				"first index must be an unique index of one column: %s"
+				, indexSchema.m_name.c_str());
+		}
+		m_keyColumnId = indexSchema.parentColumnId(0);
+	}
+
+public:
+	explicit Benchmark(const BenchOptions& opt) : m_opt(opt) {
+		std::mt19937_64 rand(opt.seed);
+		// compressible printable data, similar to leveldb db_bench
+		m_randomData.resize(1024*1024 + opt.valueSize + 64);
+		for (size_t i = 0; i < m_randomData.size(); ++i) {
+			m_randomData[i] = ' ' + char(rand() % 16 * (i % 4 ? 1 : 5));
+		}
+	}
+
+	int run() {
+		prepareDir();
+		m_tab = DbTable::open(m_opt.db);
+		setupKey();
+		printf("TableClass   : %s\n", m_opt.tableClass.c_str());
+		printf("Dir          : %s\n", m_opt.db.c_str());
+		printf("Keys         : %lld, key column: %s\n", m_opt.num
+			, m_tab->rowSchema().getColumnName(m_keyColumnId).c_str());
+		printf("Threads      : %d\n", m_opt.threads);
+		printf("------------------------------------------------\n");
+		fstring names(m_opt.benchmarks);
+		const char* beg = names.begin();
+		while (beg < names.end()) {
+			const char* end = std::find(beg, names.end(), ',');
+			std::string name(beg, end);
+			if (!name.empty())
+				runOne(name);
+			beg = end + 1;
+		}
+		BgStatSnapshot bgAll;
+		bgAll.take(m_tab.get());
+		m_tab->flush();
+		m_tab = nullptr;
+		DbTable::safeStopAndWaitForCompress();
+
+		if (!m_opt.jsonOut.empty()) {
+			json js = json::object();
+			json bg = json::object();
+			for (size_t i = 0; i < 4; ++i) {
+				json one = json::object();
+				one["count"] = bgAll.cnt[i];
+				one["seconds"] = bgAll.nsTime[i] / 1e9;
+				bg[BgStatSnapshot::name(i)] = one;
+			}
+			js["table_class"] = m_opt.tableClass;
+			js["num"] = m_opt.num;
+			js["threads"] = m_opt.threads;
+			js["value_size"] = m_opt.valueSize;
+			js["benchmarks"] = m_results;
+			js["background_total"] = bg;
+			std::string jstr = js.dump(2);
+			if ("-" == m_opt.jsonOut) {
+				printf("%s\n", jstr.c_str());
+			} else {
+				FileStream fp(m_opt.jsonOut.c_str(), "w");
+				fp.ensureWrite(jstr.data(), jstr.size());
+				fp.ensureWrite("\n", 1);
+			}
+		}
+		return 0;
+	}
+};
+
+void usage(const char* prog) {
+	fprintf(stderr, R"EOS(usage: %s [options]
+  --benchmarks=name1,name2,...
+        fillseq, fillrandom, overwrite, readrandom, readmissing,
+        seekrandom, readseq, readreverse, regex, mixed, flush, compact
+  --db=dir                table dir, default /tmp/terark_db_bench
+  --schema=file.json      dbmeta.json template, default is key/value schema
+  --table_class=name      default MockDbTable
+  --num=N                 number of keys
+  --reads=N               number of read ops per thread, default is num
+  --threads=N             threads for non-fillseq benchmarks
+  --value_size=N          length of variable length non-key columns
+  --seek_nexts=N          increments after each seek in seekrandom
+  --regex=pattern         regex applied on key index
+  --regex_ops=N           regex queries per thread
+  --read_percent=N        read ratio of mixed workload
+  --max_wrseg_size=size   MaxWritingSegmentSize for default schema
+  --compress_mem=size     CompressingWorkMemSize for default schema
+  --use_existing_db=0|1
+  --seed=N
+  --json=file             write results as json, '-' for stdout
+)EOS", prog);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+	BenchOptions opt;
+	for (int i = 1; i < argc; ++i) {
+		fstring arg(argv[i]);
+		long long n;
+		char junk;
+		auto strOpt = [&](const char* prefix, std::string* val) {
+			size_t len = strlen(prefix);
+			if (arg.startsWith(prefix)) {
+				val->assign(arg.p + len, arg.n - len);
+				return true;
+			}
+			return false;
+		};
+		auto intOpt = [&](const char* fmt, auto* val) {
+			if (sscanf(argv[i], fmt, &n, &junk) == 1) {
+				*val = n;
+				return true;
+			}
+			return false;
+		};
+		if (arg == "--help" || arg == "-h") {
+			usage(argv[0]);
+			return 0;
+		}
+		else if (strOpt("--benchmarks=", &opt.benchmarks)) {}
+		else if (strOpt("--db=", &opt.db)) {}
+		else if (strOpt("--schema=", &opt.schema)) {}
+		else if (strOpt("--table_class=", &opt.tableClass)) {}
+		else if (strOpt("--json=", &opt.jsonOut)) {}
+		else if (strOpt("--regex=", &opt.regex)) {}
+		else if (strOpt("--max_wrseg_size=", &opt.maxWrSegSize)) {}
+		else if (strOpt("--compress_mem=", &opt.compressMem)) {}
+		else if (intOpt("--num=%lld%c", &opt.num)) {}
+		else if (intOpt("--reads=%lld%c", &opt.reads)) {}
+		else if (intOpt("--seek_nexts=%lld%c", &opt.seekNexts)) {}
+		else if (intOpt("--regex_ops=%lld%c", &opt.regexOps)) {}
+		else if (intOpt("--threads=%lld%c", &opt.threads)) {}
+		else if (intOpt("--value_size=%lld%c", &opt.valueSize)) {}
+		else if (intOpt("--read_percent=%lld%c", &opt.readPercent)) {}
+		else if (intOpt("--seed=%lld%c", &opt.seed)) {}
+		else if (intOpt("--use_existing_db=%lld%c", &opt.useExistingDb)) {}
+		else {
+			fprintf(stderr, "ERROR: invalid flag: %s\n", argv[i]);
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (opt.num <= 0 || opt.threads <= 0 || opt.valueSize <= 0) {
+		fprintf(stderr, "ERROR: num, threads and value_size must be positive\n");
+		return 1;
+	}
+	try {
+		Benchmark bench(opt);
+		return bench.run();
+	}
+	catch (const std::exception& ex) {
+		fprintf(stderr, "ERROR: %s\n", ex.what());
+		return 1;
+	}
+}
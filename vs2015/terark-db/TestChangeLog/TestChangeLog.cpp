@@ -0,0 +1,145 @@
+// TestChangeLog.cpp : ChangeLog records are read back in seq order across
+// files, iterators resume from nextSeq, also after reopen, truncation and
+// a torn tail record
+//
+
+#include "stdafx.h"
+#include <terark/db/change_log.hpp>
+#include <boost/filesystem.hpp>
+#include <limits.h>
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			exit(1); \
+		} \
+	} while (0)
+
+using namespace terark;
+using namespace terark::db;
+namespace fs = boost::filesystem;
+
+static std::string dataOf(llong seq) {
+	char buf[32];
+	return std::string(buf, snprintf(buf, sizeof(buf), "row-%lld", seq));
+}
+
+// record seq has recId = seq * 10, Remove if seq % 3 == 0
+static void checkRecord(const ChangeLog::Record& rec, llong seq) {
+	CHECK(rec.seq == seq);
+	CHECK(rec.recId == seq * 10);
+	CHECK(rec.type == (seq % 3 ? ChangeLog::Upsert : ChangeLog::Remove));
+	CHECK(rec.data == dataOf(seq));
+}
+
+static void appendRecords(ChangeLog* log, llong num) {
+	for (llong i = 0; i < num; ) {
+		llong seq = log->nextSeq();
+		if (i % 50 == 0 && num - i >= 5) { // a batch of 5
+			valvec<byte> records;
+			for (llong j = 0; j < 5; ++j) {
+				llong s = seq + j;
+				ChangeLog::encode(&records,
+					s % 3 ? ChangeLog::Upsert : ChangeLog::Remove, s * 10, dataOf(s));
+			}
+			CHECK(log->appendBatch(records, 5) == seq);
+			i += 5;
+		}
+		else {
+			CHECK(log->append(seq % 3 ? ChangeLog::Upsert : ChangeLog::Remove,
+							  seq * 10, dataOf(seq)) == seq);
+			i += 1;
+		}
+	}
+}
+
+// reads up to num records, returns the seq to resume from
+static llong readRecords(ChangeLog* log, llong startSeq, llong num, llong* lastTime) {
+	ChangeLogIteratorPtr iter(log->createIterator(startSeq));
+	ChangeLog::Record rec;
+	llong seq = startSeq;
+	for (llong i = 0; i < num && iter->next(&rec); ++i) {
+		checkRecord(rec, seq++);
+		CHECK(rec.time >= *lastTime);
+		*lastTime = rec.time;
+	}
+	CHECK(iter->nextSeq() == seq);
+	return seq;
+}
+
+int main(int argc, char* argv[]) {
+	const std::string dir = argc > 1 ? argv[1] : "changelog-test";
+	const llong fileSize = 4096; // many files
+	fs::remove_all(dir);
+	llong resumeSeq, lastTime = 0;
+	{
+		ChangeLogPtr log(new ChangeLog(dir, fileSize));
+		CHECK(log->firstSeq() == 1 && log->nextSeq() == 1);
+		appendRecords(log.get(), 1000);
+		CHECK(log->nextSeq() == 1001);
+		// a consumer reads in chunks, resuming from nextSeq
+		resumeSeq = 1;
+		while (resumeSeq < 600)
+			resumeSeq = readRecords(log.get(), resumeSeq, 77, &lastTime);
+		// an iterator at the end sees records appended later
+		ChangeLogIteratorPtr iter(log->createIterator(log->nextSeq()));
+		ChangeLog::Record rec;
+		CHECK(!iter->next(&rec));
+		appendRecords(log.get(), 1);
+		CHECK(iter->next(&rec));
+		checkRecord(rec, 1001);
+		CHECK(!iter->next(&rec));
+		log->flush();
+	}
+	{
+		// resume after reopen, the log is continued
+		ChangeLogPtr log(new ChangeLog(dir, fileSize));
+		CHECK(log->firstSeq() == 1 && log->nextSeq() == 1002);
+		appendRecords(log.get(), 500);
+		resumeSeq = readRecords(log.get(), resumeSeq, LLONG_MAX, &lastTime);
+		CHECK(resumeSeq == 1502);
+
+		// seqOfTime finds the first record at or after a time
+		ChangeLogIteratorPtr iter(log->createIterator(700));
+		ChangeLog::Record rec;
+		CHECK(iter->next(&rec));
+		llong seq = log->seqOfTime(rec.time);
+		CHECK(seq <= 700);
+		iter = log->createIterator(seq);
+		ChangeLog::Record rec2;
+		CHECK(iter->next(&rec2) && rec2.time == rec.time);
+		CHECK(log->seqOfTime(0) == 1);
+		CHECK(log->seqOfTime(LLONG_MAX) == log->nextSeq());
+
+		// an iterator before truncated records jumps to the first seq
+		CHECK(log->truncateBefore(800) > 0);
+		CHECK(log->firstSeq() > 1 && log->firstSeq() <= 800);
+		iter = log->createIterator(1);
+		CHECK(iter->next(&rec));
+		checkRecord(rec, log->firstSeq());
+		log->flush();
+	}
+	{
+		// a torn tail record is removed on reopen
+		llong lastFile = -1;
+		for (auto& ent : fs::directory_iterator(dir)) {
+			llong seq = -1;
+			sscanf(ent.path().filename().string().c_str(), "%lld", &seq);
+			lastFile = std::max(lastFile, seq);
+		}
+		char fname[32];
+		snprintf(fname, sizeof(fname), "%016lld.log", lastFile);
+		fs::path fpath = fs::path(dir) / fname;
+		fs::resize_file(fpath, fs::file_size(fpath) - 3);
+		ChangeLogPtr log(new ChangeLog(dir, fileSize));
+		CHECK(log->nextSeq() == 1501);
+		appendRecords(log.get(), 1);
+		lastTime = 0;
+		llong seq = readRecords(log.get(), 1400, LLONG_MAX, &lastTime);
+		CHECK(seq == 1502);
+	}
+	fs::remove_all(dir);
+	printf("TestChangeLog passed\n");
+	return 0;
+}
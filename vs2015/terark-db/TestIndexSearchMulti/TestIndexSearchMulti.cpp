@@ -0,0 +1,148 @@
+// TestIndexSearchMulti.cpp : AND/OR of index conditions over writable and
+// readonly segments, compared with a brute force scan
+//
+
+#include "stdafx.h"
+#include <terark/db/db_table.hpp>
+#include <terark/io/DataIO.hpp>
+#include <terark/io/MemStream.hpp>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <chrono>
+#include <thread>
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			exit(1); \
+		} \
+	} while (0)
+
+struct MultiRow {
+	uint64_t id;
+	uint64_t a;
+	uint64_t b;
+	DATA_IO_LOAD_SAVE(MultiRow, &id &a &b)
+};
+
+using namespace terark;
+using namespace terark::db;
+
+// background tasks may still hold the table after syncFinishWriting, the
+// table is closed when its run.lock is removed, then it can be reopened
+static void waitForClose(const std::string& dir) {
+	for (int i = 0; i < 600 && boost::filesystem::exists(dir + "/run.lock"); ++i) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	CHECK(!boost::filesystem::exists(dir + "/run.lock"));
+}
+
+static const uint64_t ModA = 3;   // long lists
+static const uint64_t ModB = 97;  // short lists, a gallops over b
+
+static bool isRemoved(uint64_t id) { return id % 5 == 1; }
+
+static void check(DbTable* tab, DbContext* ctx, uint64_t rows) {
+	valvec<llong> recIdvec;
+	valvec<byte> val;
+	for (uint64_t a = 0; a < ModA; ++a) {
+		for (uint64_t b = 0; b < ModB; b += 7) {
+			IndexCondition conds[2];
+			conds[0].indexId = 1; conds[0].key = Schema::fstringOf(&a);
+			conds[1].indexId = 2; conds[1].key = Schema::fstringOf(&b);
+			for (int isAnd = 0; isAnd < 2; ++isAnd) {
+				tab->indexSearchMulti(conds, 2, isAnd != 0, &recIdvec, ctx);
+				CHECK(std::is_sorted(recIdvec.begin(), recIdvec.end()));
+				size_t expected = 0;
+				for (uint64_t id = 0; id < rows; ++id) {
+					bool ma = id % ModA == a, mb = id % ModB == b;
+					if (!isRemoved(id) && (isAnd ? ma && mb : ma || mb))
+						expected++;
+				}
+				CHECK(recIdvec.size() == expected);
+				for (llong recId : recIdvec) {
+					ctx->getValue(recId, &val);
+					MultiRow row;
+					NativeDataInput<MemIO> dio; dio.set(val.data(), val.size());
+					dio >> row;
+					CHECK(!isRemoved(row.id));
+					if (isAnd)
+						CHECK(row.a == a && row.b == b);
+					else
+						CHECK(row.a == a || row.b == b);
+				}
+			}
+		}
+	}
+	// a single condition and an empty list
+	uint64_t a = 1, none = ModB + 1;
+	IndexCondition conds[2];
+	conds[0].indexId = 1; conds[0].key = Schema::fstringOf(&a);
+	conds[1].indexId = 2; conds[1].key = Schema::fstringOf(&none);
+	tab->indexSearchMulti(conds, 2, true, &recIdvec, ctx);
+	CHECK(recIdvec.empty());
+	tab->indexSearchMulti(conds, 2, false, &recIdvec, ctx);
+	size_t numA = recIdvec.size();
+	tab->indexSearchMulti(conds, 1, true, &recIdvec, ctx);
+	CHECK(recIdvec.size() == numA);
+}
+
+int main(int argc, char* argv[]) {
+	const std::string dir = argc > 1 ? argv[1] : "multi-test-db";
+	const uint64_t rows = 20000;
+	boost::filesystem::remove_all(dir);
+	boost::filesystem::create_directories(dir);
+	std::ofstream(dir + "/dbmeta.json") <<
+	"{\n"
+	"	\"RowSchema\": {\n"
+	"		\"columns\" : {\n"
+	"			\"id\" : { \"type\" : \"uint64\" },\n"
+	"			\"a\"  : { \"type\" : \"uint64\" },\n"
+	"			\"b\"  : { \"type\" : \"uint64\" }\n"
+	"		}\n"
+	"	},\n"
+	"	\"MaxWrSegSize\" : \"128K\",\n"
+	"	\"TableIndex\" : [\n"
+	"		{ \"fields\": \"id\", \"ordered\" : true, \"unique\" : true },\n"
+	"		{ \"fields\": \"a\" , \"ordered\" : true },\n"
+	"		{ \"fields\": \"b\" , \"ordered\" : true }\n"
+	"	]\n"
+	"}\n";
+	{
+		DbTablePtr tab = DbTable::open(dir);
+		DbContextPtr ctx = tab->createDbContext();
+		NativeDataOutput<AutoGrownMemIO> rowBuilder;
+		valvec<llong> recIdvec;
+		for (uint64_t id = 0; id < rows; ++id) {
+			MultiRow row;
+			row.id = id;
+			row.a = id % ModA;
+			row.b = id % ModB;
+			rowBuilder.rewind();
+			rowBuilder << row;
+			CHECK(ctx->insertRow(rowBuilder.written()) >= 0);
+		}
+		for (uint64_t id = 0; id < rows; ++id) {
+			if (isRemoved(id)) {
+				ctx->indexSearchExact(0, Schema::fstringOf(&id), &recIdvec);
+				CHECK(recIdvec.size() == 1);
+				ctx->removeRow(recIdvec[0]);
+			}
+		}
+		check(tab.get(), ctx.get(), rows);
+		tab->syncFinishWriting();
+	}
+	waitForClose(dir);
+	{
+		// all segments are readonly now, ids are physic ids
+		DbTablePtr tab = DbTable::open(dir);
+		DbContextPtr ctx = tab->createDbContext();
+		check(tab.get(), ctx.get(), rows);
+		tab->syncFinishWriting();
+	}
+	DbTable::safeStopAndWaitForCompress();
+	boost::filesystem::remove_all(dir);
+	printf("TestIndexSearchMulti passed\n");
+	return 0;
+}
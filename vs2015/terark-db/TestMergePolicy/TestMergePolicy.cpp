@@ -0,0 +1,120 @@
+// TestMergePolicy.cpp : segment runs picked by the builtin merge policies
+//
+
+#include "stdafx.h"
+#include <terark/db/merge_policy.hpp>
+#include <time.h>
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			exit(1); \
+		} \
+	} while (0)
+
+using namespace terark;
+using namespace terark::db;
+
+typedef MergePolicy::SegInfo SegInfo;
+
+static valvec<SegInfo> makeSegs(const llong* rows, size_t num) {
+	valvec<SegInfo> segs(num);
+	for (size_t i = 0; i < num; ++i) {
+		segs[i].rows = rows[i];
+		segs[i].delcnt = 0;
+		segs[i].storageSize = rows[i] * 100;
+		segs[i].buildTime = 0;
+	}
+	return segs;
+}
+
+static void testTiered() {
+	MergePolicyPtr mp(MergePolicy::create("tiered", ""));
+	CHECK(strcmp(mp->name(), "tiered") == 0);
+	MergePolicy::Pick pk;
+	// avg = 4000, max = 7000: the first big segment breaks the run
+	const llong rows[] = { 10000, 1000, 1000, 1000, 10000, 1000 };
+	valvec<SegInfo> segs = makeSegs(rows, 6);
+	CHECK(mp->pickSegments(segs, false, 3, &pk));
+	CHECK(pk.beg == 1 && pk.len == 3 && !pk.purge);
+	CHECK(!mp->pickSegments(segs, false, 4, &pk));
+	// forced: max = 12000, all segments
+	CHECK(mp->pickSegments(segs, true, 4, &pk));
+	CHECK(pk.beg == 0 && pk.len == 6);
+	CHECK(!mp->pickSegments(valvec<SegInfo>(), true, 1, &pk));
+}
+
+static void testTargetSegNum() {
+	MergePolicyPtr mp(MergePolicy::create("tiered", R"({"targetSegNum":3})"));
+	MergePolicy::Pick pk;
+	const llong rows[] = { 10000, 1000, 1000, 10000, 1000 };
+	valvec<SegInfo> segs = makeSegs(rows, 5);
+	// more segments than the target, a run of 2 is enough
+	CHECK(mp->pickSegments(segs, false, 5, &pk));
+	CHECK(pk.beg == 1 && pk.len == 2);
+	MergePolicy::Stat st;
+	mp->getStat(&st);
+	CHECK(st.segNum == 5 && st.targetSegNum == 3);
+}
+
+static void testSizeRatio() {
+	MergePolicyPtr mp(MergePolicy::create("size_ratio", ""));
+	MergePolicy::Pick pk;
+	// from the newest: 1, 1+1, 2+2, 4+4 fits, 100 > 8
+	const llong rows[] = { 100, 4, 2, 1, 1 };
+	valvec<SegInfo> segs = makeSegs(rows, 5);
+	CHECK(mp->pickSegments(segs, false, 2, &pk));
+	CHECK(pk.beg == 1 && pk.len == 4);
+	CHECK(!mp->pickSegments(segs, false, 5, &pk));
+}
+
+static void testTimeWindow() {
+	MergePolicyPtr mp(MergePolicy::create("time_window", R"({"windowSeconds":100})"));
+	MergePolicy::Pick pk;
+	const llong rows[] = { 1, 1, 1, 1, 1, 1 };
+	valvec<SegInfo> segs = makeSegs(rows, 6);
+	const llong now = time(NULL) / 100 * 100;
+	const llong buildTime[] = { 0, 10, 150, 160, 170, now };
+	for (size_t i = 0; i < segs.size(); ++i)
+		segs[i].buildTime = buildTime[i];
+	CHECK(mp->pickSegments(segs, false, 2, &pk));
+	CHECK(pk.beg == 2 && pk.len == 3);
+	// the current window is skipped unless forced
+	segs[2].buildTime = segs[3].buildTime = segs[4].buildTime = now + 1;
+	CHECK(mp->pickSegments(segs, false, 2, &pk));
+	CHECK(pk.beg == 0 && pk.len == 2);
+	CHECK(mp->pickSegments(segs, true, 2, &pk));
+	CHECK(pk.beg == 2 && pk.len == 4);
+}
+
+static void testGarbageRatio() {
+	MergePolicyPtr mp(MergePolicy::create("garbage_ratio", R"({"maxSegNum":3})"));
+	MergePolicy::Pick pk;
+	const llong rows[] = { 100, 100, 100, 100, 100 };
+	valvec<SegInfo> segs = makeSegs(rows, 5);
+	segs[2].delcnt = 50;
+	segs[3].delcnt = 40;
+	CHECK(mp->pickSegments(segs, false, 2, &pk));
+	CHECK(pk.beg == 2 && pk.len == 2 && pk.purge);
+	// 10% deleted is below garbageRatio
+	segs[2].delcnt = segs[3].delcnt = 10;
+	CHECK(!mp->pickSegments(segs, false, 2, &pk));
+	CHECK(mp->pickSegments(segs, true, 2, &pk));
+	CHECK(pk.beg == 2 && pk.len == 2 && pk.purge);
+}
+
+int main() {
+	testTiered();
+	testTargetSegNum();
+	testSizeRatio();
+	testTimeWindow();
+	testGarbageRatio();
+	try {
+		MergePolicyPtr mp(MergePolicy::create("no_such_policy", ""));
+		CHECK(!"unknown policy must be rejected");
+	}
+	catch (const std::invalid_argument&) {}
+	printf("TestMergePolicy passed\n");
+	return 0;
+}
@@ -0,0 +1,110 @@
+// TestScanColumn.cpp : scanColumnPredicate over rows of the writing segment
+// which are not converted yet, and over readonly segments after reopen
+//
+
+#include "stdafx.h"
+#include <terark/db/db_table.hpp>
+#include <terark/io/DataIO.hpp>
+#include <terark/io/MemStream.hpp>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <chrono>
+#include <thread>
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			exit(1); \
+		} \
+	} while (0)
+
+struct ScanRow {
+	uint64_t id;
+	uint64_t a;
+	DATA_IO_LOAD_SAVE(ScanRow, &id &a)
+};
+
+using namespace terark;
+using namespace terark::db;
+
+// background tasks may still hold the table after syncFinishWriting, the
+// table is closed when its run.lock is removed, then it can be reopened
+static void waitForClose(const std::string& dir) {
+	for (int i = 0; i < 600 && boost::filesystem::exists(dir + "/run.lock"); ++i) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	CHECK(!boost::filesystem::exists(dir + "/run.lock"));
+}
+
+static void insert(DbContext* ctx, uint64_t id, uint64_t a) {
+	NativeDataOutput<AutoGrownMemIO> rowBuilder;
+	ScanRow row;
+	row.id = id;
+	row.a = a;
+	rowBuilder << row;
+	CHECK(ctx->insertRow(rowBuilder.written()) >= 0);
+}
+
+static void checkEq(DbTable* tab, DbContext* ctx, uint64_t a, llong expected) {
+	ColumnPredicate pred;
+	pred.columnId = 1;
+	pred.op = ColumnPredicate::Eq;
+	pred.lo = Schema::fstringOf(&a);
+	febitvec matches;
+	ColumnAggregate agg;
+	tab->scanColumnPredicate(pred, &matches, &agg, ctx);
+	CHECK(agg.count == expected);
+	CHECK(llong(matches.popcnt()) == expected);
+	CHECK(llong(matches.size()) >= tab->numDataRows());
+	if (expected) {
+		CHECK(agg.min == double(a));
+		CHECK(agg.max == double(a));
+	}
+}
+
+int main(int argc, char* argv[]) {
+	const std::string dir = argc > 1 ? argv[1] : "scan-test-db";
+	boost::filesystem::remove_all(dir);
+	boost::filesystem::create_directories(dir);
+	std::ofstream(dir + "/dbmeta.json") <<
+	"{\n"
+	"	\"RowSchema\": {\n"
+	"		\"columns\" : {\n"
+	"			\"id\" : { \"type\" : \"uint64\" },\n"
+	"			\"a\"  : { \"type\" : \"uint64\" }\n"
+	"		}\n"
+	"	},\n"
+	"	\"TableIndex\" : [\n"
+	"		{ \"fields\": \"id\", \"ordered\" : true, \"unique\" : true }\n"
+	"	]\n"
+	"}\n";
+	{
+		DbTablePtr tab = DbTable::open(dir);
+		DbContextPtr ctx = tab->createDbContext();
+		for (uint64_t id = 0; id < 10; ++id) {
+			insert(ctx.get(), id, 5);
+		}
+		// the rows are in the writing segment, not in a published version
+		checkEq(tab.get(), ctx.get(), 5, 10);
+		checkEq(tab.get(), ctx.get(), 6, 0);
+		tab->syncFinishWriting();
+	}
+	waitForClose(dir);
+	{
+		DbTablePtr tab = DbTable::open(dir);
+		DbContextPtr ctx = tab->createDbContext();
+		checkEq(tab.get(), ctx.get(), 5, 10);
+		// new rows of the writing segment after a readonly segment
+		for (uint64_t id = 10; id < 30; ++id) {
+			insert(ctx.get(), id, id % 2 ? 5 : 6);
+		}
+		checkEq(tab.get(), ctx.get(), 5, 20);
+		checkEq(tab.get(), ctx.get(), 6, 10);
+		tab->syncFinishWriting();
+	}
+	DbTable::safeStopAndWaitForCompress();
+	boost::filesystem::remove_all(dir);
+	printf("TestScanColumn passed\n");
+	return 0;
+}
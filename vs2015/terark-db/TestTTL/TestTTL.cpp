@@ -0,0 +1,145 @@
+// TestTTL.cpp : rows expired by "TTLColumn" are invisible to reads and
+// do not conflict with new rows of the same unique key
+//
+
+#include "stdafx.h"
+#include <terark/db/db_table.hpp>
+#include <terark/io/DataIO.hpp>
+#include <terark/io/MemStream.hpp>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <time.h>
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			exit(1); \
+		} \
+	} while (0)
+
+struct TtlRow {
+	uint64_t id;
+	int64_t  expire;
+	DATA_IO_LOAD_SAVE(TtlRow, &id &expire)
+};
+
+using namespace terark;
+using namespace terark::db;
+
+// background tasks may still hold the table after syncFinishWriting, the
+// table is closed when its run.lock is removed, then it can be reopened
+static void waitForClose(const std::string& dir) {
+	for (int i = 0; i < 600 && boost::filesystem::exists(dir + "/run.lock"); ++i) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	CHECK(!boost::filesystem::exists(dir + "/run.lock"));
+}
+
+static void writeMeta(const std::string& dir, const char* ttlSeconds) {
+	boost::filesystem::remove_all(dir);
+	boost::filesystem::create_directories(dir);
+	std::ofstream(dir + "/dbmeta.json") <<
+	"{\n"
+	"	\"RowSchema\": {\n"
+	"		\"columns\" : {\n"
+	"			\"id\"     : { \"type\" : \"uint64\" },\n"
+	"			\"expire\" : { \"type\" : \"sint64\" }\n"
+	"		}\n"
+	"	},\n"
+	"	\"TTLColumn\" : \"expire\",\n"
+	"	\"TTLSeconds\" : " << ttlSeconds << ",\n"
+	"	\"TableIndex\" : [\n"
+	"		{ \"fields\": \"id\", \"ordered\" : true, \"unique\" : true }\n"
+	"	]\n"
+	"}\n";
+}
+
+static llong insert(DbContext* ctx, uint64_t id, int64_t expire) {
+	NativeDataOutput<AutoGrownMemIO> rowBuilder;
+	TtlRow row;
+	row.id = id;
+	row.expire = expire;
+	rowBuilder << row;
+	return ctx->insertRow(rowBuilder.written());
+}
+
+// live rows are the odd ids in [0, rows)
+static void checkVisible(DbTable* tab, DbContext* ctx, uint64_t rows) {
+	valvec<llong> recIdvec;
+	for (uint64_t id = 0; id < rows; ++id) {
+		ctx->indexSearchExact(0, Schema::fstringOf(&id), &recIdvec);
+		CHECK(recIdvec.size() == (id % 2));
+	}
+	size_t num = 0;
+	llong recId;
+	valvec<byte> val;
+	StoreIteratorPtr storeIter = ctx->createTableIterForward();
+	while (storeIter->increment(&recId, &val)) {
+		TtlRow row;
+		NativeDataInput<MemIO> dio; dio.set(val.data(), val.size());
+		dio >> row;
+		CHECK(row.id % 2 == 1);
+		num++;
+	}
+	CHECK(num == rows / 2);
+	num = 0;
+	IndexIteratorPtr indexIter = tab->createIndexIterForward(size_t(0));
+	while (indexIter->increment(&recId, &val)) {
+		CHECK(unaligned_load<uint64_t>(val.data()) % 2 == 1);
+		num++;
+	}
+	CHECK(num == rows / 2);
+}
+
+int main(int argc, char* argv[]) {
+	const std::string dir = argc > 1 ? argv[1] : "ttl-test-db";
+	const uint64_t rows = 1000;
+	const llong now = time(NULL);
+
+	writeMeta(dir, "-1");
+	try {
+		DbTablePtr tab = DbTable::open(dir);
+		CHECK(!"negative TTLSeconds must be rejected");
+	}
+	catch (const std::invalid_argument&) {}
+
+	writeMeta(dir, "10");
+	{
+		DbTablePtr tab = DbTable::open(dir);
+		DbContextPtr ctx = tab->createDbContext();
+		for (uint64_t id = 0; id < rows; ++id) {
+			CHECK(insert(ctx.get(), id, id % 2 ? now + 3600 : now - 100) >= 0);
+		}
+		checkVisible(tab.get(), ctx.get(), rows);
+		// expired keys in the writing segment are replaced
+		CHECK(insert(ctx.get(), 0, now - 100) >= 0);
+		CHECK(insert(ctx.get(), 1, now + 3600) < 0);
+		tab->syncFinishWriting();
+	}
+	waitForClose(dir);
+	{
+		DbTablePtr tab = DbTable::open(dir);
+		DbContextPtr ctx = tab->createDbContext();
+		checkVisible(tab.get(), ctx.get(), rows);
+		// expired keys in frozen segments are replaced
+		CHECK(insert(ctx.get(), 2, now - 100) >= 0);
+		CHECK(insert(ctx.get(), 3, now + 3600) < 0);
+		tab->expireTTL();
+		checkVisible(tab.get(), ctx.get(), rows);
+		tab->syncFinishWriting();
+	}
+	waitForClose(dir);
+	{
+		// the last segment has only expired rows, it is loaded without data
+		DbTablePtr tab = DbTable::open(dir);
+		DbContextPtr ctx = tab->createDbContext();
+		checkVisible(tab.get(), ctx.get(), rows);
+	}
+	DbTable::safeStopAndWaitForCompress();
+	boost::filesystem::remove_all(dir);
+	printf("TestTTL passed\n");
+	return 0;
+}
@@ -0,0 +1,146 @@
+// TestZipIntStore.cpp : values of ZipIntStore round trip by every codec,
+// by getValue, iterators and save/load, also loaded by pread
+//
+
+#include "stdafx.h"
+#include <terark/db/zip_int_store.hpp>
+#include <boost/filesystem.hpp>
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			exit(1); \
+		} \
+	} while (0)
+
+using namespace terark;
+using namespace terark::db;
+
+class TestStore : public ZipIntStore {
+public:
+	explicit TestStore(const Schema& schema) : ZipIntStore(schema) {}
+	bool usesBlocks() const { return m_blockRows != 0; }
+};
+typedef boost::intrusive_ptr<TestStore> TestStorePtr;
+
+static void checkValues(const ZipIntStore& store, const valvec<int64_t>& values) {
+	CHECK(store.numDataRows() == llong(values.size()));
+	valvec<byte> val;
+	for (size_t i = 0; i < values.size(); ++i) {
+		val.erase_all();
+		store.getValueAppend(i, &val, NULL);
+		CHECK(val.size() == 8);
+		CHECK(unaligned_load<int64_t>(val.data()) == values[i]);
+	}
+	StoreIteratorPtr iter(store.createStoreIterForward(NULL));
+	if (!iter) {
+		return; // only block codec has iterators
+	}
+	llong id;
+	size_t num = 0;
+	while (iter->increment(&id, &val)) {
+		CHECK(id == llong(num));
+		CHECK(unaligned_load<int64_t>(val.data()) == values[id]);
+		num++;
+	}
+	CHECK(num == values.size());
+	iter.reset(store.createStoreIterBackward(NULL));
+	while (iter->increment(&id, &val)) {
+		CHECK(id == llong(--num));
+		CHECK(unaligned_load<int64_t>(val.data()) == values[id]);
+	}
+	CHECK(0 == num);
+	// seek into the middle of a block then go on to the next block
+	iter.reset(store.createStoreIterForward(NULL));
+	size_t mid = std::min(values.size() - 1, ZipIntStore::BlockSize + 5);
+	CHECK(iter->seekExact(mid, &val));
+	CHECK(unaligned_load<int64_t>(val.data()) == values[mid]);
+	if (mid + 1 < values.size()) {
+		CHECK(iter->increment(&id, &val));
+		CHECK(id == llong(mid + 1));
+	}
+	CHECK(!iter->seekExact(values.size(), &val));
+}
+
+static void testOne(const Schema& schema, const Schema& preadSchema, const char* name,
+					const valvec<int64_t>& values, bool expectBlocks) {
+	SortableStrVec strVec;
+	strVec.m_strpool.append((const byte*)values.data(), values.used_mem_size());
+	TestStorePtr store(new TestStore(schema)); // iterators hold a ref
+	store->build(ColumnType::Sint64, strVec);
+	CHECK(store->usesBlocks() == expectBlocks);
+	checkValues(*store, values);
+
+	std::string path = std::string("zint-test-") + name;
+	store->save(path);
+	{
+		TestStorePtr loaded(new TestStore(schema));
+		loaded->load(path + ".zint");
+		CHECK(loaded->usesBlocks() == expectBlocks);
+		checkValues(*loaded, values);
+	}
+	{
+		TestStorePtr loaded(new TestStore(preadSchema));
+		loaded->load(path + ".zint");
+		CHECK(loaded->usesBlocks() == expectBlocks);
+		checkValues(*loaded, values);
+		loaded->save(path + "-copy"); // copies the file
+		loaded.reset(new TestStore(schema));
+		loaded->load(path + "-copy.zint");
+		checkValues(*loaded, values);
+	}
+	boost::filesystem::remove(path + "-copy.zint");
+	boost::filesystem::remove(path + ".zint");
+	printf("%s: rows = %zd, size = %lld\n", name, values.size(), store->dataStorageSize());
+}
+
+int main() {
+	Schema schema;
+	schema.m_columnsMeta.insert_i("v", ColumnMeta(ColumnType::Sint64));
+	schema.compile();
+	Schema preadSchema;
+	preadSchema.m_columnsMeta.insert_i("v", ColumnMeta(ColumnType::Sint64));
+	preadSchema.m_usePread = true;
+	preadSchema.compile();
+
+	const size_t rows = 10 * ZipIntStore::BlockSize + 37; // last block is partial
+	valvec<int64_t> values(rows);
+
+	// timestamps: delta blocks
+	int64_t t = 1500000000000LL;
+	for (size_t i = 0; i < rows; ++i) {
+		t += 1000 + rand() % 16;
+		values[i] = t;
+	}
+	testOne(schema, preadSchema, "timestamps", values, true);
+
+	// negative and descending
+	for (size_t i = 0; i < rows; ++i) {
+		values[i] = -llong(i) * 3;
+	}
+	testOne(schema, preadSchema, "descending", values, true);
+
+	// small values with a few huge exceptions in each block, the value
+	// range is limited by UintVecMin0, build throws if it is too large
+	for (size_t i = 0; i < rows; ++i) {
+		values[i] = rand() % 1000;
+		if (i % 61 == 7)
+			values[i] = (1LL << 50) - i;
+	}
+	testOne(schema, preadSchema, "exceptions", values, true);
+
+	// few distinct random values: dedup and index
+	for (size_t i = 0; i < rows; ++i) {
+		values[i] = (rand() % 4) * 1000000007LL;
+	}
+	testOne(schema, preadSchema, "dedup", values, false);
+
+	// a single value
+	values.resize(1);
+	values[0] = 42;
+	testOne(schema, preadSchema, "single", values, false);
+
+	printf("TestZipIntStore passed\n");
+	return 0;
+}